@@ -47,6 +47,10 @@ int ASPI_Send(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, void *
 unsigned long ASPI_Receive(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, void *buffer, unsigned long size);
 void ASPI_InquireDevice(scsi_debug_t *debug, char result[], unsigned char ha_id, unsigned char id);
 
+/* Device handle caching */
+void ASPI_SetKeepOpen(int enable);
+void ASPI_CloseAll(void);
+
 #ifdef __cplusplus
 }
 #endif
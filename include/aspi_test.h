@@ -12,6 +12,20 @@
 #define CMDLINE_SIZE 256
 /* Data buffer size for SCSI transfers */
 #define DATA_BUFFER_SIZE 8192
+/* Default chunk size for streamed file transfers */
+#define DEFAULT_CHUNK_SIZE 65536
+/* Largest chunk - the 6 byte CDB has a 24-bit transfer length */
+#define MAX_CHUNK_SIZE 0x00FFFFFF
+/* Alignment of the transfer buffer */
+#define BUFFER_ALIGN 4096
+/* Latency histogram: log2 buckets of microseconds, bar width in characters */
+#define HISTOGRAM_BUCKETS 32
+#define HISTOGRAM_WIDTH 40
+
+/* Commands supported by repeat */
+#define REPEAT_READY   0
+#define REPEAT_SEND    1
+#define REPEAT_RECEIVE 2
 
 /* Parse hexadecimal string into byte array */
 int parse_hex_data(const char *hex_str, unsigned char *data, int max_len);
@@ -26,7 +40,13 @@ void cmd_ready(scsi_debug_t *debug, unsigned char ha_id, unsigned char id);
 void cmd_inquire(scsi_debug_t *debug, unsigned char ha_id, unsigned char id);
 void cmd_send(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, const char *hex_data);
 void cmd_receive(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, unsigned long size);
-void cmd_dumpfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id, unsigned char id, unsigned long size);
-void cmd_sendfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id, unsigned char id);
+void cmd_dumpfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id, unsigned char id,
+                  unsigned long size, unsigned long chunk);
+void cmd_sendfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id, unsigned char id,
+                  unsigned long chunk);
+void cmd_repeat(scsi_debug_t *debug, unsigned long count, const char *command,
+                const char *arg1, const char *arg2, const char *arg3);
+void cmd_bench(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, 
+               unsigned long size, unsigned long count, const char *mode);
 
 #endif /* __ASPI_TEST_H__ */
@@ -12,6 +12,11 @@ extern "C" {
 
 #include <stdio.h>
 
+/* POSIX, but hidden by <stdio.h> in strict ANSI mode */
+#ifndef fileno
+extern int fileno(FILE* stream);
+#endif
+
 /* Type definitions for 32-bit IRIX 5.3 */
 #ifndef BYTE
 #define BYTE unsigned char       /* 8-bit */
@@ -61,16 +66,23 @@ extern "C" {
 #define	SMDIE_NOMEMORY                  0x00200004
 #define SMDIE_UNSUPPSAMBITS             0x00200006
 
-/* Copy modes for SMDI_SendDataPacket - Not used in IRIX (big-endian) */
-/* We keep the defines but don't actually use them */
+/* Copy modes for the data packet functions (dwCopyMode) */
 #define	CM_NORMAL                       0x00000000 /* Does a 1:1 copy */
+#define	CM_SWAP16                       0x00000001 /* Swaps the bytes of each 16-bit word */
+#define	CM_SWAP24                       0x00000002 /* Swaps the bytes of each 24-bit word */
+#define	CM_SWAP32                       0x00000003 /* Swaps the bytes of each 32-bit word */
 
 /* Sample format identifiers */
 #define SF_NATIVE                       0x00000001 /* SMDI native sample format */
+#define SF_AIFF                         0x00000002 /* AIFF or AIFF-C, decoded as it is sent */
+#define SF_WAV                          0x00000003 /* WAV or RF64, decoded as it is sent */
 
 /* File errors */
 #define FE_OPENERROR                    0x00010001 /* Couldn't open the file */
 #define	FE_UNKNOWNFORMAT                0x00010002 /* Unsupported file format */
+#define	FE_READERROR                    0x00010003 /* File or source data ran short */
+#define	FE_WRITEERROR                   0x00010004 /* File or sink did not take the data */
+#define	FE_VERIFYERROR                  0x00010005 /* Data read back differs from the source */
 
 /* SCSI device information structure */
 typedef struct SCSI_DevInfo
@@ -120,6 +132,20 @@ typedef struct SMDI_TransmissionInfo
   BYTE Rsvd2;                           /* (31) */
 } SMDI_TransmissionInfo;
 
+/* Where an upload stopped, so that sending the same sample again carries
+   on from the last packet the device acknowledged */
+typedef struct SMDI_Checkpoint
+{
+  DWORD dwStructSize;
+  BYTE HA_ID;
+  BYTE SCSI_ID;
+  DWORD dwSampleNumber;
+  DWORD dwHeaderHash;                   /* SMDI_HeaderHash of the header sent */
+  DWORD dwPacketSize;                   /* Negotiated data packet length */
+  DWORD dwPackets;                      /* Packets acknowledged, 0 when there is nothing to resume */
+  DWORD dwResumed;                      /* Packets the last upload skipped by resuming */
+} SMDI_Checkpoint;
+
 /* SMDI file transmission information structure */
 typedef struct SMDI_FileTransmissionInfo
 {
@@ -131,6 +157,10 @@ typedef struct SMDI_FileTransmissionInfo
   char cFileName[MAX_PATH];
   DWORD * lpReturnValue;
   DWORD dwUserData;
+  void * lpMapBase;                     /* File mapping when sending mapped, else NULL */
+  DWORD dwMapSize;
+  struct SMDI_SampleSource * lpSource;  /* Decoder when sending AIFF or WAV, else NULL */
+  SMDI_Checkpoint * lpCheckpoint;       /* Kept up to date while sending, may be NULL */
 } SMDI_FileTransmissionInfo;
 
 /* SMDI file transfer structure */
@@ -153,34 +183,115 @@ typedef struct SMDI_FileTransfer
   DWORD dwUserData;
   BOOL bAsync;
   DWORD * lpReturnValue;
+  BOOL bVerify;                         /* Read the sample back after sending and compare */
+  DWORD dwVerifyOffset;                 /* First byte that differed, set on FE_VERIFYERROR */
+  SMDI_Checkpoint * lpCheckpoint;       /* Uploads: resumed from if it matches, and left
+                                           where the upload stopped; may be NULL */
+  SMDI_SampleHeader * lpSampleHeader;   /* Downloads to a sink: header already requested,
+                                           NULL to request it */
 } SMDI_FileTransfer;
 
+/* Streaming source of sample data for uploads */
+typedef struct SMDI_SampleSource
+{
+  DWORD dwStructSize;
+  SMDI_SampleHeader header;             /* Format, length, loop and name */
+  DWORD dwSampleRate;                   /* In Hz, which the header period rounds */
+  DWORD dwCopyMode;                     /* CM_* turning the data into SMDI order */
+  void * lpData;                        /* Whole sample in memory, or NULL to use lpRead */
+  DWORD (*lpRead)(struct SMDI_SampleSource*, void*, DWORD);  /* Fill the next bytes; returns the count */
+  void (*lpClose)(struct SMDI_SampleSource*);                /* Release the source, may be NULL */
+  void * lpUserData;                    /* Source state */
+} SMDI_SampleSource;
+
+/* Streaming destination of sample data for downloads */
+typedef struct SMDI_SampleSink
+{
+  DWORD dwStructSize;
+  SMDI_SampleHeader header;             /* Filled in before lpBegin is called */
+  DWORD dwCopyMode;                     /* CM_* the data is wanted in, may be set by lpBegin */
+  BOOL (*lpBegin)(struct SMDI_SampleSink*);              /* Open the destination for the header */
+  BOOL (*lpWrite)(struct SMDI_SampleSink*, void*, DWORD); /* Take the next bytes of data */
+  BOOL (*lpEnd)(struct SMDI_SampleSink*, BOOL);          /* Finish, or abandon when FALSE; always called */
+  void * lpUserData;                    /* Sink state */
+} SMDI_SampleSink;
+
+/* SMDI transfer statistics structure */
+typedef struct SMDI_TransferStats
+{
+  DWORD dwStructSize;
+  DWORD dwPackets;                      /* Data packets acknowledged */
+  DWORD dwBytes;                        /* Sample data bytes transferred */
+  DWORD dwPacketSize;                   /* Negotiated data packet length */
+  DWORD dwWaits;                        /* WAIT responses from the device */
+  DWORD dwRetries;                      /* Unit ready polls repeated after a WAIT, resumed uploads */
+  DWORD dwLastMessage;                  /* Last SMDI message or error code */
+} SMDI_TransferStats;
+
 /* Core SMDI functions */
 unsigned char SMDI_Init(void);
 BOOL SMDI_TestUnitReady(BYTE HA_ID, BYTE SCSI_ID);
 void SMDI_GetDeviceInfo(BYTE HA_ID, BYTE SCSI_ID, SCSI_DevInfo* info);
 
+/* Device sessions */
+void SMDI_SetKeepDevicesOpen(BOOL enable);
+void SMDI_CloseDevices(void);
+
+/* Memory shared with child processes, released with munmap */
+void* SMDI_SharedAlloc(size_t size);
+
 /* Debug functions */
 void SMDI_SetDebugMode(int enable);
 int SMDI_GetDebugMode(void);
 
+/* Transfer settings */
+void SMDI_SetPacketSize(DWORD dwPacketSize);
+DWORD SMDI_GetPacketSize(void);
+
+/* Transfer statistics */
+void SMDI_ResetTransferStats(void);
+void SMDI_GetTransferStats(SMDI_TransferStats* lpStats);
+
 /* File operations */
 DWORD SMDI_SendFile(SMDI_FileTransfer* ft);
 DWORD SMDI_ReceiveFile(SMDI_FileTransfer* ft);
 
+/* Streaming uploads - packets are filled straight from the source; the
+   transfer's lpFileName is not used */
+DWORD SMDI_SendSampleSource(SMDI_FileTransfer* ft, SMDI_SampleSource* source);
+void SMDI_CloseSampleSource(SMDI_SampleSource* source);
+
+/* Read a sample back through the reception loop and compare each packet
+   with the source as it arrives, without writing anything; stops at the
+   first difference and returns FE_VERIFYERROR with its byte offset in
+   *lpOffset. The source must be unread. SMDI_SendFile and, for sources
+   in memory, SMDI_SendSampleSource do this themselves when bVerify is
+   set. */
+DWORD SMDI_VerifySampleSource(SMDI_FileTransfer* ft, SMDI_SampleSource* source, DWORD* lpOffset);
+
+/* Streaming downloads - each packet goes straight to the sink, which is
+   finished at the end of the procedure; the transfer's lpFileName is not
+   used */
+DWORD SMDI_ReceiveSampleSink(SMDI_FileTransfer* ft, SMDI_SampleSink* sink);
+
 /* Sample operations */
 DWORD SMDI_DeleteSample(BYTE HA_ID, BYTE SCSI_ID, DWORD sample_number);
 DWORD SMDI_SampleHeaderRequest(BYTE HA_ID, BYTE SCSI_ID, DWORD sample_number, SMDI_SampleHeader* sh);
 
 /* Internal functions - not typically called directly by applications */
-DWORD SMDI_SendDataPacket(BYTE ha_id, BYTE id, DWORD pn, void* data, DWORD length);
+DWORD SMDI_SendDataPacket(BYTE ha_id, BYTE id, DWORD pn, void* data, DWORD length, DWORD dwCopyMode);
+DWORD SMDI_SendDataPacketInPlace(BYTE ha_id, BYTE id, DWORD pn, void* data, DWORD length);
 DWORD SMDI_SendBeginSampleTransfer(BYTE ha_id, BYTE id, DWORD sampleNum, void* packetLength);
 DWORD SMDI_SendSampleHeader(BYTE ha_id, BYTE id, DWORD sampleNum, SMDI_SampleHeader* sh, DWORD* DataPacketLength);
-DWORD SMDI_NextDataPacketRequest(BYTE ha_id, BYTE id, DWORD packetNumber, void* buffer, DWORD maxlen);
+DWORD SMDI_NextDataPacketRequest(BYTE ha_id, BYTE id, DWORD packetNumber, void* buffer, DWORD maxlen,
+                                 DWORD dwCopyMode);
 DWORD SMDI_MasterIdentify(BYTE ha_id, BYTE id);
 DWORD SMDI_SampleName(BYTE ha_id, BYTE id, DWORD sampleNum, char sampleName[]);
 DWORD SMDI_GetMessage(BYTE ha_id, BYTE id);
 DWORD SMDI_GetLastError(void);
+DWORD SMDI_GetRequestedPacket(void);
+DWORD SMDI_CRC32(DWORD dwCrc, const void* data, DWORD dwBytes);
+DWORD SMDI_HeaderHash(const SMDI_SampleHeader* sh);
 
 /* Sample transmission functions */
 DWORD SMDI_InitSampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo);
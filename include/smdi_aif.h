@@ -12,13 +12,31 @@ extern "C" {
 
 #include "smdi.h"
 #include "smdi_sample.h"
+#include "smdi_pcm.h"
 
-/* Load an AIF file into SMDI sample format */
+/* Load an AIF file into SMDI sample format; wider files are reduced to
+   16 bit with TPDF dither */
 SMDI_Sample* SMDI_LoadAIFSample(const char* filename);
 
+/* Load an AIF file as 8 or 16 bit samples (0 for the default) with a
+   PCM_DITHER_* mode for the bit depth reduction */
+SMDI_Sample* SMDI_LoadAIFSampleAs(const char* filename, BYTE bits_per_sample,
+                                  DWORD dither_mode);
+
+/* Open an AIF file as an upload source for SMDI_SendSampleSource, decoding
+   8 or 16 bit frames (0 for the default) as packets go out; release it
+   with SMDI_CloseSampleSource */
+BOOL SMDI_OpenAIFSource(SMDI_SampleSource* source, const char* filename,
+                        BYTE bits_per_sample, DWORD dither_mode);
+
 /* Save SMDI sample as AIF file */
 BOOL SMDI_SaveAIFSample(SMDI_Sample* sample, const char* filename, int use_aifc);
 
+/* Set up a download sink for SMDI_ReceiveSampleSink writing each packet
+   straight to an AIF file; the sizes are finished at the end of the
+   procedure and the file is removed if the download fails */
+BOOL SMDI_OpenAIFSink(SMDI_SampleSink* sink, const char* filename, int use_aifc);
+
 #ifdef __cplusplus
 }
 #endif
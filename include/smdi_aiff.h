@@ -0,0 +1,119 @@
+/*
+ * SMDI AIFF/AIFF-C file reader and writer for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_AIFF_H
+#define _SMDI_AIFF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "smdi.h"
+#include "smdi_pcm.h"
+
+/* Chunk ids and AIFF-C compression types as big-endian words */
+#define AIFF_ID(a, b, c, d) (((DWORD)(a) << 24) | ((DWORD)(b) << 16) | \
+                             ((DWORD)(c) << 8) | (DWORD)(d))
+
+/* Most markers kept from a file */
+#define AIFF_MAX_MARKERS    16
+
+/* Loop play modes in the INST chunk */
+#define AIFF_LOOP_NONE      0
+#define AIFF_LOOP_FORWARD   1
+#define AIFF_LOOP_PINGPONG  2
+
+/* Marker from the MARK chunk */
+typedef struct SMDI_AIFFMarker
+{
+  WORD wId;                             /* Non-zero marker id */
+  DWORD dwPosition;                     /* Frame the marker sits before */
+  char szName[32];                      /* Truncated marker name */
+} SMDI_AIFFMarker;
+
+/* Loop from the INST chunk */
+typedef struct SMDI_AIFFLoop
+{
+  WORD wPlayMode;                       /* AIFF_LOOP_* */
+  WORD wBeginId;                        /* Marker ids */
+  WORD wEndId;
+} SMDI_AIFFLoop;
+
+/* Everything the header chunks say about a file */
+typedef struct SMDI_AIFFInfo
+{
+  BOOL bAIFC;                           /* AIFF-C form */
+  DWORD dwChannels;
+  DWORD dwFrames;
+  DWORD dwBits;                         /* Sample size from COMM */
+  DWORD dwRate;                         /* Rounded to whole Hz */
+  DWORD dwCompression;                  /* AIFF-C compression type, 'NONE' for AIFF */
+  SMDI_PCMFormat pcmFormat;             /* Layout of the sound data */
+  DWORD dwNumMarkers;
+  SMDI_AIFFMarker markers[AIFF_MAX_MARKERS];
+  BOOL bHasInst;                        /* INST chunk present */
+  BYTE baseNote;                        /* MIDI note */
+  signed char detune;                   /* Cents, -50 to +50 */
+  SMDI_AIFFLoop sustainLoop;
+  SMDI_AIFFLoop releaseLoop;
+  char szName[256];                     /* NAME chunk, empty if none */
+  DWORD dwDataOffset;                   /* File offset of the first frame */
+  DWORD dwDataSize;                     /* Bytes of sound data */
+} SMDI_AIFFInfo;
+
+/* Open file being read or written */
+typedef struct SMDI_AIFFFile
+{
+  FILE* fp;
+  BOOL bWriting;
+  SMDI_AIFFInfo info;
+  DWORD dwFrame;                        /* Frames read or written so far */
+  DWORD dwFormSizePos;                  /* Offsets of sizes patched on close */
+  DWORD dwFramesPos;
+  DWORD dwSoundSizePos;
+  BOOL bError;                          /* A write failed */
+  void* lpBuffer;                       /* Conversion buffer */
+} SMDI_AIFFFile;
+
+/* Clear an info block for a new file: no markers, no loops, middle C */
+void SMDI_AIFFInitInfo(SMDI_AIFFInfo* info, BOOL bAIFC);
+
+/* Open a file and parse its chunks; the file is left at the first frame.
+   Returns NULL if the file is not an AIFF or AIFF-C with sound data
+   this library can decode. */
+SMDI_AIFFFile* SMDI_AIFFOpen(const char* filename);
+
+/* Read up to dwFrames frames converted to an interleaved format, carrying the
+   dither state across calls. Returns the frames read. */
+DWORD SMDI_AIFFReadFrames(SMDI_AIFFFile* file, const SMDI_PCMFormat* fmt, void* buffer,
+                          DWORD dwFrames, SMDI_PCMDither* dither);
+
+/* Map the whole file privately (copy on write) and return the first frame
+   of the sound data in the file's own layout, or NULL if it cannot be
+   mapped. Release with SMDI_UnmapNativeFile(*lpMapBase, *lpMapSize). */
+void* SMDI_AIFFMapSound(SMDI_AIFFFile* file, void** lpMapBase, DWORD* lpMapSize);
+
+/* Find a marker by id; NULL if there is none */
+const SMDI_AIFFMarker* SMDI_AIFFFindMarker(const SMDI_AIFFInfo* info, WORD wId);
+
+/* Create a file from an info block (channels, bits, rate, markers, INST
+   and name) and write its header. dwFrames may be 0 when the length is
+   not known yet; the sizes are patched when the file is closed. */
+SMDI_AIFFFile* SMDI_AIFFCreate(const char* filename, const SMDI_AIFFInfo* info);
+
+/* Append interleaved frames given in fmt, converting to the file's layout */
+BOOL SMDI_AIFFWriteFrames(SMDI_AIFFFile* file, const SMDI_PCMFormat* fmt, const void* buffer,
+                          DWORD dwFrames);
+
+/* Close a file; a written file gets its final sizes. Returns FALSE if
+   any part of a written file failed to reach the disk. */
+BOOL SMDI_AIFFClose(SMDI_AIFFFile* file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_AIFF_H */
@@ -0,0 +1,148 @@
+/*
+ * SMDI multi-sample archive (SMDA) for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_ARCHIVE_H
+#define _SMDI_ARCHIVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "smdi.h"
+#include "smdi_sample.h"
+
+/*
+ * SMDA version 1 layout - all fields big-endian, no compiler padding:
+ *
+ *   0   4  "SMDA"
+ *   4   4  version (1)
+ *   8   4  index capacity (entries)
+ *  12   4  entry count
+ *  16   4  data alignment (SMDI_ARCHIVE_ALIGN)
+ *  20   4  offset of the first data page
+ *  24  40  reserved (0)
+ *  64      index: capacity entries of SMDI_ARCHIVE_ENTRY_SIZE bytes
+ *
+ * Index entry:
+ *
+ *   0   4  sample number
+ *   4   4  data offset (multiple of SMDI_ARCHIVE_ALIGN)
+ *   8   4  data size in bytes
+ *  12   4  CRC-32 of the data
+ *  16   1  bits per sample
+ *  17   1  channels
+ *  18   1  loop control
+ *  19   1  name length
+ *  20   4  period in nanoseconds
+ *  24   4  sample rate in Hz
+ *  28   4  sample count per channel
+ *  32   4  loop start
+ *  36   4  loop end
+ *  40   2  pitch (MIDI note)
+ *  42   2  pitch fraction (cents)
+ *  44  20  reserved (0)
+ *  64 256  name, zero padded
+ *
+ * The index is padded to a page, and each sample's data starts on a page
+ * of its own in SMDI (big-endian) order, so any one sample can be mapped
+ * without the others. A sample is appended by writing its data, then its
+ * index entry, then the new count; the count is the commit point, so an
+ * archive cut short by an interrupted backup still opens with every
+ * sample committed before it. Offsets are 32 bits and the file is read
+ * with fseek, so an archive is limited to 2 GB.
+ */
+
+#define SMDI_ARCHIVE_SIGNATURE    "SMDA"
+#define SMDI_ARCHIVE_VERSION      1
+#define SMDI_ARCHIVE_HEADER_SIZE  64
+#define SMDI_ARCHIVE_ENTRY_SIZE   320
+#define SMDI_ARCHIVE_ALIGN        4096     /* Data offset alignment (page size) */
+#define SMDI_ARCHIVE_CAPACITY     512      /* Default number of index entries */
+#define SMDI_ARCHIVE_NOT_FOUND    0xFFFFFFFFUL
+
+/* One sample in the index */
+typedef struct SMDI_ArchiveEntry
+{
+  DWORD dwSampleNumber;                 /* Slot the sample came from */
+  SMDI_SampleHeader header;             /* dwDataOffset is the archive offset */
+  DWORD dwSampleRate;                   /* In Hz, which the header period rounds */
+  DWORD dwDataSize;                     /* Bytes of data in SMDI order */
+  DWORD dwChecksum;                     /* CRC-32 of the data */
+} SMDI_ArchiveEntry;
+
+/* Open archive */
+typedef struct SMDI_Archive
+{
+  FILE* fp;
+  char szFilename[MAX_PATH];
+  BOOL bWritable;
+  DWORD dwCapacity;                     /* Index entries the file has room for */
+  DWORD dwCount;                        /* Samples committed */
+  DWORD dwDataStart;                    /* Offset of the first data page */
+  DWORD dwEnd;                          /* End of the last sample's data */
+  SMDI_ArchiveEntry* lpEntries;         /* Whole index, dwCapacity entries */
+  DWORD* lpSlots;                       /* Hash of sample numbers to entry + 1 */
+  DWORD dwSlotMask;
+  BOOL bAppending;                      /* A sample is being written */
+  DWORD dwWritten;                      /* Data written for it so far */
+} SMDI_Archive;
+
+/* Create an empty archive with room for dwCapacity samples (0 for the
+   default), replacing any file of that name */
+SMDI_Archive* SMDI_ArchiveCreate(const char* filename, DWORD dwCapacity);
+
+/* Open an archive and read its index; with bWritable set, samples can be
+   appended after the last committed one */
+SMDI_Archive* SMDI_ArchiveOpen(const char* filename, BOOL bWritable);
+
+/* Close an archive. Returns FALSE if any written part failed to reach the
+   disk; a sample still being appended is dropped. */
+BOOL SMDI_ArchiveClose(SMDI_Archive* archive);
+
+/* Entry by position, 0 to dwCount - 1, or NULL */
+const SMDI_ArchiveEntry* SMDI_ArchiveGetEntry(SMDI_Archive* archive, DWORD dwIndex);
+
+/* Position of the entry for a sample number, or SMDI_ARCHIVE_NOT_FOUND */
+DWORD SMDI_ArchiveFindSample(SMDI_Archive* archive, DWORD dwSampleNumber);
+
+/* Start appending a sample; dwSampleRate may be 0 to derive it from the
+   header period. Fails if the index is full or the number is already in
+   the archive. */
+BOOL SMDI_ArchiveBeginSample(SMDI_Archive* archive, DWORD dwSampleNumber,
+                             const SMDI_SampleHeader* header, DWORD dwSampleRate);
+
+/* Append the next bytes of the sample's data, in SMDI order */
+BOOL SMDI_ArchiveWriteData(SMDI_Archive* archive, const void* data, DWORD dwBytes);
+
+/* Commit the sample once all of its data is written, or drop it when
+   bKeep is FALSE */
+BOOL SMDI_ArchiveEndSample(SMDI_Archive* archive, BOOL bKeep);
+
+/* Append a whole sample held in memory (host order) */
+BOOL SMDI_ArchiveAddSample(SMDI_Archive* archive, DWORD dwSampleNumber, SMDI_Sample* sample);
+
+/* Set up a download sink for SMDI_ReceiveSampleSink appending each packet
+   to the archive as dwSampleNumber; the sample is only committed if the
+   download completes */
+BOOL SMDI_ArchiveOpenSink(SMDI_SampleSink* sink, SMDI_Archive* archive, DWORD dwSampleNumber);
+
+/* Load a sample with sample_data pointing into a private mapping of just
+   its own pages; falls back to reading it into memory */
+SMDI_Sample* SMDI_ArchiveMapSample(SMDI_Archive* archive, DWORD dwIndex);
+
+/* Open a sample as an upload source for SMDI_SendSampleSource, sent from a
+   mapping of its pages; release it with SMDI_CloseSampleSource. The source
+   has its own handle on the file, so it may outlive the archive. */
+BOOL SMDI_ArchiveOpenSource(SMDI_SampleSource* source, SMDI_Archive* archive, DWORD dwIndex);
+
+/* Check a sample's data against its CRC-32 */
+BOOL SMDI_ArchiveVerifySample(SMDI_Archive* archive, DWORD dwIndex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_ARCHIVE_H */
@@ -0,0 +1,123 @@
+/*
+ * SMDI whole-sampler backup and restore for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_BACKUP_H
+#define _SMDI_BACKUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+
+/* Slots scanned when none are given */
+#define SMDI_BACKUP_SLOTS  128
+
+/* Backup of the populated slots of one sampler */
+typedef struct SMDI_Backup
+{
+  DWORD dwStructSize;
+  BYTE HA_ID;
+  BYTE SCSI_ID;
+  DWORD dwFirstSample;                  /* First slot scanned */
+  DWORD dwSlots;                        /* Slots scanned, 0 for SMDI_BACKUP_SLOTS */
+  char * lpDestination;                 /* Archive file, or an existing directory for
+                                           one native file per slot (NNN.sdmp) */
+  BOOL bResume;                         /* Keep the samples a previous run finished */
+  void (*lpCallback)(struct SMDI_Backup*, DWORD, DWORD);  /* Sample number and result as each one finishes */
+  void * lpTransferCallback;            /* Packet progress, as SMDI_FileTransfer lpCallback */
+  DWORD dwUserData;
+  DWORD dwFound;                        /* Populated slots */
+  DWORD dwSaved;                        /* Samples written this run */
+  DWORD dwSkipped;                      /* Samples a previous run finished */
+  DWORD dwFailed;
+  DWORD dwBytes;                        /* Sample data written this run */
+} SMDI_Backup;
+
+/* Scan the slots of a sampler for samples, then download each one into an
+   archive or a directory. A writer process takes the data through a pipe,
+   so the disk writes of one sample overlap the header request and begin
+   of the next. Returns SMDIM_ENDOFPROCEDURE when every sample was saved,
+   FE_OPENERROR if the destination cannot be used, or the first failure. */
+DWORD SMDI_BackupDevice(SMDI_Backup* backup);
+
+/* Where restored samples go */
+#define SMDI_RESTORE_SAME  0   /* The slot each one was saved from */
+#define SMDI_RESTORE_PACK  1   /* The free slots of the sampler, in order */
+
+#define SMDI_NOSLOT  0xFFFFFFFFUL
+
+/* What happened to a slot */
+#define SMDI_RESTORE_SENT       0
+#define SMDI_RESTORE_UNCHANGED  1   /* Sync found it up to date */
+#define SMDI_RESTORE_DELETED    2   /* Sync removed a sample the source no longer has */
+
+/* One sample as a restore finishes it */
+typedef struct SMDI_RestoreSample
+{
+  DWORD dwStructSize;
+  const char * lpName;                  /* File, or the sample name in an archive */
+  DWORD dwSource;                       /* Slot it was saved from, SMDI_NOSLOT if unknown */
+  DWORD dwTarget;                       /* Slot it went to, SMDI_NOSLOT if none was free */
+  DWORD dwAction;                       /* SMDI_RESTORE_SENT, _UNCHANGED or _DELETED */
+  DWORD dwBytes;                        /* Sample data sent */
+  double dSeconds;                      /* Time of the upload */
+  double dWaitSeconds;                  /* Time spent waiting for it to be decoded */
+  DWORD dwResult;
+  DWORD dwVerifyOffset;                 /* First byte that differed on FE_VERIFYERROR */
+} SMDI_RestoreSample;
+
+/* Restore of an archive or directory onto one sampler */
+typedef struct SMDI_Restore
+{
+  DWORD dwStructSize;
+  char * lpSource;                      /* Archive file, or a directory of native,
+                                           WAV and AIFF files named from their slot */
+  BYTE HA_ID;
+  BYTE SCSI_ID;
+  DWORD dwPlacement;                    /* SMDI_RESTORE_SAME or _PACK */
+  DWORD dwFirstSample;                  /* First slot packing may use */
+  DWORD dwSlots;                        /* Slots packing may use, 0 for SMDI_BACKUP_SLOTS */
+  void (*lpCallback)(struct SMDI_Restore*, SMDI_RestoreSample*);  /* As each sample finishes */
+  void * lpTransferCallback;            /* Packet progress, as SMDI_FileTransfer lpCallback */
+  DWORD dwUserData;
+  BOOL bVerify;                         /* Read each sample back and compare */
+  char * lpManifest;                    /* Sync: what was last written to each slot */
+  DWORD dwFound;                        /* Samples in the source */
+  DWORD dwRestored;                     /* Samples sent */
+  DWORD dwUnchanged;
+  DWORD dwDeleted;
+  DWORD dwFailed;
+  DWORD dwBytes;                        /* Sample data sent */
+} SMDI_Restore;
+
+/* Upload every sample of an archive or directory to a sampler. Samples
+   without a slot number (directory files not named NNN...) and, with
+   SMDI_RESTORE_PACK, all of them go to the free slots found by a scan.
+   While one sample uploads, a worker process gets the next one ready:
+   AIFF and WAV files are decoded into shared memory, archive samples
+   have their CRC-32 checked. Returns SMDIM_ENDOFPROCEDURE when every
+   sample was restored, FE_OPENERROR if the source cannot be read, or the
+   first failure. */
+DWORD SMDI_RestoreDevice(SMDI_Restore* restore);
+
+/* Bring a sampler up to date with an archive or directory, sending only
+   what changed since the last sync. Each sample's fingerprint - a hash of
+   its header and the CRC-32 of its data (archive) or of its file
+   (directory) - is kept in the manifest for its slot with a hash of the
+   header the sampler reported after the upload. A header request per
+   slot confirms the sampler still holds what the manifest says, so
+   unchanged samples cost no data transfer. Slots the last sync wrote
+   that have no sample in the source any more are deleted, unless
+   something else was put there since. Only numbered samples are synced,
+   to their own slot; dwPlacement is not used. Returns as
+   SMDI_RestoreDevice. */
+DWORD SMDI_SyncDevice(SMDI_Restore* restore);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_BACKUP_H */
@@ -0,0 +1,47 @@
+/*
+ * SMDI sampler-to-sampler copy for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_COPY_H
+#define _SMDI_COPY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+
+/* Copy of one sample from one sampler to another */
+typedef struct SMDI_Copy
+{
+  DWORD dwStructSize;
+  BYTE SourceHA_ID;
+  BYTE SourceSCSI_ID;
+  DWORD dwSourceSample;
+  BYTE DestHA_ID;
+  BYTE DestSCSI_ID;
+  DWORD dwDestSample;
+  char * lpSampleName;                  /* Name on the destination, NULL to keep it */
+  void * lpCallback;                    /* Packet progress of the upload, as
+                                           SMDI_FileTransfer lpCallback */
+  DWORD dwUserData;
+  SMDI_SampleHeader header;             /* Filled in with the source's header */
+  DWORD dwBytes;                        /* Sample data copied */
+} SMDI_Copy;
+
+/* Copy a sample between samplers without an intermediate file. A reader
+   process downloads the source packet by packet into a pipe while this
+   process uploads from the other end, so the two transfers overlap and
+   the pipe bounds how far the reader may run ahead. The header goes to
+   the destination before the first packet arrives. Within one sampler, or
+   without a reader, the sample is staged in memory. Returns SMDIM_ENDOFPROCEDURE, SMDIE_NOSAMPLE
+   if the source slot is empty, the failure of the upload, or FE_READERROR
+   if the download failed. */
+DWORD SMDI_CopySample(SMDI_Copy* copy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_COPY_H */
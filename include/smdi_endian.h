@@ -0,0 +1,36 @@
+/*
+ * SMDI sample data byte order conversion for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_ENDIAN_H
+#define _SMDI_ENDIAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+
+/* Check the byte order of the host (tested once at run time) */
+BOOL SMDI_HostIsLittleEndian(void);
+
+/* Copy mode that swaps words of the given sample width, CM_NORMAL for 8 bits */
+DWORD SMDI_SwapCopyMode(DWORD bitsPerWord);
+
+/* Copy mode between SMDI (big-endian) data and host order samples;
+   CM_NORMAL on big-endian hosts */
+DWORD SMDI_HostCopyMode(DWORD bitsPerWord);
+
+/* Bytes per word handled by a copy mode, 1 for CM_NORMAL */
+DWORD SMDI_CopyModeWidth(DWORD dwCopyMode);
+
+/* Copy sample data applying a copy mode. dst may equal src to convert
+   in place; any trailing partial word is copied unchanged. */
+void SMDI_CopySampleData(void* dst, const void* src, DWORD length, DWORD dwCopyMode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_ENDIAN_H */
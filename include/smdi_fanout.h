@@ -0,0 +1,67 @@
+/*
+ * SMDI fan-out upload of one sample to several samplers for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_FANOUT_H
+#define _SMDI_FANOUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+
+/* Samplers one fan-out may send to */
+#define SMDI_FANOUT_TARGETS  16
+
+/* Chunks of decoded data a sender may run ahead of the slowest one */
+#define SMDI_FANOUT_WINDOW   16
+#define SMDI_FANOUT_CHUNK    65536
+
+/* One sampler of a fan-out */
+typedef struct SMDI_FanOutTarget
+{
+  DWORD dwStructSize;
+  BYTE HA_ID;
+  BYTE SCSI_ID;
+  DWORD dwSampleNumber;
+  DWORD dwResult;                       /* Set when the upload finishes */
+  DWORD dwPacketSize;                   /* Packet length the sampler negotiated */
+  double dSeconds;                      /* Time of its upload */
+} SMDI_FanOutTarget;
+
+/* Upload of one file to several samplers at once */
+typedef struct SMDI_FanOut
+{
+  DWORD dwStructSize;
+  char * lpFileName;                    /* Native, WAV/RF64 or AIFF file */
+  char * lpSampleName;                  /* Name on the samplers, NULL for the file's */
+  SMDI_FanOutTarget * lpTargets;
+  DWORD dwTargets;                      /* Up to SMDI_FANOUT_TARGETS */
+  DWORD dwWindow;                       /* Chunks in the window, 0 for SMDI_FANOUT_WINDOW */
+  void (*lpCallback)(struct SMDI_FanOut*, SMDI_FanOutTarget*);  /* As each sampler finishes */
+  DWORD dwUserData;
+  DWORD dwFailed;                       /* Samplers the upload failed on */
+  DWORD dwBytes;                        /* Sample data sent to each sampler */
+  double dSeconds;                      /* Time of the whole fan-out */
+} SMDI_FanOut;
+
+/* Send one file to every target at the same time. The file is read, and
+   an AIFF or WAV file decoded, only once: a native file is mapped and
+   each sender uploads from the mapping, a decoded file goes through a
+   ring of dwWindow chunks in shared memory. Each target has a sender
+   process of its own, with its own device session and packet length. A
+   chunk is refilled only once every sender has handed it back, so a
+   fast sampler runs at most the window ahead of the slowest one and the
+   fan-out takes about as long as the slowest upload. Without a sender
+   process a target is sent to afterwards in line. Returns
+   SMDIM_ENDOFPROCEDURE when every target took the sample, FE_OPENERROR or
+   FE_UNKNOWNFORMAT if the file cannot be used, or the first failure. */
+DWORD SMDI_FanOutFile(SMDI_FanOut* fanout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_FANOUT_H */
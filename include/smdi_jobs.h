@@ -0,0 +1,77 @@
+/*
+ * SMDI transfer job scheduler for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_JOBS_H
+#define _SMDI_JOBS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+
+/* Kinds of job */
+#define SMDI_JOB_SEND     0   /* lpFileName to the sample */
+#define SMDI_JOB_RECEIVE  1   /* The sample to lpFileName, as dwFileType */
+#define SMDI_JOB_DELETE   2
+#define SMDI_JOB_COPY     3   /* The sample to the destination sample */
+
+/* Where a job is */
+#define SMDI_JOB_QUEUED   0
+#define SMDI_JOB_RUNNING  1
+#define SMDI_JOB_DONE     2
+
+/* One transfer for the scheduler */
+typedef struct SMDI_Job
+{
+  DWORD dwStructSize;
+  DWORD dwType;                         /* SMDI_JOB_* */
+  DWORD dwPriority;                     /* Higher runs first; queue order among equals */
+  BYTE HA_ID;
+  BYTE SCSI_ID;
+  DWORD dwSampleNumber;
+  char * lpFileName;                    /* Send and receive */
+  DWORD dwFileType;                     /* Receive: SF_NATIVE, SF_WAV or SF_AIFF */
+  char * lpSampleName;                  /* Send and copy, NULL for the default */
+  BYTE DestHA_ID;                       /* Copy */
+  BYTE DestSCSI_ID;
+  DWORD dwDestSample;
+  DWORD dwState;                        /* SMDI_JOB_QUEUED, _RUNNING or _DONE */
+  DWORD dwResult;                       /* SMDIM_ENDOFPROCEDURE on success */
+  double dWaitSeconds;                  /* From the start of the run to the job's */
+  double dSeconds;                      /* Time the job ran */
+} SMDI_Job;
+
+/* A run of queued jobs */
+typedef struct SMDI_Scheduler
+{
+  DWORD dwStructSize;
+  SMDI_Job * lpJobs;
+  DWORD dwJobs;
+  DWORD dwMaxJobs;                      /* Jobs running at once, 0 for no limit */
+  DWORD dwMaxPerAdapter;                /* Jobs on one host adapter, 0 for no limit */
+  void (*lpCallback)(struct SMDI_Scheduler*, SMDI_Job*);  /* As each job starts and finishes */
+  DWORD dwUserData;
+  DWORD dwDone;                         /* Jobs that succeeded */
+  DWORD dwFailed;
+  double dSeconds;                      /* Time of the whole run */
+} SMDI_Scheduler;
+
+/* Run every queued job, as many at once as the limits allow. A device
+   takes one job at a time, as SMDI has one procedure per target, and a
+   copy holds both of its devices. Whenever a job finishes, the queued
+   job of highest priority whose devices and adapters are free starts
+   next, so a job waiting for a busy device does not hold up the others
+   and every adapter is kept busy. Each job runs in a process of its own
+   with its own device sessions; without one it runs in line. Returns
+   SMDIM_ENDOFPROCEDURE when every job succeeded, or the first failure
+   in queue order. */
+DWORD SMDI_RunJobs(SMDI_Scheduler* scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_JOBS_H */
@@ -0,0 +1,92 @@
+/*
+ * SMDI PCM sample format conversion for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_PCM_H
+#define _SMDI_PCM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+
+/* Sample encodings */
+#define PCM_S8          1   /* Signed 8-bit */
+#define PCM_U8          2   /* Unsigned 8-bit, 128 is silence */
+#define PCM_S16         3   /* Signed 16-bit */
+#define PCM_S24         4   /* Signed 24-bit, packed in 3 bytes */
+#define PCM_S24_32      5   /* Signed 24-bit in the low 3 bytes of 32-bit words */
+#define PCM_S32         6   /* Signed 32-bit */
+#define PCM_F32         7   /* IEEE float, full scale -1.0 to 1.0 */
+
+/* Byte orders */
+#define PCM_ORDER_HOST      0
+#define PCM_ORDER_BIG       1   /* SMDI, AIFF */
+#define PCM_ORDER_LITTLE    2   /* WAV */
+
+/* Most channels a conversion handles */
+#define PCM_MAX_CHANNELS    8
+
+/* Dither applied when reducing bit depth */
+#define PCM_DITHER_NONE     0   /* Round to nearest */
+#define PCM_DITHER_TPDF     1   /* Triangular dither, +/- 1 LSB */
+#define PCM_DITHER_SHAPED   2   /* TPDF with error feedback moving noise up in frequency */
+
+/* Layout of a block of PCM data */
+typedef struct SMDI_PCMFormat
+{
+  DWORD dwEncoding;                     /* PCM_S8 ... PCM_F32 */
+  DWORD dwByteOrder;                    /* PCM_ORDER_* */
+  DWORD dwChannels;                     /* 1 to PCM_MAX_CHANNELS */
+  BOOL bPlanar;                         /* Each channel in its own plane */
+  DWORD dwPlaneStride;                  /* Samples from plane to plane, 0 = frames converted */
+} SMDI_PCMFormat;
+
+/* Dither state, carried from one chunk of a stream to the next */
+typedef struct SMDI_PCMDither
+{
+  DWORD dwMode;                         /* PCM_DITHER_* */
+  DWORD dwSeed;                         /* Noise generator state */
+  long lError[PCM_MAX_CHANNELS][2];     /* Last quantization errors per channel */
+} SMDI_PCMDither;
+
+/* Fill in a format (interleaved when bPlanar is FALSE) */
+void SMDI_PCMSetFormat(SMDI_PCMFormat* fmt, DWORD dwEncoding, DWORD dwByteOrder,
+                       DWORD dwChannels, BOOL bPlanar);
+
+/* Bytes per sample of an encoding, 0 if unknown */
+DWORD SMDI_PCMSampleSize(DWORD dwEncoding);
+
+/* Bytes per frame of a format */
+DWORD SMDI_PCMFrameSize(const SMDI_PCMFormat* fmt);
+
+/* Short name of an encoding ("s16", "f32", ...) and the reverse lookup */
+const char* SMDI_PCMEncodingName(DWORD dwEncoding);
+DWORD SMDI_PCMParseEncoding(const char* name);
+
+/* Convert frames from one format to another. Channels are mixed down to
+   mono by averaging and mono is copied to every output channel. Calls are
+   independent, so long data can be converted chunk by chunk; for planar
+   chunks of a longer buffer set dwPlaneStride to the buffer's frame count. */
+BOOL SMDI_PCMConvert(const SMDI_PCMFormat* src, const void* in,
+                     const SMDI_PCMFormat* dst, void* out, DWORD frames);
+
+/* Start a dither stream; the noise sequence is the same for every stream */
+void SMDI_PCMInitDither(SMDI_PCMDither* dither, DWORD dwMode);
+
+/* Dither mode for a name ("none", "tpdf", "shaped"), or -1 if unknown */
+long SMDI_PCMParseDither(const char* name);
+
+/* Convert as SMDI_PCMConvert, dithering when the destination keeps fewer
+   bits than the source. Pass the same state for every chunk of a stream. */
+BOOL SMDI_PCMConvertDither(const SMDI_PCMFormat* src, const void* in,
+                           const SMDI_PCMFormat* dst, void* out, DWORD frames,
+                           SMDI_PCMDither* dither);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_PCM_H */
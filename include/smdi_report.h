@@ -0,0 +1,62 @@
+/*
+ * SMDI machine-readable operation reports for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_REPORT_H
+#define _SMDI_REPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+
+/* One report record - written as a single JSON line */
+typedef struct {
+    const char* operation;     /* "send", "receive", "list", "delete", "scan", ... */
+    BYTE  ha_id;
+    BYTE  scsi_id;             /* Ignored when all_ids is set */
+    BOOL  all_ids;             /* Operation covered a whole host adapter */
+    long  sample_number;       /* -1 if not applicable */
+    const char* file;          /* NULL if not applicable */
+    DWORD bytes;
+    DWORD packets;
+    DWORD packet_size;
+    double seconds;            /* Wall time */
+    DWORD waits;
+    DWORD retries;
+    DWORD count;               /* Items found by list/scan */
+    DWORD result;              /* Final SMDI message or error code */
+    BOOL  success;
+} SMDI_Report;
+
+/* Start writing reports to a file ("-" or "stdout" for standard output) */
+BOOL SMDI_ReportOpen(const char* target);
+
+/* Stop writing reports */
+void SMDI_ReportClose(void);
+
+/* Check whether reports are being written */
+BOOL SMDI_ReportEnabled(void);
+
+/* Clear a report record */
+void SMDI_ReportInit(SMDI_Report* report, const char* operation);
+
+/* Copy the counters of the last transfer into a report record */
+void SMDI_ReportFromStats(SMDI_Report* report);
+
+/* Write one report record */
+void SMDI_ReportWrite(SMDI_Report* report);
+
+/* Get a symbolic name for an SMDI message or error code */
+const char* SMDI_MessageName(DWORD message);
+
+/* Get the wall clock time in seconds */
+double SMDI_GetTime(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_REPORT_H */
@@ -0,0 +1,35 @@
+/*
+ * SMDI sample rate conversion for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_RESAMPLE_H
+#define _SMDI_RESAMPLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+#include "smdi_sample.h"
+
+/* Frames produced when converting in_frames from in_rate to out_rate */
+DWORD SMDI_ResampleLength(DWORD in_frames, DWORD in_rate, DWORD out_rate);
+
+/* Resample one channel of float data; out must hold
+   SMDI_ResampleLength(in_frames, in_rate, out_rate) values */
+BOOL SMDI_ResampleFloat(const float* in, DWORD in_frames, DWORD in_rate,
+                        float* out, DWORD out_rate);
+
+/* Resample a sample to a new rate, scaling the loop points; the result is
+   requantized with a PCM_DITHER_* mode. Returns a new sample or NULL. */
+SMDI_Sample* SMDI_ResampleSample(SMDI_Sample* sample, DWORD out_rate, DWORD dither_mode);
+
+/* Release the cached filter tables */
+void SMDI_FreeResampleTables(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_RESAMPLE_H */
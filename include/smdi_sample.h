@@ -35,12 +35,19 @@ typedef struct {
     char  name[256];           /* Sample name */
     short* sample_data;        /* Interleaved if stereo */
     DWORD data_size;           /* Size in bytes */
+    void* map_base;            /* File mapping holding sample_data, NULL if allocated */
+    DWORD map_size;
 } SMDI_Sample;
 
 /* Create a new sample */
 SMDI_Sample* SMDI_CreateSample(DWORD sample_rate, BYTE bits_per_sample, 
                              BYTE channels, DWORD sample_count);
 
+/* Create a new sample without clearing the data, for callers that
+   fill all of it */
+SMDI_Sample* SMDI_AllocSample(DWORD sample_rate, BYTE bits_per_sample, 
+                            BYTE channels, DWORD sample_count);
+
 /* Free a sample */
 void SMDI_FreeSample(SMDI_Sample* sample);
 
@@ -50,12 +57,23 @@ SMDI_Sample* SMDI_HeaderToSample(SMDI_SampleHeader* header, void* data);
 /* Convert our sample structure to SMDI sample header */
 void SMDI_SampleToHeader(SMDI_Sample* sample, SMDI_SampleHeader* header);
 
+/* Set up an upload source sending the sample from memory; the sample must
+   outlive the transfer */
+void SMDI_SampleSourceFromSample(SMDI_SampleSource* source, SMDI_Sample* sample);
+
 /* Save a sample to a file */
 BOOL SMDI_SaveSample(SMDI_Sample* sample, const char* filename);
 
+/* Set up a download sink for SMDI_ReceiveSampleSink writing each packet
+   straight to a native file; the file is removed if the download fails */
+BOOL SMDI_OpenNativeSink(SMDI_SampleSink* sink, const char* filename);
+
 /* Load a sample from a file */
 SMDI_Sample* SMDI_LoadSample(const char* filename);
 
+/* Load a sample with sample_data pointing into a private mapping of the file */
+SMDI_Sample* SMDI_MapSample(const char* filename);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,89 @@
+/*
+ * SMDI native sample file (SDMP) header for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_SDMP_H
+#define _SMDI_SDMP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "smdi.h"
+
+/*
+ * SDMP version 2 layout - all fields big-endian, no compiler padding:
+ *
+ *   0   4  "SDMP"
+ *   4   4  version (2)
+ *   8   4  data offset (multiple of SDMP_DATA_ALIGN)
+ *  12   4  data size in bytes
+ *  16   1  bits per sample
+ *  17   1  channels
+ *  18   1  loop type
+ *  19   1  reserved (0)
+ *  20   4  sample rate in Hz
+ *  24   4  sample count per channel
+ *  28   4  loop start
+ *  32   4  loop end
+ *  36   2  pitch (MIDI note)
+ *  38   2  pitch fraction (cents)
+ *  40   4  name length
+ *  44  20  reserved (0)
+ *  64 256  name, zero padded
+ * 320      reserved metadata area (0) up to the data offset
+ *
+ * Sample data follows at the data offset in SMDI (big-endian) order.
+ * Version 1 files hold the raw IRIX header struct (36 bytes) and the
+ * name, with the data right after the name.
+ */
+
+#define SDMP_SIGNATURE       "SDMP"
+#define SDMP_VERSION_1       1
+#define SDMP_VERSION_2       2
+#define SDMP_V1_HEADER_SIZE  36
+#define SDMP_V2_NAME_OFFSET  64
+#define SDMP_V2_FIXED_SIZE   320    /* Fields and name area */
+#define SDMP_DATA_ALIGN      4096   /* Data offset alignment (page size) */
+
+/* Parsed SDMP header */
+typedef struct {
+    DWORD version;
+    BYTE  bitsPerSample;      /* Typically 16 */
+    BYTE  channels;           /* 1=mono, 2=stereo */
+    BYTE  loopType;           /* 0=none, 1=forward, 2=bidirectional */
+    BYTE  reserved;
+    DWORD sampleRate;         /* In Hz */
+    DWORD sampleCount;        /* Per channel */
+    DWORD loopStart;          /* Sample point */
+    DWORD loopEnd;            /* Sample point */
+    WORD  pitch;              /* MIDI note */
+    WORD  pitchFraction;      /* Cents, -50 to +50 */
+    DWORD nameLength;         /* Length of name string (max 255) */
+    char  name[256];          /* Zero terminated */
+    DWORD dataOffset;         /* File offset of the sample data */
+    DWORD dataSize;           /* Sample data size in bytes */
+} SMDI_NativeHeader;
+
+/* Clear a header and set the current version */
+void SMDI_InitNativeHeader(SMDI_NativeHeader* hdr);
+
+/* Read a version 1 or 2 header; the file is left at the sample data */
+BOOL SMDI_ReadNativeHeader(FILE* fp, SMDI_NativeHeader* hdr);
+
+/* Write a version 2 header padded up to the data offset */
+BOOL SMDI_WriteNativeHeader(FILE* fp, SMDI_NativeHeader* hdr);
+
+/* Map a whole native file privately (copy on write) for sequential reading */
+void* SMDI_MapNativeFile(FILE* fp, SMDI_NativeHeader* hdr, DWORD* lpMapSize);
+
+/* Release a mapping from SMDI_MapNativeFile */
+void SMDI_UnmapNativeFile(void* lpMapBase, DWORD dwMapSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_SDMP_H */
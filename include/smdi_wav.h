@@ -0,0 +1,44 @@
+/*
+ * SMDI WAV file format support for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_WAV_H
+#define _SMDI_WAV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "smdi.h"
+#include "smdi_sample.h"
+#include "smdi_pcm.h"
+
+/* Load a WAV or RF64 file into SMDI sample format; wider files are reduced
+   to 16 bit with TPDF dither. The first smpl loop and the unity note give
+   the loop and root note. */
+SMDI_Sample* SMDI_LoadWAVSample(const char* filename);
+
+/* Load a WAV or RF64 file as 8 or 16 bit samples (0 for the default) with
+   a PCM_DITHER_* mode for the bit depth reduction */
+SMDI_Sample* SMDI_LoadWAVSampleAs(const char* filename, BYTE bits_per_sample,
+                                  DWORD dither_mode);
+
+/* Open a WAV or RF64 file as an upload source for SMDI_SendSampleSource,
+   decoding 8 or 16 bit frames (0 for the default) as packets go out;
+   release it with SMDI_CloseSampleSource */
+BOOL SMDI_OpenWAVSource(SMDI_SampleSource* source, const char* filename,
+                        BYTE bits_per_sample, DWORD dither_mode);
+
+/* Save SMDI sample as WAV file with a smpl chunk for the loop and tuning */
+BOOL SMDI_SaveWAVSample(SMDI_Sample* sample, const char* filename);
+
+/* Set up a download sink for SMDI_ReceiveSampleSink writing each packet
+   straight to a WAV file; the file is removed if the download fails */
+BOOL SMDI_OpenWAVSink(SMDI_SampleSink* sink, const char* filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_WAV_H */
@@ -0,0 +1,108 @@
+/*
+ * SMDI WAV/RF64 file reader and writer for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#ifndef _SMDI_WAVE_H
+#define _SMDI_WAVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "smdi.h"
+#include "smdi_pcm.h"
+
+/* Format tags of the fmt chunk */
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_IEEE_FLOAT  0x0003
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+/* Most loops kept from a smpl chunk */
+#define WAVE_MAX_LOOPS          8
+
+/* Loop types in the smpl chunk */
+#define WAVE_LOOP_FORWARD       0
+#define WAVE_LOOP_ALTERNATING   1
+#define WAVE_LOOP_BACKWARD      2
+
+/* Loop from the smpl chunk */
+typedef struct SMDI_WAVELoop
+{
+  DWORD dwCuePointId;
+  DWORD dwType;                         /* WAVE_LOOP_* */
+  DWORD dwStart;                        /* First frame of the loop */
+  DWORD dwEnd;                          /* Last frame of the loop, played */
+  DWORD dwFraction;                     /* Fraction of a frame past the end */
+  DWORD dwPlayCount;                    /* 0 loops forever */
+} SMDI_WAVELoop;
+
+/* Everything the header chunks say about a file */
+typedef struct SMDI_WAVEInfo
+{
+  BOOL bRF64;                           /* RF64 or BW64 form with 64-bit sizes */
+  WORD wFormatTag;                      /* PCM or IEEE float, EXTENSIBLE resolved */
+  DWORD dwChannels;
+  DWORD dwFrames;
+  DWORD dwBits;                         /* Valid bits per sample */
+  DWORD dwRate;
+  SMDI_PCMFormat pcmFormat;             /* Layout of the sound data */
+  BOOL bHasSampler;                     /* smpl chunk present */
+  DWORD dwUnityNote;                    /* MIDI note played at the recorded pitch */
+  DWORD dwPitchFraction;                /* Fraction of a semitone above it, 0x80000000 = 50 cents */
+  DWORD dwNumLoops;
+  SMDI_WAVELoop loops[WAVE_MAX_LOOPS];
+  char szName[256];                     /* LIST INFO INAM, empty if none */
+  DWORD dwDataOffset;                   /* File offset of the first frame */
+  DWORD dwDataSize;                     /* Bytes of sound data, low 32 bits */
+  DWORD dwDataSizeHigh;                 /* High 32 bits, only set in RF64 */
+} SMDI_WAVEInfo;
+
+/* Open file being read or written */
+typedef struct SMDI_WAVEFile
+{
+  FILE* fp;
+  BOOL bWriting;
+  SMDI_WAVEInfo info;
+  DWORD dwFrame;                        /* Frames read or written so far */
+  DWORD dwBytes;                        /* Sound data written, low and high 32 bits */
+  DWORD dwBytesHigh;
+  DWORD dwSizesPos;                     /* Offset of the JUNK chunk that becomes ds64 */
+  DWORD dwFactPos;                      /* Offset of the fact frame count, 0 if none */
+  DWORD dwDataSizePos;                  /* Offset of the data chunk size */
+  BOOL bError;                          /* A write failed */
+  void* lpBuffer;                       /* Conversion buffer */
+} SMDI_WAVEFile;
+
+/* Clear an info block for a new file: 16-bit PCM, no loops, middle C */
+void SMDI_WAVEInitInfo(SMDI_WAVEInfo* info);
+
+/* Open a file and parse its chunks; the file is left at the first frame.
+   Returns NULL if the file is not a RIFF or RF64 WAVE with sound data
+   this library can decode. */
+SMDI_WAVEFile* SMDI_WAVEOpen(const char* filename);
+
+/* Read up to dwFrames frames converted to an interleaved format, carrying the
+   dither state across calls. Returns the frames read. */
+DWORD SMDI_WAVEReadFrames(SMDI_WAVEFile* file, const SMDI_PCMFormat* fmt, void* buffer,
+                          DWORD dwFrames, SMDI_PCMDither* dither);
+
+/* Create a file from an info block (format tag, channels, bits, rate, smpl
+   loops and name) and write its header. Room is left for a ds64 chunk, so
+   a file whose sound data passes 4 GB is finished as RF64 on close. */
+SMDI_WAVEFile* SMDI_WAVECreate(const char* filename, const SMDI_WAVEInfo* info);
+
+/* Append interleaved frames given in fmt, converting to the file's layout */
+BOOL SMDI_WAVEWriteFrames(SMDI_WAVEFile* file, const SMDI_PCMFormat* fmt, const void* buffer,
+                          DWORD dwFrames);
+
+/* Close a file; a written file gets its final sizes. Returns FALSE if
+   any part of a written file failed to reach the disk. */
+BOOL SMDI_WAVEClose(SMDI_WAVEFile* file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SMDI_WAVE_H */
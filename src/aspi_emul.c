@@ -0,0 +1,750 @@
+/*
+ * ASPI emulator backend
+ * Drop-in replacement for aspi_irix.c that emulates SMDI samplers in
+ * memory, so the tools can be exercised and benchmarked without SCSI
+ * hardware.
+ *
+ * Environment variables:
+ *   SMDI_EMUL_DEVICES  - emulated targets as "ha:id[,ha:id...]" (default "0:5")
+ *   SMDI_EMUL_SAMPLES  - number of synthetic samples pre-loaded per device (default 4)
+ *   SMDI_EMUL_PACKET   - maximum data packet length offered by the device (default 65536)
+ *   SMDI_EMUL_WAIT     - answer every Nth uploaded data packet with WAIT, then
+ *                        report not ready once (default 0 = never)
+ *   SMDI_EMUL_FAIL     - reject every Nth uploaded data packet, as a lost one
+ *                        (default 0 = never); a Begin Sample Transfer for
+ *                        the same sample then asks for the packet after
+ *                        the last one received
+ *   SMDI_EMUL_DIR      - keep sample memory in this directory so that it is
+ *                        shared between processes and runs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "aspi_irix.h"
+#include "scsi_debug.h"
+
+#define EMUL_MAX_DEVICES  8
+#define EMUL_MAX_SAMPLES  1024
+#define EMUL_MAX_REPLY    (65536 + 64)
+
+/* Emulated sample slot */
+typedef struct {
+    int            exists;
+    unsigned char  bits;
+    unsigned char  channels;
+    unsigned char  loop_control;
+    unsigned long  period;
+    unsigned long  length;
+    unsigned long  loop_start;
+    unsigned long  loop_end;
+    unsigned short pitch;
+    unsigned short pitch_fraction;
+    char           name[256];
+    unsigned char *data;
+    unsigned long  data_size;
+} emul_sample_t;
+
+/* Emulated device */
+typedef struct {
+    unsigned char  ha_id;
+    unsigned char  id;
+    emul_sample_t  samples[EMUL_MAX_SAMPLES];
+    emul_sample_t  incoming;           /* Sample being uploaded */
+    unsigned long  incoming_number;
+    int            incoming_valid;
+    unsigned long  incoming_received;  /* Bytes received in order from the start */
+    unsigned long  next_packet;        /* Data packet the device asked for */
+    unsigned long  download_number;    /* Sample being downloaded */
+    int            download_valid;
+    unsigned long  packet_length;      /* Negotiated packet length */
+    unsigned long  packet_count;       /* Data packets seen, for WAIT and FAIL emulation */
+    unsigned char  reply[EMUL_MAX_REPLY];
+    unsigned long  reply_len;
+    unsigned char  deferred[EMUL_MAX_REPLY];
+    unsigned long  deferred_len;
+    int            busy;               /* Not ready for one poll after a WAIT */
+} emul_device_t;
+
+static emul_device_t *g_devices[EMUL_MAX_DEVICES];
+static int g_device_count = -1;
+static unsigned long g_max_packet = 65536;
+static unsigned long g_wait_every = 0;
+static unsigned long g_fail_every = 0;
+static const char *g_state_dir = NULL;
+
+/* Store a 24-bit big-endian value */
+static void put24(unsigned char *p, unsigned long v)
+{
+    p[0] = (unsigned char)((v >> 16) & 0xFF);
+    p[1] = (unsigned char)((v >> 8) & 0xFF);
+    p[2] = (unsigned char)(v & 0xFF);
+}
+
+/* Store a 32-bit big-endian value */
+static void put32(unsigned char *p, unsigned long v)
+{
+    p[0] = (unsigned char)((v >> 24) & 0xFF);
+    p[1] = (unsigned char)((v >> 16) & 0xFF);
+    p[2] = (unsigned char)((v >> 8) & 0xFF);
+    p[3] = (unsigned char)(v & 0xFF);
+}
+
+/* Fetch a 24-bit big-endian value */
+static unsigned long get24(const unsigned char *p)
+{
+    return ((unsigned long)p[0] << 16) | ((unsigned long)p[1] << 8) | (unsigned long)p[2];
+}
+
+/* Fetch a 32-bit big-endian value */
+static unsigned long get32(const unsigned char *p)
+{
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+           ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+}
+
+/*
+ * Sample persistence (only used when SMDI_EMUL_DIR is set)
+ */
+
+static void emul_slot_path(char path[], emul_device_t *dev, unsigned long n)
+{
+    sprintf(path, "%s/emul_%d_%d_%lu.smp", g_state_dir, dev->ha_id, dev->id, n);
+}
+
+static void emul_store_slot(emul_device_t *dev, unsigned long n)
+{
+    char path[MAX_PATH + 64];
+    unsigned char hdr[36];
+    emul_sample_t *s;
+    FILE *fp;
+
+    if (g_state_dir == NULL)
+    {
+        return;
+    }
+
+    s = &dev->samples[n];
+    emul_slot_path(path, dev, n);
+
+    if (!s->exists)
+    {
+        remove(path);
+        return;
+    }
+
+    fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        return;
+    }
+
+    hdr[0] = s->bits;
+    hdr[1] = s->channels;
+    hdr[2] = s->loop_control;
+    hdr[3] = (unsigned char)strlen(s->name);
+    put32(&hdr[4], s->period);
+    put32(&hdr[8], s->length);
+    put32(&hdr[12], s->loop_start);
+    put32(&hdr[16], s->loop_end);
+    put32(&hdr[20], s->pitch);
+    put32(&hdr[24], s->pitch_fraction);
+    put32(&hdr[28], s->data_size);
+    put32(&hdr[32], 0);
+    fwrite(hdr, 1, sizeof(hdr), fp);
+    fwrite(s->name, 1, hdr[3], fp);
+    if (s->data_size > 0)
+    {
+        fwrite(s->data, 1, s->data_size, fp);
+    }
+    fclose(fp);
+}
+
+static void emul_load_slot(emul_device_t *dev, unsigned long n)
+{
+    char path[MAX_PATH + 64];
+    unsigned char hdr[36];
+    emul_sample_t *s;
+    FILE *fp;
+
+    if (g_state_dir == NULL)
+    {
+        return;
+    }
+
+    s = &dev->samples[n];
+    if (s->data != NULL)
+    {
+        free(s->data);
+    }
+    memset(s, 0, sizeof(emul_sample_t));
+
+    emul_slot_path(path, dev, n);
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        return;
+    }
+
+    if (fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr))
+    {
+        s->bits = hdr[0];
+        s->channels = hdr[1];
+        s->loop_control = hdr[2];
+        s->period = get32(&hdr[4]);
+        s->length = get32(&hdr[8]);
+        s->loop_start = get32(&hdr[12]);
+        s->loop_end = get32(&hdr[16]);
+        s->pitch = (unsigned short)get32(&hdr[20]);
+        s->pitch_fraction = (unsigned short)get32(&hdr[24]);
+        s->data_size = get32(&hdr[28]);
+        fread(s->name, 1, hdr[3], fp);
+        s->name[hdr[3]] = '\0';
+        s->data = (unsigned char *)malloc(s->data_size > 0 ? s->data_size : 1);
+        if (s->data != NULL &&
+            fread(s->data, 1, s->data_size, fp) == s->data_size)
+        {
+            s->exists = 1;
+        }
+    }
+    fclose(fp);
+}
+
+/* Fill a slot with a synthetic sawtooth so that list/receive have something to show */
+static void emul_make_sample(emul_sample_t *s, unsigned long n)
+{
+    unsigned long i;
+
+    s->exists = 1;
+    s->bits = 16;
+    s->channels = 1;
+    s->loop_control = 0;
+    s->period = 1000000000 / 44100;
+    s->length = 4410 * (n + 1);
+    s->loop_start = 0;
+    s->loop_end = s->length - 1;
+    s->pitch = 60;
+    s->pitch_fraction = 0;
+    sprintf(s->name, "Emul %lu", n);
+    s->data_size = s->length * 2;
+    s->data = (unsigned char *)malloc(s->data_size);
+    if (s->data == NULL)
+    {
+        s->exists = 0;
+        return;
+    }
+    for (i = 0; i < s->length; i++)
+    {
+        s->data[i * 2] = (unsigned char)((i * 3) >> 8);
+        s->data[i * 2 + 1] = (unsigned char)(i * 3);
+    }
+}
+
+/* Parse the environment and create the emulated devices */
+static void emul_init(void)
+{
+    const char *spec;
+    const char *p;
+    const char *env;
+    int ha;
+    int id;
+    int n;
+    int i;
+    int preload;
+    emul_device_t *dev;
+
+    if (g_device_count >= 0)
+    {
+        return;
+    }
+    g_device_count = 0;
+
+    env = getenv("SMDI_EMUL_PACKET");
+    if (env != NULL && atol(env) > 0)
+    {
+        g_max_packet = (unsigned long)atol(env);
+        if (g_max_packet > EMUL_MAX_REPLY - 64)
+        {
+            g_max_packet = EMUL_MAX_REPLY - 64;
+        }
+    }
+    env = getenv("SMDI_EMUL_WAIT");
+    if (env != NULL)
+    {
+        g_wait_every = (unsigned long)atol(env);
+    }
+    env = getenv("SMDI_EMUL_FAIL");
+    if (env != NULL)
+    {
+        g_fail_every = (unsigned long)atol(env);
+    }
+    g_state_dir = getenv("SMDI_EMUL_DIR");
+
+    env = getenv("SMDI_EMUL_SAMPLES");
+    preload = (env != NULL) ? atoi(env) : 4;
+    if (preload > EMUL_MAX_SAMPLES)
+    {
+        preload = EMUL_MAX_SAMPLES;
+    }
+
+    spec = getenv("SMDI_EMUL_DEVICES");
+    if (spec == NULL)
+    {
+        spec = "0:5";
+    }
+
+    p = spec;
+    while (*p != '\0' && g_device_count < EMUL_MAX_DEVICES)
+    {
+        if (sscanf(p, "%d:%d%n", &ha, &id, &n) < 2)
+        {
+            break;
+        }
+
+        dev = (emul_device_t *)malloc(sizeof(emul_device_t));
+        if (dev == NULL)
+        {
+            break;
+        }
+        memset(dev, 0, sizeof(emul_device_t));
+        dev->ha_id = (unsigned char)ha;
+        dev->id = (unsigned char)id;
+
+        if (g_state_dir != NULL)
+        {
+            for (i = 0; i < EMUL_MAX_SAMPLES; i++)
+            {
+                emul_load_slot(dev, i);
+            }
+        }
+        else
+        {
+            for (i = 0; i < preload; i++)
+            {
+                emul_make_sample(&dev->samples[i], i);
+            }
+        }
+
+        g_devices[g_device_count++] = dev;
+
+        p += n;
+        while (*p == ',' || *p == ' ')
+        {
+            p++;
+        }
+    }
+}
+
+static emul_device_t *emul_find(unsigned char ha_id, unsigned char id)
+{
+    int i;
+
+    emul_init();
+
+    for (i = 0; i < g_device_count; i++)
+    {
+        if (g_devices[i]->ha_id == ha_id && g_devices[i]->id == id)
+        {
+            return g_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/* Build a reply message in the device's reply buffer */
+static unsigned char *emul_reply(emul_device_t *dev, unsigned long message_id,
+                                 unsigned long additional_length)
+{
+    memcpy(dev->reply, "SMDI", 4);
+    put32(&dev->reply[4], message_id);
+    put24(&dev->reply[8], additional_length);
+    dev->reply_len = 11 + additional_length;
+    return &dev->reply[11];
+}
+
+static void emul_reject(emul_device_t *dev, unsigned long error_code)
+{
+    unsigned char *p;
+
+    p = emul_reply(dev, 0x00020000, 4);
+    put32(p, error_code);
+}
+
+/* Answer with WAIT and hold back the real reply until the next read */
+static void emul_maybe_wait(emul_device_t *dev)
+{
+    if (g_wait_every == 0 || (dev->packet_count % g_wait_every) != 0)
+    {
+        return;
+    }
+    memcpy(dev->deferred, dev->reply, dev->reply_len);
+    dev->deferred_len = dev->reply_len;
+    dev->busy = 1;
+    emul_reply(dev, 0x01020000, 0);
+}
+
+/* Process one SMDI message written by the host */
+static void emul_message(emul_device_t *dev, unsigned char *msg, unsigned long size)
+{
+    unsigned long message_id;
+    unsigned long n;
+    unsigned long len;
+    unsigned long offset;
+    unsigned char *p;
+    emul_sample_t *s;
+
+    dev->reply_len = 0;
+    dev->deferred_len = 0;
+
+    if (size < 11 || memcmp(msg, "SMDI", 4) != 0)
+    {
+        return;
+    }
+
+    message_id = get32(&msg[4]);
+    n = (size >= 14) ? get24(&msg[11]) : 0;
+
+    switch (message_id)
+    {
+        case 0x00010000: /* Master Identify */
+            emul_reply(dev, 0x00010001, 0);
+            break;
+
+        case 0x01200000: /* Sample Header Request */
+            if (n >= EMUL_MAX_SAMPLES)
+            {
+                emul_reject(dev, 0x00200000);
+                break;
+            }
+            emul_load_slot(dev, n);
+            s = &dev->samples[n];
+            if (!s->exists)
+            {
+                emul_reject(dev, 0x00200002);
+                break;
+            }
+            len = strlen(s->name);
+            p = emul_reply(dev, 0x01210000, 0x1a + len);
+            put24(&p[0], n);
+            p[3] = s->bits;
+            p[4] = s->channels;
+            put24(&p[5], s->period);
+            put32(&p[8], s->length);
+            put32(&p[12], s->loop_start);
+            put32(&p[16], s->loop_end);
+            p[20] = s->loop_control;
+            p[21] = (unsigned char)(s->pitch >> 8);
+            p[22] = (unsigned char)s->pitch;
+            p[23] = (unsigned char)(s->pitch_fraction >> 8);
+            p[24] = (unsigned char)s->pitch_fraction;
+            p[25] = (unsigned char)len;
+            memcpy(&p[26], s->name, len);
+            break;
+
+        case 0x01210000: /* Sample Header (upload) */
+            if (n >= EMUL_MAX_SAMPLES || size < 37)
+            {
+                emul_reject(dev, 0x00200000);
+                break;
+            }
+            if (dev->incoming.data != NULL)
+            {
+                free(dev->incoming.data);
+            }
+            memset(&dev->incoming, 0, sizeof(emul_sample_t));
+            s = &dev->incoming;
+            s->bits = msg[14];
+            s->channels = msg[15];
+            s->period = get24(&msg[16]);
+            s->length = get32(&msg[19]);
+            s->loop_start = get32(&msg[23]);
+            s->loop_end = get32(&msg[27]);
+            s->loop_control = msg[31];
+            s->pitch = (unsigned short)((msg[32] << 8) | msg[33]);
+            s->pitch_fraction = (unsigned short)((msg[34] << 8) | msg[35]);
+            len = msg[36];
+            memcpy(s->name, &msg[37], len);
+            s->name[len] = '\0';
+            s->data_size = (s->length * s->channels * s->bits) / 8;
+            s->data = (unsigned char *)malloc(s->data_size > 0 ? s->data_size : 1);
+            if (s->data == NULL)
+            {
+                emul_reject(dev, 0x00200004);
+                break;
+            }
+            dev->incoming_number = n;
+            dev->incoming_valid = 1;
+            dev->incoming_received = 0;
+            dev->next_packet = 0;
+            p = emul_reply(dev, 0x01220001, 6);
+            put24(&p[0], n);
+            put24(&p[3], g_max_packet);
+            break;
+
+        case 0x01220000: /* Begin Sample Transfer */
+            len = (size >= 17) ? get24(&msg[14]) : g_max_packet;
+            if (len == 0 || len > g_max_packet)
+            {
+                len = g_max_packet;
+            }
+            dev->packet_length = len;
+            dev->packet_count = 0;
+            if (dev->incoming_valid && dev->incoming_number == n)
+            {
+                /* Carry on after the whole packets already received; a
+                   partial one at the new length is sent again */
+                dev->next_packet = dev->incoming_received / len;
+                dev->incoming_received = dev->next_packet * len;
+                p = emul_reply(dev, 0x01030000, 3);
+                put24(p, dev->next_packet);
+            }
+            else
+            {
+                if (n >= EMUL_MAX_SAMPLES || !dev->samples[n].exists)
+                {
+                    emul_reject(dev, 0x00200002);
+                    break;
+                }
+                dev->download_number = n;
+                dev->download_valid = 1;
+                p = emul_reply(dev, 0x01220001, 6);
+                put24(&p[0], n);
+                put24(&p[3], len);
+            }
+            break;
+
+        case 0x01100000: /* Data Packet (upload) */
+            if (!dev->incoming_valid || n != dev->next_packet)
+            {
+                emul_reject(dev, 0x00200000);
+                break;
+            }
+            if (g_fail_every != 0 && (dev->packet_count + 1) % g_fail_every == 0)
+            {
+                /* Drop it; what came before stays for a resume */
+                dev->packet_count++;
+                emul_reject(dev, 0x00000000);
+                break;
+            }
+            s = &dev->incoming;
+            len = get24(&msg[8]) - 3;
+            offset = dev->incoming_received;
+            if (offset < s->data_size)
+            {
+                if (offset + len > s->data_size)
+                {
+                    len = s->data_size - offset;
+                }
+                memcpy(s->data + offset, &msg[14], len);
+                dev->incoming_received = offset + len;
+            }
+            dev->next_packet++;
+            dev->packet_count++;
+            if (dev->incoming_received >= s->data_size)
+            {
+                s->exists = 1;
+                n = dev->incoming_number;
+                if (dev->samples[n].data != NULL)
+                {
+                    free(dev->samples[n].data);
+                }
+                memcpy(&dev->samples[n], s, sizeof(emul_sample_t));
+                memset(s, 0, sizeof(emul_sample_t));
+                dev->incoming_valid = 0;
+                emul_store_slot(dev, n);
+                emul_reply(dev, 0x01040000, 0);
+            }
+            else
+            {
+                p = emul_reply(dev, 0x01030000, 3);
+                put24(p, dev->next_packet);
+            }
+            emul_maybe_wait(dev);
+            break;
+
+        case 0x01030000: /* Send Next Packet (download) */
+            if (!dev->download_valid)
+            {
+                emul_reject(dev, 0x00200000);
+                break;
+            }
+            s = &dev->samples[dev->download_number];
+            offset = n * dev->packet_length;
+            if (!s->exists || offset >= s->data_size)
+            {
+                emul_reject(dev, 0x00200000);
+                break;
+            }
+            len = s->data_size - offset;
+            if (len > dev->packet_length)
+            {
+                len = dev->packet_length;
+            }
+            p = emul_reply(dev, 0x01100000, 3 + len);
+            put24(p, n);
+            memcpy(&p[3], s->data + offset, len);
+            break;
+
+        case 0x01240000: /* Delete Sample */
+            if (n >= EMUL_MAX_SAMPLES)
+            {
+                emul_reject(dev, 0x00200000);
+                break;
+            }
+            emul_load_slot(dev, n);
+            s = &dev->samples[n];
+            if (!s->exists)
+            {
+                emul_reject(dev, 0x00200002);
+                break;
+            }
+            if (s->data != NULL)
+            {
+                free(s->data);
+            }
+            memset(s, 0, sizeof(emul_sample_t));
+            emul_store_slot(dev, n);
+            emul_reply(dev, 0x01000000, 0);
+            break;
+
+        case 0x01230000: /* Sample Name */
+            emul_reply(dev, 0x01000000, 0);
+            break;
+
+        default:
+            emul_reject(dev, 0x00000000);
+            break;
+    }
+}
+
+/*
+ * ASPI interface
+ */
+
+int ASPI_Check(scsi_debug_t *debug)
+{
+    (void)debug;
+    emul_init();
+    return 1;
+}
+
+void ASPI_RescanPort(scsi_debug_t *debug, unsigned char ha_id)
+{
+    (void)debug;
+    (void)ha_id;
+    emul_init();
+}
+
+int ASPI_GetDevType(scsi_debug_t *debug, unsigned char ha_id, unsigned char id)
+{
+    (void)debug;
+    if (emul_find(ha_id, id) == NULL)
+    {
+        return 0xFF;
+    }
+    return 0x03;  /* Processor, like a real sampler */
+}
+
+int ASPI_TestUnitReady(scsi_debug_t *debug, unsigned char ha_id, unsigned char id)
+{
+    emul_device_t *dev;
+
+    (void)debug;
+    dev = emul_find(ha_id, id);
+    if (dev == NULL)
+    {
+        return FALSE;
+    }
+    if (dev->busy)
+    {
+        dev->busy = 0;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL ASPI_Send(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, void *buffer, unsigned long size)
+{
+    emul_device_t *dev;
+
+    (void)debug;
+    dev = emul_find(ha_id, id);
+    if (dev == NULL || size > 0x00FFFFFF)
+    {
+        return FALSE;
+    }
+
+    emul_message(dev, (unsigned char *)buffer, size);
+    return TRUE;
+}
+
+unsigned long ASPI_Receive(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, void *buffer, unsigned long size)
+{
+    emul_device_t *dev;
+    unsigned long len;
+
+    (void)debug;
+    dev = emul_find(ha_id, id);
+    if (dev == NULL || size > 0x00FFFFFF)
+    {
+        return 0;
+    }
+
+    /* Raw reads with nothing pending just return zeros */
+    if (dev->reply_len == 0)
+    {
+        memset(buffer, 0, size);
+        return size;
+    }
+
+    len = dev->reply_len;
+    if (len > size)
+    {
+        len = size;
+    }
+    memcpy(buffer, dev->reply, len);
+    dev->reply_len = 0;
+
+    /* A WAIT was answered; the held-back reply comes with the next read */
+    if (dev->deferred_len > 0)
+    {
+        memcpy(dev->reply, dev->deferred, dev->deferred_len);
+        dev->reply_len = dev->deferred_len;
+        dev->deferred_len = 0;
+    }
+
+    return len;
+}
+
+void ASPI_InquireDevice(scsi_debug_t *debug, char result[], unsigned char ha_id, unsigned char id)
+{
+    (void)debug;
+    if (result == NULL)
+    {
+        return;
+    }
+
+    memset(result, 0, 96);
+    if (emul_find(ha_id, id) == NULL)
+    {
+        return;
+    }
+
+    result[0] = 0x03;
+    memcpy(&result[8], "EMUL    ", 8);
+    memcpy(&result[16], "SMDI SAMPLER    ", 16);
+    memcpy(&result[32], "1.0 ", 4);
+}
+
+void ASPI_SetKeepOpen(int enable)
+{
+    /* Emulated devices have no handles to keep */
+    (void)enable;
+}
+
+void ASPI_CloseAll(void)
+{
+}
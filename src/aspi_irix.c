@@ -18,6 +18,21 @@
 #include "scsi_debug.h"
 #include "aspi_defs.h"
 
+/* Maximum number of device handles kept open at once */
+#define ASPI_MAX_HANDLES 16
+
+/* Cached device handle */
+typedef struct {
+    int            in_use;
+    unsigned char  ha_id;
+    unsigned char  id;
+    struct dsreq  *dsp;
+} aspi_handle_t;
+
+/* Handle cache, only used while keep-open mode is enabled */
+static aspi_handle_t g_handles[ASPI_MAX_HANDLES];
+static int g_keep_open = 0;
+
 /*
  * Get device path string for a given host adapter and target ID
  */
@@ -28,6 +43,104 @@ static void ASPI_GetDevNameByID(char cResult[], unsigned char ha_id, unsigned ch
     sprintf(cResult, "/dev/scsi/sc%dd%dl0", ha_id, id);
 }
 
+/*
+ * Open a read/write handle for a device, reusing a cached one in keep-open mode
+ */
+
+static struct dsreq *ASPI_OpenHandle(unsigned char ha_id, unsigned char id)
+{
+    char dev_path[MAX_PATH];
+    struct dsreq *dsp;
+    int i;
+    
+    if (g_keep_open)
+    {
+        for (i = 0; i < ASPI_MAX_HANDLES; i++)
+        {
+            if (g_handles[i].in_use && g_handles[i].ha_id == ha_id && g_handles[i].id == id)
+            {
+                return g_handles[i].dsp;
+            }
+        }
+    }
+    
+    ASPI_GetDevNameByID(dev_path, ha_id, id);
+    dsp = dsopen(dev_path, O_RDWR);
+    
+    if (dsp != NULL && g_keep_open)
+    {
+        for (i = 0; i < ASPI_MAX_HANDLES; i++)
+        {
+            if (!g_handles[i].in_use)
+            {
+                g_handles[i].in_use = 1;
+                g_handles[i].ha_id = ha_id;
+                g_handles[i].id = id;
+                g_handles[i].dsp = dsp;
+                break;
+            }
+        }
+    }
+    
+    return dsp;
+}
+
+/*
+ * Release a handle from ASPI_OpenHandle (cached handles stay open)
+ */
+
+static void ASPI_ReleaseHandle(struct dsreq *dsp)
+{
+    int i;
+    
+    if (dsp == NULL)
+    {
+        return;
+    }
+    
+    for (i = 0; i < ASPI_MAX_HANDLES; i++)
+    {
+        if (g_handles[i].in_use && g_handles[i].dsp == dsp)
+        {
+            return;
+        }
+    }
+    
+    dsclose(dsp);
+}
+
+/*
+ * Close all cached device handles
+ */
+void ASPI_CloseAll(void)
+{
+    int i;
+    
+    for (i = 0; i < ASPI_MAX_HANDLES; i++)
+    {
+        if (g_handles[i].in_use)
+        {
+            dsclose(g_handles[i].dsp);
+            g_handles[i].in_use = 0;
+            g_handles[i].dsp = NULL;
+        }
+    }
+}
+
+/*
+ * Keep device handles open between commands instead of opening
+ * and closing the device for every transfer
+ */
+void ASPI_SetKeepOpen(int enable)
+{
+    g_keep_open = enable ? 1 : 0;
+    
+    if (!g_keep_open)
+    {
+        ASPI_CloseAll();
+    }
+}
+
 /*
  * Populate a debug packet with command information
  */
@@ -282,9 +395,16 @@ int ASPI_TestUnitReady(scsi_debug_t *debug, unsigned char ha_id, unsigned char i
     char dev_path[MAX_PATH];
     scsi_debug_packet_t packet;
     
-    /* Get device path and open device */
-    ASPI_GetDevNameByID(dev_path, ha_id, id);
-    dsp = dsopen(dev_path, O_RDONLY);
+    /* Get device path and open device (reusing a cached handle if kept open) */
+    if (g_keep_open)
+    {
+        dsp = ASPI_OpenHandle(ha_id, id);
+    }
+    else
+    {
+        ASPI_GetDevNameByID(dev_path, ha_id, id);
+        dsp = dsopen(dev_path, O_RDONLY);
+    }
     
     if (dsp == NULL)
     {
@@ -337,7 +457,7 @@ int ASPI_TestUnitReady(scsi_debug_t *debug, unsigned char ha_id, unsigned char i
         scsi_debug_log(debug, &packet);
     }
     
-    dsclose(dsp);
+    ASPI_ReleaseHandle(dsp);
     return (result == 0) ? TRUE : FALSE;
 }
 
@@ -348,17 +468,15 @@ int ASPI_TestUnitReady(scsi_debug_t *debug, unsigned char ha_id, unsigned char i
 BOOL ASPI_Send(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, void *buffer, unsigned long size)
 {
     struct dsreq *dsp;
-    char dev_path[MAX_PATH];
     unsigned char cmd[6];
     int result;
     
-    /* Get device path and open it using dslib */
-    ASPI_GetDevNameByID(dev_path, ha_id, id);
-    dsp = dsopen(dev_path, O_RDWR);
+    /* Open the device using dslib (or reuse the kept-open handle) */
+    dsp = ASPI_OpenHandle(ha_id, id);
     
     if (dsp == NULL) {
         if (debug != NULL && debug->enabled) {
-            printf("ASPI_Send: Failed to open device %s\n", dev_path);
+            printf("ASPI_Send: Failed to open device %d:%d\n", ha_id, id);
         }
         return FALSE;
     }
@@ -392,11 +510,11 @@ BOOL ASPI_Send(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, void
             printf("ASPI_Send: Command failed, result=%d, ds_ret=%d, status=%d\n", 
                    result, dsp->ds_ret, dsp->ds_status);
         }
-        dsclose(dsp);
+        ASPI_ReleaseHandle(dsp);
         return FALSE;
     }
     
-    dsclose(dsp);
+    ASPI_ReleaseHandle(dsp);
     return TRUE;
 }
 
@@ -409,17 +527,24 @@ unsigned long ASPI_Receive(scsi_debug_t *debug, unsigned char ha_id, unsigned ch
     int fd;
     char dev_path[MAX_PATH];
     struct dsreq ds_req;
+    struct dsreq *dsp;
     unsigned char cmd[6];
     int result;
     unsigned long bytes_received = 0;
     
-    /* Get device path and open it directly */
-    ASPI_GetDevNameByID(dev_path, ha_id, id);
-    fd = open(dev_path, O_RDWR);
+    /* Get device path and open it directly (or use the kept-open handle) */
+    dsp = NULL;
+    if (g_keep_open) {
+        dsp = ASPI_OpenHandle(ha_id, id);
+        fd = (dsp != NULL) ? getfd(dsp) : -1;
+    } else {
+        ASPI_GetDevNameByID(dev_path, ha_id, id);
+        fd = open(dev_path, O_RDWR);
+    }
     
     if (fd < 0) {
         if (debug != NULL && debug->enabled) {
-            printf("ASPI_Receive: Failed to open device %s, errno=%d\n", dev_path, errno);
+            printf("ASPI_Receive: Failed to open device %d:%d, errno=%d\n", ha_id, id, errno);
         }
         return 0;
     }
@@ -458,8 +583,13 @@ unsigned long ASPI_Receive(scsi_debug_t *debug, unsigned char ha_id, unsigned ch
         printf("ASPI_Receive: ioctl failed, result=%d, ds_ret=%d\n", result, ds_req.ds_ret);
     }
     
-    /* Close the device */
-    close(fd);
+    /* Close the device unless it is kept open; a handle the cache had no
+       room for is closed like any other */
+    if (dsp == NULL) {
+        close(fd);
+    } else {
+        ASPI_ReleaseHandle(dsp);
+    }
     
     return bytes_received;
 }
@@ -6,11 +6,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include "aspi_test.h"
 
 /* Global debug structure */
 static scsi_debug_t g_debug;
 
+/* Reusable transfer buffer for streamed transfers */
+static unsigned char *g_xfer_mem = NULL;    /* As returned by malloc */
+static unsigned char *g_xfer_buf = NULL;    /* Aligned start */
+static unsigned long g_xfer_size = 0;
+
+/* Device handles are kept open between commands */
+static int g_keep_open = 0;
+
 /* Parse hexadecimal string into byte array */
 int parse_hex_data(const char *hex_str, unsigned char *data, int max_len)
 {
@@ -67,8 +81,11 @@ void print_usage(void)
     printf("receive <ha_id> <id> <size>  - Receive data from device\n");
     printf("debug [on|off]        - Enable/disable debug output\n");
     printf("logfile <filename>    - Set debug log file\n");
-    printf("dumpfile <filename> <ha_id> <id> <size> - Dump data from device to file\n");
-    printf("sendfile <filename> <ha_id> <id> - Send file data to device\n");
+    printf("dumpfile <filename> <ha_id> <id> <size> [chunk] - Dump data from device to file\n");
+    printf("sendfile <filename> <ha_id> <id> [chunk] - Send file data to device\n");
+    printf("bench <ha_id> <id> <size> <count> [write|read|both] - Raw transfer benchmark\n");
+    printf("repeat <n> <send|receive|ready> <ha_id> <id> [data|size] - Latency profile\n");
+    printf("keepopen [on|off]     - Reuse one open handle per device\n");
     printf("quit                  - Exit the program\n");
     printf("\n");
 }
@@ -285,64 +302,277 @@ void cmd_receive(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, uns
     }
 }
 
+/* Get the wall clock time in seconds */
+static double get_time(void)
+{
+    struct timeval tv;
+    
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/* Get a transfer buffer of at least size bytes, aligned for DMA and reused between commands */
+static unsigned char *get_transfer_buffer(unsigned long size)
+{
+    if (size > g_xfer_size)
+    {
+        free(g_xfer_mem);
+        g_xfer_mem = (unsigned char *)malloc(size + BUFFER_ALIGN);
+        if (g_xfer_mem == NULL)
+        {
+            g_xfer_buf = NULL;
+            g_xfer_size = 0;
+            return NULL;
+        }
+        g_xfer_buf = (unsigned char *)(((unsigned long)g_xfer_mem + BUFFER_ALIGN - 1) &
+                                       ~(unsigned long)(BUFFER_ALIGN - 1));
+        g_xfer_size = size;
+    }
+    
+    return g_xfer_buf;
+}
+
+/* Read exactly len bytes from a descriptor unless end of file comes first */
+static unsigned long read_full(int fd, unsigned char *buffer, unsigned long len)
+{
+    unsigned long done;
+    int n;
+    
+    done = 0;
+    while (done < len)
+    {
+        n = read(fd, buffer + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        done += n;
+    }
+    
+    return done;
+}
+
+/* Write len bytes to a descriptor; returns 0 on failure */
+static int write_full(int fd, const unsigned char *buffer, unsigned long len)
+{
+    unsigned long done;
+    int n;
+    
+    done = 0;
+    while (done < len)
+    {
+        n = write(fd, buffer + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return 0;
+        }
+        done += n;
+    }
+    
+    return 1;
+}
+
+/* Check a chunk size given on the command line */
+static unsigned long check_chunk_size(unsigned long chunk)
+{
+    if (chunk == 0)
+    {
+        return DEFAULT_CHUNK_SIZE;
+    }
+    if (chunk > MAX_CHUNK_SIZE)
+    {
+        printf("Chunk size limited to %lu bytes\n", (unsigned long)MAX_CHUNK_SIZE);
+        return MAX_CHUNK_SIZE;
+    }
+    return chunk;
+}
+
+/* Print the result of a streamed transfer */
+static void print_transfer_rate(const char *what, unsigned long bytes, unsigned long chunks, double seconds)
+{
+    printf("%s %lu bytes in %lu chunk(s)", what, bytes, chunks);
+    if (seconds > 0.0)
+    {
+        printf(", %.3f MB/s", (double)bytes / seconds / 1048576.0);
+    }
+    printf("\n");
+}
+
 /* Command: Dump data from device to file */
-void cmd_dumpfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id, unsigned char id, unsigned long size)
+void cmd_dumpfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id, unsigned char id,
+                  unsigned long size, unsigned long chunk)
 {
     unsigned char *data;
     unsigned long received;
+    unsigned long total;
+    unsigned long chunks;
+    unsigned long len;
+    int fds[2];
+    int status;
+    int ok;
+    pid_t pid;
     FILE *fp;
+    double start;
+    void (*old_handler)(int);
     
-    /* Allocate buffer */
-    data = (unsigned char *)malloc(size);
+    chunk = check_chunk_size(chunk);
+    
+    data = get_transfer_buffer(chunk);
     if (data == NULL)
     {
-        printf("Error: Failed to allocate memory for %lu bytes\n", size);
+        printf("Error: Failed to allocate memory for %lu bytes\n", chunk);
         return;
     }
     
-    printf("Receiving %lu bytes from device %d:%d...\n", size, ha_id, id);
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+    {
+        printf("Error opening file '%s' for writing\n", filename);
+        return;
+    }
     
-    received = ASPI_Receive(debug, ha_id, id, data, size);
+    printf("Receiving %lu bytes from device %d:%d in %lu byte chunks...\n", size, ha_id, id, chunk);
     
-    if (received > 0)
+    /* A writer process stores each chunk while the next one is read from the device */
+    pid = -1;
+    if (pipe(fds) == 0)
     {
-        printf("Received %lu bytes\n", received);
-        
-        /* Write data to file */
-        fp = fopen(filename, "wb");
-        if (fp != NULL)
+        fflush(NULL);
+        pid = fork();
+        if (pid == 0)
         {
-            if (fwrite(data, 1, received, fp) == received)
+            close(fds[1]);
+            ok = 1;
+            while ((len = read_full(fds[0], data, chunk)) > 0)
             {
-                printf("Data written to file '%s'\n", filename);
+                if (fwrite(data, 1, len, fp) != len)
+                {
+                    ok = 0;
+                    break;
+                }
             }
-            else
+            if (fclose(fp) != 0)
             {
-                printf("Error writing to file '%s'\n", filename);
+                ok = 0;
             }
+            _exit(ok ? 0 : 1);
+        }
+        if (pid < 0)
+        {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        else
+        {
+            close(fds[0]);
             fclose(fp);
+            fp = NULL;
+        }
+    }
+    
+    /* A failed writer must not kill the shell */
+    old_handler = signal(SIGPIPE, SIG_IGN);
+    
+    total = 0;
+    chunks = 0;
+    ok = 1;
+    start = get_time();
+    
+    while (total < size)
+    {
+        len = size - total;
+        if (len > chunk)
+        {
+            len = chunk;
+        }
+        
+        received = ASPI_Receive(debug, ha_id, id, data, len);
+        if (received == 0)
+        {
+            printf("Failed to receive data after %lu bytes\n", total);
+            ok = 0;
+            break;
+        }
+        
+        if (pid > 0)
+        {
+            ok = write_full(fds[1], data, received);
         }
         else
         {
-            printf("Error opening file '%s' for writing\n", filename);
+            ok = (fwrite(data, 1, received, fp) == received);
+        }
+        if (!ok)
+        {
+            printf("Error writing to file '%s'\n", filename);
+            break;
         }
+        
+        total += received;
+        chunks++;
     }
-    else
+    
+    /* Let the writer finish */
+    if (pid > 0)
     {
-        printf("Failed to receive data\n");
+        close(fds[1]);
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            if (ok)
+            {
+                printf("Error writing to file '%s'\n", filename);
+            }
+            ok = 0;
+        }
+    }
+    else if (fclose(fp) != 0 && ok)
+    {
+        printf("Error writing to file '%s'\n", filename);
+        ok = 0;
     }
     
-    free(data);
+    signal(SIGPIPE, old_handler);
+    
+    print_transfer_rate("Received", total, chunks, get_time() - start);
+    if (ok)
+    {
+        printf("Data written to file '%s'\n", filename);
+    }
 }
 
 /* Command: Send file data to device */
-void cmd_sendfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id, unsigned char id)
+void cmd_sendfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id, unsigned char id,
+                  unsigned long chunk)
 {
     unsigned char *data;
     unsigned long file_size;
-    unsigned long bytes_read;
-    int success;
+    unsigned long total;
+    unsigned long chunks;
+    unsigned long len;
+    int fds[2];
+    int status;
+    int ok;
+    pid_t pid;
     FILE *fp;
+    double start;
+    void (*old_handler)(int);
+    
+    chunk = check_chunk_size(chunk);
+    
+    data = get_transfer_buffer(chunk);
+    if (data == NULL)
+    {
+        printf("Error: Failed to allocate memory for %lu bytes\n", chunk);
+        return;
+    }
     
     /* Open file */
     fp = fopen(filename, "rb");
@@ -357,41 +587,466 @@ void cmd_sendfile(scsi_debug_t *debug, const char *filename, unsigned char ha_id
     file_size = ftell(fp);
     fseek(fp, 0, SEEK_SET);
     
-    /* Allocate buffer */
-    data = (unsigned char *)malloc(file_size);
-    if (data == NULL)
+    printf("Sending %lu bytes from file '%s' to device %d:%d in %lu byte chunks...\n", 
+           file_size, filename, ha_id, id, chunk);
+    
+    /* A reader process fetches the next chunk while the current one is sent */
+    pid = -1;
+    if (pipe(fds) == 0)
+    {
+        fflush(NULL);
+        pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            ok = 1;
+            while ((len = fread(data, 1, chunk, fp)) > 0)
+            {
+                if (!write_full(fds[1], data, len))
+                {
+                    break;  /* Sender stopped */
+                }
+            }
+            if (ferror(fp))
+            {
+                ok = 0;
+            }
+            fclose(fp);
+            close(fds[1]);
+            _exit(ok ? 0 : 1);
+        }
+        if (pid < 0)
+        {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        else
+        {
+            close(fds[1]);
+            fclose(fp);
+            fp = NULL;
+        }
+    }
+    
+    old_handler = signal(SIGPIPE, SIG_IGN);
+    
+    total = 0;
+    chunks = 0;
+    ok = 1;
+    start = get_time();
+    
+    while (1)
+    {
+        if (pid > 0)
+        {
+            len = read_full(fds[0], data, chunk);
+        }
+        else
+        {
+            len = fread(data, 1, chunk, fp);
+        }
+        if (len == 0)
+        {
+            break;
+        }
+        
+        if (!ASPI_Send(debug, ha_id, id, data, len))
+        {
+            printf("Failed to send data after %lu bytes\n", total);
+            ok = 0;
+            break;
+        }
+        
+        total += len;
+        chunks++;
+    }
+    
+    if (pid > 0)
     {
-        printf("Error: Failed to allocate memory for %lu bytes\n", file_size);
+        close(fds[0]);
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            if (ok)
+            {
+                printf("Error reading file '%s'\n", filename);
+            }
+            ok = 0;
+        }
+    }
+    else
+    {
+        if (ferror(fp) && ok)
+        {
+            printf("Error reading file '%s'\n", filename);
+            ok = 0;
+        }
         fclose(fp);
+    }
+    
+    signal(SIGPIPE, old_handler);
+    
+    print_transfer_rate("Sent", total, chunks, get_time() - start);
+    if (ok)
+    {
+        printf("Data sent successfully\n");
+    }
+}
+
+/* Compare two doubles for qsort */
+static int compare_double(const void *a, const void *b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    
+    if (da < db)
+    {
+        return -1;
+    }
+    return (da > db) ? 1 : 0;
+}
+
+/* Nearest rank percentile of sorted timings, permille = 990 for p99 */
+static double percentile(const double sorted[], unsigned long count, unsigned long permille)
+{
+    unsigned long rank;
+    
+    rank = (count * permille + 999) / 1000;
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+/* Print latency (min/avg/p99 in ms) and throughput for a set of timings */
+static void print_latency(const char *label, double times[], unsigned long count, double bytes)
+{
+    double total;
+    unsigned long i;
+    
+    if (count == 0)
+    {
+        printf("%-6s no successful transfers\n", label);
+        return;
+    }
+    
+    qsort(times, count, sizeof(double), compare_double);
+    
+    total = 0.0;
+    for (i = 0; i < count; i++)
+    {
+        total += times[i];
+    }
+    
+    printf("%-6s min %.3f ms  avg %.3f ms  p99 %.3f ms  %.3f MB/s\n",
+           label, times[0] * 1000.0, total * 1000.0 / count, percentile(times, count, 990) * 1000.0,
+           total > 0.0 ? bytes / total / 1048576.0 : 0.0);
+}
+
+/* Command: Raw WRITE/READ burst benchmark */
+void cmd_bench(scsi_debug_t *debug, unsigned char ha_id, unsigned char id, 
+               unsigned long size, unsigned long count, const char *mode)
+{
+    unsigned char *data;
+    double *times;
+    double start;
+    double bytes;
+    unsigned long i;
+    unsigned long done;
+    unsigned long failed;
+    unsigned long received;
+    int do_write;
+    int do_read;
+    
+    do_write = (strcmp(mode, "write") == 0 || strcmp(mode, "both") == 0);
+    do_read = (strcmp(mode, "read") == 0 || strcmp(mode, "both") == 0);
+    
+    if (!do_write && !do_read)
+    {
+        printf("Unknown mode '%s' (use write, read or both)\n", mode);
         return;
     }
     
-    /* Read file */
-    bytes_read = fread(data, 1, file_size, fp);
-    fclose(fp);
+    if (size == 0 || size > 0x00FFFFFF || count == 0)
+    {
+        printf("Size must be 1..16777215 bytes and count at least 1\n");
+        return;
+    }
     
-    if (bytes_read != file_size)
+    data = (unsigned char *)malloc(size);
+    times = (double *)malloc(count * sizeof(double));
+    if (data == NULL || times == NULL)
     {
-        printf("Error: Read %lu bytes, expected %lu bytes\n", bytes_read, file_size);
+        printf("Error: Failed to allocate memory for benchmark\n");
         free(data);
+        free(times);
         return;
     }
     
-    printf("Sending %lu bytes from file '%s' to device %d:%d...\n", 
-           file_size, filename, ha_id, id);
+    /* Not an SMDI message, so a sampler ignores it */
+    memset(data, 0, size);
     
-    success = ASPI_Send(debug, ha_id, id, data, file_size);
+    printf("Benchmark on device %d:%d: %lu x %lu bytes\n", ha_id, id, count, size);
     
-    if (success)
+    if (do_write)
     {
-        printf("Data sent successfully\n");
+        done = 0;
+        failed = 0;
+        for (i = 0; i < count; i++)
+        {
+            start = get_time();
+            if (ASPI_Send(debug, ha_id, id, data, size))
+            {
+                times[done++] = get_time() - start;
+            }
+            else
+            {
+                failed++;
+            }
+        }
+        
+        print_latency("write", times, done, (double)done * size);
+        if (failed > 0)
+        {
+            printf("write: %lu of %lu transfers failed\n", failed, count);
+        }
     }
-    else
+    
+    if (do_read)
     {
-        printf("Failed to send data\n");
+        done = 0;
+        failed = 0;
+        bytes = 0.0;
+        for (i = 0; i < count; i++)
+        {
+            start = get_time();
+            received = ASPI_Receive(debug, ha_id, id, data, size);
+            if (received > 0)
+            {
+                times[done++] = get_time() - start;
+                bytes += (double)received;
+            }
+            else
+            {
+                failed++;
+            }
+        }
+        
+        print_latency("read", times, done, bytes);
+        if (failed > 0)
+        {
+            printf("read: %lu of %lu transfers failed\n", failed, count);
+        }
     }
     
     free(data);
+    free(times);
+}
+
+/* Print a latency profile: min/max/percentiles and a log2 histogram in microseconds */
+static void print_latency_profile(double times[], unsigned long count)
+{
+    unsigned long buckets[HISTOGRAM_BUCKETS];
+    unsigned long i;
+    unsigned long peak;
+    unsigned long us;
+    double total;
+    int b;
+    int first;
+    int last;
+    int width;
+    
+    if (count == 0)
+    {
+        printf("No successful commands\n");
+        return;
+    }
+    
+    qsort(times, count, sizeof(double), compare_double);
+    
+    total = 0.0;
+    memset(buckets, 0, sizeof(buckets));
+    for (i = 0; i < count; i++)
+    {
+        total += times[i];
+        
+        /* Bucket b holds [2^(b-1), 2^b) microseconds, bucket 0 is below 1 us */
+        us = (unsigned long)(times[i] * 1000000.0);
+        for (b = 0; us > 0 && b < HISTOGRAM_BUCKETS - 1; b++)
+        {
+            us >>= 1;
+        }
+        buckets[b]++;
+    }
+    
+    printf("min %.1f us  avg %.1f us  max %.1f us\n",
+           times[0] * 1000000.0, total * 1000000.0 / count, times[count - 1] * 1000000.0);
+    printf("p50 %.1f us  p90 %.1f us  p99 %.1f us  p99.9 %.1f us\n",
+           percentile(times, count, 500) * 1000000.0, percentile(times, count, 900) * 1000000.0,
+           percentile(times, count, 990) * 1000000.0, percentile(times, count, 999) * 1000000.0);
+    
+    first = -1;
+    last = 0;
+    peak = 0;
+    for (b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        if (buckets[b] > 0)
+        {
+            if (first < 0)
+            {
+                first = b;
+            }
+            last = b;
+        }
+        if (buckets[b] > peak)
+        {
+            peak = buckets[b];
+        }
+    }
+    
+    printf("Histogram (us):\n");
+    for (b = first; b <= last; b++)
+    {
+        width = (int)((buckets[b] * HISTOGRAM_WIDTH + peak - 1) / peak);
+        if (b == 0)
+        {
+            printf("%9s %-9s %8lu ", "0", "- 1", buckets[b]);
+        }
+        else
+        {
+            printf("%9lu - %-7lu %8lu ", 1UL << (b - 1), 1UL << b, buckets[b]);
+        }
+        while (width-- > 0)
+        {
+            putchar('#');
+        }
+        putchar('\n');
+    }
+}
+
+/* Command: Run send, receive or ready n times back to back and profile latency */
+void cmd_repeat(scsi_debug_t *debug, unsigned long count, const char *command,
+                const char *arg1, const char *arg2, const char *arg3)
+{
+    unsigned char hex[DATA_BUFFER_SIZE];
+    unsigned char *data;
+    unsigned char ha_id;
+    unsigned char id;
+    unsigned long size;
+    unsigned long i;
+    unsigned long done;
+    unsigned long errors;
+    double *times;
+    double start;
+    double elapsed;
+    double timer_cost;
+    int op;
+    int ok;
+    
+    if (count == 0)
+    {
+        printf("Count must be at least 1\n");
+        return;
+    }
+    
+    ha_id = (unsigned char)atoi(arg1);
+    id = (unsigned char)atoi(arg2);
+    data = NULL;
+    size = 0;
+    
+    /* Do all parsing and allocation before the timed loop */
+    if (strcmp(command, "ready") == 0)
+    {
+        op = REPEAT_READY;
+    }
+    else if (strcmp(command, "send") == 0)
+    {
+        op = REPEAT_SEND;
+        size = parse_hex_data(arg3, hex, DATA_BUFFER_SIZE);
+        data = hex;
+        if (size == 0)
+        {
+            printf("Error: Invalid hex data\n");
+            return;
+        }
+    }
+    else if (strcmp(command, "receive") == 0)
+    {
+        op = REPEAT_RECEIVE;
+        size = (unsigned long)atol(arg3);
+        if (size == 0 || size > MAX_CHUNK_SIZE)
+        {
+            printf("Error: Invalid size\n");
+            return;
+        }
+        data = get_transfer_buffer(size);
+        if (data == NULL)
+        {
+            printf("Error: Failed to allocate memory for %lu bytes\n", size);
+            return;
+        }
+    }
+    else
+    {
+        printf("repeat supports send, receive and ready\n");
+        return;
+    }
+    
+    times = (double *)malloc(count * sizeof(double));
+    if (times == NULL)
+    {
+        printf("Error: Failed to allocate memory for %lu timings\n", count);
+        return;
+    }
+    
+    /* Cost of reading the clock, to tell host overhead from device time */
+    start = get_time();
+    for (i = 0; i < 1000; i++)
+    {
+        get_time();
+    }
+    timer_cost = (get_time() - start) / 1000.0;
+    
+    printf("Running '%s' %lu times on device %d:%d (%s)...\n", command, count, ha_id, id,
+           g_keep_open ? "one open handle" : "open per command");
+    
+    done = 0;
+    errors = 0;
+    elapsed = get_time();
+    
+    for (i = 0; i < count; i++)
+    {
+        start = get_time();
+        switch (op)
+        {
+            case REPEAT_READY:
+                ok = ASPI_TestUnitReady(debug, ha_id, id);
+                break;
+            case REPEAT_SEND:
+                ok = ASPI_Send(debug, ha_id, id, data, size);
+                break;
+            default:
+                ok = (ASPI_Receive(debug, ha_id, id, data, size) > 0);
+                break;
+        }
+        
+        if (ok)
+        {
+            times[done++] = get_time() - start;
+        }
+        else
+        {
+            errors++;
+        }
+    }
+    
+    elapsed = get_time() - elapsed;
+    
+    printf("%lu ok, %lu error(s) in %.3f s (%.1f commands/s), timer overhead %.2f us\n",
+           done, errors, elapsed, elapsed > 0.0 ? count / elapsed : 0.0, timer_cost * 1000000.0);
+    print_latency_profile(times, done);
+    
+    free(times);
 }
 
 /* Main function */
@@ -403,6 +1058,7 @@ int main(int argc, char *argv[])
     char arg2[CMDLINE_SIZE];
     char arg3[CMDLINE_SIZE];
     char arg4[CMDLINE_SIZE];
+    char arg5[CMDLINE_SIZE];
     int args;
     
     /* Initialize debug structure */
@@ -429,8 +1085,9 @@ int main(int argc, char *argv[])
         arg2[0] = '\0';
         arg3[0] = '\0';
         arg4[0] = '\0';
+        arg5[0] = '\0';
         
-        args = sscanf(cmdline, "%s %s %s %s %s", cmd, arg1, arg2, arg3, arg4);
+        args = sscanf(cmdline, "%s %s %s %s %s %s", cmd, arg1, arg2, arg3, arg4, arg5);
         
         if (args <= 0 || cmd[0] == '\0')
         {
@@ -541,23 +1198,68 @@ int main(int argc, char *argv[])
         {
             if (args < 5)
             {
-                printf("Usage: dumpfile <filename> <ha_id> <id> <size>\n");
+                printf("Usage: dumpfile <filename> <ha_id> <id> <size> [chunk]\n");
             }
             else
             {
                 cmd_dumpfile(&g_debug, arg1, (unsigned char)atoi(arg2), 
-                          (unsigned char)atoi(arg3), (unsigned long)atol(arg4));
+                          (unsigned char)atoi(arg3), (unsigned long)atol(arg4),
+                          args > 5 ? (unsigned long)atol(arg5) : 0);
             }
         }
         else if (strcmp(cmd, "sendfile") == 0)
         {
             if (args < 4)
             {
-                printf("Usage: sendfile <filename> <ha_id> <id>\n");
+                printf("Usage: sendfile <filename> <ha_id> <id> [chunk]\n");
             }
             else
             {
-                cmd_sendfile(&g_debug, arg1, (unsigned char)atoi(arg2), (unsigned char)atoi(arg3));
+                cmd_sendfile(&g_debug, arg1, (unsigned char)atoi(arg2), (unsigned char)atoi(arg3),
+                             args > 4 ? (unsigned long)atol(arg4) : 0);
+            }
+        }
+        else if (strcmp(cmd, "bench") == 0)
+        {
+            if (args < 5)
+            {
+                printf("Usage: bench <ha_id> <id> <size> <count> [write|read|both]\n");
+            }
+            else
+            {
+                cmd_bench(&g_debug, (unsigned char)atoi(arg1), (unsigned char)atoi(arg2),
+                          (unsigned long)atol(arg3), (unsigned long)atol(arg4),
+                          args > 5 ? arg5 : "both");
+            }
+        }
+        else if (strcmp(cmd, "repeat") == 0)
+        {
+            if (args < 5 || (args < 6 && strcmp(arg2, "ready") != 0))
+            {
+                printf("Usage: repeat <n> <send|receive|ready> <ha_id> <id> [data|size]\n");
+            }
+            else
+            {
+                cmd_repeat(&g_debug, (unsigned long)atol(arg1), arg2, arg3, arg4, arg5);
+            }
+        }
+        else if (strcmp(cmd, "keepopen") == 0)
+        {
+            if (args < 2 || strcmp(arg1, "on") == 0)
+            {
+                g_keep_open = 1;
+                ASPI_SetKeepOpen(1);
+                printf("Device handles kept open\n");
+            }
+            else if (strcmp(arg1, "off") == 0)
+            {
+                g_keep_open = 0;
+                ASPI_SetKeepOpen(0);
+                printf("Device handles opened per command\n");
+            }
+            else
+            {
+                printf("Usage: keepopen [on|off]\n");
             }
         }
         else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0)
@@ -570,6 +1272,8 @@ int main(int argc, char *argv[])
         }
     }
     
+    ASPI_CloseAll();
+    
     printf("\nExiting ASPI Test Shell\n");
     return 0;
 }
@@ -6,117 +6,134 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dmedia/audioutil.h>
-#include <dmedia/audiofile.h>
 #include "smdi.h"
 #include "smdi_sample.h"
+#include "smdi_sdmp.h"
+#include "smdi_endian.h"
+#include "smdi_pcm.h"
+#include "smdi_aiff.h"
+#include "smdi_aif.h"
 
-/* Load an AIF file into SMDI sample format */
-SMDI_Sample* SMDI_LoadAIFSample(const char* filename) {
-    AFfilehandle file;
-    SMDI_Sample* sample = NULL;
-    long sampfmt, sampwidth;
-    long nframes, channels, rate;
-    int file_format;
-    void* buffer;
-    long ids[32]; /* Max 32 misc chunks */
-    int nmisc, i;
-    long size;
-    char name_buffer[256];
-    const char* basename;
-    char* dot;
+/* Frames read into the sample per call */
+#define AIF_READ_FRAMES 65536
+
+/* Map 8 and 16 bit sound data that is already in the sample's layout,
+   turning it to host order in the private pages */
+static SMDI_Sample* map_aif_sample(SMDI_AIFFFile* file, const SMDI_PCMFormat* fmt) {
+    SMDI_Sample* sample;
+    void* data;
+    void* base;
+    DWORD map_size;
+    BOOL file_little;
     
-    /* Open the AIF file */
-    file = AFopenfile(filename, "r", AF_NULL_FILESETUP);
-    if (file == AF_NULL_FILEHANDLE) {
-        fprintf(stderr, "SMDI_LoadAIFSample: Failed to open file '%s'\n", filename);
+    if (file->info.pcmFormat.dwEncoding != fmt->dwEncoding || file->info.dwFrames == 0) {
         return NULL;
     }
     
-    /* Get file format - verify it's AIFF or AIFF-C */
-    file_format = AFgetfilefmt(file, NULL);
-    if (file_format != AF_FILE_AIFF && file_format != AF_FILE_AIFFC) {
-        fprintf(stderr, "SMDI_LoadAIFSample: File '%s' is not AIFF or AIFF-C format\n", filename);
-        AFclosefile(file);
+    data = SMDI_AIFFMapSound(file, &base, &map_size);
+    if (data == NULL) {
         return NULL;
     }
     
-    /* Get audio track information */
-    nframes = AFgetframecnt(file, AF_DEFAULT_TRACK);
-    channels = AFgetchannels(file, AF_DEFAULT_TRACK);
-    rate = (long)AFgetrate(file, AF_DEFAULT_TRACK);
-    AFgetsampfmt(file, AF_DEFAULT_TRACK, &sampfmt, &sampwidth);
+    sample = (SMDI_Sample*)malloc(sizeof(SMDI_Sample));
+    if (sample == NULL) {
+        SMDI_UnmapNativeFile(base, map_size);
+        return NULL;
+    }
     
-    /* Only support 8-bit or 16-bit samples for now */
-    if (sampfmt != AF_SAMPFMT_TWOSCOMP || (sampwidth != 8 && sampwidth != 16)) {
-        fprintf(stderr, "SMDI_LoadAIFSample: Unsupported sample format in '%s'\n", filename);
-        AFclosefile(file);
+    sample->sample_rate = file->info.dwRate;
+    sample->bits_per_sample = (BYTE)(SMDI_PCMSampleSize(fmt->dwEncoding) * 8);
+    sample->channels = (BYTE)file->info.dwChannels;
+    sample->loop_type = SAMPLE_LOOP_NONE;
+    sample->reserved = 0;
+    sample->sample_count = file->info.dwFrames;
+    sample->loop_start = 0;
+    sample->loop_end = 0;
+    sample->root_note = 60;  /* Middle C */
+    sample->fine_tune = 0;
+    sample->name[0] = '\0';
+    sample->sample_data = (short*)data;
+    sample->data_size = file->info.dwDataSize;
+    sample->map_base = base;
+    sample->map_size = map_size;
+    
+    /* AIFF data is big-endian unless the AIFF-C type says otherwise */
+    file_little = (file->info.pcmFormat.dwByteOrder == PCM_ORDER_LITTLE) ? TRUE : FALSE;
+    if (file_little != SMDI_HostIsLittleEndian()) {
+        SMDI_CopySampleData(sample->sample_data, sample->sample_data, sample->data_size,
+                            SMDI_SwapCopyMode(sample->bits_per_sample));
+    }
+    
+    return sample;
+}
+
+/* Load an AIF file into SMDI sample format */
+SMDI_Sample* SMDI_LoadAIFSample(const char* filename) {
+    return SMDI_LoadAIFSampleAs(filename, 0, PCM_DITHER_TPDF);
+}
+
+/* Open an AIF file and settle the word size it loads as (0 keeps 8 and 16
+   bit files as they are and reduces wider ones to 16 bit) */
+static SMDI_AIFFFile* open_aif(const char* filename, BYTE* bits_per_sample) {
+    SMDI_AIFFFile* file;
+    DWORD encoding;
+    
+    /* Open the AIF file and parse its chunks */
+    file = SMDI_AIFFOpen(filename);
+    if (file == NULL) {
+        fprintf(stderr, "SMDI_LoadAIFSample: '%s' is not a readable AIFF or AIFF-C file\n",
+                filename);
         return NULL;
     }
     
-    /* Create a new sample */
-    sample = SMDI_CreateSample(rate, sampwidth, channels, nframes);
-    if (sample == NULL) {
-        fprintf(stderr, "SMDI_LoadAIFSample: Failed to create sample\n");
-        AFclosefile(file);
+    if ((*bits_per_sample != 0 && *bits_per_sample != 8 && *bits_per_sample != 16) ||
+        file->info.dwFrames == 0) {
+        fprintf(stderr, "SMDI_LoadAIFSample: Unsupported sample format in '%s'\n", filename);
+        SMDI_AIFFClose(file);
         return NULL;
     }
     
+    if (*bits_per_sample == 0) {
+        encoding = file->info.pcmFormat.dwEncoding;
+        *bits_per_sample = (encoding == PCM_S8 || encoding == PCM_U8) ? 8 : 16;
+    }
+    return file;
+}
+
+/* Take the loop, tuning and name of a sample from the file's chunks */
+static void aif_properties(const SMDI_AIFFInfo* info, const char* filename,
+                           SMDI_Sample* sample) {
+    const SMDI_AIFFMarker* loop_start;
+    const SMDI_AIFFMarker* loop_end;
+    int fine_tune;
+    const char* basename;
+    char* dot;
+    
     /* Extract loop information if available */
-    if (AFgetinstids(file, NULL) > 0) {
-        long loop_id, loop_mode, loop_start_id, loop_end_id;
-        long loop_start, loop_end;
-        
+    if (info->bHasInst) {
         /* Get sustain loop information */
-        loop_id = AFgetinstparamlong(file, AF_DEFAULT_INST, AF_INST_SUSLOOPID);
-        if (loop_id > 0) {
-            loop_mode = AFgetloopmode(file, AF_DEFAULT_INST, loop_id);
-            loop_start_id = AFgetloopstart(file, AF_DEFAULT_INST, loop_id);
-            loop_end_id = AFgetloopend(file, AF_DEFAULT_INST, loop_id);
-            
-            if (loop_start_id > 0 && loop_end_id > 0) {
-                loop_start = AFgetmarkpos(file, AF_DEFAULT_TRACK, loop_start_id);
-                loop_end = AFgetmarkpos(file, AF_DEFAULT_TRACK, loop_end_id);
-                
-                /* Set loop parameters */
-                sample->loop_type = (loop_mode == 1) ? SAMPLE_LOOP_FORWARD : 
-                                   (loop_mode == 2) ? SAMPLE_LOOP_BIDIRECTIONAL : 
-                                   SAMPLE_LOOP_NONE;
-                sample->loop_start = loop_start;
-                sample->loop_end = loop_end;
-            }
+        loop_start = SMDI_AIFFFindMarker(info, info->sustainLoop.wBeginId);
+        loop_end = SMDI_AIFFFindMarker(info, info->sustainLoop.wEndId);
+        if (info->sustainLoop.wPlayMode != AIFF_LOOP_NONE &&
+            loop_start != NULL && loop_end != NULL) {
+            sample->loop_type = (info->sustainLoop.wPlayMode == AIFF_LOOP_FORWARD) ?
+                                SAMPLE_LOOP_FORWARD : SAMPLE_LOOP_BIDIRECTIONAL;
+            sample->loop_start = loop_start->dwPosition;
+            sample->loop_end = loop_end->dwPosition;
         }
         
-        /* Get root note information */
-        sample->root_note = AFgetinstparamlong(file, AF_DEFAULT_INST, AF_INST_MIDI_BASENOTE);
-        
-        /* Get detune information */
-        sample->fine_tune = AFgetinstparamlong(file, AF_DEFAULT_INST, AF_INST_NUMCENTS_DETUNE);
-        
-        /* Ensure fine tune is in range -50 to +50 cents */
-        if (sample->fine_tune < -50) sample->fine_tune = -50;
-        if (sample->fine_tune > 50) sample->fine_tune = 50;
+        /* Root note and detune, kept to -50 to +50 cents */
+        sample->root_note = info->baseNote;
+        fine_tune = info->detune;
+        if (fine_tune < -50) fine_tune = -50;
+        if (fine_tune > 50) fine_tune = 50;
+        sample->fine_tune = (WORD)fine_tune;
     }
     
     /* Get sample name if available */
-    nmisc = AFgetmiscids(file, NULL);
-    if (nmisc > 0) {
-        if (nmisc > 32) nmisc = 32; /* Limit to our array size */
-        AFgetmiscids(file, ids);
-        
-        /* Look for a name chunk */
-        for (i = 0; i < nmisc; i++) {
-            if (AFgetmisctype(file, ids[i]) == AF_MISC_AIFF_NAME) {
-                size = AFgetmiscsize(file, ids[i]);
-                if (size > 0 && size < 256) {
-                    AFreadmisc(file, ids[i], name_buffer, size);
-                    name_buffer[size] = '\0';
-                    strncpy(sample->name, name_buffer, 255);
-                    sample->name[255] = '\0';
-                }
-                break;
-            }
-        }
+    if (info->szName[0] != '\0') {
+        strncpy(sample->name, info->szName, 255);
+        sample->name[255] = '\0';
     }
     
     /* If no name was found, use filename as fallback */
@@ -136,138 +153,393 @@ SMDI_Sample* SMDI_LoadAIFSample(const char* filename) {
             *dot = '\0';
         }
     }
+}
+
+/* Load an AIF file as 8 or 16 bit samples (0 keeps 8 and 16 bit files as
+   they are and reduces wider ones to 16 bit) with the given dither */
+SMDI_Sample* SMDI_LoadAIFSampleAs(const char* filename, BYTE bits_per_sample,
+                                  DWORD dither_mode) {
+    SMDI_AIFFFile* file;
+    SMDI_AIFFInfo* info;
+    SMDI_Sample* sample;
+    SMDI_PCMFormat sample_pcm;
+    SMDI_PCMDither dither;
+    DWORD frame_size, done, count;
     
-    /* Allocate buffer for reading frames */
-    buffer = malloc(nframes * channels * (sampwidth / 8));
-    if (buffer == NULL) {
-        fprintf(stderr, "SMDI_LoadAIFSample: Failed to allocate buffer\n");
-        SMDI_FreeSample(sample);
-        AFclosefile(file);
+    file = open_aif(filename, &bits_per_sample);
+    if (file == NULL) {
         return NULL;
     }
+    info = &file->info;
     
-    /* Read all frames at once */
-    if (AFreadframes(file, AF_DEFAULT_TRACK, buffer, nframes) != nframes) {
-        fprintf(stderr, "SMDI_LoadAIFSample: Failed to read frames\n");
-        free(buffer);
-        SMDI_FreeSample(sample);
-        AFclosefile(file);
-        return NULL;
+    SMDI_PCMSetFormat(&sample_pcm, (bits_per_sample == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_HOST, info->dwChannels, FALSE);
+    
+    /* Sound data in the sample's layout is used where it lies in the file */
+    sample = map_aif_sample(file, &sample_pcm);
+    if (sample == NULL) {
+        /* Every frame is read over the data, so it is not cleared first */
+        sample = SMDI_AllocSample(info->dwRate, bits_per_sample, (BYTE)info->dwChannels,
+                                  info->dwFrames);
+        if (sample == NULL) {
+            fprintf(stderr, "SMDI_LoadAIFSample: Failed to create sample\n");
+            SMDI_AIFFClose(file);
+            return NULL;
+        }
+        
+        /* Frames are read straight into the sample in bounded blocks and
+           converted there when the layouts differ; the dither state runs
+           on across blocks */
+        SMDI_PCMInitDither(&dither, dither_mode);
+        frame_size = SMDI_PCMFrameSize(&sample_pcm);
+        for (done = 0; done < info->dwFrames; done += count) {
+            count = info->dwFrames - done;
+            if (count > AIF_READ_FRAMES) {
+                count = AIF_READ_FRAMES;
+            }
+            if (SMDI_AIFFReadFrames(file, &sample_pcm,
+                                    (char*)sample->sample_data + done * frame_size,
+                                    count, &dither) != count) {
+                fprintf(stderr, "SMDI_LoadAIFSample: Failed to read frames\n");
+                SMDI_FreeSample(sample);
+                SMDI_AIFFClose(file);
+                return NULL;
+            }
+        }
     }
     
-    /* Copy audio data to sample */
-    memcpy(sample->sample_data, buffer, nframes * channels * (sampwidth / 8));
+    aif_properties(info, filename, sample);
     
-    /* Clean up */
-    free(buffer);
-    AFclosefile(file);
+    /* A mapping outlives the file handle */
+    SMDI_AIFFClose(file);
     
     return sample;
 }
 
-/* Save SMDI sample as AIF file */
-BOOL SMDI_SaveAIFSample(SMDI_Sample* sample, const char* filename, int use_aifc) {
-    AFfilehandle file;
-    AFfilesetup setup;
-    int error = 0;
-    long marker_ids[2];
-    long misc_ids[1];
-    long inst_ids[1];
-    long loop_ids[1];
+/* State of an AIF upload source */
+typedef struct {
+    SMDI_AIFFFile* file;
+    SMDI_PCMFormat format;                  /* 8 or 16 bit in SMDI order */
+    SMDI_PCMDither dither;
+    BYTE carry[PCM_MAX_CHANNELS * 2];       /* Frame split between two packets */
+    DWORD carry_pos;
+    DWORD carry_len;
+} aif_source_t;
+
+/* Decode the next bytes of an AIF source into a packet */
+static DWORD aif_source_read(SMDI_SampleSource* source, void* buffer, DWORD bytes) {
+    aif_source_t* state;
+    BYTE* out;
+    DWORD frame_size, frames, got, done;
     
-    /* Verify parameters */
-    if (sample == NULL || filename == NULL) {
+    state = (aif_source_t*)source->lpUserData;
+    out = (BYTE*)buffer;
+    frame_size = SMDI_PCMFrameSize(&state->format);
+    done = 0;
+    
+    /* Finish the frame the last packet split */
+    while (done < bytes && state->carry_pos < state->carry_len) {
+        out[done++] = state->carry[state->carry_pos++];
+    }
+    
+    /* Whole frames are decoded straight into the packet */
+    frames = (bytes - done) / frame_size;
+    if (frames > 0) {
+        got = SMDI_AIFFReadFrames(state->file, &state->format, out + done, frames,
+                                  &state->dither);
+        done += got * frame_size;
+        if (got < frames) {
+            return done;
+        }
+    }
+    
+    /* A frame running on into the next packet goes through the carry */
+    if (done < bytes) {
+        if (SMDI_AIFFReadFrames(state->file, &state->format, state->carry, 1,
+                                &state->dither) != 1) {
+            return done;
+        }
+        state->carry_pos = 0;
+        state->carry_len = frame_size;
+        while (done < bytes) {
+            out[done++] = state->carry[state->carry_pos++];
+        }
+    }
+    
+    return done;
+}
+
+/* Release an AIF source */
+static void aif_source_close(SMDI_SampleSource* source) {
+    aif_source_t* state;
+    
+    state = (aif_source_t*)source->lpUserData;
+    if (state != NULL) {
+        SMDI_AIFFClose(state->file);
+        free(state);
+        source->lpUserData = NULL;
+    }
+}
+
+/* Open an AIF file as an upload source decoding frames as packets go out */
+BOOL SMDI_OpenAIFSource(SMDI_SampleSource* source, const char* filename,
+                        BYTE bits_per_sample, DWORD dither_mode) {
+    SMDI_AIFFFile* file;
+    aif_source_t* state;
+    SMDI_Sample props;
+    
+    if (source == NULL || filename == NULL) {
         return FALSE;
     }
     
-    /* Create a new file setup structure */
-    setup = AFnewfilesetup();
-    if (setup == AF_NULL_FILESETUP) {
-        fprintf(stderr, "SMDI_SaveAIFSample: Failed to create file setup\n");
+    file = open_aif(filename, &bits_per_sample);
+    if (file == NULL) {
         return FALSE;
     }
     
-    /* Set file format */
-    AFinitfilefmt(setup, use_aifc ? AF_FILE_AIFFC : AF_FILE_AIFF);
+    state = (aif_source_t*)malloc(sizeof(aif_source_t));
+    if (state == NULL) {
+        SMDI_AIFFClose(file);
+        return FALSE;
+    }
+    memset(state, 0, sizeof(aif_source_t));
+    state->file = file;
+    
+    /* Frames are produced in SMDI order, so packets go out as they are */
+    SMDI_PCMSetFormat(&state->format, (bits_per_sample == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_BIG, file->info.dwChannels, FALSE);
+    SMDI_PCMInitDither(&state->dither, dither_mode);
+    
+    /* The header is built as for a loaded sample */
+    memset(&props, 0, sizeof(SMDI_Sample));
+    props.sample_rate = file->info.dwRate;
+    props.bits_per_sample = bits_per_sample;
+    props.channels = (BYTE)file->info.dwChannels;
+    props.sample_count = file->info.dwFrames;
+    props.root_note = 60;   /* Middle C */
+    aif_properties(&file->info, filename, &props);
+    
+    memset(source, 0, sizeof(SMDI_SampleSource));
+    source->dwStructSize = sizeof(SMDI_SampleSource);
+    SMDI_SampleToHeader(&props, &source->header);
+    source->dwSampleRate = props.sample_rate;
+    source->dwCopyMode = CM_NORMAL;
+    source->lpRead = aif_source_read;
+    source->lpClose = aif_source_close;
+    source->lpUserData = state;
+    
+    return TRUE;
+}
+
+/* Describe a sample's format, loop, tuning and name for an AIF header */
+static void aif_info(SMDI_AIFFInfo* info, const SMDI_Sample* sample, int use_aifc) {
+    /* Audio track parameters */
+    SMDI_AIFFInitInfo(info, use_aifc ? TRUE : FALSE);
+    info->dwChannels = sample->channels;
+    info->dwBits = sample->bits_per_sample;
+    info->dwRate = sample->sample_rate;
+    info->dwFrames = sample->sample_count;
     
-    /* Initialize audio track parameters */
-    AFinitchannels(setup, AF_DEFAULT_TRACK, sample->channels);
-    AFinitsampfmt(setup, AF_DEFAULT_TRACK, AF_SAMPFMT_TWOSCOMP, sample->bits_per_sample);
-    AFinitrate(setup, AF_DEFAULT_TRACK, sample->sample_rate);
-    AFinitcompression(setup, AF_DEFAULT_TRACK, AF_COMPRESSION_NONE);
+    /* Root note and detune go in the instrument chunk */
+    info->bHasInst = TRUE;
+    info->baseNote = (BYTE)sample->root_note;
+    info->detune = (signed char)(short)sample->fine_tune;
     
-    /* Set up loops if present */
+    /* Set up loops if present, as the sustain loop between two markers */
     if (sample->loop_type != SAMPLE_LOOP_NONE && 
         sample->loop_start < sample->loop_end) {
+        info->dwNumMarkers = 2;
+        info->markers[0].wId = 1;
+        info->markers[0].dwPosition = sample->loop_start;
+        strcpy(info->markers[0].szName, "Loop Start");
+        info->markers[1].wId = 2;
+        info->markers[1].dwPosition = sample->loop_end;
+        strcpy(info->markers[1].szName, "Loop End");
         
-        /* Set up markers for loop points */
-        marker_ids[0] = 1;  /* Loop start = 1 */
-        marker_ids[1] = 2;  /* Loop end = 2 */
-        AFinitmarkids(setup, AF_DEFAULT_TRACK, marker_ids, 2);
-        AFinitmarkname(setup, AF_DEFAULT_TRACK, 1, "Loop Start");
-        AFinitmarkname(setup, AF_DEFAULT_TRACK, 2, "Loop End");
-        
-        /* Set up instrument chunk */
-        inst_ids[0] = 1;
-        AFinitinstids(setup, inst_ids, 1);
-        
-        /* Set up loop IDs */
-        loop_ids[0] = 1;
-        AFinitloopids(setup, AF_DEFAULT_INST, loop_ids, 1);
+        info->sustainLoop.wPlayMode = (sample->loop_type == SAMPLE_LOOP_BIDIRECTIONAL) ?
+                                      AIFF_LOOP_PINGPONG : AIFF_LOOP_FORWARD;
+        info->sustainLoop.wBeginId = 1;
+        info->sustainLoop.wEndId = 2;
     }
     
-    /* Set up name chunk if sample has a name */
-    if (sample->name[0] != '\0') {
-        misc_ids[0] = 1;
-        AFinitmiscids(setup, misc_ids, 1);
-        AFinitmisctype(setup, 1, AF_MISC_AIFF_NAME);
-        AFinitmiscsize(setup, 1, strlen(sample->name));
+    /* Name chunk if sample has a name */
+    strncpy(info->szName, sample->name, 255);
+    info->szName[255] = '\0';
+}
+
+/* Save SMDI sample as AIF file */
+BOOL SMDI_SaveAIFSample(SMDI_Sample* sample, const char* filename, int use_aifc) {
+    SMDI_AIFFFile* file;
+    SMDI_AIFFInfo info;
+    SMDI_PCMFormat sample_pcm;
+    BOOL ok;
+    
+    /* Verify parameters */
+    if (sample == NULL || filename == NULL) {
+        return FALSE;
     }
     
-    /* Open output file */
-    file = AFopenfile(filename, "w", setup);
-    if (file == AF_NULL_FILEHANDLE) {
+    aif_info(&info, sample, use_aifc);
+    
+    /* Create the file and write its header */
+    file = SMDI_AIFFCreate(filename, &info);
+    if (file == NULL) {
         fprintf(stderr, "SMDI_SaveAIFSample: Failed to open file '%s' for writing\n", filename);
-        AFfreefilesetup(setup);
         return FALSE;
     }
     
-    /* Set loop points if present */
-    if (sample->loop_type != SAMPLE_LOOP_NONE && 
-        sample->loop_start < sample->loop_end) {
-        
-        /* Set marker positions */
-        AFsetmarkpos(file, AF_DEFAULT_TRACK, 1, sample->loop_start);
-        AFsetmarkpos(file, AF_DEFAULT_TRACK, 2, sample->loop_end);
-        
-        /* Set instrument parameters */
-        AFsetinstparamlong(file, AF_DEFAULT_INST, AF_INST_MIDI_BASENOTE, sample->root_note);
-        AFsetinstparamlong(file, AF_DEFAULT_INST, AF_INST_NUMCENTS_DETUNE, sample->fine_tune);
-        
-        /* Set loop parameters */
-        AFsetinstparamlong(file, AF_DEFAULT_INST, AF_INST_SUSLOOPID, 1);
-        AFsetloopmode(file, AF_DEFAULT_INST, 1, 
-                    (sample->loop_type == SAMPLE_LOOP_FORWARD) ? 1 : 
-                    (sample->loop_type == SAMPLE_LOOP_BIDIRECTIONAL) ? 2 : 0);
-        AFsetloopstart(file, AF_DEFAULT_INST, 1, 1);  /* Marker ID 1 */
-        AFsetloopend(file, AF_DEFAULT_INST, 1, 2);    /* Marker ID 2 */
+    /* Write audio frames */
+    SMDI_PCMSetFormat(&sample_pcm, (sample->bits_per_sample == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_HOST, sample->channels, FALSE);
+    ok = SMDI_AIFFWriteFrames(file, &sample_pcm, sample->sample_data, sample->sample_count);
+    if (!ok) {
+        fprintf(stderr, "SMDI_SaveAIFSample: Failed to write frames\n");
     }
     
-    /* Write name chunk if sample has a name */
-    if (sample->name[0] != '\0') {
-        AFwritemisc(file, 1, sample->name, strlen(sample->name));
+    /* Clean up, finishing the chunk sizes */
+    if (!SMDI_AIFFClose(file)) {
+        ok = FALSE;
     }
     
-    /* Write audio frames */
-    if (AFwriteframes(file, AF_DEFAULT_TRACK, sample->sample_data, sample->sample_count) 
-        != sample->sample_count) {
-        fprintf(stderr, "SMDI_SaveAIFSample: Failed to write frames\n");
-        error = 1;
+    return ok;
+}
+
+/* State of an AIF download sink */
+typedef struct {
+    SMDI_AIFFFile* file;
+    SMDI_PCMFormat format;                  /* Received data, in SMDI order */
+    int use_aifc;
+    char filename[MAX_PATH];
+    BYTE carry[PCM_MAX_CHANNELS * 2];       /* Frame split between two packets */
+    DWORD carry_len;
+} aif_sink_t;
+
+/* Create the AIF file once the sample header is known */
+static BOOL aif_sink_begin(SMDI_SampleSink* sink) {
+    aif_sink_t* state;
+    SMDI_SampleHeader* header;
+    SMDI_Sample props;
+    SMDI_AIFFInfo info;
+    
+    state = (aif_sink_t*)sink->lpUserData;
+    header = &sink->header;
+    if ((header->BitsPerWord != 8 && header->BitsPerWord != 16) ||
+        header->NumberOfChannels < 1 || header->NumberOfChannels > PCM_MAX_CHANNELS ||
+        header->dwPeriod == 0) {
+        fprintf(stderr, "SMDI_SaveAIFSample: Unsupported sample format\n");
+        return FALSE;
+    }
+    
+    /* The header describes the file as it would a loaded sample */
+    memset(&props, 0, sizeof(SMDI_Sample));
+    props.sample_rate = 1000000000 / header->dwPeriod;
+    props.bits_per_sample = header->BitsPerWord;
+    props.channels = header->NumberOfChannels;
+    props.loop_type = header->LoopControl;
+    props.sample_count = header->dwLength;
+    props.loop_start = header->dwLoopStart;
+    props.loop_end = header->dwLoopEnd;
+    props.root_note = header->wPitch;
+    props.fine_tune = header->wPitchFraction;
+    memcpy(props.name, header->cName, header->NameLength);
+    props.name[header->NameLength] = '\0';
+    aif_info(&info, &props, state->use_aifc);
+    
+    state->file = SMDI_AIFFCreate(state->filename, &info);
+    if (state->file == NULL) {
+        fprintf(stderr, "SMDI_SaveAIFSample: Failed to open file '%s' for writing\n",
+                state->filename);
+        return FALSE;
+    }
+    
+    /* SMDI order is what AIFF holds, so packets are written as they come */
+    SMDI_PCMSetFormat(&state->format, (header->BitsPerWord == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_BIG, header->NumberOfChannels, FALSE);
+    sink->dwCopyMode = CM_NORMAL;
+    return TRUE;
+}
+
+/* Append a packet to the AIF file */
+static BOOL aif_sink_write(SMDI_SampleSink* sink, void* data, DWORD bytes) {
+    aif_sink_t* state;
+    BYTE* in;
+    DWORD frame_size, frames;
+    
+    state = (aif_sink_t*)sink->lpUserData;
+    in = (BYTE*)data;
+    frame_size = SMDI_PCMFrameSize(&state->format);
+    
+    /* Complete the frame the last packet split */
+    while (state->carry_len > 0 && state->carry_len < frame_size && bytes > 0) {
+        state->carry[state->carry_len++] = *in++;
+        bytes--;
+    }
+    if (state->carry_len == frame_size) {
+        if (!SMDI_AIFFWriteFrames(state->file, &state->format, state->carry, 1)) {
+            return FALSE;
+        }
+        state->carry_len = 0;
+    }
+    
+    /* Whole frames go straight to the file */
+    frames = bytes / frame_size;
+    if (frames > 0 && !SMDI_AIFFWriteFrames(state->file, &state->format, in, frames)) {
+        return FALSE;
+    }
+    
+    /* Keep the start of a frame running on into the next packet */
+    in += frames * frame_size;
+    bytes -= frames * frame_size;
+    while (bytes > 0) {
+        state->carry[state->carry_len++] = *in++;
+        bytes--;
+    }
+    
+    return TRUE;
+}
+
+/* Finish the AIF file, or remove it if the download failed */
+static BOOL aif_sink_end(SMDI_SampleSink* sink, BOOL complete) {
+    aif_sink_t* state;
+    BOOL ok;
+    
+    state = (aif_sink_t*)sink->lpUserData;
+    ok = FALSE;
+    if (state->file != NULL) {
+        ok = SMDI_AIFFClose(state->file) && complete;
+        if (!ok) {
+            remove(state->filename);
+        }
+    }
+    
+    free(state);
+    sink->lpUserData = NULL;
+    return ok;
+}
+
+/* Set up a download sink writing an AIF file */
+BOOL SMDI_OpenAIFSink(SMDI_SampleSink* sink, const char* filename, int use_aifc) {
+    aif_sink_t* state;
+    
+    if (sink == NULL || filename == NULL || strlen(filename) >= MAX_PATH) {
+        return FALSE;
+    }
+    
+    state = (aif_sink_t*)malloc(sizeof(aif_sink_t));
+    if (state == NULL) {
+        return FALSE;
     }
+    memset(state, 0, sizeof(aif_sink_t));
+    state->use_aifc = use_aifc;
+    strcpy(state->filename, filename);
     
-    /* Clean up */
-    AFclosefile(file);
-    AFfreefilesetup(setup);
+    memset(sink, 0, sizeof(SMDI_SampleSink));
+    sink->dwStructSize = sizeof(SMDI_SampleSink);
+    sink->dwCopyMode = CM_NORMAL;
+    sink->lpBegin = aif_sink_begin;
+    sink->lpWrite = aif_sink_write;
+    sink->lpEnd = aif_sink_end;
+    sink->lpUserData = state;
     
-    return (error == 0);
+    return TRUE;
 }
@@ -0,0 +1,728 @@
+/*
+ * SMDI AIFF/AIFF-C file reader and writer implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * Chunks are parsed and written byte by byte, so files are the same on
+ * every host. Sound data is read and written a block at a time through
+ * the PCM conversion layer; data already in the caller's layout moves
+ * straight between the file and the caller's buffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "smdi.h"
+#include "smdi_endian.h"
+#include "smdi_pcm.h"
+#include "smdi_aiff.h"
+
+/* Frames converted per block */
+#define AIFF_IO_FRAMES      4096
+
+/* Room for every chunk written ahead of the sound data */
+#define AIFF_HEADER_MAX     2048
+
+/* AIFF-C version timestamp for FVER */
+#define AIFC_VERSION_1      0xA2805140UL
+
+/* Store big-endian values */
+static void put16(BYTE* p, WORD v) {
+    p[0] = (BYTE)((v >> 8) & 0xFF);
+    p[1] = (BYTE)(v & 0xFF);
+}
+
+static void put32(BYTE* p, DWORD v) {
+    p[0] = (BYTE)((v >> 24) & 0xFF);
+    p[1] = (BYTE)((v >> 16) & 0xFF);
+    p[2] = (BYTE)((v >> 8) & 0xFF);
+    p[3] = (BYTE)(v & 0xFF);
+}
+
+/* Fetch big-endian values */
+static WORD get16(const BYTE* p) {
+    return (WORD)((p[0] << 8) | p[1]);
+}
+
+static DWORD get32(const BYTE* p) {
+    return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) |
+           ((DWORD)p[2] << 8) | (DWORD)p[3];
+}
+
+/* Decode an 80-bit IEEE extended sample rate to whole Hz */
+static DWORD get_extended(const BYTE* p) {
+    int exponent;
+    DWORD hi, lo;
+    double value;
+
+    exponent = ((p[0] & 0x7F) << 8) | p[1];
+    hi = get32(p + 2);
+    lo = get32(p + 6);
+    if ((p[0] & 0x80) || (hi == 0 && lo == 0)) {
+        return 0;
+    }
+
+    value = ldexp((double)hi, exponent - 16383 - 31) +
+            ldexp((double)lo, exponent - 16383 - 63);
+    if (value >= 4294967295.0) {
+        return 0;
+    }
+    return (DWORD)(value + 0.5);
+}
+
+/* Encode whole Hz as an 80-bit IEEE extended */
+static void put_extended(BYTE* p, DWORD rate) {
+    int exponent;
+
+    memset(p, 0, 10);
+    if (rate == 0) {
+        return;
+    }
+
+    exponent = 16383 + 31;
+    while ((rate & 0x80000000UL) == 0) {
+        rate <<= 1;
+        exponent--;
+    }
+    put16(p, (WORD)exponent);
+    put32(p + 2, rate);
+}
+
+/* Store a Pascal string padded to an even length; returns the bytes used */
+static DWORD put_pstring(BYTE* p, const char* s, DWORD max) {
+    DWORD len;
+
+    len = strlen(s);
+    if (len > max) {
+        len = max;
+    }
+    p[0] = (BYTE)len;
+    memcpy(p + 1, s, len);
+    if (((len + 1) & 1) != 0) {
+        p[len + 1] = 0;
+        return len + 2;
+    }
+    return len + 1;
+}
+
+/* Byte order a format resolves to on this host */
+static BOOL is_little(DWORD dwByteOrder) {
+    if (dwByteOrder == PCM_ORDER_HOST) {
+        return SMDI_HostIsLittleEndian();
+    }
+    return (dwByteOrder == PCM_ORDER_LITTLE) ? TRUE : FALSE;
+}
+
+/* True if frames in fmt can move to or from the file without conversion;
+   *swap is set when the words need their bytes reversed */
+static BOOL same_layout(const SMDI_AIFFFile* file, const SMDI_PCMFormat* fmt, BOOL* swap) {
+    const SMDI_PCMFormat* ffmt = &file->info.pcmFormat;
+
+    if (fmt->dwEncoding != ffmt->dwEncoding || fmt->dwChannels != ffmt->dwChannels) {
+        return FALSE;
+    }
+    *swap = (is_little(fmt->dwByteOrder) != is_little(ffmt->dwByteOrder)) ? TRUE : FALSE;
+    return TRUE;
+}
+
+/* Layout of the sound data for a sample size and compression type */
+static BOOL choose_format(SMDI_AIFFInfo* info) {
+    DWORD bytes, encoding, order;
+
+    if (info->dwChannels < 1 || info->dwChannels > PCM_MAX_CHANNELS ||
+        info->dwBits < 1 || info->dwBits > 32) {
+        return FALSE;
+    }
+
+    bytes = (info->dwBits + 7) / 8;
+    order = PCM_ORDER_BIG;
+    switch (info->dwCompression) {
+        case AIFF_ID('N', 'O', 'N', 'E'):
+        case AIFF_ID('t', 'w', 'o', 's'):
+            break;
+        case AIFF_ID('s', 'o', 'w', 't'):
+            order = PCM_ORDER_LITTLE;
+            break;
+        case AIFF_ID('r', 'a', 'w', ' '):
+            if (bytes != 1) {
+                return FALSE;
+            }
+            SMDI_PCMSetFormat(&info->pcmFormat, PCM_U8, order, info->dwChannels, FALSE);
+            return TRUE;
+        case AIFF_ID('i', 'n', '2', '4'):
+            bytes = 3;
+            break;
+        case AIFF_ID('i', 'n', '3', '2'):
+            bytes = 4;
+            break;
+        case AIFF_ID('4', '2', 'n', 'i'):
+            bytes = 3;
+            order = PCM_ORDER_LITTLE;
+            break;
+        case AIFF_ID('2', '3', 'n', 'i'):
+            bytes = 4;
+            order = PCM_ORDER_LITTLE;
+            break;
+        case AIFF_ID('f', 'l', '3', '2'):
+        case AIFF_ID('F', 'L', '3', '2'):
+            info->dwBits = 32;
+            SMDI_PCMSetFormat(&info->pcmFormat, PCM_F32, order, info->dwChannels, FALSE);
+            return TRUE;
+        default:
+            return FALSE;
+    }
+
+    /* Narrower samples sit left-justified in whole bytes */
+    switch (bytes) {
+        case 1:  encoding = PCM_S8;  break;
+        case 2:  encoding = PCM_S16; break;
+        case 3:  encoding = PCM_S24; break;
+        default: encoding = PCM_S32; break;
+    }
+    SMDI_PCMSetFormat(&info->pcmFormat, encoding, order, info->dwChannels, FALSE);
+    return TRUE;
+}
+
+/* Parse the markers of a MARK chunk */
+static void parse_markers(SMDI_AIFFInfo* info, const BYTE* p, DWORD size) {
+    DWORD count, i, pos, len;
+    SMDI_AIFFMarker* marker;
+
+    if (size < 2) {
+        return;
+    }
+    count = get16(p);
+    pos = 2;
+
+    for (i = 0; i < count && info->dwNumMarkers < AIFF_MAX_MARKERS; i++) {
+        if (pos + 7 > size) {
+            break;
+        }
+        marker = &info->markers[info->dwNumMarkers];
+        marker->wId = get16(p + pos);
+        marker->dwPosition = get32(p + pos + 2);
+        len = p[pos + 6];
+        if (pos + 7 + len > size) {
+            break;
+        }
+        if (len >= sizeof(marker->szName)) {
+            memcpy(marker->szName, p + pos + 7, sizeof(marker->szName) - 1);
+            marker->szName[sizeof(marker->szName) - 1] = '\0';
+        } else {
+            memcpy(marker->szName, p + pos + 7, len);
+            marker->szName[len] = '\0';
+        }
+        info->dwNumMarkers++;
+
+        /* Count byte and text are padded to an even length */
+        pos += 6 + ((len + 2) & ~1UL);
+    }
+}
+
+/* Clear an info block for a new file */
+void SMDI_AIFFInitInfo(SMDI_AIFFInfo* info, BOOL bAIFC) {
+    if (info == NULL) {
+        return;
+    }
+    memset(info, 0, sizeof(SMDI_AIFFInfo));
+    info->bAIFC = bAIFC;
+    info->dwCompression = AIFF_ID('N', 'O', 'N', 'E');
+    info->baseNote = 60;    /* Middle C */
+}
+
+/* Open a file and parse its chunks */
+SMDI_AIFFFile* SMDI_AIFFOpen(const char* filename) {
+    SMDI_AIFFFile* file;
+    SMDI_AIFFInfo* info;
+    FILE* fp;
+    BYTE head[12];
+    BYTE buf[64];
+    BYTE* mark;
+    DWORD form_end, file_size, pos, id, size, n, offset;
+    BOOL have_comm, have_ssnd;
+
+    if (filename == NULL) {
+        return NULL;
+    }
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0 || ftell(fp) < 12) {
+        fclose(fp);
+        return NULL;
+    }
+    file_size = (DWORD)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    /* FORM header */
+    if (fread(head, 1, 12, fp) != 12 || memcmp(head, "FORM", 4) != 0 ||
+        (memcmp(head + 8, "AIFF", 4) != 0 && memcmp(head + 8, "AIFC", 4) != 0)) {
+        fclose(fp);
+        return NULL;
+    }
+
+    file = (SMDI_AIFFFile*)malloc(sizeof(SMDI_AIFFFile));
+    if (file == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    memset(file, 0, sizeof(SMDI_AIFFFile));
+    file->fp = fp;
+    info = &file->info;
+    SMDI_AIFFInitInfo(info, (memcmp(head + 8, "AIFC", 4) == 0) ? TRUE : FALSE);
+
+    /* Writers that stream sometimes leave the FORM size short or unset */
+    form_end = get32(head + 4) + 8;
+    if (form_end < 12 || form_end > file_size) {
+        form_end = file_size;
+    }
+
+    have_comm = FALSE;
+    have_ssnd = FALSE;
+    pos = 12;
+    while (pos + 8 <= form_end) {
+        fseek(fp, (long)pos, SEEK_SET);
+        if (fread(buf, 1, 8, fp) != 8) {
+            break;
+        }
+        id = get32(buf);
+        size = get32(buf + 4);
+        pos += 8;
+        if (size > form_end - pos) {
+            size = form_end - pos;
+        }
+
+        if (id == AIFF_ID('C', 'O', 'M', 'M') && size >= 18) {
+            n = (size < sizeof(buf)) ? size : sizeof(buf);
+            if (fread(buf, 1, n, fp) != n) {
+                break;
+            }
+            info->dwChannels = get16(buf);
+            info->dwFrames = get32(buf + 2);
+            info->dwBits = get16(buf + 6);
+            info->dwRate = get_extended(buf + 8);
+            if (info->bAIFC && n >= 22) {
+                info->dwCompression = get32(buf + 18);
+            }
+            have_comm = TRUE;
+        } else if (id == AIFF_ID('S', 'S', 'N', 'D') && size >= 8) {
+            if (fread(buf, 1, 8, fp) != 8) {
+                break;
+            }
+            offset = get32(buf);
+            if (offset > size - 8) {
+                offset = size - 8;
+            }
+            info->dwDataOffset = pos + 8 + offset;
+            info->dwDataSize = size - 8 - offset;
+            have_ssnd = TRUE;
+        } else if (id == AIFF_ID('M', 'A', 'R', 'K') && size >= 2) {
+            mark = (BYTE*)malloc(size);
+            if (mark != NULL) {
+                if (fread(mark, 1, size, fp) == size) {
+                    parse_markers(info, mark, size);
+                }
+                free(mark);
+            }
+        } else if (id == AIFF_ID('I', 'N', 'S', 'T') && size >= 20) {
+            if (fread(buf, 1, 20, fp) != 20) {
+                break;
+            }
+            info->bHasInst = TRUE;
+            info->baseNote = buf[0];
+            info->detune = (signed char)buf[1];
+            info->sustainLoop.wPlayMode = get16(buf + 8);
+            info->sustainLoop.wBeginId = get16(buf + 10);
+            info->sustainLoop.wEndId = get16(buf + 12);
+            info->releaseLoop.wPlayMode = get16(buf + 14);
+            info->releaseLoop.wBeginId = get16(buf + 16);
+            info->releaseLoop.wEndId = get16(buf + 18);
+        } else if (id == AIFF_ID('N', 'A', 'M', 'E')) {
+            n = (size < sizeof(info->szName)) ? size : sizeof(info->szName) - 1;
+            if (fread(info->szName, 1, n, fp) != n) {
+                break;
+            }
+            info->szName[n] = '\0';
+        }
+
+        /* Chunks are padded to an even length */
+        pos += size + (size & 1);
+    }
+
+    if (!have_comm || !have_ssnd || info->dwRate == 0 || !choose_format(info)) {
+        fclose(fp);
+        free(file);
+        return NULL;
+    }
+
+    /* Trust the sound data over the frame count when they disagree */
+    n = SMDI_PCMFrameSize(&info->pcmFormat);
+    if (info->dwFrames > info->dwDataSize / n) {
+        info->dwFrames = info->dwDataSize / n;
+    }
+    info->dwDataSize = info->dwFrames * n;
+
+    if (fseek(fp, (long)info->dwDataOffset, SEEK_SET) != 0) {
+        fclose(fp);
+        free(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+/* Get the conversion buffer, allocating it on first use */
+static void* io_buffer(SMDI_AIFFFile* file) {
+    if (file->lpBuffer == NULL) {
+        file->lpBuffer = malloc(AIFF_IO_FRAMES * SMDI_PCMFrameSize(&file->info.pcmFormat));
+    }
+    return file->lpBuffer;
+}
+
+/* Read frames converted to an interleaved format */
+DWORD SMDI_AIFFReadFrames(SMDI_AIFFFile* file, const SMDI_PCMFormat* fmt, void* buffer,
+                          DWORD dwFrames, SMDI_PCMDither* dither) {
+    DWORD file_frame, out_frame, done, count, got;
+    BOOL swap;
+    void* raw;
+
+    if (file == NULL || file->bWriting || fmt == NULL || buffer == NULL || fmt->bPlanar) {
+        return 0;
+    }
+
+    if (dwFrames > file->info.dwFrames - file->dwFrame) {
+        dwFrames = file->info.dwFrames - file->dwFrame;
+    }
+    if (dwFrames == 0) {
+        return 0;
+    }
+
+    file_frame = SMDI_PCMFrameSize(&file->info.pcmFormat);
+    out_frame = SMDI_PCMFrameSize(fmt);
+
+    /* Matching data is read in place and at most byte swapped */
+    if (same_layout(file, fmt, &swap)) {
+        got = fread(buffer, file_frame, dwFrames, file->fp);
+        if (swap) {
+            SMDI_CopySampleData(buffer, buffer, got * file_frame,
+                                SMDI_SwapCopyMode(SMDI_PCMSampleSize(fmt->dwEncoding) * 8));
+        }
+        file->dwFrame += got;
+        return got;
+    }
+
+    raw = io_buffer(file);
+    if (raw == NULL) {
+        return 0;
+    }
+
+    for (done = 0; done < dwFrames; done += got) {
+        count = dwFrames - done;
+        if (count > AIFF_IO_FRAMES) {
+            count = AIFF_IO_FRAMES;
+        }
+        got = fread(raw, file_frame, count, file->fp);
+        if (got == 0) {
+            break;
+        }
+        SMDI_PCMConvertDither(&file->info.pcmFormat, raw, fmt,
+                              (char*)buffer + done * out_frame, got, dither);
+        if (got < count) {
+            done += got;
+            break;
+        }
+    }
+
+    file->dwFrame += done;
+    return done;
+}
+
+/* Map the file and return the first frame of the sound data */
+void* SMDI_AIFFMapSound(SMDI_AIFFFile* file, void** lpMapBase, DWORD* lpMapSize) {
+    DWORD length;
+    void* base;
+
+    if (file == NULL || file->bWriting || lpMapBase == NULL || lpMapSize == NULL ||
+        file->info.dwDataSize == 0) {
+        return NULL;
+    }
+
+    /* Words must land on their natural alignment in the page-aligned mapping */
+    if (file->info.dwDataOffset % SMDI_PCMSampleSize(file->info.pcmFormat.dwEncoding) != 0) {
+        return NULL;
+    }
+
+    length = file->info.dwDataOffset + file->info.dwDataSize;
+    base = mmap(NULL, (size_t)length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file->fp), 0);
+    if (base == (void*)MAP_FAILED) {
+        return NULL;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise((char*)base, (size_t)length, MADV_SEQUENTIAL);
+#endif
+
+    *lpMapBase = base;
+    *lpMapSize = length;
+    return (char*)base + file->info.dwDataOffset;
+}
+
+/* Find a marker by id */
+const SMDI_AIFFMarker* SMDI_AIFFFindMarker(const SMDI_AIFFInfo* info, WORD wId) {
+    DWORD i;
+
+    if (info == NULL || wId == 0) {
+        return NULL;
+    }
+    for (i = 0; i < info->dwNumMarkers; i++) {
+        if (info->markers[i].wId == wId) {
+            return &info->markers[i];
+        }
+    }
+    return NULL;
+}
+
+/* Store a loop in INST layout */
+static void put_loop(BYTE* p, const SMDI_AIFFLoop* loop) {
+    put16(p, loop->wPlayMode);
+    put16(p + 2, loop->wBeginId);
+    put16(p + 4, loop->wEndId);
+}
+
+/* Create a file and write its header */
+SMDI_AIFFFile* SMDI_AIFFCreate(const char* filename, const SMDI_AIFFInfo* info) {
+    SMDI_AIFFFile* file;
+    BYTE head[AIFF_HEADER_MAX];
+    BYTE* chunk;
+    DWORD pos, size, i, len;
+    const char* compression_name;
+
+    if (filename == NULL || info == NULL || info->dwRate == 0 ||
+        info->dwNumMarkers > AIFF_MAX_MARKERS) {
+        return NULL;
+    }
+
+    file = (SMDI_AIFFFile*)malloc(sizeof(SMDI_AIFFFile));
+    if (file == NULL) {
+        return NULL;
+    }
+    memset(file, 0, sizeof(SMDI_AIFFFile));
+    memcpy(&file->info, info, sizeof(SMDI_AIFFInfo));
+    file->bWriting = TRUE;
+
+    /* Plain AIFF only holds big-endian integers */
+    if (!info->bAIFC) {
+        file->info.dwCompression = AIFF_ID('N', 'O', 'N', 'E');
+    }
+    switch (file->info.dwCompression) {
+        case AIFF_ID('N', 'O', 'N', 'E'): compression_name = "not compressed"; break;
+        case AIFF_ID('s', 'o', 'w', 't'): compression_name = ""; break;
+        case AIFF_ID('f', 'l', '3', '2'): compression_name = "32-bit floating point"; break;
+        default:                          compression_name = NULL; break;
+    }
+    if (compression_name == NULL || !choose_format(&file->info)) {
+        free(file);
+        return NULL;
+    }
+
+    /* FORM header; the size is patched on close */
+    memcpy(head, "FORM", 4);
+    put32(head + 4, 0);
+    memcpy(head + 8, info->bAIFC ? "AIFC" : "AIFF", 4);
+    pos = 12;
+
+    if (info->bAIFC) {
+        memcpy(head + pos, "FVER", 4);
+        put32(head + pos + 4, 4);
+        put32(head + pos + 8, AIFC_VERSION_1);
+        pos += 12;
+    }
+
+    /* COMM */
+    chunk = head + pos;
+    memcpy(chunk, "COMM", 4);
+    put16(chunk + 8, (WORD)file->info.dwChannels);
+    put32(chunk + 10, file->info.dwFrames);
+    put16(chunk + 14, (WORD)file->info.dwBits);
+    put_extended(chunk + 16, file->info.dwRate);
+    size = 18;
+    if (info->bAIFC) {
+        put32(chunk + 26, file->info.dwCompression);
+        size += 4 + put_pstring(chunk + 30, compression_name, 255);
+    }
+    put32(chunk + 4, size);
+    file->dwFramesPos = pos + 10;
+    pos += 8 + size;
+
+    /* MARK */
+    if (file->info.dwNumMarkers > 0) {
+        chunk = head + pos;
+        memcpy(chunk, "MARK", 4);
+        put16(chunk + 8, (WORD)file->info.dwNumMarkers);
+        size = 2;
+        for (i = 0; i < file->info.dwNumMarkers; i++) {
+            put16(chunk + 8 + size, file->info.markers[i].wId);
+            put32(chunk + 8 + size + 2, file->info.markers[i].dwPosition);
+            len = put_pstring(chunk + 8 + size + 6, file->info.markers[i].szName,
+                              sizeof(file->info.markers[i].szName) - 1);
+            size += 6 + len;
+        }
+        put32(chunk + 4, size);
+        pos += 8 + size;
+    }
+
+    /* INST */
+    if (file->info.bHasInst) {
+        chunk = head + pos;
+        memcpy(chunk, "INST", 4);
+        put32(chunk + 4, 20);
+        chunk[8] = file->info.baseNote;
+        chunk[9] = (BYTE)file->info.detune;
+        chunk[10] = 0;      /* Low note */
+        chunk[11] = 127;    /* High note */
+        chunk[12] = 1;      /* Low velocity */
+        chunk[13] = 127;    /* High velocity */
+        put16(chunk + 14, 0);   /* Gain in dB */
+        put_loop(chunk + 16, &file->info.sustainLoop);
+        put_loop(chunk + 22, &file->info.releaseLoop);
+        pos += 28;
+    }
+
+    /* NAME */
+    len = strlen(file->info.szName);
+    if (len > 0) {
+        chunk = head + pos;
+        memcpy(chunk, "NAME", 4);
+        put32(chunk + 4, len);
+        memcpy(chunk + 8, file->info.szName, len);
+        if (len & 1) {
+            chunk[8 + len] = 0;
+        }
+        pos += 8 + len + (len & 1);
+    }
+
+    /* SSND with no offset or block alignment; the size is patched on close */
+    chunk = head + pos;
+    memcpy(chunk, "SSND", 4);
+    put32(chunk + 4, 8);
+    put32(chunk + 8, 0);
+    put32(chunk + 12, 0);
+    file->dwSoundSizePos = pos + 4;
+    pos += 16;
+
+    file->info.dwDataOffset = pos;
+    file->info.dwDataSize = 0;
+    file->dwFormSizePos = 4;
+
+    file->fp = fopen(filename, "wb");
+    if (file->fp == NULL) {
+        free(file);
+        return NULL;
+    }
+    if (fwrite(head, 1, pos, file->fp) != pos) {
+        fclose(file->fp);
+        free(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+/* Append frames, converting to the file's layout */
+BOOL SMDI_AIFFWriteFrames(SMDI_AIFFFile* file, const SMDI_PCMFormat* fmt, const void* buffer,
+                          DWORD dwFrames) {
+    DWORD file_frame, in_frame, done, count;
+    BOOL swap;
+    void* raw;
+
+    if (file == NULL || !file->bWriting || fmt == NULL || buffer == NULL || fmt->bPlanar) {
+        return FALSE;
+    }
+
+    file_frame = SMDI_PCMFrameSize(&file->info.pcmFormat);
+    in_frame = SMDI_PCMFrameSize(fmt);
+
+    /* Matching data goes straight to the file */
+    if (same_layout(file, fmt, &swap) && !swap) {
+        if (fwrite(buffer, file_frame, dwFrames, file->fp) != dwFrames) {
+            file->bError = TRUE;
+            return FALSE;
+        }
+        file->dwFrame += dwFrames;
+        return TRUE;
+    }
+
+    raw = io_buffer(file);
+    if (raw == NULL) {
+        file->bError = TRUE;
+        return FALSE;
+    }
+
+    for (done = 0; done < dwFrames; done += count) {
+        count = dwFrames - done;
+        if (count > AIFF_IO_FRAMES) {
+            count = AIFF_IO_FRAMES;
+        }
+        SMDI_PCMConvert(fmt, (const char*)buffer + done * in_frame,
+                        &file->info.pcmFormat, raw, count);
+        if (fwrite(raw, file_frame, count, file->fp) != count) {
+            file->bError = TRUE;
+            file->dwFrame += done;
+            return FALSE;
+        }
+    }
+
+    file->dwFrame += dwFrames;
+    return TRUE;
+}
+
+/* Patch a big-endian size at a file offset */
+static BOOL patch32(FILE* fp, DWORD pos, DWORD value) {
+    BYTE raw[4];
+
+    put32(raw, value);
+    if (fseek(fp, (long)pos, SEEK_SET) != 0) {
+        return FALSE;
+    }
+    return (fwrite(raw, 1, 4, fp) == 4) ? TRUE : FALSE;
+}
+
+/* Close a file, finishing the sizes of a written one */
+BOOL SMDI_AIFFClose(SMDI_AIFFFile* file) {
+    DWORD data_size, end;
+    BOOL ok;
+
+    if (file == NULL) {
+        return FALSE;
+    }
+
+    ok = TRUE;
+    if (file->bWriting) {
+        ok = !file->bError;
+        data_size = file->dwFrame * SMDI_PCMFrameSize(&file->info.pcmFormat);
+
+        /* Odd sound data takes a pad byte */
+        if ((data_size & 1) != 0 && putc(0, file->fp) == EOF) {
+            ok = FALSE;
+        }
+        end = file->info.dwDataOffset + data_size + (data_size & 1);
+
+        if (!patch32(file->fp, file->dwFormSizePos, end - 8) ||
+            !patch32(file->fp, file->dwFramesPos, file->dwFrame) ||
+            !patch32(file->fp, file->dwSoundSizePos, data_size + 8)) {
+            ok = FALSE;
+        }
+    }
+
+    if (fclose(file->fp) != 0) {
+        ok = FALSE;
+    }
+    free(file->lpBuffer);
+    free(file);
+    return ok;
+}
@@ -0,0 +1,771 @@
+/*
+ * SMDI multi-sample archive (SMDA) implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * The whole index is read when an archive is opened, so finding a sample
+ * by position or number never touches the file. Sample data is read
+ * through mappings of its own pages, or a handle of its own, so readers
+ * never move the position an append is writing at.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "smdi.h"
+#include "smdi_endian.h"
+#include "smdi_sample.h"
+#include "smdi_archive.h"
+
+#define ARCHIVE_POS_MAX      0x7FFFFFFFUL   /* fseek offsets are a long */
+#define ARCHIVE_MAX_CAPACITY 65536
+#define ARCHIVE_CHUNK        49152          /* A multiple of 2, 3 and 4 byte words */
+
+/* Store and fetch big-endian values */
+static void put16(BYTE* p, WORD v) {
+    p[0] = (BYTE)((v >> 8) & 0xFF);
+    p[1] = (BYTE)(v & 0xFF);
+}
+
+static void put32(BYTE* p, DWORD v) {
+    p[0] = (BYTE)((v >> 24) & 0xFF);
+    p[1] = (BYTE)((v >> 16) & 0xFF);
+    p[2] = (BYTE)((v >> 8) & 0xFF);
+    p[3] = (BYTE)(v & 0xFF);
+}
+
+static WORD get16(const BYTE* p) {
+    return (WORD)((p[0] << 8) | p[1]);
+}
+
+static DWORD get32(const BYTE* p) {
+    return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) |
+           ((DWORD)p[2] << 8) | (DWORD)p[3];
+}
+
+/* Round an offset up to the next data page */
+static DWORD align_offset(DWORD offset) {
+    return (offset + SMDI_ARCHIVE_ALIGN - 1) & ~(DWORD)(SMDI_ARCHIVE_ALIGN - 1);
+}
+
+/* Bytes of data a header describes */
+static DWORD header_data_size(const SMDI_SampleHeader* header) {
+    return (header->dwLength * (DWORD)header->NumberOfChannels *
+            (DWORD)header->BitsPerWord) / 8;
+}
+
+/* Hash slot of a sample number */
+static DWORD slot_hash(SMDI_Archive* archive, DWORD number) {
+    return ((number * 2654435761UL) >> 8) & archive->dwSlotMask;
+}
+
+/* Find the hash slot holding a number, or the empty one it would go in */
+static DWORD slot_find(SMDI_Archive* archive, DWORD number) {
+    DWORD slot;
+    DWORD entry;
+
+    slot = slot_hash(archive, number);
+    while ((entry = archive->lpSlots[slot]) != 0 &&
+           archive->lpEntries[entry - 1].dwSampleNumber != number) {
+        slot = (slot + 1) & archive->dwSlotMask;
+    }
+    return slot;
+}
+
+/* Allocate the index and number hash of an archive */
+static SMDI_Archive* archive_alloc(const char* filename, DWORD capacity) {
+    SMDI_Archive* archive;
+    DWORD slots;
+
+    archive = (SMDI_Archive*)malloc(sizeof(SMDI_Archive));
+    if (archive == NULL) {
+        return NULL;
+    }
+    memset(archive, 0, sizeof(SMDI_Archive));
+    strcpy(archive->szFilename, filename);
+    archive->dwCapacity = capacity;
+    archive->dwDataStart = align_offset(SMDI_ARCHIVE_HEADER_SIZE +
+                                        capacity * SMDI_ARCHIVE_ENTRY_SIZE);
+    archive->dwEnd = archive->dwDataStart;
+
+    /* At most half full, so probes stay short */
+    slots = 16;
+    while (slots < capacity * 2) {
+        slots <<= 1;
+    }
+    archive->dwSlotMask = slots - 1;
+
+    archive->lpEntries = (SMDI_ArchiveEntry*)malloc(capacity * sizeof(SMDI_ArchiveEntry));
+    archive->lpSlots = (DWORD*)malloc(slots * sizeof(DWORD));
+    if (archive->lpEntries == NULL || archive->lpSlots == NULL) {
+        free(archive->lpEntries);
+        free(archive->lpSlots);
+        free(archive);
+        return NULL;
+    }
+    memset(archive->lpEntries, 0, capacity * sizeof(SMDI_ArchiveEntry));
+    memset(archive->lpSlots, 0, slots * sizeof(DWORD));
+
+    return archive;
+}
+
+/* Release an archive's memory and file */
+static BOOL archive_free(SMDI_Archive* archive) {
+    BOOL ok;
+
+    ok = TRUE;
+    if (archive->fp != NULL && fclose(archive->fp) != 0) {
+        ok = FALSE;
+    }
+    free(archive->lpEntries);
+    free(archive->lpSlots);
+    free(archive);
+    return ok;
+}
+
+/* Serialize an index entry */
+static void pack_entry(BYTE* raw, const SMDI_ArchiveEntry* entry) {
+    memset(raw, 0, SMDI_ARCHIVE_ENTRY_SIZE);
+    put32(&raw[0], entry->dwSampleNumber);
+    put32(&raw[4], entry->header.dwDataOffset);
+    put32(&raw[8], entry->dwDataSize);
+    put32(&raw[12], entry->dwChecksum);
+    raw[16] = entry->header.BitsPerWord;
+    raw[17] = entry->header.NumberOfChannels;
+    raw[18] = entry->header.LoopControl;
+    raw[19] = entry->header.NameLength;
+    put32(&raw[20], entry->header.dwPeriod);
+    put32(&raw[24], entry->dwSampleRate);
+    put32(&raw[28], entry->header.dwLength);
+    put32(&raw[32], entry->header.dwLoopStart);
+    put32(&raw[36], entry->header.dwLoopEnd);
+    put16(&raw[40], entry->header.wPitch);
+    put16(&raw[42], entry->header.wPitchFraction);
+    memcpy(&raw[64], entry->header.cName, entry->header.NameLength);
+}
+
+/* Parse an index entry */
+static void unpack_entry(const BYTE* raw, SMDI_ArchiveEntry* entry) {
+    memset(entry, 0, sizeof(SMDI_ArchiveEntry));
+    entry->dwSampleNumber = get32(&raw[0]);
+    entry->header.dwStructSize = sizeof(SMDI_SampleHeader);
+    entry->header.bDoesExist = TRUE;
+    entry->header.dwDataOffset = get32(&raw[4]);
+    entry->dwDataSize = get32(&raw[8]);
+    entry->dwChecksum = get32(&raw[12]);
+    entry->header.BitsPerWord = raw[16];
+    entry->header.NumberOfChannels = raw[17];
+    entry->header.LoopControl = raw[18];
+    entry->header.NameLength = raw[19];
+    entry->header.dwPeriod = get32(&raw[20]);
+    entry->dwSampleRate = get32(&raw[24]);
+    entry->header.dwLength = get32(&raw[28]);
+    entry->header.dwLoopStart = get32(&raw[32]);
+    entry->header.dwLoopEnd = get32(&raw[36]);
+    entry->header.wPitch = get16(&raw[40]);
+    entry->header.wPitchFraction = get16(&raw[42]);
+    memcpy(entry->header.cName, &raw[64], entry->header.NameLength);
+    entry->header.cName[entry->header.NameLength] = '\0';
+}
+
+/* Create an empty archive */
+SMDI_Archive* SMDI_ArchiveCreate(const char* filename, DWORD dwCapacity) {
+    SMDI_Archive* archive;
+    BYTE raw[SMDI_ARCHIVE_HEADER_SIZE];
+    BYTE* zero;
+    DWORD offset;
+    DWORD length;
+    BOOL ok;
+
+    if (filename == NULL || strlen(filename) >= MAX_PATH) {
+        return NULL;
+    }
+    if (dwCapacity == 0) {
+        dwCapacity = SMDI_ARCHIVE_CAPACITY;
+    }
+    if (dwCapacity > ARCHIVE_MAX_CAPACITY) {
+        return NULL;
+    }
+
+    archive = archive_alloc(filename, dwCapacity);
+    if (archive == NULL) {
+        return NULL;
+    }
+    archive->bWritable = TRUE;
+
+    archive->fp = fopen(filename, "w+b");
+    if (archive->fp == NULL) {
+        archive_free(archive);
+        return NULL;
+    }
+
+    memset(raw, 0, sizeof(raw));
+    memcpy(raw, SMDI_ARCHIVE_SIGNATURE, 4);
+    put32(&raw[4], SMDI_ARCHIVE_VERSION);
+    put32(&raw[8], archive->dwCapacity);
+    put32(&raw[12], 0);
+    put32(&raw[16], SMDI_ARCHIVE_ALIGN);
+    put32(&raw[20], archive->dwDataStart);
+    ok = (fwrite(raw, 1, sizeof(raw), archive->fp) == sizeof(raw));
+
+    /* The empty index runs up to the first data page */
+    zero = (BYTE*)calloc(1, ARCHIVE_CHUNK);
+    ok = ok && (zero != NULL);
+    for (offset = sizeof(raw); ok && offset < archive->dwDataStart; offset += length) {
+        length = archive->dwDataStart - offset;
+        if (length > ARCHIVE_CHUNK) {
+            length = ARCHIVE_CHUNK;
+        }
+        ok = (fwrite(zero, 1, length, archive->fp) == length);
+    }
+    free(zero);
+
+    if (!ok || fflush(archive->fp) != 0) {
+        archive_free(archive);
+        remove(filename);
+        return NULL;
+    }
+
+    return archive;
+}
+
+/* Open an archive and read its index */
+SMDI_Archive* SMDI_ArchiveOpen(const char* filename, BOOL bWritable) {
+    SMDI_Archive* archive;
+    SMDI_ArchiveEntry* entry;
+    FILE* fp;
+    BYTE raw[SMDI_ARCHIVE_ENTRY_SIZE];
+    DWORD capacity;
+    DWORD count;
+    DWORD i;
+    DWORD end;
+    long file_size;
+
+    if (filename == NULL || strlen(filename) >= MAX_PATH) {
+        return NULL;
+    }
+
+    fp = fopen(filename, bWritable ? "r+b" : "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (file_size = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) != 0 ||
+        fread(raw, 1, SMDI_ARCHIVE_HEADER_SIZE, fp) != SMDI_ARCHIVE_HEADER_SIZE ||
+        memcmp(raw, SMDI_ARCHIVE_SIGNATURE, 4) != 0 ||
+        get32(&raw[4]) != SMDI_ARCHIVE_VERSION ||
+        get32(&raw[16]) != SMDI_ARCHIVE_ALIGN) {
+        fclose(fp);
+        return NULL;
+    }
+
+    capacity = get32(&raw[8]);
+    count = get32(&raw[12]);
+    if (capacity == 0 || capacity > ARCHIVE_MAX_CAPACITY || count > capacity) {
+        fclose(fp);
+        return NULL;
+    }
+
+    archive = archive_alloc(filename, capacity);
+    if (archive == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    archive->fp = fp;
+    archive->bWritable = bWritable;
+    if (get32(&raw[20]) != archive->dwDataStart) {
+        archive_free(archive);
+        return NULL;
+    }
+
+    /* Committed entries must lie whole within the file, once each */
+    for (i = 0; i < count; i++) {
+        if (fread(raw, 1, SMDI_ARCHIVE_ENTRY_SIZE, fp) != SMDI_ARCHIVE_ENTRY_SIZE) {
+            archive_free(archive);
+            return NULL;
+        }
+        entry = &archive->lpEntries[i];
+        unpack_entry(raw, entry);
+        end = entry->header.dwDataOffset + entry->dwDataSize;
+
+        if (entry->header.dwDataOffset < archive->dwDataStart ||
+            (entry->header.dwDataOffset % SMDI_ARCHIVE_ALIGN) != 0 ||
+            entry->dwDataSize > ARCHIVE_POS_MAX ||
+            end > (DWORD)file_size ||
+            entry->dwDataSize != header_data_size(&entry->header) ||
+            archive->lpSlots[slot_find(archive, entry->dwSampleNumber)] != 0) {
+            archive_free(archive);
+            return NULL;
+        }
+
+        archive->lpSlots[slot_find(archive, entry->dwSampleNumber)] = i + 1;
+        archive->dwCount = i + 1;
+        if (end > archive->dwEnd) {
+            archive->dwEnd = end;
+        }
+    }
+
+    return archive;
+}
+
+/* Close an archive */
+BOOL SMDI_ArchiveClose(SMDI_Archive* archive) {
+    if (archive == NULL) {
+        return FALSE;
+    }
+
+    return archive_free(archive);
+}
+
+/* Entry by position */
+const SMDI_ArchiveEntry* SMDI_ArchiveGetEntry(SMDI_Archive* archive, DWORD dwIndex) {
+    if (archive == NULL || dwIndex >= archive->dwCount) {
+        return NULL;
+    }
+
+    return &archive->lpEntries[dwIndex];
+}
+
+/* Position of the entry for a sample number */
+DWORD SMDI_ArchiveFindSample(SMDI_Archive* archive, DWORD dwSampleNumber) {
+    DWORD entry;
+
+    if (archive == NULL) {
+        return SMDI_ARCHIVE_NOT_FOUND;
+    }
+
+    entry = archive->lpSlots[slot_find(archive, dwSampleNumber)];
+    return (entry != 0) ? entry - 1 : SMDI_ARCHIVE_NOT_FOUND;
+}
+
+/* Start appending a sample */
+BOOL SMDI_ArchiveBeginSample(SMDI_Archive* archive, DWORD dwSampleNumber,
+                             const SMDI_SampleHeader* header, DWORD dwSampleRate) {
+    SMDI_ArchiveEntry* entry;
+    BYTE zero[SMDI_ARCHIVE_ALIGN];
+    DWORD offset;
+    DWORD size;
+
+    if (archive == NULL || header == NULL || !archive->bWritable ||
+        archive->bAppending || archive->dwCount >= archive->dwCapacity ||
+        SMDI_ArchiveFindSample(archive, dwSampleNumber) != SMDI_ARCHIVE_NOT_FOUND) {
+        return FALSE;
+    }
+
+    /* The data goes on the page after the last sample's */
+    offset = align_offset(archive->dwEnd);
+    size = header_data_size(header);
+    if (offset > ARCHIVE_POS_MAX || size > ARCHIVE_POS_MAX - offset) {
+        return FALSE;
+    }
+
+    memset(zero, 0, sizeof(zero));
+    if (fseek(archive->fp, (long)archive->dwEnd, SEEK_SET) != 0 ||
+        fwrite(zero, 1, offset - archive->dwEnd, archive->fp) != offset - archive->dwEnd) {
+        return FALSE;
+    }
+
+    entry = &archive->lpEntries[archive->dwCount];
+    memset(entry, 0, sizeof(SMDI_ArchiveEntry));
+    entry->dwSampleNumber = dwSampleNumber;
+    memcpy(&entry->header, header, sizeof(SMDI_SampleHeader));
+    entry->header.dwStructSize = sizeof(SMDI_SampleHeader);
+    entry->header.bDoesExist = TRUE;
+    entry->header.cName[255] = '\0';
+    entry->header.NameLength = (BYTE)strlen(entry->header.cName);
+    entry->header.dwDataOffset = offset;
+    entry->dwSampleRate = dwSampleRate;
+    if (entry->dwSampleRate == 0 && header->dwPeriod != 0) {
+        entry->dwSampleRate = 1000000000UL / header->dwPeriod;
+    }
+    entry->dwDataSize = size;
+
+    archive->bAppending = TRUE;
+    archive->dwWritten = 0;
+    return TRUE;
+}
+
+/* Append the next bytes of the sample's data */
+BOOL SMDI_ArchiveWriteData(SMDI_Archive* archive, const void* data, DWORD dwBytes) {
+    SMDI_ArchiveEntry* entry;
+
+    if (archive == NULL || !archive->bAppending || (data == NULL && dwBytes > 0)) {
+        return FALSE;
+    }
+
+    entry = &archive->lpEntries[archive->dwCount];
+    if (dwBytes > entry->dwDataSize - archive->dwWritten ||
+        fwrite(data, 1, dwBytes, archive->fp) != dwBytes) {
+        return FALSE;
+    }
+
+    entry->dwChecksum = SMDI_CRC32(entry->dwChecksum, data, dwBytes);
+    archive->dwWritten += dwBytes;
+    return TRUE;
+}
+
+/* Commit or drop the sample being appended */
+BOOL SMDI_ArchiveEndSample(SMDI_Archive* archive, BOOL bKeep) {
+    SMDI_ArchiveEntry* entry;
+    BYTE raw[SMDI_ARCHIVE_ENTRY_SIZE];
+    BYTE count[4];
+
+    if (archive == NULL || !archive->bAppending) {
+        return FALSE;
+    }
+    archive->bAppending = FALSE;
+
+    /* Dropped data is left past the end, where the next sample overwrites it */
+    entry = &archive->lpEntries[archive->dwCount];
+    if (!bKeep || archive->dwWritten != entry->dwDataSize) {
+        return !bKeep;
+    }
+
+    /* The data reaches the file before the entry, and the entry before the count */
+    pack_entry(raw, entry);
+    put32(count, archive->dwCount + 1);
+    if (fflush(archive->fp) != 0 ||
+        fseek(archive->fp, (long)(SMDI_ARCHIVE_HEADER_SIZE +
+                                  archive->dwCount * SMDI_ARCHIVE_ENTRY_SIZE), SEEK_SET) != 0 ||
+        fwrite(raw, 1, sizeof(raw), archive->fp) != sizeof(raw) ||
+        fflush(archive->fp) != 0 ||
+        fseek(archive->fp, 12, SEEK_SET) != 0 ||
+        fwrite(count, 1, sizeof(count), archive->fp) != sizeof(count) ||
+        fflush(archive->fp) != 0) {
+        return FALSE;
+    }
+
+    archive->lpSlots[slot_find(archive, entry->dwSampleNumber)] = archive->dwCount + 1;
+    archive->dwCount++;
+    archive->dwEnd = entry->header.dwDataOffset + entry->dwDataSize;
+    return TRUE;
+}
+
+/* Append a whole sample held in memory */
+BOOL SMDI_ArchiveAddSample(SMDI_Archive* archive, DWORD dwSampleNumber, SMDI_Sample* sample) {
+    SMDI_SampleHeader header;
+    BYTE* chunk;
+    DWORD mode;
+    DWORD offset;
+    DWORD length;
+    BOOL ok;
+
+    if (archive == NULL || sample == NULL) {
+        return FALSE;
+    }
+
+    SMDI_SampleToHeader(sample, &header);
+    if (!SMDI_ArchiveBeginSample(archive, dwSampleNumber, &header, sample->sample_rate)) {
+        return FALSE;
+    }
+
+    /* Samples are kept in host order; the archive holds SMDI order */
+    mode = SMDI_HostCopyMode(sample->bits_per_sample);
+    chunk = NULL;
+    if (mode != CM_NORMAL) {
+        chunk = (BYTE*)malloc(ARCHIVE_CHUNK);
+    }
+
+    ok = (mode == CM_NORMAL || chunk != NULL);
+    for (offset = 0; ok && offset < sample->data_size; offset += length) {
+        length = sample->data_size - offset;
+        if (length > ARCHIVE_CHUNK) {
+            length = ARCHIVE_CHUNK;
+        }
+        if (chunk != NULL) {
+            SMDI_CopySampleData(chunk, (BYTE*)sample->sample_data + offset, length, mode);
+            ok = SMDI_ArchiveWriteData(archive, chunk, length);
+        } else {
+            ok = SMDI_ArchiveWriteData(archive, (BYTE*)sample->sample_data + offset, length);
+        }
+    }
+    free(chunk);
+
+    return SMDI_ArchiveEndSample(archive, ok) && ok;
+}
+
+/* State of an archive download sink */
+typedef struct {
+    SMDI_Archive* archive;
+    DWORD number;
+    BOOL begun;
+} archive_sink_t;
+
+/* Start the sample once the header is known; packets arrive in SMDI order */
+static BOOL archive_sink_begin(SMDI_SampleSink* sink) {
+    archive_sink_t* state;
+
+    state = (archive_sink_t*)sink->lpUserData;
+    state->begun = SMDI_ArchiveBeginSample(state->archive, state->number, &sink->header, 0);
+    sink->dwCopyMode = CM_NORMAL;
+    return state->begun;
+}
+
+static BOOL archive_sink_write(SMDI_SampleSink* sink, void* data, DWORD bytes) {
+    archive_sink_t* state;
+
+    state = (archive_sink_t*)sink->lpUserData;
+    return SMDI_ArchiveWriteData(state->archive, data, bytes);
+}
+
+/* Commit the sample, or drop it if the download failed */
+static BOOL archive_sink_end(SMDI_SampleSink* sink, BOOL complete) {
+    archive_sink_t* state;
+    BOOL ok;
+
+    state = (archive_sink_t*)sink->lpUserData;
+    ok = state->begun && SMDI_ArchiveEndSample(state->archive, complete) && complete;
+
+    free(state);
+    sink->lpUserData = NULL;
+    return ok;
+}
+
+/* Set up a download sink appending to an archive */
+BOOL SMDI_ArchiveOpenSink(SMDI_SampleSink* sink, SMDI_Archive* archive, DWORD dwSampleNumber) {
+    archive_sink_t* state;
+
+    if (sink == NULL || archive == NULL || !archive->bWritable) {
+        return FALSE;
+    }
+
+    state = (archive_sink_t*)malloc(sizeof(archive_sink_t));
+    if (state == NULL) {
+        return FALSE;
+    }
+    state->archive = archive;
+    state->number = dwSampleNumber;
+    state->begun = FALSE;
+
+    memset(sink, 0, sizeof(SMDI_SampleSink));
+    sink->dwStructSize = sizeof(SMDI_SampleSink);
+    sink->dwCopyMode = CM_NORMAL;
+    sink->lpBegin = archive_sink_begin;
+    sink->lpWrite = archive_sink_write;
+    sink->lpEnd = archive_sink_end;
+    sink->lpUserData = state;
+
+    return TRUE;
+}
+
+/* Map the pages holding one sample's data; the mapping starts at the page
+   boundary at or before the data */
+static void* map_entry(FILE* fp, const SMDI_ArchiveEntry* entry, int prot,
+                       void** map_base, DWORD* map_size) {
+    DWORD page;
+    DWORD start;
+    void* base;
+
+    if (entry->dwDataSize == 0) {
+        return NULL;
+    }
+
+    page = (DWORD)sysconf(_SC_PAGESIZE);
+    if (page == 0 || page == (DWORD)-1) {
+        page = SMDI_ARCHIVE_ALIGN;
+    }
+    start = entry->header.dwDataOffset - (entry->header.dwDataOffset % page);
+
+    *map_size = entry->header.dwDataOffset + entry->dwDataSize - start;
+    base = mmap(NULL, (size_t)*map_size, prot, MAP_PRIVATE, fileno(fp), (off_t)start);
+    if (base == (void*)MAP_FAILED) {
+        return NULL;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    /* Transfers walk the data once from start to end */
+    madvise((char*)base, (size_t)*map_size, MADV_SEQUENTIAL);
+#endif
+
+    *map_base = base;
+    return (char*)base + (entry->header.dwDataOffset - start);
+}
+
+/* Load a sample mapped from its own pages */
+SMDI_Sample* SMDI_ArchiveMapSample(SMDI_Archive* archive, DWORD dwIndex) {
+    const SMDI_ArchiveEntry* entry;
+    SMDI_Sample* sample;
+    FILE* fp;
+    void* data;
+    void* base;
+    DWORD map_size;
+
+    entry = SMDI_ArchiveGetEntry(archive, dwIndex);
+    if (entry == NULL || entry->dwSampleRate == 0 ||
+        (entry->header.BitsPerWord != 8 && entry->header.BitsPerWord != 16)) {
+        return NULL;
+    }
+
+    base = NULL;
+    map_size = 0;
+    data = map_entry(archive->fp, entry, PROT_READ | PROT_WRITE, &base, &map_size);
+    if (data != NULL) {
+        sample = (SMDI_Sample*)malloc(sizeof(SMDI_Sample));
+        if (sample == NULL) {
+            munmap((char*)base, (size_t)map_size);
+            return NULL;
+        }
+        memset(sample, 0, sizeof(SMDI_Sample));
+        sample->sample_data = (short*)data;
+        sample->data_size = entry->dwDataSize;
+        sample->map_base = base;
+        sample->map_size = map_size;
+    } else {
+        /* Read it into memory through a handle of its own */
+        sample = SMDI_AllocSample(entry->dwSampleRate, entry->header.BitsPerWord,
+                                  entry->header.NumberOfChannels, entry->header.dwLength);
+        if (sample == NULL) {
+            return NULL;
+        }
+        fp = fopen(archive->szFilename, "rb");
+        if (fp == NULL ||
+            fseek(fp, (long)entry->header.dwDataOffset, SEEK_SET) != 0 ||
+            fread(sample->sample_data, 1, sample->data_size, fp) != sample->data_size) {
+            if (fp != NULL) {
+                fclose(fp);
+            }
+            SMDI_FreeSample(sample);
+            return NULL;
+        }
+        fclose(fp);
+    }
+
+    /* Copy the sample properties */
+    sample->sample_rate = entry->dwSampleRate;
+    sample->bits_per_sample = entry->header.BitsPerWord;
+    sample->channels = entry->header.NumberOfChannels;
+    sample->loop_type = entry->header.LoopControl;
+    sample->reserved = 0;
+    sample->sample_count = entry->header.dwLength;
+    sample->loop_start = entry->header.dwLoopStart;
+    sample->loop_end = entry->header.dwLoopEnd;
+    sample->root_note = entry->header.wPitch;
+    sample->fine_tune = entry->header.wPitchFraction;
+    strncpy(sample->name, entry->header.cName, 255);
+    sample->name[255] = '\0';
+
+    /* Convert to host order; a no-op on big-endian hosts */
+    SMDI_CopySampleData(sample->sample_data, sample->sample_data, sample->data_size,
+                        SMDI_HostCopyMode(sample->bits_per_sample));
+
+    return sample;
+}
+
+/* State of an archive upload source */
+typedef struct {
+    FILE* fp;
+    void* map_base;
+    DWORD map_size;
+} archive_source_t;
+
+/* Read the next bytes when the sample could not be mapped */
+static DWORD archive_source_read(SMDI_SampleSource* source, void* buffer, DWORD bytes) {
+    archive_source_t* state;
+
+    state = (archive_source_t*)source->lpUserData;
+    return (DWORD)fread(buffer, 1, bytes, state->fp);
+}
+
+static void archive_source_close(SMDI_SampleSource* source) {
+    archive_source_t* state;
+
+    state = (archive_source_t*)source->lpUserData;
+    if (state == NULL) {
+        return;
+    }
+
+    if (state->map_base != NULL) {
+        munmap((char*)state->map_base, (size_t)state->map_size);
+    }
+    fclose(state->fp);
+    free(state);
+    source->lpUserData = NULL;
+    source->lpData = NULL;
+}
+
+/* Open a sample as an upload source */
+BOOL SMDI_ArchiveOpenSource(SMDI_SampleSource* source, SMDI_Archive* archive, DWORD dwIndex) {
+    const SMDI_ArchiveEntry* entry;
+    archive_source_t* state;
+
+    entry = SMDI_ArchiveGetEntry(archive, dwIndex);
+    if (source == NULL || entry == NULL) {
+        return FALSE;
+    }
+
+    state = (archive_source_t*)malloc(sizeof(archive_source_t));
+    if (state == NULL) {
+        return FALSE;
+    }
+    memset(state, 0, sizeof(archive_source_t));
+
+    state->fp = fopen(archive->szFilename, "rb");
+    if (state->fp == NULL) {
+        free(state);
+        return FALSE;
+    }
+
+    memset(source, 0, sizeof(SMDI_SampleSource));
+    source->dwStructSize = sizeof(SMDI_SampleSource);
+    memcpy(&source->header, &entry->header, sizeof(SMDI_SampleHeader));
+    source->header.dwDataOffset = 0;
+    source->dwSampleRate = entry->dwSampleRate;
+
+    /* The archive holds SMDI order, so packets go out as they lie */
+    source->dwCopyMode = CM_NORMAL;
+    source->lpData = map_entry(state->fp, entry, PROT_READ, &state->map_base, &state->map_size);
+    if (source->lpData == NULL) {
+        if (fseek(state->fp, (long)entry->header.dwDataOffset, SEEK_SET) != 0) {
+            fclose(state->fp);
+            free(state);
+            return FALSE;
+        }
+        source->lpRead = archive_source_read;
+    }
+    source->lpClose = archive_source_close;
+    source->lpUserData = state;
+
+    return TRUE;
+}
+
+/* Check a sample's data against its CRC-32 */
+BOOL SMDI_ArchiveVerifySample(SMDI_Archive* archive, DWORD dwIndex) {
+    SMDI_SampleSource source;
+    BYTE* chunk;
+    DWORD crc;
+    DWORD offset;
+    DWORD length;
+    DWORD size;
+    BOOL ok;
+
+    if (!SMDI_ArchiveOpenSource(&source, archive, dwIndex)) {
+        return FALSE;
+    }
+
+    size = archive->lpEntries[dwIndex].dwDataSize;
+    crc = 0;
+    ok = TRUE;
+    if (source.lpData != NULL) {
+        crc = SMDI_CRC32(crc, source.lpData, size);
+    } else {
+        chunk = (BYTE*)malloc(ARCHIVE_CHUNK);
+        ok = (chunk != NULL);
+        for (offset = 0; ok && offset < size; offset += length) {
+            length = size - offset;
+            if (length > ARCHIVE_CHUNK) {
+                length = ARCHIVE_CHUNK;
+            }
+            ok = (archive_source_read(&source, chunk, length) == length);
+            if (ok) {
+                crc = SMDI_CRC32(crc, chunk, length);
+            }
+        }
+        free(chunk);
+    }
+    archive_source_close(&source);
+
+    return ok && crc == archive->lpEntries[dwIndex].dwChecksum;
+}
@@ -0,0 +1,1368 @@
+/*
+ * SMDI whole-sampler backup and restore implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * The samples are downloaded one after another in this process, while a
+ * writer process puts them on disk. Each packet goes down a pipe as it
+ * arrives, so the bus work of the next sample starts while the writer
+ * is still finishing the last one, and the pipe bounds how far ahead the
+ * bus may run. If the writer cannot be started the samples are written
+ * in line instead.
+ *
+ * A restore runs the other way round: a worker process gets the next
+ * sample ready - decoded into memory shared with this process, or its
+ * checksum checked - while this one uploads the current one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include "smdi.h"
+#include "smdi_sample.h"
+#include "smdi_pcm.h"
+#include "smdi_aif.h"
+#include "smdi_wav.h"
+#include "smdi_archive.h"
+#include "smdi_report.h"
+#include "smdi_backup.h"
+
+/* Records sent to the writer process */
+#define RECORD_BEGIN  1    /* A sample with its header */
+#define RECORD_DATA   2    /* dwBytes of data follow */
+#define RECORD_END    3    /* dwBytes is TRUE to keep the sample */
+
+typedef struct {
+    DWORD type;
+    DWORD index;                     /* Position in the list of samples */
+    DWORD number;
+    DWORD bytes;
+    SMDI_SampleHeader header;
+} backup_record_t;
+
+/* Answer from the writer as each sample is finished */
+typedef struct {
+    DWORD index;
+    DWORD result;
+} backup_result_t;
+
+/* Destination of the samples, used by the writer */
+typedef struct {
+    const char* destination;
+    BOOL directory;
+    SMDI_Archive* archive;
+    SMDI_SampleSink sink;
+    BOOL open;                       /* The sink took the header */
+    BOOL failed;                     /* A write failed */
+    DWORD result;
+    char path[MAX_PATH];
+    char part[MAX_PATH + 8];         /* Name while the file is written: path.part */
+} backup_writer_t;
+
+/* State of the sink the reception loop writes to */
+typedef struct {
+    backup_writer_t* writer;         /* Writes in line, or NULL */
+    int fd;                          /* Pipe to the writer process */
+    DWORD index;
+    DWORD number;
+} backup_pipe_t;
+
+/* Samples found by the scan */
+typedef struct {
+    DWORD number;
+    DWORD size;
+    SMDI_SampleHeader header;        /* As the scan found it */
+    BOOL skip;                       /* Already in the destination */
+    DWORD result;                    /* Of the download, then of the write */
+    BOOL done;
+} backup_sample_t;
+
+/* Write or read a whole buffer on a pipe */
+static BOOL pipe_write(int fd, const void* data, DWORD bytes) {
+    const char* p;
+    int n;
+
+    p = (const char*)data;
+    while (bytes > 0) {
+        n = write(fd, p, bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return FALSE;
+        }
+        p += n;
+        bytes -= (DWORD)n;
+    }
+    return TRUE;
+}
+
+static BOOL pipe_read(int fd, void* data, DWORD bytes) {
+    char* p;
+    int n;
+
+    p = (char*)data;
+    while (bytes > 0) {
+        n = read(fd, p, bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return FALSE;
+        }
+        p += n;
+        bytes -= (DWORD)n;
+    }
+    return TRUE;
+}
+
+/* Native file of a slot in a directory backup */
+static BOOL slot_path(char* path, const char* directory, DWORD number) {
+    if (strlen(directory) + 32 >= MAX_PATH) {
+        return FALSE;
+    }
+    sprintf(path, "%s/%03lu.sdmp", directory, number);
+    return TRUE;
+}
+
+/* Open the destination of a sample */
+static void writer_begin(backup_writer_t* writer, DWORD number, const SMDI_SampleHeader* header) {
+    BOOL ok;
+
+    writer->open = FALSE;
+    writer->failed = FALSE;
+    writer->result = FE_OPENERROR;
+
+    if (writer->directory) {
+        ok = slot_path(writer->path, writer->destination, number);
+        if (ok) {
+            sprintf(writer->part, "%s.part", writer->path);
+            ok = SMDI_OpenNativeSink(&writer->sink, writer->part);
+        }
+    } else {
+        ok = (writer->archive != NULL) &&
+             SMDI_ArchiveOpenSink(&writer->sink, writer->archive, number);
+    }
+    if (!ok) {
+        return;
+    }
+
+    memcpy(&writer->sink.header, header, sizeof(SMDI_SampleHeader));
+    if (!(*writer->sink.lpBegin)(&writer->sink)) {
+        (*writer->sink.lpEnd)(&writer->sink, FALSE);
+        return;
+    }
+    writer->open = TRUE;
+}
+
+static void writer_data(backup_writer_t* writer, void* data, DWORD bytes) {
+    if (writer->open && !writer->failed &&
+        !(*writer->sink.lpWrite)(&writer->sink, data, bytes)) {
+        writer->failed = TRUE;
+    }
+}
+
+/* Finish a sample; a directory file only gets its name once complete */
+static DWORD writer_end(backup_writer_t* writer, BOOL keep) {
+    BOOL ok;
+
+    if (!writer->open) {
+        return writer->result;
+    }
+    writer->open = FALSE;
+
+    ok = (*writer->sink.lpEnd)(&writer->sink, keep && !writer->failed);
+    if (ok && writer->directory && rename(writer->part, writer->path) != 0) {
+        remove(writer->part);
+        ok = FALSE;
+    }
+
+    if (ok) {
+        return SMDIM_ENDOFPROCEDURE;
+    }
+    return keep ? FE_WRITEERROR : SMDIM_ERROR;
+}
+
+/* Writer process: apply records from the pipe until it is closed */
+static void writer_run(backup_writer_t* writer, int in, int out) {
+    backup_record_t record;
+    backup_result_t answer;
+    void* buffer;
+    DWORD size;
+    void* grown;
+
+    buffer = NULL;
+    size = 0;
+    while (pipe_read(in, &record, sizeof(record))) {
+        switch (record.type) {
+            case RECORD_BEGIN:
+                writer_begin(writer, record.number, &record.header);
+                break;
+
+            case RECORD_DATA:
+                if (record.bytes > size) {
+                    grown = realloc(buffer, record.bytes);
+                    if (grown == NULL) {
+                        free(buffer);
+                        return;
+                    }
+                    buffer = grown;
+                    size = record.bytes;
+                }
+                if (!pipe_read(in, buffer, record.bytes)) {
+                    free(buffer);
+                    return;
+                }
+                writer_data(writer, buffer, record.bytes);
+                break;
+
+            case RECORD_END:
+                answer.index = record.index;
+                answer.result = writer_end(writer, (BOOL)record.bytes);
+                pipe_write(out, &answer, sizeof(answer));
+                break;
+        }
+    }
+
+    free(buffer);
+}
+
+/* Pass the header to the writer */
+static BOOL backup_sink_begin(SMDI_SampleSink* sink) {
+    backup_pipe_t* state;
+    backup_record_t record;
+
+    state = (backup_pipe_t*)sink->lpUserData;
+    sink->dwCopyMode = CM_NORMAL;
+
+    if (state->writer != NULL) {
+        writer_begin(state->writer, state->number, &sink->header);
+        return state->writer->open;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.type = RECORD_BEGIN;
+    record.index = state->index;
+    record.number = state->number;
+    memcpy(&record.header, &sink->header, sizeof(SMDI_SampleHeader));
+    return pipe_write(state->fd, &record, sizeof(record));
+}
+
+static BOOL backup_sink_write(SMDI_SampleSink* sink, void* data, DWORD bytes) {
+    backup_pipe_t* state;
+    backup_record_t record;
+
+    state = (backup_pipe_t*)sink->lpUserData;
+    if (state->writer != NULL) {
+        writer_data(state->writer, data, bytes);
+        return !state->writer->failed;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.type = RECORD_DATA;
+    record.index = state->index;
+    record.bytes = bytes;
+    return pipe_write(state->fd, &record, sizeof(record)) &&
+           pipe_write(state->fd, data, bytes);
+}
+
+/* Hand the end to the writer; its answer comes back on the result pipe */
+static BOOL backup_sink_end(SMDI_SampleSink* sink, BOOL complete) {
+    backup_pipe_t* state;
+    backup_record_t record;
+
+    state = (backup_pipe_t*)sink->lpUserData;
+    if (state->writer != NULL) {
+        state->writer->result = writer_end(state->writer, complete);
+        return state->writer->result == SMDIM_ENDOFPROCEDURE || !complete;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.type = RECORD_END;
+    record.index = state->index;
+    record.bytes = (DWORD)complete;
+    return pipe_write(state->fd, &record, sizeof(record));
+}
+
+/* Record the final result of a sample */
+static void backup_finish(SMDI_Backup* backup, backup_sample_t* sample, DWORD result) {
+    if (sample->done) {
+        return;
+    }
+    sample->done = TRUE;
+
+    /* A failed download is what went wrong, whatever the writer said */
+    if (sample->result == SMDIM_ENDOFPROCEDURE) {
+        sample->result = result;
+    }
+    if (sample->result == SMDIM_ENDOFPROCEDURE) {
+        backup->dwSaved++;
+        backup->dwBytes += sample->size;
+    } else {
+        backup->dwFailed++;
+    }
+
+    if (backup->lpCallback != NULL) {
+        (*backup->lpCallback)(backup, sample->number, sample->result);
+    }
+}
+
+/* Take the answers the writer has sent so far */
+static void backup_collect(SMDI_Backup* backup, backup_sample_t* samples, DWORD count,
+                           int fd) {
+    backup_result_t answer;
+    int n;
+
+    for (;;) {
+        n = read(fd, &answer, sizeof(answer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n != (int)sizeof(answer)) {
+            return;
+        }
+        if (answer.index < count) {
+            backup_finish(backup, &samples[answer.index], answer.result);
+        }
+    }
+}
+
+/* Find the populated slots */
+static DWORD backup_scan(SMDI_Backup* backup, backup_sample_t* samples, DWORD slots) {
+    SMDI_SampleHeader sh;
+    DWORD i;
+    DWORD count;
+
+    count = 0;
+    for (i = 0; i < slots; i++) {
+        memset(&sh, 0, sizeof(SMDI_SampleHeader));
+        sh.dwStructSize = sizeof(SMDI_SampleHeader);
+        if (SMDI_SampleHeaderRequest(backup->HA_ID, backup->SCSI_ID,
+                                     backup->dwFirstSample + i, &sh) == SMDIM_SAMPLEHEADER &&
+            sh.bDoesExist) {
+            memset(&samples[count], 0, sizeof(backup_sample_t));
+            samples[count].number = backup->dwFirstSample + i;
+            samples[count].size = (sh.dwLength * (DWORD)sh.NumberOfChannels *
+                                   (DWORD)sh.BitsPerWord) / 8;
+            memcpy(&samples[count].header, &sh, sizeof(SMDI_SampleHeader));
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Prepare the destination and mark the samples a previous run finished */
+static BOOL backup_prepare(SMDI_Backup* backup, backup_sample_t* samples, DWORD count,
+                           BOOL directory) {
+    SMDI_Archive* archive;
+    struct stat st;
+    char path[MAX_PATH];
+    DWORD i;
+    DWORD todo;
+    DWORD capacity;
+
+    if (directory) {
+        for (i = 0; i < count; i++) {
+            if (!slot_path(path, backup->lpDestination, samples[i].number)) {
+                return FALSE;
+            }
+            samples[i].skip = backup->bResume && stat(path, &st) == 0;
+        }
+        return TRUE;
+    }
+
+    archive = NULL;
+    if (backup->bResume && stat(backup->lpDestination, &st) == 0) {
+        archive = SMDI_ArchiveOpen(backup->lpDestination, FALSE);
+        if (archive == NULL) {
+            return FALSE;
+        }
+    } else {
+        capacity = (count > SMDI_ARCHIVE_CAPACITY) ? count : SMDI_ARCHIVE_CAPACITY;
+        archive = SMDI_ArchiveCreate(backup->lpDestination, capacity);
+        if (archive == NULL) {
+            return FALSE;
+        }
+    }
+
+    todo = 0;
+    for (i = 0; i < count; i++) {
+        samples[i].skip =
+            (SMDI_ArchiveFindSample(archive, samples[i].number) != SMDI_ARCHIVE_NOT_FOUND);
+        if (!samples[i].skip) {
+            todo++;
+        }
+    }
+
+    /* Everything left has to fit in the index */
+    if (todo > archive->dwCapacity - archive->dwCount) {
+        SMDI_ArchiveClose(archive);
+        return FALSE;
+    }
+
+    return SMDI_ArchiveClose(archive);
+}
+
+/* Back up the populated slots of a sampler */
+DWORD SMDI_BackupDevice(SMDI_Backup* backup) {
+    SMDI_FileTransfer ft;
+    SMDI_SampleSink sink;
+    backup_writer_t writer;
+    backup_pipe_t* state;
+    backup_sample_t* samples;
+    struct stat st;
+    void (*old_pipe)(int);
+    int data_pipe[2];
+    int result_pipe[2];
+    pid_t pid;
+    DWORD slots;
+    DWORD count;
+    DWORD result;
+    DWORD i;
+    BOOL directory;
+
+    if (backup == NULL || backup->lpDestination == NULL) {
+        return SMDIM_ERROR;
+    }
+    backup->dwFound = 0;
+    backup->dwSaved = 0;
+    backup->dwSkipped = 0;
+    backup->dwFailed = 0;
+    backup->dwBytes = 0;
+
+    slots = (backup->dwSlots != 0) ? backup->dwSlots : SMDI_BACKUP_SLOTS;
+    samples = (backup_sample_t*)malloc(slots * sizeof(backup_sample_t));
+    if (samples == NULL) {
+        return SMDIE_NOMEMORY;
+    }
+
+    directory = (stat(backup->lpDestination, &st) == 0 && S_ISDIR(st.st_mode));
+    count = backup_scan(backup, samples, slots);
+    backup->dwFound = count;
+
+    if (!backup_prepare(backup, samples, count, directory)) {
+        free(samples);
+        return FE_OPENERROR;
+    }
+
+    memset(&writer, 0, sizeof(writer));
+    writer.destination = backup->lpDestination;
+    writer.directory = directory;
+
+    /* Start the writer; without one the samples are written in line */
+    pid = -1;
+    fflush(NULL);
+    if (pipe(data_pipe) == 0) {
+        if (pipe(result_pipe) == 0) {
+            pid = fork();
+            if (pid == 0) {
+                close(data_pipe[1]);
+                close(result_pipe[0]);
+                if (!directory) {
+                    writer.archive = SMDI_ArchiveOpen(backup->lpDestination, TRUE);
+                }
+                writer_run(&writer, data_pipe[0], result_pipe[1]);
+                if (writer.archive != NULL) {
+                    SMDI_ArchiveClose(writer.archive);
+                }
+                _exit(0);
+            }
+            if (pid < 0) {
+                close(result_pipe[0]);
+                close(result_pipe[1]);
+            }
+        }
+        if (pid < 0) {
+            close(data_pipe[0]);
+            close(data_pipe[1]);
+        }
+    }
+
+    if (pid > 0) {
+        close(data_pipe[0]);
+        close(result_pipe[1]);
+        fcntl(result_pipe[0], F_SETFL, O_NONBLOCK);
+    } else if (!directory) {
+        writer.archive = SMDI_ArchiveOpen(backup->lpDestination, TRUE);
+    }
+
+    /* A writer that died shows up as a failed write, not a signal */
+    old_pipe = signal(SIGPIPE, SIG_IGN);
+
+    result = SMDIM_ENDOFPROCEDURE;
+    for (i = 0; i < count; i++) {
+        if (samples[i].skip) {
+            samples[i].done = TRUE;
+            backup->dwSkipped++;
+            continue;
+        }
+
+        state = (backup_pipe_t*)malloc(sizeof(backup_pipe_t));
+        if (state == NULL) {
+            samples[i].result = SMDIE_NOMEMORY;
+            backup_finish(backup, &samples[i], SMDIE_NOMEMORY);
+            continue;
+        }
+        state->writer = (pid > 0) ? NULL : &writer;
+        state->fd = (pid > 0) ? data_pipe[1] : -1;
+        state->index = i;
+        state->number = samples[i].number;
+
+        memset(&sink, 0, sizeof(sink));
+        sink.dwStructSize = sizeof(sink);
+        sink.dwCopyMode = CM_NORMAL;
+        sink.lpBegin = backup_sink_begin;
+        sink.lpWrite = backup_sink_write;
+        sink.lpEnd = backup_sink_end;
+        sink.lpUserData = state;
+
+        memset(&ft, 0, sizeof(ft));
+        ft.dwStructSize = sizeof(ft);
+        ft.HA_ID = backup->HA_ID;
+        ft.SCSI_ID = backup->SCSI_ID;
+        ft.dwSampleNumber = samples[i].number;
+        ft.dwFileType = SF_NATIVE;
+        ft.lpCallback = backup->lpTransferCallback;
+        ft.dwUserData = backup->dwUserData;
+        ft.bAsync = FALSE;
+        ft.lpSampleHeader = &samples[i].header;  /* No second header request */
+
+        samples[i].result = SMDI_ReceiveSampleSink(&ft, &sink);
+        free(state);
+
+        if (pid > 0) {
+            /* The writer answers in its own time */
+            if (samples[i].result != SMDIM_ENDOFPROCEDURE) {
+                backup_finish(backup, &samples[i], samples[i].result);
+            }
+            backup_collect(backup, samples, count, result_pipe[0]);
+        } else {
+            backup_finish(backup, &samples[i], writer.result);
+        }
+    }
+
+    if (pid > 0) {
+        /* Closing the pipe lets the writer finish; then wait for its answers */
+        close(data_pipe[1]);
+        fcntl(result_pipe[0], F_SETFL, 0);
+        backup_collect(backup, samples, count, result_pipe[0]);
+        close(result_pipe[0]);
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+    } else if (writer.archive != NULL) {
+        SMDI_ArchiveClose(writer.archive);
+    }
+
+    signal(SIGPIPE, old_pipe);
+
+    /* A writer that died never answered for its last samples */
+    for (i = 0; i < count; i++) {
+        if (!samples[i].done) {
+            backup_finish(backup, &samples[i], FE_WRITEERROR);
+        }
+        if (result == SMDIM_ENDOFPROCEDURE && !samples[i].skip &&
+            samples[i].result != SMDIM_ENDOFPROCEDURE) {
+            result = samples[i].result;
+        }
+    }
+
+    free(samples);
+    return result;
+}
+
+/* Kinds of sample a restore sends */
+#define ITEM_ARCHIVE  0    /* Archive entry, sent from a mapping */
+#define ITEM_NATIVE   1    /* Native file, sent from a mapping */
+#define ITEM_DECODED  2    /* AIFF or WAV file, decoded by the worker */
+
+/* Samples found in the source */
+typedef struct {
+    DWORD kind;
+    DWORD type;                      /* SF_* of a file */
+    DWORD index;                     /* Archive entry */
+    DWORD number;                    /* Slot it was saved from, or SMDI_NOSLOT */
+    DWORD target;
+    DWORD size;                      /* Bytes of data in SMDI order */
+    char name[MAX_PATH];             /* File, or the name in the archive */
+    BOOL unchanged;                  /* Sync found the slot up to date */
+    DWORD result;
+    DWORD header_hash;               /* Fingerprint for sync */
+    DWORD data_crc;
+} restore_item_t;
+
+/* What the decoder leaves at the start of its shared memory; the data
+   follows at DECODED_OFFSET */
+typedef struct {
+    DWORD ok;
+    DWORD copy_mode;
+    DWORD rate;
+    SMDI_SampleHeader header;
+} restore_decoded_t;
+
+#define DECODED_OFFSET  ((sizeof(restore_decoded_t) + 15) & ~(size_t)15)
+#define DECODE_CHUNK    65536
+
+/* A sample being got ready for upload */
+typedef struct {
+    restore_item_t* item;
+    pid_t pid;                       /* Worker, or -1 */
+    char* region;                    /* Shared memory the decoder fills */
+    size_t region_size;
+    SMDI_Sample* sample;             /* Mapped native file */
+    SMDI_SampleSource source;
+    BOOL open;                       /* The source needs closing */
+} restore_job_t;
+
+/* Open an AIFF or WAV file as a streaming source */
+static BOOL restore_open_file(SMDI_SampleSource* source, const restore_item_t* item) {
+    memset(source, 0, sizeof(SMDI_SampleSource));
+    source->dwStructSize = sizeof(SMDI_SampleSource);
+    if (item->type == SF_AIFF) {
+        return SMDI_OpenAIFSource(source, item->name, 0, PCM_DITHER_TPDF);
+    }
+    if (item->type == SF_WAV) {
+        return SMDI_OpenWAVSource(source, item->name, 0, PCM_DITHER_TPDF);
+    }
+    return FALSE;
+}
+
+/* Decoder process: the whole sample into the shared memory */
+static BOOL decode_run(const restore_item_t* item, char* region) {
+    SMDI_SampleSource source;
+    restore_decoded_t* head;
+    char* p;
+    DWORD left;
+    DWORD chunk;
+    BOOL ok;
+
+    if (!restore_open_file(&source, item)) {
+        return FALSE;
+    }
+
+    ok = ((source.header.dwLength * (DWORD)source.header.NumberOfChannels *
+           (DWORD)source.header.BitsPerWord) / 8 == item->size);
+    p = region + DECODED_OFFSET;
+    left = item->size;
+    while (ok && left > 0) {
+        chunk = (left > DECODE_CHUNK) ? DECODE_CHUNK : left;
+        ok = ((*source.lpRead)(&source, p, chunk) == chunk);
+        p += chunk;
+        left -= chunk;
+    }
+
+    head = (restore_decoded_t*)region;
+    head->copy_mode = source.dwCopyMode;
+    head->rate = source.dwSampleRate;
+    memcpy(&head->header, &source.header, sizeof(SMDI_SampleHeader));
+    head->ok = ok;
+
+    SMDI_CloseSampleSource(&source);
+    return ok;
+}
+
+/* Start getting a sample ready; without a worker it is done in line by
+   restore_ready */
+static void restore_start(restore_job_t* job, restore_item_t* item, SMDI_Archive* archive) {
+    memset(job, 0, sizeof(restore_job_t));
+    job->item = item;
+    job->pid = -1;
+
+    if (item->kind == ITEM_DECODED) {
+        job->region_size = DECODED_OFFSET + item->size;
+        job->region = SMDI_SharedAlloc(job->region_size);
+        if (job->region == NULL) {
+            return;
+        }
+    } else if (item->kind != ITEM_ARCHIVE) {
+        return;
+    }
+
+    fflush(NULL);
+    job->pid = fork();
+    if (job->pid == 0) {
+        if (item->kind == ITEM_DECODED) {
+            _exit(decode_run(item, job->region) ? 0 : 1);
+        }
+
+        /* The check reads through a handle of its own, leaving the
+           parent's file position alone */
+        archive->fp = fopen(archive->szFilename, "rb");
+        _exit((archive->fp != NULL && SMDI_ArchiveVerifySample(archive, item->index)) ? 0 : 1);
+    }
+    if (job->pid < 0 && job->region != NULL) {
+        munmap(job->region, job->region_size);
+        job->region = NULL;
+    }
+}
+
+/* Wait for the worker and set up the source to send from */
+static DWORD restore_ready(restore_job_t* job, SMDI_Archive* archive) {
+    restore_decoded_t* head;
+    restore_item_t* item;
+    int status;
+    BOOL ok;
+
+    item = job->item;
+    ok = TRUE;
+    if (job->pid > 0) {
+        while (waitpid(job->pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                status = 1;
+                break;
+            }
+        }
+        job->pid = -1;
+        ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    } else if (item->kind == ITEM_ARCHIVE) {
+        ok = SMDI_ArchiveVerifySample(archive, item->index);
+    }
+    if (!ok) {
+        return FE_READERROR;
+    }
+
+    switch (item->kind) {
+        case ITEM_ARCHIVE:
+            if (!SMDI_ArchiveOpenSource(&job->source, archive, item->index)) {
+                return FE_OPENERROR;
+            }
+            job->open = TRUE;
+            break;
+
+        case ITEM_NATIVE:
+            job->sample = SMDI_MapSample(item->name);
+            if (job->sample == NULL) {
+                return FE_OPENERROR;
+            }
+            SMDI_SampleSourceFromSample(&job->source, job->sample);
+            break;
+
+        default:
+            if (job->region == NULL) {
+                /* No worker: decode as the packets go out */
+                if (!restore_open_file(&job->source, item)) {
+                    return FE_OPENERROR;
+                }
+                job->open = TRUE;
+                break;
+            }
+            head = (restore_decoded_t*)job->region;
+            if (!head->ok) {
+                return FE_READERROR;
+            }
+            memset(&job->source, 0, sizeof(SMDI_SampleSource));
+            job->source.dwStructSize = sizeof(SMDI_SampleSource);
+            memcpy(&job->source.header, &head->header, sizeof(SMDI_SampleHeader));
+            job->source.dwSampleRate = head->rate;
+            job->source.dwCopyMode = head->copy_mode;
+            job->source.lpData = job->region + DECODED_OFFSET;
+            break;
+    }
+    return SMDIM_ENDOFPROCEDURE;
+}
+
+/* Release a sample, waiting for a worker still running on it */
+static void restore_release(restore_job_t* job) {
+    int status;
+
+    if (job->pid > 0) {
+        while (waitpid(job->pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        job->pid = -1;
+    }
+    if (job->open) {
+        SMDI_CloseSampleSource(&job->source);
+        job->open = FALSE;
+    }
+    if (job->sample != NULL) {
+        SMDI_FreeSample(job->sample);
+        job->sample = NULL;
+    }
+    if (job->region != NULL) {
+        munmap(job->region, job->region_size);
+        job->region = NULL;
+    }
+}
+
+/* Order samples by slot number, those without one last by name */
+static int restore_compare(const void* a, const void* b) {
+    const restore_item_t* ia = (const restore_item_t*)a;
+    const restore_item_t* ib = (const restore_item_t*)b;
+
+    if (ia->number != ib->number) {
+        return (ia->number < ib->number) ? -1 : 1;
+    }
+    return strcmp(ia->name, ib->name);
+}
+
+/* Make room for one more sample */
+static restore_item_t* restore_add(restore_item_t** items, DWORD* count, DWORD* size) {
+    restore_item_t* grown;
+
+    if (*count == *size) {
+        grown = (restore_item_t*)realloc(*items, (*size + 64) * sizeof(restore_item_t));
+        if (grown == NULL) {
+            return NULL;
+        }
+        *items = grown;
+        *size += 64;
+    }
+    memset(&(*items)[*count], 0, sizeof(restore_item_t));
+    return &(*items)[(*count)++];
+}
+
+/* List the samples of an archive */
+static DWORD restore_list_archive(SMDI_Archive* archive, restore_item_t** items) {
+    const SMDI_ArchiveEntry* entry;
+    restore_item_t* item;
+    DWORD count;
+    DWORD size;
+    DWORD i;
+
+    count = 0;
+    size = 0;
+    for (i = 0; i < archive->dwCount; i++) {
+        entry = SMDI_ArchiveGetEntry(archive, i);
+        item = restore_add(items, &count, &size);
+        if (item == NULL) {
+            break;
+        }
+        item->kind = ITEM_ARCHIVE;
+        item->index = i;
+        item->number = entry->dwSampleNumber;
+        item->size = entry->dwDataSize;
+        strncpy(item->name, entry->header.cName, MAX_PATH - 1);
+    }
+    return count;
+}
+
+/* List the sample files of a directory; the slot is the number the name
+   starts with. Backup files still being written (.part) are left out. */
+static DWORD restore_list_directory(const char* directory, restore_item_t** items) {
+    DIR* dir;
+    struct dirent* de;
+    struct stat st;
+    SMDI_SampleHeader sh;
+    restore_item_t* item;
+    DWORD count;
+    DWORD size;
+    DWORD type;
+    size_t len;
+
+    count = 0;
+    size = 0;
+    dir = opendir(directory);
+    if (dir == NULL) {
+        return 0;
+    }
+
+    while ((de = readdir(dir)) != NULL) {
+        len = strlen(de->d_name);
+        if (de->d_name[0] == '.' ||
+            (len >= 5 && strcmp(de->d_name + len - 5, ".part") == 0) ||
+            strlen(directory) + len + 2 > MAX_PATH) {
+            continue;
+        }
+
+        item = restore_add(items, &count, &size);
+        if (item == NULL) {
+            break;
+        }
+        sprintf(item->name, "%s/%s", directory, de->d_name);
+
+        memset(&sh, 0, sizeof(SMDI_SampleHeader));
+        sh.dwStructSize = sizeof(SMDI_SampleHeader);
+        type = FE_UNKNOWNFORMAT;
+        if (stat(item->name, &st) == 0 && S_ISREG(st.st_mode)) {
+            type = SMDI_GetFileSampleHeader(item->name, &sh);
+        }
+        if (type != SF_NATIVE && type != SF_AIFF && type != SF_WAV) {
+            count--;
+            continue;
+        }
+
+        item->kind = (type == SF_NATIVE) ? ITEM_NATIVE : ITEM_DECODED;
+        item->type = type;
+        item->number = isdigit((unsigned char)de->d_name[0]) ?
+                       (DWORD)strtoul(de->d_name, NULL, 10) : SMDI_NOSLOT;
+        item->size = (sh.dwLength * (DWORD)sh.NumberOfChannels * (DWORD)sh.BitsPerWord) / 8;
+    }
+
+    closedir(dir);
+    return count;
+}
+
+/* Choose the slot of each sample. Numbered samples keep their slot unless
+   packing; the rest take the free slots in order. Without pack_free only
+   the numbered samples get a slot. Any left over get SMDI_NOSLOT. */
+static void restore_plan(SMDI_Restore* restore, restore_item_t* items, DWORD count,
+                         BOOL pack_free) {
+    SMDI_SampleHeader sh;
+    DWORD slots;
+    DWORD slot;
+    DWORD i;
+    DWORD j;
+    BOOL taken;
+
+    for (i = 0; i < count; i++) {
+        items[i].target = SMDI_NOSLOT;
+        if ((restore->dwPlacement == SMDI_RESTORE_SAME || !pack_free) &&
+            (i == 0 || items[i - 1].number != items[i].number)) {
+            items[i].target = items[i].number;
+        }
+    }
+
+    if (!pack_free) {
+        return;
+    }
+
+    slots = (restore->dwSlots != 0) ? restore->dwSlots : SMDI_BACKUP_SLOTS;
+    i = 0;
+    for (slot = restore->dwFirstSample; slot < restore->dwFirstSample + slots; slot++) {
+        while (i < count && items[i].target != SMDI_NOSLOT) {
+            i++;
+        }
+        if (i == count) {
+            break;
+        }
+
+        taken = FALSE;
+        for (j = 0; j < count && !taken; j++) {
+            taken = (items[j].target == slot);
+        }
+        if (taken) {
+            continue;
+        }
+
+        memset(&sh, 0, sizeof(SMDI_SampleHeader));
+        sh.dwStructSize = sizeof(SMDI_SampleHeader);
+        if (SMDI_SampleHeaderRequest(restore->HA_ID, restore->SCSI_ID, slot, &sh) ==
+                SMDIM_SAMPLEHEADER && sh.bDoesExist) {
+            continue;
+        }
+        items[i].target = slot;
+    }
+}
+
+/* Next sample from position i on that has to be sent */
+static DWORD restore_next(restore_item_t* items, DWORD count, DWORD i) {
+    while (i < count && (items[i].target == SMDI_NOSLOT || items[i].unchanged)) {
+        i++;
+    }
+    return i;
+}
+
+/* Send the samples in order, each made ready by a worker while the one
+   before it uploads; the two jobs take turns */
+static DWORD restore_upload(SMDI_Restore* restore, restore_item_t* items, DWORD count,
+                            SMDI_Archive* archive) {
+    SMDI_FileTransfer ft;
+    SMDI_RestoreSample done;
+    restore_job_t jobs[2];
+    restore_job_t* job;
+    double start;
+    int current;
+    DWORD result;
+    DWORD next;
+    DWORD i;
+
+    current = 0;
+    next = restore_next(items, count, 0);
+    if (next < count) {
+        restore_start(&jobs[current], &items[next], archive);
+    }
+
+    result = SMDIM_ENDOFPROCEDURE;
+    for (i = 0; i < count; i++) {
+        memset(&done, 0, sizeof(done));
+        done.dwStructSize = sizeof(done);
+        done.lpName = items[i].name;
+        done.dwSource = items[i].number;
+        done.dwTarget = items[i].target;
+        done.dwBytes = items[i].size;
+        done.dwAction = SMDI_RESTORE_SENT;
+
+        if (items[i].target == SMDI_NOSLOT) {
+            done.dwResult = SMDIE_OUTOFRANGE;
+        } else if (items[i].unchanged) {
+            done.dwAction = SMDI_RESTORE_UNCHANGED;
+            done.dwResult = SMDIM_ENDOFPROCEDURE;
+        } else {
+            job = &jobs[current];
+            start = SMDI_GetTime();
+            done.dwResult = restore_ready(job, archive);
+            done.dWaitSeconds = SMDI_GetTime() - start;
+
+            current = 1 - current;
+            next = restore_next(items, count, i + 1);
+            if (next < count) {
+                restore_start(&jobs[current], &items[next], archive);
+            }
+
+            if (done.dwResult == SMDIM_ENDOFPROCEDURE) {
+                memset(&ft, 0, sizeof(ft));
+                ft.dwStructSize = sizeof(ft);
+                ft.HA_ID = restore->HA_ID;
+                ft.SCSI_ID = restore->SCSI_ID;
+                ft.dwSampleNumber = items[i].target;
+                ft.lpCallback = restore->lpTransferCallback;
+                ft.dwUserData = restore->dwUserData;
+                ft.bAsync = FALSE;
+                ft.bVerify = restore->bVerify;
+
+                start = SMDI_GetTime();
+                done.dwResult = SMDI_SendSampleSource(&ft, &job->source);
+                done.dSeconds = SMDI_GetTime() - start;
+                done.dwVerifyOffset = ft.dwVerifyOffset;
+            }
+            restore_release(job);
+        }
+        items[i].result = done.dwResult;
+
+        if (done.dwAction == SMDI_RESTORE_UNCHANGED) {
+            restore->dwUnchanged++;
+        } else if (done.dwResult == SMDIM_ENDOFPROCEDURE) {
+            restore->dwRestored++;
+            restore->dwBytes += done.dwBytes;
+        } else {
+            restore->dwFailed++;
+            if (result == SMDIM_ENDOFPROCEDURE) {
+                result = done.dwResult;
+            }
+        }
+        if (restore->lpCallback != NULL) {
+            (*restore->lpCallback)(restore, &done);
+        }
+    }
+    return result;
+}
+
+/* List the samples of a restore source; *archive is left open for an
+   archive. Returns FALSE if the source cannot be read. */
+static BOOL restore_list(SMDI_Restore* restore, restore_item_t** items, DWORD* count,
+                         SMDI_Archive** archive) {
+    struct stat st;
+
+    restore->dwFound = 0;
+    restore->dwRestored = 0;
+    restore->dwUnchanged = 0;
+    restore->dwDeleted = 0;
+    restore->dwFailed = 0;
+    restore->dwBytes = 0;
+
+    *items = NULL;
+    *count = 0;
+    *archive = NULL;
+    if (stat(restore->lpSource, &st) != 0) {
+        return FALSE;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        *count = restore_list_directory(restore->lpSource, items);
+    } else {
+        *archive = SMDI_ArchiveOpen(restore->lpSource, FALSE);
+        if (*archive == NULL) {
+            return FALSE;
+        }
+        *count = restore_list_archive(*archive, items);
+    }
+    restore->dwFound = *count;
+
+    if (*count > 1) {
+        qsort(*items, *count, sizeof(restore_item_t), restore_compare);
+    }
+    return TRUE;
+}
+
+/* Restore an archive or directory onto a sampler */
+DWORD SMDI_RestoreDevice(SMDI_Restore* restore) {
+    SMDI_Archive* archive;
+    restore_item_t* items;
+    DWORD count;
+    DWORD result;
+
+    if (restore == NULL || restore->lpSource == NULL) {
+        return SMDIM_ERROR;
+    }
+    if (!restore_list(restore, &items, &count, &archive)) {
+        return FE_OPENERROR;
+    }
+
+    restore_plan(restore, items, count, TRUE);
+    result = restore_upload(restore, items, count, archive);
+
+    if (archive != NULL) {
+        SMDI_ArchiveClose(archive);
+    }
+    free(items);
+    return result;
+}
+
+/* A slot as the last sync left it */
+typedef struct {
+    DWORD slot;
+    DWORD device_hash;               /* Header the sampler reported */
+    DWORD header_hash;               /* Fingerprint of the sample sent */
+    DWORD data_crc;
+} sync_entry_t;
+
+#define SYNC_MANIFEST_ID  "SMDI sync manifest 1"
+
+/* CRC-32 of a whole file */
+static BOOL file_crc(const char* filename, DWORD* crc) {
+    FILE* file;
+    char buffer[8192];
+    size_t n;
+    BOOL ok;
+
+    file = fopen(filename, "rb");
+    if (file == NULL) {
+        return FALSE;
+    }
+    *crc = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        *crc = SMDI_CRC32(*crc, buffer, (DWORD)n);
+    }
+    ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+/* Fingerprint of a sample in the source; an archive has the CRC-32 of the
+   data in its index, a file is hashed whole */
+static BOOL sync_fingerprint(restore_item_t* item, SMDI_Archive* archive) {
+    const SMDI_ArchiveEntry* entry;
+    SMDI_SampleHeader sh;
+
+    if (item->kind == ITEM_ARCHIVE) {
+        entry = SMDI_ArchiveGetEntry(archive, item->index);
+        item->header_hash = SMDI_HeaderHash(&entry->header);
+        item->data_crc = entry->dwChecksum;
+        return TRUE;
+    }
+
+    memset(&sh, 0, sizeof(SMDI_SampleHeader));
+    sh.dwStructSize = sizeof(SMDI_SampleHeader);
+    if (SMDI_GetFileSampleHeader(item->name, &sh) != item->type) {
+        return FALSE;
+    }
+    item->header_hash = SMDI_HeaderHash(&sh);
+    return file_crc(item->name, &item->data_crc);
+}
+
+/* Header of the sample in a slot; FALSE if the slot is empty */
+static BOOL sync_device_header(SMDI_Restore* restore, DWORD slot, SMDI_SampleHeader* sh) {
+    memset(sh, 0, sizeof(SMDI_SampleHeader));
+    sh->dwStructSize = sizeof(SMDI_SampleHeader);
+    return SMDI_SampleHeaderRequest(restore->HA_ID, restore->SCSI_ID, slot, sh) ==
+               SMDIM_SAMPLEHEADER && sh->bDoesExist;
+}
+
+/* Read a manifest; a missing or unreadable one is empty, so everything
+   gets sent */
+static DWORD sync_read(const char* filename, sync_entry_t** entries) {
+    FILE* file;
+    char line[128];
+    sync_entry_t entry;
+    sync_entry_t* grown;
+    DWORD count;
+    DWORD size;
+
+    *entries = NULL;
+    count = 0;
+    size = 0;
+    file = fopen(filename, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    if (fgets(line, sizeof(line), file) == NULL ||
+        strncmp(line, SYNC_MANIFEST_ID, strlen(SYNC_MANIFEST_ID)) != 0) {
+        fclose(file);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "%lu %lx %lx %lx", &entry.slot, &entry.device_hash,
+                   &entry.header_hash, &entry.data_crc) != 4) {
+            continue;
+        }
+        if (count == size) {
+            grown = (sync_entry_t*)realloc(*entries, (size + 64) * sizeof(sync_entry_t));
+            if (grown == NULL) {
+                break;
+            }
+            *entries = grown;
+            size += 64;
+        }
+        (*entries)[count++] = entry;
+    }
+
+    fclose(file);
+    return count;
+}
+
+/* Replace a manifest; it only takes the new name once fully written */
+static BOOL sync_write(const char* filename, const sync_entry_t* entries, DWORD count) {
+    FILE* file;
+    char part[MAX_PATH];
+    DWORD i;
+    BOOL ok;
+
+    if (strlen(filename) + 6 > MAX_PATH) {
+        return FALSE;
+    }
+    sprintf(part, "%s.part", filename);
+    file = fopen(part, "w");
+    if (file == NULL) {
+        return FALSE;
+    }
+
+    fprintf(file, "%s\n", SYNC_MANIFEST_ID);
+    for (i = 0; i < count; i++) {
+        fprintf(file, "%lu %08lx %08lx %08lx\n", entries[i].slot, entries[i].device_hash,
+                entries[i].header_hash, entries[i].data_crc);
+    }
+
+    ok = !ferror(file);
+    if (fclose(file) != 0) {
+        ok = FALSE;
+    }
+    if (ok && rename(part, filename) != 0) {
+        ok = FALSE;
+    }
+    if (!ok) {
+        remove(part);
+    }
+    return ok;
+}
+
+/* Entry of a slot in the manifest, or count */
+static DWORD sync_find(const sync_entry_t* entries, DWORD count, DWORD slot) {
+    DWORD i;
+
+    for (i = 0; i < count && entries[i].slot != slot; i++) {
+    }
+    return i;
+}
+
+/* Bring a sampler up to date with an archive or directory */
+DWORD SMDI_SyncDevice(SMDI_Restore* restore) {
+    SMDI_SampleHeader sh;
+    SMDI_RestoreSample done;
+    SMDI_Archive* archive;
+    restore_item_t* items;
+    sync_entry_t* old;
+    sync_entry_t* now;
+    DWORD old_count;
+    DWORD now_count;
+    DWORD count;
+    DWORD result;
+    DWORD i;
+    DWORD j;
+
+    if (restore == NULL || restore->lpSource == NULL || restore->lpManifest == NULL) {
+        return SMDIM_ERROR;
+    }
+    if (!restore_list(restore, &items, &count, &archive)) {
+        return FE_OPENERROR;
+    }
+    restore_plan(restore, items, count, FALSE);
+
+    old_count = sync_read(restore->lpManifest, &old);
+    now = (sync_entry_t*)malloc((count + old_count + 1) * sizeof(sync_entry_t));
+    if (now == NULL) {
+        free(old);
+        free(items);
+        if (archive != NULL) {
+            SMDI_ArchiveClose(archive);
+        }
+        return SMDIE_NOMEMORY;
+    }
+    now_count = 0;
+
+    /* A sample is unchanged if it matches what the manifest says was sent
+       and the slot still holds what the sampler reported then */
+    for (i = 0; i < count; i++) {
+        if (items[i].target == SMDI_NOSLOT || !sync_fingerprint(&items[i], archive)) {
+            continue;
+        }
+        j = sync_find(old, old_count, items[i].target);
+        if (j < old_count && old[j].header_hash == items[i].header_hash &&
+            old[j].data_crc == items[i].data_crc &&
+            sync_device_header(restore, items[i].target, &sh) &&
+            SMDI_HeaderHash(&sh) == old[j].device_hash) {
+            items[i].unchanged = TRUE;
+            now[now_count++] = old[j];
+        }
+    }
+
+    result = restore_upload(restore, items, count, archive);
+
+    /* Samples that failed get no entry, so the next sync sends them again */
+    for (i = 0; i < count; i++) {
+        if (items[i].target != SMDI_NOSLOT && !items[i].unchanged &&
+            items[i].result == SMDIM_ENDOFPROCEDURE &&
+            sync_device_header(restore, items[i].target, &sh)) {
+            now[now_count].slot = items[i].target;
+            now[now_count].device_hash = SMDI_HeaderHash(&sh);
+            now[now_count].header_hash = items[i].header_hash;
+            now[now_count].data_crc = items[i].data_crc;
+            now_count++;
+        }
+    }
+
+    /* Delete what the last sync sent to slots the source no longer fills,
+       unless the slot was emptied or reused since */
+    for (j = 0; j < old_count; j++) {
+        for (i = 0; i < count && items[i].target != old[j].slot; i++) {
+        }
+        if (i < count || !sync_device_header(restore, old[j].slot, &sh) ||
+            SMDI_HeaderHash(&sh) != old[j].device_hash) {
+            continue;
+        }
+
+        memset(&done, 0, sizeof(done));
+        done.dwStructSize = sizeof(done);
+        done.lpName = sh.cName;
+        done.dwSource = SMDI_NOSLOT;
+        done.dwTarget = old[j].slot;
+        done.dwAction = SMDI_RESTORE_DELETED;
+        done.dwResult = SMDI_DeleteSample(restore->HA_ID, restore->SCSI_ID, old[j].slot);
+        if (done.dwResult == SMDIM_ACK) {
+            done.dwResult = SMDIM_ENDOFPROCEDURE;
+        }
+
+        if (done.dwResult == SMDIM_ENDOFPROCEDURE) {
+            restore->dwDeleted++;
+        } else {
+            /* Kept so a later sync tries again */
+            now[now_count++] = old[j];
+            restore->dwFailed++;
+            if (result == SMDIM_ENDOFPROCEDURE) {
+                result = done.dwResult;
+            }
+        }
+        if (restore->lpCallback != NULL) {
+            (*restore->lpCallback)(restore, &done);
+        }
+    }
+
+    if (!sync_write(restore->lpManifest, now, now_count) && result == SMDIM_ENDOFPROCEDURE) {
+        result = FE_WRITEERROR;
+    }
+
+    if (archive != NULL) {
+        SMDI_ArchiveClose(archive);
+    }
+    free(now);
+    free(old);
+    free(items);
+    return result;
+}
@@ -0,0 +1,256 @@
+/*
+ * SMDI sampler-to-sampler copy implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * The source is downloaded in a reader process that writes each packet
+ * into a pipe, and this process uploads to the destination from the
+ * other end. The pipe is the ring between the two transfers: the reader
+ * blocks once it holds a pipe's worth of data the upload has not taken,
+ * and the upload blocks until the next packet is there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "smdi.h"
+#include "smdi_copy.h"
+
+/* Sample held in memory when there is no reader */
+typedef struct {
+    char* data;
+    DWORD size;
+    DWORD used;
+} copy_memory_t;
+
+/* Write or read a whole buffer on a pipe */
+static BOOL pipe_write(int fd, const void* data, DWORD bytes) {
+    const char* p;
+    int n;
+
+    p = (const char*)data;
+    while (bytes > 0) {
+        n = write(fd, p, bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return FALSE;
+        }
+        p += n;
+        bytes -= (DWORD)n;
+    }
+    return TRUE;
+}
+
+static BOOL pipe_read(int fd, void* data, DWORD bytes) {
+    char* p;
+    int n;
+
+    p = (char*)data;
+    while (bytes > 0) {
+        n = read(fd, p, bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return FALSE;
+        }
+        p += n;
+        bytes -= (DWORD)n;
+    }
+    return TRUE;
+}
+
+/* Reader side: packets go into the pipe in SMDI order */
+static BOOL pipe_sink_begin(SMDI_SampleSink* sink) {
+    sink->dwCopyMode = CM_NORMAL;
+    return TRUE;
+}
+
+static BOOL pipe_sink_write(SMDI_SampleSink* sink, void* data, DWORD bytes) {
+    return pipe_write(*(int*)sink->lpUserData, data, bytes);
+}
+
+static BOOL pipe_sink_end(SMDI_SampleSink* sink, BOOL complete) {
+    (void)sink;
+    return complete;
+}
+
+/* Upload side: each packet is read from the pipe */
+static DWORD pipe_source_read(SMDI_SampleSource* source, void* data, DWORD bytes) {
+    return pipe_read(*(int*)source->lpUserData, data, bytes) ? bytes : 0;
+}
+
+/* Staging in memory when the reader cannot be started */
+static BOOL memory_sink_begin(SMDI_SampleSink* sink) {
+    copy_memory_t* memory;
+
+    memory = (copy_memory_t*)sink->lpUserData;
+    sink->dwCopyMode = CM_NORMAL;
+    memory->size = (sink->header.dwLength * (DWORD)sink->header.NumberOfChannels *
+                    (DWORD)sink->header.BitsPerWord) / 8;
+    memory->used = 0;
+    memory->data = (char*)malloc(memory->size > 0 ? memory->size : 1);
+    return memory->data != NULL;
+}
+
+static BOOL memory_sink_write(SMDI_SampleSink* sink, void* data, DWORD bytes) {
+    copy_memory_t* memory;
+
+    memory = (copy_memory_t*)sink->lpUserData;
+    if (bytes > memory->size - memory->used) {
+        return FALSE;
+    }
+    memcpy(memory->data + memory->used, data, bytes);
+    memory->used += bytes;
+    return TRUE;
+}
+
+static BOOL memory_sink_end(SMDI_SampleSink* sink, BOOL complete) {
+    (void)sink;
+    return complete;
+}
+
+/* Download the source sample into a sink */
+static DWORD copy_download(SMDI_Copy* copy, SMDI_SampleSink* sink) {
+    SMDI_FileTransfer ft;
+
+    memset(&ft, 0, sizeof(ft));
+    ft.dwStructSize = sizeof(ft);
+    ft.HA_ID = copy->SourceHA_ID;
+    ft.SCSI_ID = copy->SourceSCSI_ID;
+    ft.dwSampleNumber = copy->dwSourceSample;
+    ft.bAsync = FALSE;
+    return SMDI_ReceiveSampleSink(&ft, sink);
+}
+
+/* Copy a sample between samplers */
+DWORD SMDI_CopySample(SMDI_Copy* copy) {
+    SMDI_FileTransfer ft;
+    SMDI_SampleSource source;
+    SMDI_SampleSink sink;
+    copy_memory_t memory;
+    void (*old_pipe)(int);
+    int fds[2];
+    int status;
+    pid_t pid;
+    DWORD result;
+
+    if (copy == NULL) {
+        return SMDIM_ERROR;
+    }
+    copy->dwBytes = 0;
+
+    /* The upload needs the format before the first packet is read */
+    memset(&copy->header, 0, sizeof(SMDI_SampleHeader));
+    copy->header.dwStructSize = sizeof(SMDI_SampleHeader);
+    result = SMDI_SampleHeaderRequest(copy->SourceHA_ID, copy->SourceSCSI_ID,
+                                      copy->dwSourceSample, &copy->header);
+    if (result == SMDIM_MESSAGEREJECT && SMDI_GetLastError() == SMDIE_NOSAMPLE) {
+        return SMDIE_NOSAMPLE;
+    }
+    if (result != SMDIM_SAMPLEHEADER) {
+        return result;
+    }
+    if (!copy->header.bDoesExist) {
+        return SMDIE_NOSAMPLE;
+    }
+
+    memset(&source, 0, sizeof(source));
+    source.dwStructSize = sizeof(source);
+    memcpy(&source.header, &copy->header, sizeof(SMDI_SampleHeader));
+    source.dwCopyMode = CM_NORMAL;
+
+    memset(&ft, 0, sizeof(ft));
+    ft.dwStructSize = sizeof(ft);
+    ft.HA_ID = copy->DestHA_ID;
+    ft.SCSI_ID = copy->DestSCSI_ID;
+    ft.dwSampleNumber = copy->dwDestSample;
+    ft.lpSampleName = copy->lpSampleName;
+    ft.lpCallback = copy->lpCallback;
+    ft.dwUserData = copy->dwUserData;
+    ft.bAsync = FALSE;
+
+    memset(&sink, 0, sizeof(sink));
+    sink.dwStructSize = sizeof(sink);
+    sink.dwCopyMode = CM_NORMAL;
+
+    /* Start the reader, unless both ends are one sampler that cannot
+       run two transfers at once */
+    pid = -1;
+    fflush(NULL);
+    if ((copy->SourceHA_ID != copy->DestHA_ID || copy->SourceSCSI_ID != copy->DestSCSI_ID) &&
+        pipe(fds) == 0) {
+        pid = fork();
+        if (pid == 0) {
+            /* Handles inherited from the parent belong to the parent */
+            SMDI_CloseDevices();
+            close(fds[0]);
+            signal(SIGPIPE, SIG_IGN);
+            sink.lpBegin = pipe_sink_begin;
+            sink.lpWrite = pipe_sink_write;
+            sink.lpEnd = pipe_sink_end;
+            sink.lpUserData = &fds[1];
+            result = copy_download(copy, &sink);
+            SMDI_CloseDevices();
+            close(fds[1]);
+            _exit(result == SMDIM_ENDOFPROCEDURE ? 0 : 1);
+        }
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+    }
+
+    if (pid > 0) {
+        close(fds[1]);
+        source.lpRead = pipe_source_read;
+        source.lpUserData = &fds[0];
+
+        /* A reader that gave up shows up as a short read, not a signal */
+        old_pipe = signal(SIGPIPE, SIG_IGN);
+        result = SMDI_SendSampleSource(&ft, &source);
+        close(fds[0]);
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                status = 1;
+                break;
+            }
+        }
+        signal(SIGPIPE, old_pipe);
+
+        /* A reader that gave up early already failed the upload with a
+           short read (FE_READERROR); any other upload failure is the
+           upload's own. One that failed after the last packet still
+           fails the copy. */
+        if (result == SMDIM_ENDOFPROCEDURE &&
+            !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+            result = FE_READERROR;
+        }
+    } else {
+        memset(&memory, 0, sizeof(memory));
+        sink.lpBegin = memory_sink_begin;
+        sink.lpWrite = memory_sink_write;
+        sink.lpEnd = memory_sink_end;
+        sink.lpUserData = &memory;
+        result = copy_download(copy, &sink);
+        if (result == SMDIM_ENDOFPROCEDURE) {
+            source.lpData = memory.data;
+            result = SMDI_SendSampleSource(&ft, &source);
+        } else {
+            result = FE_READERROR;
+        }
+        free(memory.data);
+    }
+
+    if (result == SMDIM_ENDOFPROCEDURE) {
+        copy->dwBytes = (copy->header.dwLength * (DWORD)copy->header.NumberOfChannels *
+                         (DWORD)copy->header.BitsPerWord) / 8;
+    }
+    return result;
+}
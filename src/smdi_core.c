@@ -7,7 +7,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
 #include "smdi.h"
+#include "smdi_sdmp.h"
+#include "smdi_endian.h"
+#include "smdi_pcm.h"
+#include "smdi_aif.h"
+#include "smdi_wav.h"
 #include "aspi_irix.h"
 #include "scsi_debug.h"
 
@@ -20,30 +27,74 @@
 #define LOOP_FORWARD      1
 #define LOOP_BIDIRECTIONAL 2
 
-/* Sleep function for IRIX */
+/* Sleep function for IRIX; elsewhere (emulator builds) select() waits */
 static void sleep_ms(int ms) {
+#ifdef __sgi
     /* Convert ms to clock ticks (10ms each), rounding up */
     sginap((ms + 9) / 10);
+#else
+    struct timeval tv;
+    
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (long)(ms % 1000) * 1000L;
+    select(0, NULL, NULL, NULL, &tv);
+#endif
 }
 
-/* Structure for native sample format header */
-typedef struct {
-    BYTE  signature[4];       /* 'SDMP' */
-    DWORD version;            /* Version number (1) */
-    BYTE  bitsPerSample;      /* Typically 16 */
-    BYTE  channels;           /* 1=mono, 2=stereo */
-    BYTE  loopType;           /* 0=none, 1=forward, 2=bidirectional */
-    BYTE  reserved;
-    DWORD sampleRate;         /* In Hz */
-    DWORD sampleCount;        /* Per channel */
-    DWORD loopStart;          /* Sample point */
-    DWORD loopEnd;            /* Sample point */
-    WORD  pitch;              /* MIDI note */
-    WORD  pitchFraction;      /* Cents, -50 to +50 */
-    DWORD nameLength;         /* Length of name string */
-    /* Name string follows... */
-    /* Then sample data... */
-} NativeSampleHeader;
+/* Counters for the current transfer, read back with SMDI_GetTransferStats */
+static SMDI_TransferStats g_stats;
+
+/* Requested data packet length, 0 for the defaults */
+static DWORD g_packet_size = 0;
+
+/*
+ * Transfer settings
+ */
+
+/* Set the data packet length to request (0 restores the defaults) */
+void SMDI_SetPacketSize(DWORD dwPacketSize) {
+    g_packet_size = dwPacketSize & 0x00FFFFFF;  /* 24-bit field on the wire */
+}
+
+/* Get the requested data packet length (0 for the defaults) */
+DWORD SMDI_GetPacketSize(void) {
+    return g_packet_size;
+}
+
+/* Packet length to ask for when receiving */
+static DWORD SMDI_ReceivePacketSize(void) {
+    return (g_packet_size != 0) ? g_packet_size : PACKETSIZE;
+}
+
+/* Round a packet length down so that swapped words never span packets */
+static DWORD SMDI_WholeWordPacketSize(DWORD dwPacketSize, DWORD dwCopyMode) {
+    DWORD width;
+    
+    width = SMDI_CopyModeWidth(dwCopyMode);
+    if (dwPacketSize >= width) {
+        dwPacketSize -= dwPacketSize % width;
+    }
+    return dwPacketSize;
+}
+
+/*
+ * Transfer statistics
+ */
+
+/* Clear the transfer counters */
+void SMDI_ResetTransferStats(void) {
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.dwStructSize = sizeof(g_stats);
+}
+
+/* Get a copy of the transfer counters */
+void SMDI_GetTransferStats(SMDI_TransferStats* lpStats) {
+    if (lpStats == NULL) {
+        return;
+    }
+    g_stats.dwStructSize = sizeof(g_stats);
+    memcpy(lpStats, &g_stats, sizeof(SMDI_TransferStats));
+}
 
 /*
  * Sample transmission functions
@@ -71,6 +122,13 @@ DWORD SMDI_InitSampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
         &transmissionInfo.dwPacketSize);
     
     if (messRet == SMDIM_TRANSFERACKNOWLEDGE) {
+        /* Ask for a shorter packet than the device offers if one was set */
+        if (g_packet_size != 0 && g_packet_size < transmissionInfo.dwPacketSize) {
+            transmissionInfo.dwPacketSize = g_packet_size;
+        }
+        transmissionInfo.dwPacketSize = SMDI_WholeWordPacketSize(
+            transmissionInfo.dwPacketSize, transmissionInfo.dwCopyMode);
+        
         /* Send begin sample transfer */
         messRet = SMDI_SendBeginSampleTransfer(
             transmissionInfo.HA_ID,
@@ -80,6 +138,7 @@ DWORD SMDI_InitSampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
         
         /* Handle WAIT response */
         if (messRet == SMDIM_WAIT) {
+            g_stats.dwWaits++;
             unitready = FALSE;
             while (unitready == FALSE) {
                 /* Delay 100 ms */
@@ -91,6 +150,9 @@ DWORD SMDI_InitSampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
                     NULL,
                     transmissionInfo.HA_ID,
                     transmissionInfo.SCSI_ID);
+                if (unitready == FALSE) {
+                    g_stats.dwRetries++;
+                }
             }
             /* Get the next message */
             messRet = SMDI_GetMessage(
@@ -99,9 +161,13 @@ DWORD SMDI_InitSampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
         }
     }
     
+    g_stats.dwPacketSize = transmissionInfo.dwPacketSize;
+    g_stats.dwLastMessage = messRet;
+    
     /* Check for message reject */
     if (messRet == SMDIM_MESSAGEREJECT) {
-        return SMDI_GetLastError();
+        g_stats.dwLastMessage = SMDI_GetLastError();
+        return g_stats.dwLastMessage;
     }
     
     /* Copy back the updated info */
@@ -110,14 +176,123 @@ DWORD SMDI_InitSampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
     return messRet;
 }
 
-/* Perform a sample transmission */
-DWORD SMDI_SampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
+/* Carry an upload on from a checkpoint of the same sample. Only the begin
+   is sent again: a new header would make the device drop the packets it
+   already has. The device names the packet it wants next; any packet up
+   to the checkpoint is fine, since the source can be skipped to it. A
+   device that asks for packet 0, one past the checkpoint, or answers with
+   anything other than SENDNEXTPACKET no longer holds the transfer, and
+   the caller starts over. */
+static DWORD SMDI_ResumeSampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo,
+                                           SMDI_Checkpoint* lpCheckpoint) {
+    SMDI_SampleHeader* sampleHeader;
+    DWORD samLength;
+    DWORD packetLength;
+    DWORD packetNumber;
+    DWORD messRet;
+    
+    sampleHeader = lpTransmissionInfo->lpSampleHeader;
+    samLength = (sampleHeader->dwLength *
+               (DWORD)sampleHeader->NumberOfChannels *
+               (DWORD)sampleHeader->BitsPerWord) / 8;
+    
+    /* Only a part-sent upload of this very sample to this device */
+    if (lpCheckpoint->dwPackets == 0 || lpCheckpoint->dwPacketSize == 0 ||
+        lpCheckpoint->HA_ID != lpTransmissionInfo->HA_ID ||
+        lpCheckpoint->SCSI_ID != lpTransmissionInfo->SCSI_ID ||
+        lpCheckpoint->dwSampleNumber != lpTransmissionInfo->dwSampleNumber ||
+        lpCheckpoint->dwHeaderHash != SMDI_HeaderHash(sampleHeader) ||
+        lpCheckpoint->dwPacketSize * lpCheckpoint->dwPackets >= samLength) {
+        return SMDIM_ERROR;
+    }
+    
+    packetLength = lpCheckpoint->dwPacketSize;
+    messRet = SMDI_SendBeginSampleTransfer(
+        lpTransmissionInfo->HA_ID,
+        lpTransmissionInfo->SCSI_ID,
+        lpTransmissionInfo->dwSampleNumber,
+        &packetLength);
+    g_stats.dwLastMessage = messRet;
+    if (messRet != SMDIM_SENDNEXTPACKET) {
+        return messRet;
+    }
+    packetNumber = SMDI_GetRequestedPacket();
+    if (packetNumber == 0 || packetNumber > lpCheckpoint->dwPackets) {
+        return SMDIM_ERROR;
+    }
+    
+    /* Packets are numbered from the start of the sample, so the length
+       must stay what it was */
+    lpTransmissionInfo->dwPacketSize = lpCheckpoint->dwPacketSize;
+    lpTransmissionInfo->dwTransmittedPackets = packetNumber;
+    g_stats.dwPacketSize = lpCheckpoint->dwPacketSize;
+    g_stats.dwRetries++;
+    return messRet;
+}
+
+/* Start an upload, resuming from the checkpoint where the device allows
+   it; otherwise the checkpoint is set up for the new upload */
+static DWORD SMDI_StartSampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo,
+                                          SMDI_Checkpoint* lpCheckpoint) {
+    DWORD messRet;
+    
+    if (lpCheckpoint == NULL) {
+        return SMDI_InitSampleTransmission(lpTransmissionInfo);
+    }
+    
+    lpCheckpoint->dwResumed = 0;
+    if (SMDI_ResumeSampleTransmission(lpTransmissionInfo, lpCheckpoint) == SMDIM_SENDNEXTPACKET) {
+        lpCheckpoint->dwResumed = lpTransmissionInfo->dwTransmittedPackets;
+        return SMDIM_SENDNEXTPACKET;
+    }
+    
+    messRet = SMDI_InitSampleTransmission(lpTransmissionInfo);
+    lpCheckpoint->dwStructSize = sizeof(SMDI_Checkpoint);
+    lpCheckpoint->HA_ID = lpTransmissionInfo->HA_ID;
+    lpCheckpoint->SCSI_ID = lpTransmissionInfo->SCSI_ID;
+    lpCheckpoint->dwSampleNumber = lpTransmissionInfo->dwSampleNumber;
+    lpCheckpoint->dwHeaderHash = SMDI_HeaderHash(lpTransmissionInfo->lpSampleHeader);
+    lpCheckpoint->dwPacketSize = lpTransmissionInfo->dwPacketSize;
+    lpCheckpoint->dwPackets = 0;
+    return messRet;
+}
+
+/* Note a packet the device acknowledged; a finished upload leaves nothing
+   to resume */
+static void SMDI_UpdateCheckpoint(SMDI_Checkpoint* lpCheckpoint,
+                                  SMDI_TransmissionInfo* lpTransmissionInfo, DWORD messRet) {
+    if (lpCheckpoint == NULL) {
+        return;
+    }
+    if (messRet == SMDIM_SENDNEXTPACKET) {
+        lpCheckpoint->dwPackets = lpTransmissionInfo->dwTransmittedPackets;
+    } else if (messRet == SMDIM_ENDOFPROCEDURE) {
+        lpCheckpoint->dwPackets = 0;
+    }
+}
+
+/* Read past the packets a resumed upload does not send again */
+static BOOL SMDI_SkipSourcePackets(SMDI_SampleSource* lpSource, void* lpBuffer,
+                                   DWORD dwPacketSize, DWORD dwPackets) {
+    while (dwPackets-- > 0) {
+        if ((*lpSource->lpRead)(lpSource, lpBuffer, dwPacketSize) != dwPacketSize) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Send the next data packet from lpData and handle WAIT; bInPlace sends
+   straight from lpData, which then needs 14 writable bytes in front of it */
+static DWORD SMDI_TransmitPacket(SMDI_TransmissionInfo* lpTransmissionInfo, void* lpData,
+                                 BOOL bInPlace) {
     SMDI_SampleHeader sampleHeader;
     SMDI_TransmissionInfo transmissionInfo;
     BOOL ur;
     DWORD messRet;
     DWORD transmittedBytes;
     DWORD samLength;
+    DWORD packetLength;
     
     /* Make local copies */
     memcpy(&transmissionInfo, lpTransmissionInfo, sizeof(SMDI_TransmissionInfo));
@@ -132,20 +307,32 @@ DWORD SMDI_SampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
                (DWORD)sampleHeader.BitsPerWord) / 8;
     
     /* If we're sending the last packet, adjust the size */
-    if ((transmittedBytes + transmissionInfo.dwPacketSize) > samLength) {
-        transmissionInfo.dwPacketSize = samLength - transmittedBytes;
+    packetLength = transmissionInfo.dwPacketSize;
+    if ((transmittedBytes + packetLength) > samLength) {
+        packetLength = samLength - transmittedBytes;
     }
     
-    /* Calculate data pointer for this packet */
-    messRet = SMDI_SendDataPacket(
-        transmissionInfo.HA_ID,
-        transmissionInfo.SCSI_ID,
-        transmissionInfo.dwTransmittedPackets,
-        (void*)((char*)transmissionInfo.lpSampleData + transmittedBytes),
-        transmissionInfo.dwPacketSize);
+    if (bInPlace) {
+        /* Only native file data, already in SMDI order, is sent in place */
+        messRet = SMDI_SendDataPacketInPlace(
+            transmissionInfo.HA_ID,
+            transmissionInfo.SCSI_ID,
+            transmissionInfo.dwTransmittedPackets,
+            lpData,
+            packetLength);
+    } else {
+        messRet = SMDI_SendDataPacket(
+            transmissionInfo.HA_ID,
+            transmissionInfo.SCSI_ID,
+            transmissionInfo.dwTransmittedPackets,
+            lpData,
+            packetLength,
+            transmissionInfo.dwCopyMode);
+    }
     
     /* Handle WAIT response */
     if (messRet == SMDIM_WAIT) {
+        g_stats.dwWaits++;
         ur = FALSE;
         while (ur == FALSE) {
             /* Delay 100 ticks (about 10ms) */
@@ -156,6 +343,9 @@ DWORD SMDI_SampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
                 NULL,
                 transmissionInfo.HA_ID,
                 transmissionInfo.SCSI_ID);
+            if (ur == FALSE) {
+                g_stats.dwRetries++;
+            }
         }
         /* Get the next message */
         messRet = SMDI_GetMessage(
@@ -163,6 +353,12 @@ DWORD SMDI_SampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
             transmissionInfo.SCSI_ID);
     }
     
+    if (messRet == SMDIM_SENDNEXTPACKET || messRet == SMDIM_ENDOFPROCEDURE) {
+        g_stats.dwPackets++;
+        g_stats.dwBytes += packetLength;
+    }
+    g_stats.dwLastMessage = messRet;
+    
     /* Increment packet counter */
     transmissionInfo.dwTransmittedPackets++;
     
@@ -172,45 +368,46 @@ DWORD SMDI_SampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
     return messRet;
 }
 
-/* Initialize a sample reception */
-DWORD SMDI_InitSampleReception(SMDI_TransmissionInfo* tiATemp) {
+/* Perform a sample transmission */
+DWORD SMDI_SampleTransmission(SMDI_TransmissionInfo* lpTransmissionInfo) {
+    DWORD transmittedBytes;
+    
+    /* The whole sample is in memory, so send from the current offset */
+    transmittedBytes = lpTransmissionInfo->dwPacketSize * lpTransmissionInfo->dwTransmittedPackets;
+    
+    return SMDI_TransmitPacket(lpTransmissionInfo,
+        (void*)((char*)lpTransmissionInfo->lpSampleData + transmittedBytes), FALSE);
+}
+
+/* Begin a sample reception once the header is known */
+static DWORD SMDI_BeginSampleReception(SMDI_TransmissionInfo* tiATemp) {
     SMDI_TransmissionInfo tiTemp;
     DWORD messRet;
     
-    /* Make sure we have a valid pointer */
-    if (tiATemp == NULL) {
-        printf("tiATemp is NULL!!\n");
-        return SMDIM_ERROR;
-    }
-    
     /* Make a local copy */
     memcpy(&tiTemp, tiATemp, sizeof(SMDI_TransmissionInfo));
     
     /* Initialize */
     tiTemp.dwTransmittedPackets = 0;
     
-    /* Request the sample header */
-    messRet = SMDI_SampleHeaderRequest(
+    /* Set default packet size */
+    tiTemp.dwPacketSize = SMDI_WholeWordPacketSize(
+        SMDI_ReceivePacketSize(), tiTemp.dwCopyMode);
+    
+    /* Begin the sample transfer */
+    messRet = SMDI_SendBeginSampleTransfer(
         tiTemp.HA_ID,
         tiTemp.SCSI_ID,
         tiTemp.dwSampleNumber,
-        tiTemp.lpSampleHeader);
+        &tiTemp.dwPacketSize);
     
-    if (messRet == SMDIM_SAMPLEHEADER) {
-        /* Set default packet size */
-        tiTemp.dwPacketSize = PACKETSIZE;
-        
-        /* Begin the sample transfer */
-        messRet = SMDI_SendBeginSampleTransfer(
-            tiTemp.HA_ID,
-            tiTemp.SCSI_ID,
-            tiTemp.dwSampleNumber,
-            &tiTemp.dwPacketSize);
-    }
+    g_stats.dwPacketSize = tiTemp.dwPacketSize;
+    g_stats.dwLastMessage = messRet;
     
     /* Check for message reject */
     if (messRet == SMDIM_MESSAGEREJECT) {
-        return SMDI_GetLastError();
+        g_stats.dwLastMessage = SMDI_GetLastError();
+        return g_stats.dwLastMessage;
     }
     
     /* Copy back the updated info */
@@ -219,14 +416,43 @@ DWORD SMDI_InitSampleReception(SMDI_TransmissionInfo* tiATemp) {
     return messRet;
 }
 
-/* Receive a sample packet */
-DWORD SMDI_SampleReception(SMDI_TransmissionInfo* lpTransmissionInfo) {
+/* Initialize a sample reception */
+DWORD SMDI_InitSampleReception(SMDI_TransmissionInfo* tiATemp) {
+    DWORD messRet;
+    
+    /* Make sure we have a valid pointer */
+    if (tiATemp == NULL) {
+        printf("tiATemp is NULL!!\n");
+        return SMDIM_ERROR;
+    }
+    
+    /* Request the sample header */
+    messRet = SMDI_SampleHeaderRequest(
+        tiATemp->HA_ID,
+        tiATemp->SCSI_ID,
+        tiATemp->dwSampleNumber,
+        tiATemp->lpSampleHeader);
+    
+    if (messRet != SMDIM_SAMPLEHEADER) {
+        g_stats.dwLastMessage = messRet;
+        if (messRet == SMDIM_MESSAGEREJECT) {
+            g_stats.dwLastMessage = SMDI_GetLastError();
+            return g_stats.dwLastMessage;
+        }
+        return messRet;
+    }
+    
+    return SMDI_BeginSampleReception(tiATemp);
+}
+
+/* Receive the next data packet into lpData */
+static DWORD SMDI_ReceivePacket(SMDI_TransmissionInfo* lpTransmissionInfo, void* lpData) {
     SMDI_TransmissionInfo transmissionInfo;
     SMDI_SampleHeader sampleHeader;
     DWORD messRet;
     DWORD transmittedBytes;
     DWORD samLength;
-    void* dataPtr;
+    DWORD packetLength;
     
     /* Make local copies */
     memcpy(&transmissionInfo, lpTransmissionInfo, sizeof(SMDI_TransmissionInfo));
@@ -240,21 +466,31 @@ DWORD SMDI_SampleReception(SMDI_TransmissionInfo* lpTransmissionInfo) {
                (DWORD)sampleHeader.NumberOfChannels *
                (DWORD)sampleHeader.BitsPerWord) / 8;
     
-    /* Calculate data pointer for this packet */
-    dataPtr = (void*)((char*)transmissionInfo.lpSampleData + transmittedBytes);
+    /* The last packet is shorter; never copy past the end of the sample */
+    packetLength = transmissionInfo.dwPacketSize;
+    if ((transmittedBytes + packetLength) > samLength) {
+        packetLength = samLength - transmittedBytes;
+    }
     
     /* Request the next data packet */
     messRet = SMDI_NextDataPacketRequest(
         transmissionInfo.HA_ID,
         transmissionInfo.SCSI_ID,
         transmissionInfo.dwTransmittedPackets,
-        dataPtr,
-        transmissionInfo.dwPacketSize);
+        lpData,
+        packetLength,
+        transmissionInfo.dwCopyMode);
     
-    /* If we've transferred enough data, return END OF PROCEDURE */
-    if ((transmittedBytes + transmissionInfo.dwPacketSize) >= samLength) {
-        messRet = SMDIM_ENDOFPROCEDURE;
+    if (messRet == SMDIM_DATAPACKET) {
+        g_stats.dwPackets++;
+        g_stats.dwBytes += packetLength;
+        
+        /* If we've transferred enough data, return END OF PROCEDURE */
+        if ((transmittedBytes + transmissionInfo.dwPacketSize) >= samLength) {
+            messRet = SMDIM_ENDOFPROCEDURE;
+        }
     }
+    g_stats.dwLastMessage = messRet;
     
     /* Increment packet counter */
     transmissionInfo.dwTransmittedPackets++;
@@ -265,15 +501,77 @@ DWORD SMDI_SampleReception(SMDI_TransmissionInfo* lpTransmissionInfo) {
     return messRet;
 }
 
+/* Receive a sample packet */
+DWORD SMDI_SampleReception(SMDI_TransmissionInfo* lpTransmissionInfo) {
+    SMDI_SampleHeader* sampleHeader;
+    DWORD transmittedBytes;
+    DWORD samLength;
+    DWORD dwCopyMode;
+    DWORD width;
+    DWORD dwStart;
+    DWORD dwEnd;
+    DWORD messRet;
+    char* lpData;
+    
+    /* The whole sample is in memory, so receive at the current offset */
+    transmittedBytes = lpTransmissionInfo->dwPacketSize * lpTransmissionInfo->dwTransmittedPackets;
+    lpData = (char*)lpTransmissionInfo->lpSampleData;
+    
+    width = SMDI_CopyModeWidth(lpTransmissionInfo->dwCopyMode);
+    if (lpTransmissionInfo->dwPacketSize % width == 0) {
+        return SMDI_ReceivePacket(lpTransmissionInfo, (void*)(lpData + transmittedBytes));
+    }
+    
+    /* The device chose a packet length that splits words: take the bytes
+       as they come and swap each word once all of it is in */
+    dwCopyMode = lpTransmissionInfo->dwCopyMode;
+    lpTransmissionInfo->dwCopyMode = CM_NORMAL;
+    messRet = SMDI_ReceivePacket(lpTransmissionInfo, (void*)(lpData + transmittedBytes));
+    lpTransmissionInfo->dwCopyMode = dwCopyMode;
+    
+    if (messRet == SMDIM_DATAPACKET || messRet == SMDIM_ENDOFPROCEDURE) {
+        sampleHeader = lpTransmissionInfo->lpSampleHeader;
+        samLength = (sampleHeader->dwLength *
+                   (DWORD)sampleHeader->NumberOfChannels *
+                   (DWORD)sampleHeader->BitsPerWord) / 8;
+        dwEnd = transmittedBytes + lpTransmissionInfo->dwPacketSize;
+        if (dwEnd > samLength) {
+            dwEnd = samLength;
+        }
+        dwStart = transmittedBytes - transmittedBytes % width;
+        dwEnd -= dwEnd % width;
+        if (dwEnd > dwStart) {
+            SMDI_CopySampleData(lpData + dwStart, lpData + dwStart, dwEnd - dwStart, dwCopyMode);
+        }
+    }
+    return messRet;
+}
+
 /*
  * File-based sample operations
  */
 
+/* Open an AIFF or WAV file as a source decoding to 8 or 16 bit words */
+static BOOL SMDI_OpenFileSource(SMDI_SampleSource* lpSource, char cFileName[], DWORD dwFileType) {
+    if (dwFileType == SF_AIFF) {
+        return SMDI_OpenAIFSource(lpSource, cFileName, 0, PCM_DITHER_TPDF);
+    }
+    if (dwFileType == SF_WAV) {
+        return SMDI_OpenWAVSource(lpSource, cFileName, 0, PCM_DITHER_TPDF);
+    }
+    return FALSE;
+}
+
+/* Read-back verification of a file, below */
+static DWORD SMDI_VerifyFile(SMDI_FileTransfer* lpFileTransfer, DWORD* lpOffset);
+
 /* Get sample header from a file */
 DWORD SMDI_GetFileSampleHeader(char cFileName[], SMDI_SampleHeader* lpSampleHeader) {
     FILE* hFile;
-    NativeSampleHeader nativeHdr;
+    SMDI_NativeHeader nativeHdr;
     SMDI_SampleHeader shMyTemp;
+    SMDI_SampleSource source;
+    DWORD dwFileType;
     char buffer[8];
     
     /* Make sure we have valid pointers */
@@ -297,15 +595,17 @@ DWORD SMDI_GetFileSampleHeader(char cFileName[], SMDI_SampleHeader* lpSampleHead
     }
     
     /* Read file signature */
-    fread(buffer, 1, 4, hFile);
+    if (fread(buffer, 1, 4, hFile) != 4) {
+        fclose(hFile);
+        return FE_UNKNOWNFORMAT;
+    }
     
     /* Check for native sample format */
     if (memcmp(buffer, "SDMP", 4) == 0) {
-        /* Read the header from the beginning */
+        /* Read the header from the beginning (version 1 or 2) */
         fseek(hFile, 0, SEEK_SET);
         
-        /* Read native sample header */
-        if (fread(&nativeHdr, sizeof(NativeSampleHeader), 1, hFile) != 1) {
+        if (!SMDI_ReadNativeHeader(hFile, &nativeHdr) || nativeHdr.sampleRate == 0) {
             fclose(hFile);
             return FE_UNKNOWNFORMAT;
         }
@@ -322,16 +622,13 @@ DWORD SMDI_GetFileSampleHeader(char cFileName[], SMDI_SampleHeader* lpSampleHead
         shMyTemp.wPitch = nativeHdr.pitch;
         shMyTemp.wPitchFraction = nativeHdr.pitchFraction;
         
-        /* Read name */
-        shMyTemp.NameLength = (BYTE)(nativeHdr.nameLength > 255 ? 255 : nativeHdr.nameLength);
+        /* Copy name */
+        shMyTemp.NameLength = (BYTE)nativeHdr.nameLength;
         memset(shMyTemp.cName, 0, 256);
+        memcpy(shMyTemp.cName, nativeHdr.name, nativeHdr.nameLength);
         
-        if (shMyTemp.NameLength > 0) {
-            fread(shMyTemp.cName, 1, shMyTemp.NameLength, hFile);
-        }
-        
-        /* Data offset is right after the header and name */
-        shMyTemp.dwDataOffset = sizeof(NativeSampleHeader) + nativeHdr.nameLength;
+        /* Data offset comes from the header */
+        shMyTemp.dwDataOffset = nativeHdr.dataOffset;
         
         fclose(hFile);
         
@@ -346,9 +643,30 @@ DWORD SMDI_GetFileSampleHeader(char cFileName[], SMDI_SampleHeader* lpSampleHead
         return SF_NATIVE;
     }
     
-    /* Unknown format */
     fclose(hFile);
-    return FE_UNKNOWNFORMAT;
+    
+    /* AIFF and WAV files give the header of the words they decode to */
+    if (memcmp(buffer, "FORM", 4) == 0) {
+        dwFileType = SF_AIFF;
+    } else if (memcmp(buffer, "RIFF", 4) == 0 || memcmp(buffer, "RF64", 4) == 0 ||
+               memcmp(buffer, "BW64", 4) == 0) {
+        dwFileType = SF_WAV;
+    } else {
+        /* Unknown format */
+        return FE_UNKNOWNFORMAT;
+    }
+    
+    if (!SMDI_OpenFileSource(&source, cFileName, dwFileType)) {
+        return FE_UNKNOWNFORMAT;
+    }
+    memcpy(&shMyTemp, &source.header, sizeof(SMDI_SampleHeader));
+    shMyTemp.dwStructSize = lpSampleHeader->dwStructSize;
+    shMyTemp.dwDataOffset = 0;
+    SMDI_CloseSampleSource(&source);
+    
+    memcpy(lpSampleHeader, &shMyTemp, sizeof(SMDI_SampleHeader));
+    
+    return dwFileType;
 }
 
 /* Initialize a file-based sample transmission */
@@ -356,6 +674,7 @@ DWORD SMDI_InitFileSampleTransmission(SMDI_FileTransmissionInfo* lpFileTransmiss
     SMDI_FileTransmissionInfo ftiTemp;
     SMDI_TransmissionInfo tiTemp;
     SMDI_SampleHeader shTemp;
+    SMDI_NativeHeader nativeHdr;
     DWORD dwTemp;
     
     /* Make local copies */
@@ -368,32 +687,50 @@ DWORD SMDI_InitFileSampleTransmission(SMDI_FileTransmissionInfo* lpFileTransmiss
     /* Make a local copy of the sample header */
     memcpy(&shTemp, tiTemp.lpSampleHeader, sizeof(SMDI_SampleHeader));
     
-    /* Default pitch settings */
-    shTemp.wPitch = 60;         /* Middle C */
-    shTemp.wPitchFraction = 0;
-    
     /* Check file format */
     if (dwTemp == SF_NATIVE) {
-        /* No need for byte swapping on big-endian IRIX */
+        /* Default pitch settings */
+        shTemp.wPitch = 60;         /* Middle C */
+        shTemp.wPitchFraction = 0;
+        
+        /* Native files hold SMDI (big-endian) order; send the data as is */
         tiTemp.dwCopyMode = CM_NORMAL;
         
         /* Initialize the sample transmission */
-        dwTemp = SMDI_InitSampleTransmission(&tiTemp);
+        dwTemp = SMDI_StartSampleTransmission(&tiTemp, ftiTemp.lpCheckpoint);
         
         if (dwTemp == SMDIM_SENDNEXTPACKET) {
             /* Open the file */
             ftiTemp.hFile = fopen(ftiTemp.cFileName, "rb");
+            if (ftiTemp.hFile == NULL) {
+                return FE_OPENERROR;
+            }
             
-            /* Seek to the data */
-            fseek(ftiTemp.hFile, shTemp.dwDataOffset, SEEK_SET);
-            
-            /* Allocate buffer for data */
-            tiTemp.lpSampleData = malloc(tiTemp.dwPacketSize);
+            /* Map the file so packets go out straight from its pages */
+            ftiTemp.lpMapBase = NULL;
+            ftiTemp.dwMapSize = 0;
+            if (SMDI_ReadNativeHeader(ftiTemp.hFile, &nativeHdr)) {
+                ftiTemp.lpMapBase = SMDI_MapNativeFile(ftiTemp.hFile, &nativeHdr, &ftiTemp.dwMapSize);
+            }
             
-            /* Check for allocation failure */
-            if (tiTemp.lpSampleData == NULL) {
+            if (ftiTemp.lpMapBase != NULL) {
+                /* The mapping stays valid after the file is closed */
                 fclose(ftiTemp.hFile);
-                return SMDIM_ERROR;
+                ftiTemp.hFile = NULL;
+                tiTemp.lpSampleData = (char*)ftiTemp.lpMapBase + shTemp.dwDataOffset;
+            } else {
+                /* Seek to the data, past what a resumed upload already sent */
+                fseek(ftiTemp.hFile, (long)(shTemp.dwDataOffset +
+                      tiTemp.dwPacketSize * tiTemp.dwTransmittedPackets), SEEK_SET);
+                
+                /* Allocate buffer for data */
+                tiTemp.lpSampleData = malloc(tiTemp.dwPacketSize);
+                
+                /* Check for allocation failure */
+                if (tiTemp.lpSampleData == NULL) {
+                    fclose(ftiTemp.hFile);
+                    return SMDIM_ERROR;
+                }
             }
         }
         
@@ -401,6 +738,42 @@ DWORD SMDI_InitFileSampleTransmission(SMDI_FileTransmissionInfo* lpFileTransmiss
         memcpy(tiTemp.lpSampleHeader, &shTemp, sizeof(SMDI_SampleHeader));
         memcpy(ftiTemp.lpTransmissionInfo, &tiTemp, sizeof(SMDI_TransmissionInfo));
         memcpy(lpFileTransmissionInfo, &ftiTemp, sizeof(SMDI_FileTransmissionInfo));
+    } else if (dwTemp == SF_AIFF || dwTemp == SF_WAV) {
+        /* The file is decoded a packet at a time into one buffer */
+        ftiTemp.lpSource = (SMDI_SampleSource*)malloc(sizeof(SMDI_SampleSource));
+        if (ftiTemp.lpSource == NULL) {
+            return SMDIM_ERROR;
+        }
+        if (!SMDI_OpenFileSource(ftiTemp.lpSource, ftiTemp.cFileName, dwTemp)) {
+            free(ftiTemp.lpSource);
+            return FE_OPENERROR;
+        }
+        tiTemp.dwCopyMode = ftiTemp.lpSource->dwCopyMode;
+        
+        /* Initialize the sample transmission */
+        dwTemp = SMDI_StartSampleTransmission(&tiTemp, ftiTemp.lpCheckpoint);
+        
+        tiTemp.lpSampleData = NULL;
+        if (dwTemp == SMDIM_SENDNEXTPACKET) {
+            tiTemp.lpSampleData = malloc(tiTemp.dwPacketSize);
+            if (tiTemp.lpSampleData == NULL) {
+                dwTemp = SMDIM_ERROR;
+            } else if (!SMDI_SkipSourcePackets(ftiTemp.lpSource, tiTemp.lpSampleData,
+                                               tiTemp.dwPacketSize, tiTemp.dwTransmittedPackets)) {
+                free(tiTemp.lpSampleData);
+                tiTemp.lpSampleData = NULL;
+                dwTemp = FE_READERROR;
+            }
+        }
+        if (dwTemp != SMDIM_SENDNEXTPACKET) {
+            SMDI_CloseSampleSource(ftiTemp.lpSource);
+            free(ftiTemp.lpSource);
+            ftiTemp.lpSource = NULL;
+        }
+        
+        /* Copy back the updated headers */
+        memcpy(ftiTemp.lpTransmissionInfo, &tiTemp, sizeof(SMDI_TransmissionInfo));
+        memcpy(lpFileTransmissionInfo, &ftiTemp, sizeof(SMDI_FileTransmissionInfo));
     }
     
     return dwTemp;
@@ -412,30 +785,64 @@ DWORD SMDI_FileSampleTransmission(SMDI_FileTransmissionInfo* lpFileTransmissionI
     SMDI_TransmissionInfo tiTemp;
     SMDI_SampleHeader shTemp;
     DWORD dwTemp;
+    DWORD dwTotal;
+    DWORD dwSent;
+    DWORD dwBytes;
     
     /* Make local copies */
     memcpy(&ftiTemp, lpFileTransmissionInfo, sizeof(SMDI_FileTransmissionInfo));
     memcpy(&tiTemp, ftiTemp.lpTransmissionInfo, sizeof(SMDI_TransmissionInfo));
     memcpy(&shTemp, tiTemp.lpSampleHeader, sizeof(SMDI_SampleHeader));
     
-    /* Read the next chunk of data from file */
-    fread(tiTemp.lpSampleData, 1, tiTemp.dwPacketSize, ftiTemp.hFile);
-    
-    /* Send the data */
-    dwTemp = SMDI_SampleTransmission(&tiTemp);
-    
-    /* Check for end of procedure */
-    if (dwTemp == SMDIM_ENDOFPROCEDURE) {
-        /* Free resources */
-        free(tiTemp.lpSampleData);
-        fclose(ftiTemp.hFile);
-        return dwTemp;
-    }
-    else if (dwTemp != SMDIM_SENDNEXTPACKET) {
-        /* Error - free resources */
-        free(tiTemp.lpSampleData);
-        fclose(ftiTemp.hFile);
+    if (ftiTemp.lpMapBase != NULL) {
+        /* Send straight from the mapped file, no copy */
+        dwTemp = SMDI_TransmitPacket(&tiTemp,
+            (char*)tiTemp.lpSampleData + tiTemp.dwPacketSize * tiTemp.dwTransmittedPackets, TRUE);
+        
+        if (dwTemp != SMDIM_SENDNEXTPACKET) {
+            SMDI_UnmapNativeFile(ftiTemp.lpMapBase, ftiTemp.dwMapSize);
+            ftiTemp.lpMapBase = NULL;
+            tiTemp.lpSampleData = NULL;
+        }
+    } else if (ftiTemp.lpSource != NULL) {
+        /* Decode the next packet; the last one holds what is left */
+        dwTotal = (shTemp.dwLength * (DWORD)shTemp.NumberOfChannels *
+                   (DWORD)shTemp.BitsPerWord) / 8;
+        dwSent = tiTemp.dwPacketSize * tiTemp.dwTransmittedPackets;
+        dwBytes = tiTemp.dwPacketSize;
+        if (dwSent + dwBytes > dwTotal) {
+            dwBytes = dwTotal - dwSent;
+        }
+        if ((*ftiTemp.lpSource->lpRead)(ftiTemp.lpSource, tiTemp.lpSampleData, dwBytes) != dwBytes) {
+            dwTemp = FE_READERROR;
+        } else {
+            dwTemp = SMDI_TransmitPacket(&tiTemp, tiTemp.lpSampleData, FALSE);
+        }
+        
+        if (dwTemp != SMDIM_SENDNEXTPACKET) {
+            /* Done or failed - free resources */
+            free(tiTemp.lpSampleData);
+            tiTemp.lpSampleData = NULL;
+            SMDI_CloseSampleSource(ftiTemp.lpSource);
+            free(ftiTemp.lpSource);
+            ftiTemp.lpSource = NULL;
+        }
+    } else {
+        /* Read the next chunk of data from file */
+        fread(tiTemp.lpSampleData, 1, tiTemp.dwPacketSize, ftiTemp.hFile);
+        
+        /* Send the data; the buffer only ever holds the current packet */
+        dwTemp = SMDI_TransmitPacket(&tiTemp, tiTemp.lpSampleData, FALSE);
+        
+        if (dwTemp != SMDIM_SENDNEXTPACKET) {
+            /* Done or failed - free resources */
+            free(tiTemp.lpSampleData);
+            tiTemp.lpSampleData = NULL;
+            fclose(ftiTemp.hFile);
+            ftiTemp.hFile = NULL;
+        }
     }
+    SMDI_UpdateCheckpoint(ftiTemp.lpCheckpoint, &tiTemp, dwTemp);
     
     /* Copy back the updated headers */
     memcpy(tiTemp.lpSampleHeader, &shTemp, sizeof(SMDI_SampleHeader));
@@ -451,8 +858,7 @@ DWORD SMDI_InitFileSampleReception(SMDI_FileTransmissionInfo* lpFileTransmission
     SMDI_TransmissionInfo tiTemp;
     SMDI_SampleHeader shTemp;
     DWORD dwTemp;
-    DWORD nameLen;
-    NativeSampleHeader nativeHdr;
+    SMDI_NativeHeader nativeHdr;
     
     /* Make local copies */
     memcpy(&ftiTemp, lpFileTransmissionInfo, sizeof(SMDI_FileTransmissionInfo));
@@ -471,7 +877,7 @@ DWORD SMDI_InitFileSampleReception(SMDI_FileTransmissionInfo* lpFileTransmission
     }
     
     /* Set default packet size */
-    tiTemp.dwPacketSize = PACKETSIZE;
+    tiTemp.dwPacketSize = SMDI_ReceivePacketSize();
     
     /* Open output file */
     ftiTemp.hFile = fopen(ftiTemp.cFileName, "wb");
@@ -479,46 +885,37 @@ DWORD SMDI_InitFileSampleReception(SMDI_FileTransmissionInfo* lpFileTransmission
         return FE_OPENERROR;
     }
     
-    /* Write native sample format header */
-    memcpy(nativeHdr.signature, "SDMP", 4);
-    nativeHdr.version = 1;
+    /* Write native sample format header; the data follows at the aligned offset */
+    SMDI_InitNativeHeader(&nativeHdr);
     nativeHdr.bitsPerSample = shTemp.BitsPerWord;
     nativeHdr.channels = shTemp.NumberOfChannels;
     nativeHdr.loopType = shTemp.LoopControl;
-    nativeHdr.reserved = 0;
     nativeHdr.sampleRate = 1000000000 / shTemp.dwPeriod;
     nativeHdr.sampleCount = shTemp.dwLength;
     nativeHdr.loopStart = shTemp.dwLoopStart;
     nativeHdr.loopEnd = shTemp.dwLoopEnd;
     nativeHdr.pitch = shTemp.wPitch;
     nativeHdr.pitchFraction = shTemp.wPitchFraction;
+    strncpy(nativeHdr.name, shTemp.cName, 255);
+    nativeHdr.name[255] = '\0';
     
-    /* Get the name length */
-    nameLen = strlen(shTemp.cName);
-    if (nameLen > 255) {
-        nameLen = 255;
+    if (!SMDI_WriteNativeHeader(ftiTemp.hFile, &nativeHdr)) {
+        fclose(ftiTemp.hFile);
+        remove(ftiTemp.cFileName);
+        return FE_OPENERROR;
     }
-    nativeHdr.nameLength = nameLen;
-    
-    /* Write header */
-    fwrite(&nativeHdr, sizeof(NativeSampleHeader), 1, ftiTemp.hFile);
     
-    /* Write name */
-    if (nameLen > 0) {
-        fwrite(shTemp.cName, 1, nameLen, ftiTemp.hFile);
-    }
+    /* Native files hold SMDI (big-endian) order; store the data as is */
+    tiTemp.dwCopyMode = CM_NORMAL;
     
-    /* Initialize the sample reception */
-    dwTemp = SMDI_InitSampleReception(&tiTemp);
+    /* Begin the reception; the header is already known */
+    dwTemp = SMDI_BeginSampleReception(&tiTemp);
     if (dwTemp != SMDIM_TRANSFERACKNOWLEDGE) {
         fclose(ftiTemp.hFile);
         remove(ftiTemp.cFileName);
         return dwTemp;
     }
     
-    /* We're on big-endian IRIX, so no byte swapping needed */
-    tiTemp.dwCopyMode = CM_NORMAL;
-    
     /* Allocate sample data buffer */
     tiTemp.lpSampleData = malloc(tiTemp.dwPacketSize);
     if (tiTemp.lpSampleData == NULL) {
@@ -548,13 +945,21 @@ DWORD SMDI_FileSampleReception(SMDI_FileTransmissionInfo* lpFileTransmissionInfo
     memcpy(&tiTemp, ftiTemp.lpTransmissionInfo, sizeof(SMDI_TransmissionInfo));
     memcpy(&shTemp, tiTemp.lpSampleHeader, sizeof(SMDI_SampleHeader));
     
-    /* Receive the next packet */
-    dwTemp = SMDI_SampleReception(&tiTemp);
+    /* Receive the next packet; the buffer only ever holds the current packet */
+    dwTemp = SMDI_ReceivePacket(&tiTemp, tiTemp.lpSampleData);
+    
+    /* Error - free resources */
+    if (dwTemp != SMDIM_DATAPACKET && dwTemp != SMDIM_ENDOFPROCEDURE) {
+        fclose(ftiTemp.hFile);
+        free(tiTemp.lpSampleData);
+        memcpy(ftiTemp.lpTransmissionInfo, &tiTemp, sizeof(SMDI_TransmissionInfo));
+        return dwTemp;
+    }
     
     /* Calculate bytes to write */
     bytesToWrite = tiTemp.dwPacketSize;
     
-    /* If not data packet or last packet, adjust size */
+    /* If last packet, adjust size */
     if (dwTemp != SMDIM_DATAPACKET) {
         bytesToWrite = (shTemp.dwLength *
                       ((DWORD)shTemp.NumberOfChannels) *
@@ -629,6 +1034,8 @@ DWORD SMDI_SendFile(SMDI_FileTransfer* lpFileTransfer) {
     SMDI_SampleHeader* shTemp;
     void* lpTemp;
     SMDI_FileTransfer fileTransfer;
+    DWORD dwTemp;
+    DWORD dwOffset;
     
     /* Allocate memory for the structures */
     ftiTemp = (SMDI_FileTransmissionInfo*)malloc(
@@ -656,6 +1063,10 @@ DWORD SMDI_SendFile(SMDI_FileTransfer* lpFileTransfer) {
     fileTransfer.lpCallback = NULL;
     fileTransfer.dwUserData = 0;
     fileTransfer.lpReturnValue = NULL;
+    fileTransfer.bVerify = FALSE;
+    fileTransfer.dwVerifyOffset = 0;
+    fileTransfer.lpCheckpoint = NULL;
+    fileTransfer.lpSampleHeader = NULL;
     
     /* Copy the provided structure (using the minimum of the two sizes) */
     memcpy(&fileTransfer, lpFileTransfer,
@@ -664,6 +1075,10 @@ DWORD SMDI_SendFile(SMDI_FileTransfer* lpFileTransfer) {
     
     /* Initialize structures */
     ftiTemp->dwStructSize = sizeof(*ftiTemp);
+    ftiTemp->lpMapBase = NULL;
+    ftiTemp->dwMapSize = 0;
+    ftiTemp->lpSource = NULL;
+    ftiTemp->lpCheckpoint = fileTransfer.lpCheckpoint;
     tiTemp->dwStructSize = sizeof(*tiTemp);
     shTemp->dwStructSize = sizeof(*shTemp);
     
@@ -684,7 +1099,7 @@ DWORD SMDI_SendFile(SMDI_FileTransfer* lpFileTransfer) {
         shTemp->NameLength = 0;
     }
     
-    /* Always use normal copy mode on big-endian system */
+    /* Native files are in SMDI byte order; decoded files set their own */
     tiTemp->dwCopyMode = CM_NORMAL;
     
     /* Set callback and user data */
@@ -702,7 +1117,140 @@ DWORD SMDI_SendFile(SMDI_FileTransfer* lpFileTransfer) {
     }
     
     /* Execute synchronously */
-    return SMDI_SendFileMain(lpTemp);
+    dwTemp = SMDI_SendFileMain(lpTemp);
+    
+    /* Optionally prove the sampler holds what was sent */
+    if (dwTemp == SMDIM_ENDOFPROCEDURE && fileTransfer.bVerify) {
+        dwTemp = SMDI_VerifyFile(&fileTransfer, &dwOffset);
+        if (dwTemp == FE_VERIFYERROR && lpFileTransfer->dwStructSize >= sizeof(SMDI_FileTransfer)) {
+            lpFileTransfer->dwVerifyOffset = dwOffset;
+        }
+    }
+    return dwTemp;
+}
+
+/* Send a sample from a streaming source to the device */
+DWORD SMDI_SendSampleSource(SMDI_FileTransfer* lpFileTransfer, SMDI_SampleSource* lpSource) {
+    SMDI_FileTransmissionInfo ftiTemp;
+    SMDI_TransmissionInfo tiTemp;
+    SMDI_SampleHeader shTemp;
+    SMDI_FileTransfer fileTransfer;
+    DWORD dwTemp;
+    DWORD dwTotal;
+    DWORD dwSent;
+    DWORD dwBytes;
+    DWORD dwOffset;
+    void* lpBuffer;
+    
+    if (lpFileTransfer == NULL || lpSource == NULL ||
+        (lpSource->lpData == NULL && lpSource->lpRead == NULL)) {
+        return SMDIM_ERROR;
+    }
+    
+    /* Copy the provided structure (using the minimum of the two sizes) */
+    memset(&fileTransfer, 0, sizeof(fileTransfer));
+    memcpy(&fileTransfer, lpFileTransfer,
+        (lpFileTransfer->dwStructSize > sizeof(fileTransfer)) ?
+        sizeof(fileTransfer) : lpFileTransfer->dwStructSize);
+    
+    /* The header comes from the source, the name from the transfer if given */
+    memcpy(&shTemp, &lpSource->header, sizeof(SMDI_SampleHeader));
+    shTemp.dwStructSize = sizeof(shTemp);
+    shTemp.bDoesExist = TRUE;
+    if (fileTransfer.lpSampleName != NULL) {
+        strncpy(shTemp.cName, fileTransfer.lpSampleName, 255);
+        shTemp.cName[255] = '\0';
+        shTemp.NameLength = (BYTE)strlen(shTemp.cName);
+    }
+    
+    memset(&tiTemp, 0, sizeof(tiTemp));
+    tiTemp.dwStructSize = sizeof(tiTemp);
+    tiTemp.HA_ID = fileTransfer.HA_ID;
+    tiTemp.SCSI_ID = fileTransfer.SCSI_ID;
+    tiTemp.dwSampleNumber = fileTransfer.dwSampleNumber;
+    tiTemp.dwCopyMode = lpSource->dwCopyMode;
+    tiTemp.lpSampleHeader = &shTemp;
+    
+    /* Callbacks see the same structures as for a file, without the file */
+    memset(&ftiTemp, 0, sizeof(ftiTemp));
+    ftiTemp.dwStructSize = sizeof(ftiTemp);
+    ftiTemp.lpCallBackProcedure = (void (*)(SMDI_FileTransmissionInfo*, DWORD))fileTransfer.lpCallback;
+    ftiTemp.lpTransmissionInfo = &tiTemp;
+    ftiTemp.lpReturnValue = fileTransfer.lpReturnValue;
+    ftiTemp.dwUserData = fileTransfer.dwUserData;
+    
+    if (fileTransfer.lpReturnValue != NULL) {
+        *(fileTransfer.lpReturnValue) = (DWORD)-1;
+    }
+    
+    dwTemp = SMDI_StartSampleTransmission(&tiTemp, fileTransfer.lpCheckpoint);
+    if (dwTemp == SMDIM_SENDNEXTPACKET) {
+        dwTotal = (shTemp.dwLength * (DWORD)shTemp.NumberOfChannels *
+                   (DWORD)shTemp.BitsPerWord) / 8;
+        
+        /* Sources in memory are sent from where they lie; others fill one
+           packet buffer at a time */
+        lpBuffer = NULL;
+        if (lpSource->lpData != NULL) {
+            tiTemp.lpSampleData = lpSource->lpData;
+        } else {
+            lpBuffer = malloc(tiTemp.dwPacketSize);
+            if (lpBuffer == NULL) {
+                dwTemp = SMDIE_NOMEMORY;
+            } else if (!SMDI_SkipSourcePackets(lpSource, lpBuffer, tiTemp.dwPacketSize,
+                                               tiTemp.dwTransmittedPackets)) {
+                dwTemp = FE_READERROR;
+            }
+        }
+        
+        while (dwTemp == SMDIM_SENDNEXTPACKET) {
+            if (lpBuffer != NULL) {
+                dwSent = tiTemp.dwPacketSize * tiTemp.dwTransmittedPackets;
+                dwBytes = tiTemp.dwPacketSize;
+                if (dwSent + dwBytes > dwTotal) {
+                    dwBytes = dwTotal - dwSent;
+                }
+                if ((*lpSource->lpRead)(lpSource, lpBuffer, dwBytes) != dwBytes) {
+                    dwTemp = FE_READERROR;
+                    break;
+                }
+                dwTemp = SMDI_TransmitPacket(&tiTemp, lpBuffer, FALSE);
+            } else {
+                dwTemp = SMDI_SampleTransmission(&tiTemp);
+            }
+            SMDI_UpdateCheckpoint(fileTransfer.lpCheckpoint, &tiTemp, dwTemp);
+            
+            /* Call callback if provided */
+            if (ftiTemp.lpCallBackProcedure != NULL) {
+                (*ftiTemp.lpCallBackProcedure)(&ftiTemp, ftiTemp.dwUserData);
+            }
+        }
+        
+        free(lpBuffer);
+    }
+    
+    /* Store result if pointer provided */
+    if (fileTransfer.lpReturnValue != NULL) {
+        *(fileTransfer.lpReturnValue) = dwTemp;
+    }
+    
+    /* A source in memory can be read again to check the sampler's copy */
+    if (dwTemp == SMDIM_ENDOFPROCEDURE && fileTransfer.bVerify && lpSource->lpData != NULL) {
+        dwTemp = SMDI_VerifySampleSource(&fileTransfer, lpSource, &dwOffset);
+        if (dwTemp == FE_VERIFYERROR && lpFileTransfer->dwStructSize >= sizeof(SMDI_FileTransfer)) {
+            lpFileTransfer->dwVerifyOffset = dwOffset;
+        }
+    }
+    
+    return dwTemp;
+}
+
+/* Release a sample source */
+void SMDI_CloseSampleSource(SMDI_SampleSource* lpSource) {
+    if (lpSource != NULL && lpSource->lpClose != NULL) {
+        (*lpSource->lpClose)(lpSource);
+        lpSource->lpClose = NULL;
+    }
 }
 
 /* Helper function for sample reception (for ReceiveFile) */
@@ -748,6 +1296,340 @@ unsigned long SMDI_ReceiveFileMain(void* lpStart) {
     return dwTemp;
 }
 
+/* Receive a sample from the device into a streaming sink */
+DWORD SMDI_ReceiveSampleSink(SMDI_FileTransfer* lpFileTransfer, SMDI_SampleSink* lpSink) {
+    SMDI_FileTransmissionInfo ftiTemp;
+    SMDI_TransmissionInfo tiTemp;
+    SMDI_SampleHeader shTemp;
+    SMDI_FileTransfer fileTransfer;
+    DWORD dwTemp;
+    DWORD dwTotal;
+    DWORD dwReceived;
+    DWORD dwBytes;
+    DWORD dwCopyMode;
+    DWORD dwWidth;
+    DWORD dwCarry;
+    DWORD dwWhole;
+    char* lpBuffer;
+    
+    if (lpFileTransfer == NULL || lpSink == NULL || lpSink->lpBegin == NULL ||
+        lpSink->lpWrite == NULL || lpSink->lpEnd == NULL) {
+        return SMDIM_ERROR;
+    }
+    
+    /* Copy the provided structure (using the minimum of the two sizes) */
+    memset(&fileTransfer, 0, sizeof(fileTransfer));
+    memcpy(&fileTransfer, lpFileTransfer,
+        (lpFileTransfer->dwStructSize > sizeof(fileTransfer)) ?
+        sizeof(fileTransfer) : lpFileTransfer->dwStructSize);
+    
+    memset(&shTemp, 0, sizeof(shTemp));
+    shTemp.dwStructSize = sizeof(shTemp);
+    memset(&tiTemp, 0, sizeof(tiTemp));
+    tiTemp.dwStructSize = sizeof(tiTemp);
+    tiTemp.HA_ID = fileTransfer.HA_ID;
+    tiTemp.SCSI_ID = fileTransfer.SCSI_ID;
+    tiTemp.dwSampleNumber = fileTransfer.dwSampleNumber;
+    tiTemp.lpSampleHeader = &shTemp;
+    
+    /* Callbacks see the same structures as for a file, without the file */
+    memset(&ftiTemp, 0, sizeof(ftiTemp));
+    ftiTemp.dwStructSize = sizeof(ftiTemp);
+    ftiTemp.lpCallBackProcedure = (void (*)(SMDI_FileTransmissionInfo*, DWORD))fileTransfer.lpCallback;
+    ftiTemp.lpTransmissionInfo = &tiTemp;
+    ftiTemp.lpReturnValue = fileTransfer.lpReturnValue;
+    ftiTemp.dwUserData = fileTransfer.dwUserData;
+    
+    if (fileTransfer.lpReturnValue != NULL) {
+        *(fileTransfer.lpReturnValue) = (DWORD)-1;
+    }
+    
+    /* The sink opens its destination once the header is known; a caller
+       that just asked for it passes it in */
+    if (fileTransfer.lpSampleHeader != NULL) {
+        memcpy(&shTemp, fileTransfer.lpSampleHeader, sizeof(SMDI_SampleHeader));
+        shTemp.dwStructSize = sizeof(shTemp);
+        dwTemp = SMDIM_SAMPLEHEADER;
+    } else {
+        dwTemp = SMDI_SampleHeaderRequest(tiTemp.HA_ID, tiTemp.SCSI_ID,
+                                          tiTemp.dwSampleNumber, &shTemp);
+    }
+    if (dwTemp == SMDIM_SAMPLEHEADER) {
+        memcpy(&lpSink->header, &shTemp, sizeof(SMDI_SampleHeader));
+        if (!(*lpSink->lpBegin)(lpSink)) {
+            (*lpSink->lpEnd)(lpSink, FALSE);
+            dwTemp = FE_OPENERROR;
+        } else {
+            tiTemp.dwCopyMode = lpSink->dwCopyMode;
+            dwTemp = SMDI_BeginSampleReception(&tiTemp);
+            
+            /* A packet length the device chose may split words; the bytes
+               are then swapped here, with a split word carried over to
+               the next packet */
+            dwCopyMode = CM_NORMAL;
+            dwWidth = SMDI_CopyModeWidth(tiTemp.dwCopyMode);
+            if (tiTemp.dwPacketSize % dwWidth != 0) {
+                dwCopyMode = tiTemp.dwCopyMode;
+                tiTemp.dwCopyMode = CM_NORMAL;
+            }
+            dwCarry = 0;
+            
+            lpBuffer = NULL;
+            if (dwTemp == SMDIM_TRANSFERACKNOWLEDGE) {
+                lpBuffer = (char*)malloc(tiTemp.dwPacketSize + dwWidth);
+                dwTemp = (lpBuffer != NULL) ? SMDIM_DATAPACKET : SMDIE_NOMEMORY;
+            }
+            
+            dwTotal = (shTemp.dwLength * (DWORD)shTemp.NumberOfChannels *
+                       (DWORD)shTemp.BitsPerWord) / 8;
+            while (dwTemp == SMDIM_DATAPACKET) {
+                dwReceived = tiTemp.dwPacketSize * tiTemp.dwTransmittedPackets;
+                dwBytes = tiTemp.dwPacketSize;
+                if (dwReceived + dwBytes > dwTotal) {
+                    dwBytes = dwTotal - dwReceived;
+                }
+                
+                /* The buffer only ever holds the current packet */
+                dwTemp = SMDI_ReceivePacket(&tiTemp, lpBuffer + dwCarry);
+                dwWhole = dwBytes;
+                if (dwCopyMode != CM_NORMAL) {
+                    dwWhole = dwCarry + dwBytes;
+                    dwWhole -= dwWhole % dwWidth;
+                    SMDI_CopySampleData(lpBuffer, lpBuffer, dwWhole, dwCopyMode);
+                }
+                if ((dwTemp == SMDIM_DATAPACKET || dwTemp == SMDIM_ENDOFPROCEDURE) &&
+                    !(*lpSink->lpWrite)(lpSink, lpBuffer, dwWhole)) {
+                    dwTemp = FE_WRITEERROR;
+                }
+                if (dwCopyMode != CM_NORMAL) {
+                    dwCarry = dwCarry + dwBytes - dwWhole;
+                    memmove(lpBuffer, lpBuffer + dwWhole, dwCarry);
+                }
+                
+                /* Call callback if provided */
+                if (ftiTemp.lpCallBackProcedure != NULL) {
+                    (*ftiTemp.lpCallBackProcedure)(&ftiTemp, ftiTemp.dwUserData);
+                }
+            }
+            free(lpBuffer);
+            
+            /* Headers are finished only when every packet arrived */
+            if (!(*lpSink->lpEnd)(lpSink, dwTemp == SMDIM_ENDOFPROCEDURE) &&
+                dwTemp == SMDIM_ENDOFPROCEDURE) {
+                dwTemp = FE_WRITEERROR;
+            }
+        }
+    } else {
+        /* The sink is released whatever happens */
+        (*lpSink->lpEnd)(lpSink, FALSE);
+    }
+    
+    /* Store result if pointer provided */
+    if (fileTransfer.lpReturnValue != NULL) {
+        *(fileTransfer.lpReturnValue) = dwTemp;
+    }
+    
+    return dwTemp;
+}
+
+/*
+ * Read-back verification
+ */
+
+/* State of a comparison with the source */
+typedef struct {
+    SMDI_SampleSource* lpSource;
+    DWORD dwWidth;                      /* Bytes per word of the source's copy mode */
+    BYTE carry[4];                      /* Word split across packets */
+    DWORD dwCarry;
+    char* lpBuffer;                     /* Packet in source order, then expected bytes */
+    DWORD dwBufferSize;
+    DWORD dwOffset;                     /* Bytes that matched so far */
+    BOOL bMismatch;
+} SMDI_VerifyState;
+
+/* The sampler must report the format that was sent */
+static BOOL SMDI_VerifyBegin(SMDI_SampleSink* lpSink) {
+    SMDI_VerifyState* lpState;
+    SMDI_SampleHeader* lpHeader;
+    
+    lpState = (SMDI_VerifyState*)lpSink->lpUserData;
+    lpHeader = &lpState->lpSource->header;
+    
+    /* Packets are taken in SMDI order and turned into the source's order
+       here, since a packet may end inside a word */
+    lpSink->dwCopyMode = CM_NORMAL;
+    lpState->dwWidth = SMDI_CopyModeWidth(lpState->lpSource->dwCopyMode);
+    
+    if (lpSink->header.dwLength != lpHeader->dwLength ||
+        lpSink->header.BitsPerWord != lpHeader->BitsPerWord ||
+        lpSink->header.NumberOfChannels != lpHeader->NumberOfChannels) {
+        lpState->bMismatch = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Compare a packet with the same bytes of the source */
+static BOOL SMDI_VerifyWrite(SMDI_SampleSink* lpSink, void* lpData, DWORD dwBytes) {
+    SMDI_VerifyState* lpState;
+    SMDI_SampleSource* lpSource;
+    const char* lpExpected;
+    const char* lpActual;
+    char* lpGrown;
+    DWORD dwTotal;
+    DWORD dwWhole;
+    DWORD i;
+    
+    lpState = (SMDI_VerifyState*)lpSink->lpUserData;
+    lpSource = lpState->lpSource;
+    
+    /* Whole words in source order; an unfinished one waits for the next
+       packet */
+    dwTotal = lpState->dwCarry + dwBytes;
+    dwWhole = dwTotal - dwTotal % lpState->dwWidth;
+    if (lpState->dwWidth == 1) {
+        lpActual = (const char*)lpData;
+    } else {
+        if (dwTotal * 2 > lpState->dwBufferSize) {
+            lpGrown = (char*)realloc(lpState->lpBuffer, dwTotal * 2);
+            if (lpGrown == NULL) {
+                return FALSE;
+            }
+            lpState->lpBuffer = lpGrown;
+            lpState->dwBufferSize = dwTotal * 2;
+        }
+        memcpy(lpState->lpBuffer, lpState->carry, lpState->dwCarry);
+        memcpy(lpState->lpBuffer + lpState->dwCarry, lpData, dwBytes);
+        lpState->dwCarry = dwTotal - dwWhole;
+        memcpy(lpState->carry, lpState->lpBuffer + dwWhole, lpState->dwCarry);
+        SMDI_CopySampleData(lpState->lpBuffer, lpState->lpBuffer, dwWhole,
+                            lpSource->dwCopyMode);
+        lpActual = lpState->lpBuffer;
+    }
+    
+    if (lpSource->lpData != NULL) {
+        lpExpected = (const char*)lpSource->lpData + lpState->dwOffset;
+    } else {
+        if (lpState->dwWidth == 1 && dwWhole > lpState->dwBufferSize) {
+            lpGrown = (char*)realloc(lpState->lpBuffer, dwWhole);
+            if (lpGrown == NULL) {
+                return FALSE;
+            }
+            lpState->lpBuffer = lpGrown;
+            lpState->dwBufferSize = dwWhole;
+        }
+        lpExpected = lpState->lpBuffer + ((lpState->dwWidth == 1) ? 0 : dwTotal);
+        if ((*lpSource->lpRead)(lpSource, (void*)lpExpected, dwWhole) != dwWhole) {
+            return FALSE;
+        }
+    }
+    
+    /* Whole packets are compared at memcmp speed; only a packet that
+       differs is walked for the first byte */
+    if (memcmp(lpExpected, lpActual, dwWhole) != 0) {
+        for (i = 0; lpExpected[i] == lpActual[i]; i++) {
+        }
+        lpState->dwOffset += i;
+        lpState->bMismatch = TRUE;
+        return FALSE;
+    }
+    
+    lpState->dwOffset += dwWhole;
+    return TRUE;
+}
+
+static BOOL SMDI_VerifyEnd(SMDI_SampleSink* lpSink, BOOL bComplete) {
+    (void)lpSink;
+    (void)bComplete;
+    return TRUE;
+}
+
+/* Read a sample back and compare it with its source */
+DWORD SMDI_VerifySampleSource(SMDI_FileTransfer* lpFileTransfer, SMDI_SampleSource* lpSource,
+                              DWORD* lpOffset) {
+    SMDI_VerifyState state;
+    SMDI_SampleSink sink;
+    DWORD dwTemp;
+    
+    if (lpFileTransfer == NULL || lpSource == NULL ||
+        (lpSource->lpData == NULL && lpSource->lpRead == NULL)) {
+        return SMDIM_ERROR;
+    }
+    
+    memset(&state, 0, sizeof(state));
+    state.lpSource = lpSource;
+    
+    memset(&sink, 0, sizeof(sink));
+    sink.dwStructSize = sizeof(sink);
+    sink.dwCopyMode = CM_NORMAL;
+    sink.lpBegin = SMDI_VerifyBegin;
+    sink.lpWrite = SMDI_VerifyWrite;
+    sink.lpEnd = SMDI_VerifyEnd;
+    sink.lpUserData = &state;
+    
+    dwTemp = SMDI_ReceiveSampleSink(lpFileTransfer, &sink);
+    free(state.lpBuffer);
+    
+    if (state.bMismatch) {
+        dwTemp = FE_VERIFYERROR;
+    } else if (dwTemp == FE_WRITEERROR) {
+        /* The source ran short */
+        dwTemp = FE_READERROR;
+    }
+    if (lpOffset != NULL) {
+        *lpOffset = state.dwOffset;
+    }
+    
+    if (lpFileTransfer->lpReturnValue != NULL) {
+        *(lpFileTransfer->lpReturnValue) = dwTemp;
+    }
+    return dwTemp;
+}
+
+/* Native file data read straight from the file for verification */
+static DWORD SMDI_NativeSourceRead(SMDI_SampleSource* lpSource, void* lpData, DWORD dwBytes) {
+    return (DWORD)fread(lpData, 1, dwBytes, (FILE*)lpSource->lpUserData);
+}
+
+static void SMDI_NativeSourceClose(SMDI_SampleSource* lpSource) {
+    fclose((FILE*)lpSource->lpUserData);
+}
+
+/* Read a file's sample back from the device and compare */
+static DWORD SMDI_VerifyFile(SMDI_FileTransfer* lpFileTransfer, DWORD* lpOffset) {
+    SMDI_SampleSource source;
+    FILE* hFile;
+    DWORD dwFileType;
+    DWORD dwTemp;
+    
+    memset(&source, 0, sizeof(source));
+    source.dwStructSize = sizeof(source);
+    source.header.dwStructSize = sizeof(SMDI_SampleHeader);
+    
+    dwFileType = SMDI_GetFileSampleHeader(lpFileTransfer->lpFileName, &source.header);
+    if (dwFileType == SF_NATIVE) {
+        hFile = fopen(lpFileTransfer->lpFileName, "rb");
+        if (hFile == NULL ||
+            fseek(hFile, (long)source.header.dwDataOffset, SEEK_SET) != 0) {
+            if (hFile != NULL) {
+                fclose(hFile);
+            }
+            return FE_OPENERROR;
+        }
+        source.dwCopyMode = CM_NORMAL;
+        source.lpRead = SMDI_NativeSourceRead;
+        source.lpClose = SMDI_NativeSourceClose;
+        source.lpUserData = hFile;
+    } else if (!SMDI_OpenFileSource(&source, lpFileTransfer->lpFileName, dwFileType)) {
+        return FE_OPENERROR;
+    }
+    
+    dwTemp = SMDI_VerifySampleSource(lpFileTransfer, &source, lpOffset);
+    SMDI_CloseSampleSource(&source);
+    return dwTemp;
+}
+
 /* Receive a file from the device */
 DWORD SMDI_ReceiveFile(SMDI_FileTransfer* lpFileTransfer) {
     SMDI_FileTransmissionInfo* ftiTemp;
@@ -755,21 +1637,8 @@ DWORD SMDI_ReceiveFile(SMDI_FileTransfer* lpFileTransfer) {
     SMDI_SampleHeader* shTemp;
     void* lpTemp;
     SMDI_FileTransfer fileTransfer;
-    
-    /* Allocate memory for the structures */
-    ftiTemp = (SMDI_FileTransmissionInfo*)malloc(
-        sizeof(SMDI_FileTransmissionInfo) + 
-        sizeof(SMDI_TransmissionInfo) + 
-        sizeof(SMDI_SampleHeader));
-    
-    if (ftiTemp == NULL) {
-        return SMDIM_ERROR;
-    }
-    
-    /* Calculate pointers */
-    lpTemp = ftiTemp;
-    tiTemp = (SMDI_TransmissionInfo*)((char*)ftiTemp + sizeof(SMDI_FileTransmissionInfo));
-    shTemp = (SMDI_SampleHeader*)((char*)ftiTemp + sizeof(SMDI_FileTransmissionInfo) + sizeof(SMDI_TransmissionInfo));
+    SMDI_SampleSink sink;
+    BOOL bSink;
     
     /* Set default values */
     fileTransfer.dwStructSize = sizeof(fileTransfer);
@@ -788,8 +1657,43 @@ DWORD SMDI_ReceiveFile(SMDI_FileTransfer* lpFileTransfer) {
         (lpFileTransfer->dwStructSize > sizeof(fileTransfer)) ?
         sizeof(fileTransfer) : lpFileTransfer->dwStructSize);
     
+    /* AIFF and WAV files are written through a sink as packets arrive */
+    if (fileTransfer.dwFileType == SF_AIFF || fileTransfer.dwFileType == SF_WAV) {
+        if (fileTransfer.dwFileType == SF_AIFF) {
+            bSink = SMDI_OpenAIFSink(&sink, fileTransfer.lpFileName, FALSE);
+        } else {
+            bSink = SMDI_OpenWAVSink(&sink, fileTransfer.lpFileName);
+        }
+        if (!bSink) {
+            if (fileTransfer.lpReturnValue != NULL) {
+                *(fileTransfer.lpReturnValue) = FE_OPENERROR;
+            }
+            return FE_OPENERROR;
+        }
+        return SMDI_ReceiveSampleSink(lpFileTransfer, &sink);
+    }
+    
+    /* Allocate memory for the structures */
+    ftiTemp = (SMDI_FileTransmissionInfo*)malloc(
+        sizeof(SMDI_FileTransmissionInfo) + 
+        sizeof(SMDI_TransmissionInfo) + 
+        sizeof(SMDI_SampleHeader));
+    
+    if (ftiTemp == NULL) {
+        return SMDIM_ERROR;
+    }
+    
+    /* Calculate pointers */
+    lpTemp = ftiTemp;
+    tiTemp = (SMDI_TransmissionInfo*)((char*)ftiTemp + sizeof(SMDI_FileTransmissionInfo));
+    shTemp = (SMDI_SampleHeader*)((char*)ftiTemp + sizeof(SMDI_FileTransmissionInfo) + sizeof(SMDI_TransmissionInfo));
+    
     /* Initialize structures */
     ftiTemp->dwStructSize = sizeof(*ftiTemp);
+    ftiTemp->lpMapBase = NULL;
+    ftiTemp->dwMapSize = 0;
+    ftiTemp->lpSource = NULL;
+    ftiTemp->lpCheckpoint = NULL;
     tiTemp->dwStructSize = sizeof(*tiTemp);
     shTemp->dwStructSize = sizeof(*shTemp);
     
@@ -798,7 +1702,7 @@ DWORD SMDI_ReceiveFile(SMDI_FileTransfer* lpFileTransfer) {
     tiTemp->HA_ID = fileTransfer.HA_ID;
     tiTemp->SCSI_ID = fileTransfer.SCSI_ID;
     
-    /* Always use normal copy mode on big-endian system */
+    /* Files are native format, always in SMDI byte order */
     tiTemp->dwCopyMode = CM_NORMAL;
     
     ftiTemp->dwFileType = fileTransfer.dwFileType;
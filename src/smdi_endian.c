@@ -0,0 +1,172 @@
+/*
+ * SMDI sample data byte order conversion implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * SMDI carries sample words big-endian. On IRIX the host order matches
+ * and every copy is a plain memcpy; on little-endian hosts (the emulator
+ * build) 16-bit and wider words are swapped while they are copied into
+ * or out of a packet buffer, so the swap never costs a separate pass.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smdi.h"
+#include "smdi_endian.h"
+
+/* Host byte order: -1 until tested, then 0 (big) or 1 (little) */
+static int g_host_little = -1;
+
+/* Check the byte order of the host (tested once at run time) */
+BOOL SMDI_HostIsLittleEndian(void) {
+    unsigned int probe;
+
+    if (g_host_little < 0) {
+        probe = 1;
+        g_host_little = (*(unsigned char*)&probe == 1) ? 1 : 0;
+    }
+    return g_host_little ? TRUE : FALSE;
+}
+
+/* Copy mode that swaps words of the given sample width, CM_NORMAL for 8 bits */
+DWORD SMDI_SwapCopyMode(DWORD bitsPerWord) {
+    switch ((bitsPerWord + 7) / 8) {
+        case 2:  return CM_SWAP16;
+        case 3:  return CM_SWAP24;
+        case 4:  return CM_SWAP32;
+        default: return CM_NORMAL;
+    }
+}
+
+/* Copy mode between SMDI (big-endian) data and host order samples */
+DWORD SMDI_HostCopyMode(DWORD bitsPerWord) {
+    if (!SMDI_HostIsLittleEndian()) {
+        return CM_NORMAL;
+    }
+    return SMDI_SwapCopyMode(bitsPerWord);
+}
+
+/* Bytes per word handled by a copy mode, 1 for CM_NORMAL */
+DWORD SMDI_CopyModeWidth(DWORD dwCopyMode) {
+    switch (dwCopyMode) {
+        case CM_SWAP16: return 2;
+        case CM_SWAP24: return 3;
+        case CM_SWAP32: return 4;
+        default:        return 1;
+    }
+}
+
+/* Swap 16-bit words; two at a time through 32-bit loads when aligned */
+static void swap16(BYTE* dst, const BYTE* src, DWORD count) {
+    unsigned int* d32;
+    const unsigned int* s32;
+    unsigned int v;
+    DWORD pairs;
+    BYTE t;
+
+    if ((((unsigned long)dst | (unsigned long)src) & 3) == 0) {
+        d32 = (unsigned int*)dst;
+        s32 = (const unsigned int*)src;
+        for (pairs = count / 2; pairs > 0; pairs--) {
+            v = *s32++;
+            *d32++ = ((v >> 8) & 0x00FF00FFU) | ((v & 0x00FF00FFU) << 8);
+        }
+        dst = (BYTE*)d32;
+        src = (const BYTE*)s32;
+        count &= 1;
+    }
+
+    while (count > 0) {
+        t = src[0];
+        dst[0] = src[1];
+        dst[1] = t;
+        dst += 2;
+        src += 2;
+        count--;
+    }
+}
+
+/* Swap 24-bit words (the middle byte stays put) */
+static void swap24(BYTE* dst, const BYTE* src, DWORD count) {
+    BYTE t;
+
+    while (count > 0) {
+        t = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = t;
+        dst += 3;
+        src += 3;
+        count--;
+    }
+}
+
+/* Swap 32-bit words */
+static void swap32(BYTE* dst, const BYTE* src, DWORD count) {
+    unsigned int* d32;
+    const unsigned int* s32;
+    unsigned int v;
+    BYTE t0;
+    BYTE t1;
+
+    if ((((unsigned long)dst | (unsigned long)src) & 3) == 0) {
+        d32 = (unsigned int*)dst;
+        s32 = (const unsigned int*)src;
+        while (count > 0) {
+            v = *s32++;
+            v = ((v >> 8) & 0x00FF00FFU) | ((v & 0x00FF00FFU) << 8);
+            *d32++ = (v >> 16) | (v << 16);
+            count--;
+        }
+        return;
+    }
+
+    while (count > 0) {
+        t0 = src[0];
+        t1 = src[1];
+        dst[0] = src[3];
+        dst[1] = src[2];
+        dst[2] = t1;
+        dst[3] = t0;
+        dst += 4;
+        src += 4;
+        count--;
+    }
+}
+
+/* Copy sample data applying a copy mode */
+void SMDI_CopySampleData(void* dst, const void* src, DWORD length, DWORD dwCopyMode) {
+    DWORD width;
+    DWORD words;
+
+    if (dst == NULL || src == NULL || length == 0) {
+        return;
+    }
+
+    width = SMDI_CopyModeWidth(dwCopyMode);
+    if (width == 1) {
+        if (dst != src) {
+            memcpy(dst, src, length);
+        }
+        return;
+    }
+
+    words = length / width;
+    switch (dwCopyMode) {
+        case CM_SWAP16:
+            swap16((BYTE*)dst, (const BYTE*)src, words);
+            break;
+        case CM_SWAP24:
+            swap24((BYTE*)dst, (const BYTE*)src, words);
+            break;
+        default:
+            swap32((BYTE*)dst, (const BYTE*)src, words);
+            break;
+    }
+
+    /* Trailing partial word */
+    if (dst != src && words * width < length) {
+        memcpy((BYTE*)dst + words * width, (const BYTE*)src + words * width,
+               length - words * width);
+    }
+}
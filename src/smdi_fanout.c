@@ -0,0 +1,447 @@
+/*
+ * SMDI fan-out upload implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * Every target gets a sender process of its own. A native file is mapped
+ * before they start, so each sender uploads from the same pages. An AIFF
+ * or WAV file is decoded here, once, into a ring of chunks in memory
+ * shared with the senders. Two pipes per sender carry one byte per
+ * chunk: "ready" from this process when a chunk is filled, "free" back
+ * when the sender has taken all of it. A chunk is refilled only after
+ * every live sender has freed it, which keeps the fast senders within
+ * the window of the slowest one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "smdi.h"
+#include "smdi_sample.h"
+#include "smdi_pcm.h"
+#include "smdi_aif.h"
+#include "smdi_wav.h"
+#include "smdi_report.h"
+#include "smdi_fanout.h"
+
+/* What a sender leaves in the shared memory for its target */
+typedef struct {
+    DWORD result;
+    DWORD packet_size;
+    double seconds;
+} fanout_status_t;
+
+/* A sender as this process sees it */
+typedef struct {
+    pid_t pid;                       /* Sender, or -1 to send in line */
+    int ready;                       /* Write end of its ready pipe */
+    int release;                     /* Read end of its free pipe */
+    BOOL live;                       /* Has pipes and still takes chunks */
+} fanout_sender_t;
+
+/* A sender's view of the ring */
+typedef struct {
+    int ready;
+    int release;
+    char* ring;
+    DWORD window;
+    DWORD size;                      /* Bytes of sample data */
+    DWORD chunk;                     /* Chunks taken so far */
+    DWORD used;                      /* Bytes of the current chunk taken */
+    BOOL held;                       /* The current chunk is ready */
+} fanout_reader_t;
+
+/* One token on a pipe; FALSE once the other end has gone */
+static BOOL token_write(int fd) {
+    char token;
+    int n;
+
+    token = 0;
+    do {
+        n = write(fd, &token, 1);
+    } while (n < 0 && errno == EINTR);
+    return n == 1;
+}
+
+static BOOL token_read(int fd) {
+    char token;
+    int n;
+
+    do {
+        n = read(fd, &token, 1);
+    } while (n < 0 && errno == EINTR);
+    return n == 1;
+}
+
+/* Bytes in a chunk of the ring */
+static DWORD chunk_bytes(DWORD size, DWORD chunk) {
+    DWORD left;
+
+    left = size - chunk * SMDI_FANOUT_CHUNK;
+    return (left > SMDI_FANOUT_CHUNK) ? SMDI_FANOUT_CHUNK : left;
+}
+
+/* Sender side: the upload reads its packets out of the ring */
+static DWORD ring_source_read(SMDI_SampleSource* source, void* data, DWORD bytes) {
+    fanout_reader_t* reader;
+    char* p;
+    DWORD done;
+    DWORD avail;
+    DWORD n;
+
+    reader = (fanout_reader_t*)source->lpUserData;
+    p = (char*)data;
+    done = 0;
+    while (done < bytes && reader->chunk * SMDI_FANOUT_CHUNK < reader->size) {
+        if (!reader->held) {
+            if (!token_read(reader->ready)) {
+                break;
+            }
+            reader->held = TRUE;
+            reader->used = 0;
+        }
+
+        avail = chunk_bytes(reader->size, reader->chunk) - reader->used;
+        n = (bytes - done < avail) ? bytes - done : avail;
+        memcpy(p + done, reader->ring + (reader->chunk % reader->window) * SMDI_FANOUT_CHUNK +
+               reader->used, n);
+        reader->used += n;
+        done += n;
+
+        if (reader->used == chunk_bytes(reader->size, reader->chunk)) {
+            reader->held = FALSE;
+            reader->chunk++;
+            token_write(reader->release);
+        }
+    }
+    return done;
+}
+
+/* Open the file as an upload source; *sample is set for a mapped native
+   file */
+static DWORD fanout_open(SMDI_FanOut* fanout, SMDI_SampleSource* source, SMDI_Sample** sample) {
+    SMDI_SampleHeader sh;
+    DWORD type;
+    BOOL ok;
+
+    *sample = NULL;
+    memset(&sh, 0, sizeof(sh));
+    sh.dwStructSize = sizeof(sh);
+    type = SMDI_GetFileSampleHeader(fanout->lpFileName, &sh);
+
+    memset(source, 0, sizeof(SMDI_SampleSource));
+    source->dwStructSize = sizeof(SMDI_SampleSource);
+    switch (type) {
+        case SF_NATIVE:
+            *sample = SMDI_MapSample(fanout->lpFileName);
+            if (*sample == NULL) {
+                return FE_OPENERROR;
+            }
+            SMDI_SampleSourceFromSample(source, *sample);
+            return SMDIM_ENDOFPROCEDURE;
+
+        case SF_AIFF:
+            ok = SMDI_OpenAIFSource(source, fanout->lpFileName, 0, PCM_DITHER_TPDF);
+            break;
+
+        case SF_WAV:
+            ok = SMDI_OpenWAVSource(source, fanout->lpFileName, 0, PCM_DITHER_TPDF);
+            break;
+
+        default:
+            return type;
+    }
+    return ok ? SMDIM_ENDOFPROCEDURE : FE_OPENERROR;
+}
+
+static void fanout_close(SMDI_SampleSource* source, SMDI_Sample* sample) {
+    if (sample != NULL) {
+        SMDI_FreeSample(sample);
+    } else {
+        SMDI_CloseSampleSource(source);
+    }
+}
+
+/* Upload a source to one target */
+static void fanout_send(SMDI_FanOut* fanout, SMDI_FanOutTarget* target,
+                        SMDI_SampleSource* source, fanout_status_t* status) {
+    SMDI_FileTransfer ft;
+    SMDI_TransferStats stats;
+    double start;
+
+    memset(&ft, 0, sizeof(ft));
+    ft.dwStructSize = sizeof(ft);
+    ft.HA_ID = target->HA_ID;
+    ft.SCSI_ID = target->SCSI_ID;
+    ft.dwSampleNumber = target->dwSampleNumber;
+    ft.lpSampleName = fanout->lpSampleName;
+    ft.dwUserData = fanout->dwUserData;
+    ft.bAsync = FALSE;
+
+    SMDI_ResetTransferStats();
+    start = SMDI_GetTime();
+    status->result = SMDI_SendSampleSource(&ft, source);
+    status->seconds = SMDI_GetTime() - start;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.dwStructSize = sizeof(stats);
+    SMDI_GetTransferStats(&stats);
+    status->packet_size = stats.dwPacketSize;
+}
+
+/* Sender process body */
+static void sender_run(SMDI_FanOut* fanout, DWORD index, SMDI_SampleSource* source,
+                       fanout_sender_t* senders, fanout_status_t* status,
+                       fanout_reader_t* reader) {
+    SMDI_SampleSource ring;
+    DWORD i;
+
+    /* Handles inherited from the parent belong to the parent */
+    SMDI_CloseDevices();
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Only this sender's own pipe ends may stay open, or the others would
+       not see each other go */
+    for (i = 0; i < index; i++) {
+        if (senders[i].live) {
+            close(senders[i].ready);
+            close(senders[i].release);
+        }
+    }
+
+    if (reader != NULL) {
+        memcpy(&ring, source, sizeof(SMDI_SampleSource));
+        ring.lpData = NULL;
+        ring.lpRead = ring_source_read;
+        ring.lpClose = NULL;
+        ring.lpUserData = reader;
+        source = &ring;
+    }
+    fanout_send(fanout, &fanout->lpTargets[index], source, &status[index]);
+
+    fflush(NULL);
+    _exit(0);
+}
+
+/* Start a sender per target; those that cannot be started are left with
+   a pid of -1 */
+static void fanout_start(SMDI_FanOut* fanout, SMDI_SampleSource* source,
+                         fanout_sender_t* senders, fanout_status_t* status,
+                         char* ring, DWORD window, DWORD size) {
+    fanout_reader_t reader;
+    int ready[2];
+    int release[2];
+    DWORD i;
+
+    for (i = 0; i < fanout->dwTargets; i++) {
+        senders[i].pid = -1;
+        senders[i].live = FALSE;
+
+        if (ring != NULL) {
+            if (pipe(ready) != 0) {
+                continue;
+            }
+            if (pipe(release) != 0) {
+                close(ready[0]);
+                close(ready[1]);
+                continue;
+            }
+        }
+
+        fflush(NULL);
+        senders[i].pid = fork();
+        if (senders[i].pid == 0) {
+            if (ring == NULL) {
+                sender_run(fanout, i, source, senders, status, NULL);
+            }
+            close(ready[1]);
+            close(release[0]);
+            memset(&reader, 0, sizeof(reader));
+            reader.ready = ready[0];
+            reader.release = release[1];
+            reader.ring = ring;
+            reader.window = window;
+            reader.size = size;
+            sender_run(fanout, i, source, senders, status, &reader);
+        }
+
+        if (ring != NULL) {
+            close(ready[0]);
+            close(release[1]);
+            if (senders[i].pid < 0) {
+                close(ready[1]);
+                close(release[0]);
+                continue;
+            }
+            senders[i].ready = ready[1];
+            senders[i].release = release[0];
+            senders[i].live = TRUE;
+        }
+    }
+}
+
+/* Decode the file into the ring, chunk by chunk, as the senders free it */
+static BOOL fanout_fill(SMDI_FanOut* fanout, SMDI_SampleSource* source,
+                        fanout_sender_t* senders, char* ring, DWORD window, DWORD size) {
+    DWORD chunks;
+    DWORD chunk;
+    DWORD bytes;
+    DWORD i;
+
+    chunks = (size + SMDI_FANOUT_CHUNK - 1) / SMDI_FANOUT_CHUNK;
+    for (chunk = 0; chunk < chunks; chunk++) {
+        if (chunk >= window) {
+            /* Every sender has to be done with what this chunk replaces */
+            for (i = 0; i < fanout->dwTargets; i++) {
+                if (senders[i].live && !token_read(senders[i].release)) {
+                    senders[i].live = FALSE;
+                }
+            }
+        }
+
+        bytes = chunk_bytes(size, chunk);
+        if ((*source->lpRead)(source, ring + (chunk % window) * SMDI_FANOUT_CHUNK, bytes) != bytes) {
+            return FALSE;
+        }
+
+        for (i = 0; i < fanout->dwTargets; i++) {
+            if (senders[i].live && !token_write(senders[i].ready)) {
+                senders[i].live = FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/* Send one file to several samplers at once */
+DWORD SMDI_FanOutFile(SMDI_FanOut* fanout) {
+    SMDI_SampleSource source;
+    SMDI_Sample* sample;
+    SMDI_FanOutTarget* target;
+    fanout_sender_t senders[SMDI_FANOUT_TARGETS];
+    fanout_status_t* status;
+    void (*old_pipe)(int);
+    char* region;
+    char* ring;
+    size_t region_size;
+    size_t status_size;
+    double start;
+    int wstatus;
+    DWORD window;
+    DWORD size;
+    DWORD result;
+    BOOL filled;
+    DWORD i;
+
+    if (fanout == NULL || fanout->lpFileName == NULL || fanout->lpTargets == NULL ||
+        fanout->dwTargets == 0 || fanout->dwTargets > SMDI_FANOUT_TARGETS) {
+        return SMDIM_ERROR;
+    }
+    fanout->dwFailed = 0;
+    fanout->dwBytes = 0;
+    fanout->dSeconds = 0.0;
+    start = SMDI_GetTime();
+
+    result = fanout_open(fanout, &source, &sample);
+    if (result != SMDIM_ENDOFPROCEDURE) {
+        return result;
+    }
+    size = (source.header.dwLength * (DWORD)source.header.NumberOfChannels *
+            (DWORD)source.header.BitsPerWord) / 8;
+    fanout->dwBytes = size;
+
+    /* Sender results, then the ring when the data is not in memory */
+    window = (fanout->dwWindow > 0) ? fanout->dwWindow : SMDI_FANOUT_WINDOW;
+    status_size = (fanout->dwTargets * sizeof(fanout_status_t) + 15) & ~(size_t)15;
+    region_size = status_size;
+    if (source.lpData == NULL) {
+        region_size += (size_t)window * SMDI_FANOUT_CHUNK;
+    }
+    region = SMDI_SharedAlloc(region_size);
+    if (region == NULL) {
+        status = (fanout_status_t*)calloc(fanout->dwTargets, sizeof(fanout_status_t));
+        if (status == NULL) {
+            fanout_close(&source, sample);
+            return SMDIE_NOMEMORY;
+        }
+        for (i = 0; i < fanout->dwTargets; i++) {
+            senders[i].pid = -1;
+            senders[i].live = FALSE;
+        }
+        ring = NULL;
+    } else {
+        status = (fanout_status_t*)region;
+        ring = (source.lpData == NULL) ? region + status_size : NULL;
+        fanout_start(fanout, &source, senders, status, ring, window, size);
+    }
+
+    /* A sender that has gone shows up as a failed write, not a signal */
+    old_pipe = signal(SIGPIPE, SIG_IGN);
+    filled = TRUE;
+    if (ring != NULL) {
+        filled = fanout_fill(fanout, &source, senders, ring, window, size);
+        for (i = 0; i < fanout->dwTargets; i++) {
+            if (senders[i].pid > 0) {
+                close(senders[i].ready);
+                close(senders[i].release);
+            }
+        }
+    }
+
+    result = SMDIM_ENDOFPROCEDURE;
+    for (i = 0; i < fanout->dwTargets; i++) {
+        target = &fanout->lpTargets[i];
+        if (senders[i].pid > 0) {
+            while (waitpid(senders[i].pid, &wstatus, 0) < 0) {
+                if (errno != EINTR) {
+                    wstatus = 1;
+                    break;
+                }
+            }
+            if (!(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0)) {
+                status[i].result = SMDIM_ERROR;
+            } else if (!filled && status[i].result != SMDIM_ENDOFPROCEDURE) {
+                status[i].result = FE_READERROR;
+            }
+        } else if (source.lpData != NULL) {
+            /* No sender: upload from the data in memory, or from a fresh
+               read of the file */
+            fanout_send(fanout, target, &source, &status[i]);
+        } else {
+            fanout_close(&source, sample);
+            status[i].result = fanout_open(fanout, &source, &sample);
+            if (status[i].result == SMDIM_ENDOFPROCEDURE) {
+                fanout_send(fanout, target, &source, &status[i]);
+            }
+        }
+
+        target->dwResult = status[i].result;
+        target->dwPacketSize = status[i].packet_size;
+        target->dSeconds = status[i].seconds;
+        if (target->dwResult != SMDIM_ENDOFPROCEDURE) {
+            fanout->dwFailed++;
+            if (result == SMDIM_ENDOFPROCEDURE) {
+                result = target->dwResult;
+            }
+        }
+        if (fanout->lpCallback != NULL) {
+            (*fanout->lpCallback)(fanout, target);
+        }
+    }
+    signal(SIGPIPE, old_pipe);
+
+    if (region != NULL) {
+        munmap(region, region_size);
+    } else {
+        free(status);
+    }
+    fanout_close(&source, sample);
+
+    fanout->dSeconds = SMDI_GetTime() - start;
+    return result;
+}
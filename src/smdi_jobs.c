@@ -0,0 +1,328 @@
+/*
+ * SMDI transfer job scheduler implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * Each running job is a process of its own, which leaves its result in
+ * memory shared with this one. This process only does the bookkeeping:
+ * it starts what the limits allow, waits for any job to finish, and
+ * starts the next. Only the jobs' own processes are waited for, so
+ * children of the rest of the program are left alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "smdi.h"
+#include "smdi_copy.h"
+#include "smdi_report.h"
+#include "smdi_jobs.h"
+
+/* What a job leaves in the shared memory */
+typedef struct {
+    DWORD result;
+    double seconds;
+} job_status_t;
+
+/* Devices a job holds while it runs; returns how many */
+static int job_devices(const SMDI_Job* job, BYTE* ha, BYTE* id) {
+    ha[0] = job->HA_ID;
+    id[0] = job->SCSI_ID;
+    if (job->dwType != SMDI_JOB_COPY ||
+        (job->DestHA_ID == job->HA_ID && job->DestSCSI_ID == job->SCSI_ID)) {
+        return 1;
+    }
+    ha[1] = job->DestHA_ID;
+    id[1] = job->DestSCSI_ID;
+    return 2;
+}
+
+/* Whether a job touches an adapter, or a device when id is given */
+static BOOL job_uses(const SMDI_Job* job, BYTE ha, int id) {
+    BYTE has[2];
+    BYTE ids[2];
+    int count;
+    int i;
+
+    count = job_devices(job, has, ids);
+    for (i = 0; i < count; i++) {
+        if (has[i] == ha && (id < 0 || ids[i] == (BYTE)id)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Whether a queued job may start beside the running ones */
+static BOOL job_can_start(SMDI_Scheduler* scheduler, const SMDI_Job* job) {
+    BYTE has[2];
+    BYTE ids[2];
+    DWORD on_adapter;
+    DWORD j;
+    int count;
+    int i;
+
+    count = job_devices(job, has, ids);
+    for (i = 0; i < count; i++) {
+        on_adapter = 0;
+        for (j = 0; j < scheduler->dwJobs; j++) {
+            if (scheduler->lpJobs[j].dwState != SMDI_JOB_RUNNING) {
+                continue;
+            }
+            if (job_uses(&scheduler->lpJobs[j], has[i], ids[i])) {
+                return FALSE;
+            }
+            if (job_uses(&scheduler->lpJobs[j], has[i], -1)) {
+                on_adapter++;
+            }
+        }
+        if (scheduler->dwMaxPerAdapter > 0 && on_adapter >= scheduler->dwMaxPerAdapter) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* The queued job to start next, or dwJobs if none may */
+static DWORD job_next(SMDI_Scheduler* scheduler) {
+    SMDI_Job* job;
+    DWORD best;
+    DWORD i;
+
+    best = scheduler->dwJobs;
+    for (i = 0; i < scheduler->dwJobs; i++) {
+        job = &scheduler->lpJobs[i];
+        if (job->dwState != SMDI_JOB_QUEUED) {
+            continue;
+        }
+        if (best < scheduler->dwJobs && job->dwPriority <= scheduler->lpJobs[best].dwPriority) {
+            continue;
+        }
+        if (job_can_start(scheduler, job)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* Do the work of a job */
+static void job_run(SMDI_Job* job, job_status_t* status) {
+    SMDI_FileTransfer ft;
+    SMDI_Copy copy;
+    double start;
+    DWORD result;
+
+    start = SMDI_GetTime();
+    memset(&ft, 0, sizeof(ft));
+    ft.dwStructSize = sizeof(ft);
+    ft.HA_ID = job->HA_ID;
+    ft.SCSI_ID = job->SCSI_ID;
+    ft.dwSampleNumber = job->dwSampleNumber;
+    ft.lpFileName = job->lpFileName;
+    ft.bAsync = FALSE;
+
+    switch (job->dwType) {
+        case SMDI_JOB_SEND:
+            ft.lpSampleName = job->lpSampleName;
+            result = SMDI_SendFile(&ft);
+            break;
+
+        case SMDI_JOB_RECEIVE:
+            ft.dwFileType = job->dwFileType;
+            result = SMDI_ReceiveFile(&ft);
+            break;
+
+        case SMDI_JOB_DELETE:
+            result = SMDI_DeleteSample(job->HA_ID, job->SCSI_ID, job->dwSampleNumber);
+            break;
+
+        case SMDI_JOB_COPY:
+            memset(&copy, 0, sizeof(copy));
+            copy.dwStructSize = sizeof(copy);
+            copy.SourceHA_ID = job->HA_ID;
+            copy.SourceSCSI_ID = job->SCSI_ID;
+            copy.dwSourceSample = job->dwSampleNumber;
+            copy.DestHA_ID = job->DestHA_ID;
+            copy.DestSCSI_ID = job->DestSCSI_ID;
+            copy.dwDestSample = job->dwDestSample;
+            copy.lpSampleName = job->lpSampleName;
+            result = SMDI_CopySample(&copy);
+            break;
+
+        default:
+            result = SMDIM_ERROR;
+            break;
+    }
+
+    /* Sends and deletes may finish with an ACK */
+    if (result == SMDIM_ACK) {
+        result = SMDIM_ENDOFPROCEDURE;
+    }
+    status->result = result;
+    status->seconds = SMDI_GetTime() - start;
+}
+
+/* Poll interval while jobs run */
+#define JOB_POLL_MS  10
+
+/* Sleep between polls */
+static void job_pause(void) {
+    struct timeval tv;
+
+    tv.tv_sec = 0;
+    tv.tv_usec = JOB_POLL_MS * 1000L;
+    select(0, NULL, NULL, NULL, &tv);
+}
+
+/* Record a finished job */
+static void job_finish(SMDI_Scheduler* scheduler, SMDI_Job* job, job_status_t* status) {
+    job->dwResult = status->result;
+    job->dSeconds = status->seconds;
+    job->dwState = SMDI_JOB_DONE;
+    if (job->dwResult == SMDIM_ENDOFPROCEDURE) {
+        scheduler->dwDone++;
+    } else {
+        scheduler->dwFailed++;
+    }
+    if (scheduler->lpCallback != NULL) {
+        (*scheduler->lpCallback)(scheduler, job);
+    }
+}
+
+/* Run every queued job within the limits */
+DWORD SMDI_RunJobs(SMDI_Scheduler* scheduler) {
+    SMDI_Job* job;
+    job_status_t* status;
+    pid_t* pids;
+    pid_t pid;
+    size_t status_size;
+    double start;
+    int wstatus;
+    DWORD running;
+    DWORD finished;
+    DWORD collected;
+    DWORD result;
+    DWORD i;
+
+    if (scheduler == NULL || (scheduler->lpJobs == NULL && scheduler->dwJobs > 0)) {
+        return SMDIM_ERROR;
+    }
+    scheduler->dwDone = 0;
+    scheduler->dwFailed = 0;
+    start = SMDI_GetTime();
+    if (scheduler->dwJobs == 0) {
+        scheduler->dSeconds = 0.0;
+        return SMDIM_ENDOFPROCEDURE;
+    }
+
+    pids = (pid_t*)malloc(scheduler->dwJobs * sizeof(pid_t));
+    status_size = scheduler->dwJobs * sizeof(job_status_t);
+    status = (job_status_t*)SMDI_SharedAlloc(status_size);
+    if (pids == NULL || status == NULL) {
+        if (status != NULL) {
+            munmap((void*)status, status_size);
+        }
+        free(pids);
+        return SMDIE_NOMEMORY;
+    }
+    for (i = 0; i < scheduler->dwJobs; i++) {
+        scheduler->lpJobs[i].dwState = SMDI_JOB_QUEUED;
+        scheduler->lpJobs[i].dwResult = SMDIM_ERROR;
+        scheduler->lpJobs[i].dWaitSeconds = 0.0;
+        scheduler->lpJobs[i].dSeconds = 0.0;
+        pids[i] = -1;
+    }
+
+    running = 0;
+    finished = 0;
+    while (finished < scheduler->dwJobs) {
+        /* Start whatever the limits allow */
+        while (scheduler->dwMaxJobs == 0 || running < scheduler->dwMaxJobs) {
+            i = job_next(scheduler);
+            if (i == scheduler->dwJobs) {
+                break;
+            }
+            job = &scheduler->lpJobs[i];
+            job->dwState = SMDI_JOB_RUNNING;
+            job->dWaitSeconds = SMDI_GetTime() - start;
+            if (scheduler->lpCallback != NULL) {
+                (*scheduler->lpCallback)(scheduler, job);
+            }
+
+            status[i].result = SMDIM_ERROR;
+            status[i].seconds = 0.0;
+            fflush(NULL);
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                /* Handles inherited from the parent belong to the parent */
+                SMDI_CloseDevices();
+                job_run(job, &status[i]);
+                SMDI_CloseDevices();
+                fflush(NULL);
+                _exit(0);
+            }
+            if (pids[i] < 0) {
+                /* No process for it: run it here */
+                job_run(job, &status[i]);
+                job_finish(scheduler, job, &status[i]);
+                finished++;
+                continue;
+            }
+            running++;
+        }
+
+        if (running == 0) {
+            break;
+        }
+
+        /* Collect the jobs that finished. One reaped elsewhere has still
+           left its result; one that died before that has SMDIM_ERROR */
+        collected = 0;
+        for (i = 0; i < scheduler->dwJobs; i++) {
+            if (scheduler->lpJobs[i].dwState != SMDI_JOB_RUNNING || pids[i] <= 0) {
+                continue;
+            }
+            pid = waitpid(pids[i], &wstatus, WNOHANG);
+            if (pid == 0 || (pid < 0 && errno == EINTR)) {
+                continue;
+            }
+            if (pid == pids[i] && !(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0)) {
+                status[i].result = SMDIM_ERROR;
+            }
+            job_finish(scheduler, &scheduler->lpJobs[i], &status[i]);
+            running--;
+            finished++;
+            collected++;
+        }
+        if (collected == 0) {
+            job_pause();
+        }
+    }
+
+    /* Nothing is left running or queued */
+    for (i = 0; i < scheduler->dwJobs; i++) {
+        if (scheduler->lpJobs[i].dwState != SMDI_JOB_DONE) {
+            status[i].result = SMDIM_ERROR;
+            status[i].seconds = 0.0;
+            job_finish(scheduler, &scheduler->lpJobs[i], &status[i]);
+        }
+    }
+
+    result = SMDIM_ENDOFPROCEDURE;
+    for (i = 0; i < scheduler->dwJobs; i++) {
+        if (scheduler->lpJobs[i].dwResult != SMDIM_ENDOFPROCEDURE) {
+            result = scheduler->lpJobs[i].dwResult;
+            break;
+        }
+    }
+
+    munmap((void*)status, status_size);
+    free(pids);
+    scheduler->dSeconds = SMDI_GetTime() - start;
+    return result;
+}
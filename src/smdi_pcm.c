@@ -0,0 +1,543 @@
+/*
+ * SMDI PCM sample format conversion implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * Conversions run in blocks of frames: each source channel is decoded
+ * into 32-bit left-justified integers, channels are mapped, and the
+ * result is encoded into the destination format. Integer formats go
+ * through losslessly; narrowing rounds to nearest and clips, or is
+ * dithered when a dither state is given. Conversions that only change
+ * byte order or copy are done with the word swap kernels.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smdi.h"
+#include "smdi_endian.h"
+#include "smdi_pcm.h"
+
+/* Frames per conversion block; keeps the work buffers on the stack small */
+#define PCM_BLOCK_FRAMES    128
+
+/* Full scale of the intermediate 32-bit values */
+#define PCM_FULL_SCALE      2147483648.0
+#define PCM_MAX_VALUE       2147483647L
+#define PCM_MIN_VALUE       (-2147483647L - 1L)
+
+/* Initial noise generator state for dither streams */
+#define PCM_DITHER_SEED     0x2545F491UL
+
+/* Encoding names, indexed by PCM_* value */
+static const char* g_pcm_names[] = {
+    "", "s8", "u8", "s16", "s24", "s24_32", "s32", "f32"
+};
+
+/* Dither names, indexed by PCM_DITHER_* value */
+static const char* g_dither_names[] = {
+    "none", "tpdf", "shaped"
+};
+
+/* Fill in a format */
+void SMDI_PCMSetFormat(SMDI_PCMFormat* fmt, DWORD dwEncoding, DWORD dwByteOrder,
+                       DWORD dwChannels, BOOL bPlanar) {
+    if (fmt == NULL) {
+        return;
+    }
+
+    fmt->dwEncoding = dwEncoding;
+    fmt->dwByteOrder = dwByteOrder;
+    fmt->dwChannels = dwChannels;
+    fmt->bPlanar = bPlanar;
+    fmt->dwPlaneStride = 0;
+}
+
+/* Bytes per sample of an encoding, 0 if unknown */
+DWORD SMDI_PCMSampleSize(DWORD dwEncoding) {
+    switch (dwEncoding) {
+        case PCM_S8:
+        case PCM_U8:     return 1;
+        case PCM_S16:    return 2;
+        case PCM_S24:    return 3;
+        case PCM_S24_32:
+        case PCM_S32:
+        case PCM_F32:    return 4;
+        default:         return 0;
+    }
+}
+
+/* Bytes per frame of a format */
+DWORD SMDI_PCMFrameSize(const SMDI_PCMFormat* fmt) {
+    if (fmt == NULL) {
+        return 0;
+    }
+    return SMDI_PCMSampleSize(fmt->dwEncoding) * fmt->dwChannels;
+}
+
+/* Short name of an encoding */
+const char* SMDI_PCMEncodingName(DWORD dwEncoding) {
+    if (dwEncoding < PCM_S8 || dwEncoding > PCM_F32) {
+        return "unknown";
+    }
+    return g_pcm_names[dwEncoding];
+}
+
+/* Encoding for a short name, 0 if unknown */
+DWORD SMDI_PCMParseEncoding(const char* name) {
+    DWORD i;
+
+    if (name == NULL) {
+        return 0;
+    }
+    for (i = PCM_S8; i <= PCM_F32; i++) {
+        if (strcmp(name, g_pcm_names[i]) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/* Bits of resolution of an encoding; float counts as 32 */
+static int pcm_bits(DWORD enc) {
+    switch (enc) {
+        case PCM_S8:
+        case PCM_U8:     return 8;
+        case PCM_S16:    return 16;
+        case PCM_S24:
+        case PCM_S24_32: return 24;
+        default:         return 32;
+    }
+}
+
+/* Resolve PCM_ORDER_HOST to big (TRUE) or little (FALSE) */
+static BOOL pcm_is_big(DWORD dwByteOrder) {
+    if (dwByteOrder == PCM_ORDER_HOST) {
+        return SMDI_HostIsLittleEndian() ? FALSE : TRUE;
+    }
+    return (dwByteOrder == PCM_ORDER_BIG) ? TRUE : FALSE;
+}
+
+/* Fetch a 32-bit word in the given byte order */
+static unsigned long pcm_get32(const BYTE* p, BOOL big) {
+    if (big) {
+        return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+               ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+    }
+    return ((unsigned long)p[3] << 24) | ((unsigned long)p[2] << 16) |
+           ((unsigned long)p[1] << 8) | (unsigned long)p[0];
+}
+
+/* Store a 32-bit word in the given byte order */
+static void pcm_put32(BYTE* p, unsigned long v, BOOL big) {
+    if (big) {
+        p[0] = (BYTE)((v >> 24) & 0xFF);
+        p[1] = (BYTE)((v >> 16) & 0xFF);
+        p[2] = (BYTE)((v >> 8) & 0xFF);
+        p[3] = (BYTE)(v & 0xFF);
+    } else {
+        p[3] = (BYTE)((v >> 24) & 0xFF);
+        p[2] = (BYTE)((v >> 16) & 0xFF);
+        p[1] = (BYTE)((v >> 8) & 0xFF);
+        p[0] = (BYTE)(v & 0xFF);
+    }
+}
+
+/* Sign extend the low bits of a word */
+static long pcm_signed(unsigned long u, int bits) {
+    unsigned long sign;
+
+    sign = 1UL << (bits - 1);
+    u &= (sign << 1) - 1;
+    if (u & sign) {
+        return -(long)(((sign << 1) - 1 - u)) - 1L;
+    }
+    return (long)u;
+}
+
+/* Round a 32-bit value to its top (32 - shift) bits, clipping at full scale */
+static long pcm_narrow(long v, int shift) {
+    long max;
+
+    max = (1L << (31 - shift)) - 1L;
+    v = ((v >> (shift - 1)) + 1L) >> 1;
+    return (v > max) ? max : v;
+}
+
+/* Float to 32-bit value, rounded and clipped */
+static long pcm_from_float(float f) {
+    double d;
+
+    d = (double)f * PCM_FULL_SCALE;
+    if (d >= (double)PCM_MAX_VALUE) {
+        return PCM_MAX_VALUE;
+    }
+    if (d <= -PCM_FULL_SCALE) {
+        return PCM_MIN_VALUE;
+    }
+    if (d >= 0.0) {
+        return (long)(d + 0.5);
+    }
+    return -(long)(0.5 - d);
+}
+
+/* Next value of the dither noise generator (32-bit LCG) */
+static unsigned long pcm_random(SMDI_PCMDither* dither) {
+    dither->dwSeed = (DWORD)((dither->dwSeed * 1664525UL + 1013904223UL) & 0xFFFFFFFFUL);
+    return (unsigned long)dither->dwSeed;
+}
+
+/* Requantize count values (step apart) to their top bits with TPDF dither;
+   err holds the channel's last two errors for noise shaping. Values are
+   halved first so that dither and feedback cannot overflow 32 bits. */
+static void pcm_dither(SMDI_PCMDither* dither, long* v, DWORD step, DWORD count,
+                       int bits, long* err) {
+    int shift;
+    long lsb, max, min;
+    long y, q, r1, r2;
+
+    shift = 32 - bits - 1;
+    lsb = 1L << shift;
+    max = (1L << (bits - 1)) - 1L;
+    min = -max - 1L;
+
+    for (; count > 0; count--, v += step) {
+        y = *v >> 1;
+        if (dither->dwMode == PCM_DITHER_SHAPED) {
+            /* Noise transfer 1 - z^-1 + 0.5 z^-2: -6 dB at DC, +8 dB at Nyquist */
+            y -= err[0] - err[1] / 2;
+        }
+
+        /* Two uniform values of one LSB each make triangular noise */
+        r1 = (long)(pcm_random(dither) >> (32 - shift));
+        r2 = (long)(pcm_random(dither) >> (32 - shift));
+        q = (y + r1 + r2 - lsb + (lsb >> 1)) >> shift;
+
+        err[1] = err[0];
+        err[0] = q * lsb - y;
+
+        if (q > max) {
+            q = max;
+        } else if (q < min) {
+            q = min;
+        }
+        *v = q * (lsb << 1);
+    }
+}
+
+/* Decode count samples, step bytes apart, into out (out_step apart) */
+static void pcm_decode(DWORD enc, BOOL big, const BYTE* p, DWORD step,
+                       long* out, DWORD out_step, DWORD count) {
+    const short* s16;
+    unsigned long u;
+    unsigned int w;
+    float f;
+
+    switch (enc) {
+        case PCM_S8:
+            for (; count > 0; count--, p += step, out += out_step) {
+                *out = (long)(signed char)p[0] * 16777216L;
+            }
+            break;
+
+        case PCM_U8:
+            for (; count > 0; count--, p += step, out += out_step) {
+                *out = ((long)p[0] - 128L) * 16777216L;
+            }
+            break;
+
+        case PCM_S16:
+            if (big != SMDI_HostIsLittleEndian() && ((unsigned long)p & 1) == 0) {
+                /* Host order - load the words directly */
+                s16 = (const short*)p;
+                step /= 2;
+                for (; count > 0; count--, s16 += step, out += out_step) {
+                    *out = (long)*s16 * 65536L;
+                }
+                break;
+            }
+            for (; count > 0; count--, p += step, out += out_step) {
+                u = big ? (((unsigned long)p[0] << 8) | p[1])
+                        : (((unsigned long)p[1] << 8) | p[0]);
+                *out = pcm_signed(u, 16) * 65536L;
+            }
+            break;
+
+        case PCM_S24:
+            for (; count > 0; count--, p += step, out += out_step) {
+                u = big ? (((unsigned long)p[0] << 16) | ((unsigned long)p[1] << 8) | p[2])
+                        : (((unsigned long)p[2] << 16) | ((unsigned long)p[1] << 8) | p[0]);
+                *out = pcm_signed(u, 24) * 256L;
+            }
+            break;
+
+        case PCM_S24_32:
+            for (; count > 0; count--, p += step, out += out_step) {
+                *out = pcm_signed(pcm_get32(p, big), 24) * 256L;
+            }
+            break;
+
+        case PCM_S32:
+            for (; count > 0; count--, p += step, out += out_step) {
+                *out = pcm_signed(pcm_get32(p, big), 32);
+            }
+            break;
+
+        case PCM_F32:
+            for (; count > 0; count--, p += step, out += out_step) {
+                w = (unsigned int)pcm_get32(p, big);
+                memcpy(&f, &w, sizeof(f));
+                *out = pcm_from_float(f);
+            }
+            break;
+    }
+}
+
+/* Encode count values (in_step apart) into samples step bytes apart */
+static void pcm_encode(DWORD enc, BOOL big, const long* in, DWORD in_step,
+                       BYTE* p, DWORD step, DWORD count) {
+    short* s16;
+    long v;
+    unsigned int w;
+    float f;
+
+    switch (enc) {
+        case PCM_S8:
+            for (; count > 0; count--, p += step, in += in_step) {
+                p[0] = (BYTE)(pcm_narrow(*in, 24) & 0xFF);
+            }
+            break;
+
+        case PCM_U8:
+            for (; count > 0; count--, p += step, in += in_step) {
+                p[0] = (BYTE)(pcm_narrow(*in, 24) + 128L);
+            }
+            break;
+
+        case PCM_S16:
+            if (big != SMDI_HostIsLittleEndian() && ((unsigned long)p & 1) == 0) {
+                /* Host order - store the words directly */
+                s16 = (short*)p;
+                step /= 2;
+                for (; count > 0; count--, s16 += step, in += in_step) {
+                    *s16 = (short)pcm_narrow(*in, 16);
+                }
+                break;
+            }
+            for (; count > 0; count--, p += step, in += in_step) {
+                v = pcm_narrow(*in, 16);
+                p[big ? 0 : 1] = (BYTE)((v >> 8) & 0xFF);
+                p[big ? 1 : 0] = (BYTE)(v & 0xFF);
+            }
+            break;
+
+        case PCM_S24:
+            for (; count > 0; count--, p += step, in += in_step) {
+                v = pcm_narrow(*in, 8);
+                p[big ? 0 : 2] = (BYTE)((v >> 16) & 0xFF);
+                p[1] = (BYTE)((v >> 8) & 0xFF);
+                p[big ? 2 : 0] = (BYTE)(v & 0xFF);
+            }
+            break;
+
+        case PCM_S24_32:
+            for (; count > 0; count--, p += step, in += in_step) {
+                pcm_put32(p, (unsigned long)pcm_narrow(*in, 8) & 0xFFFFFFFFUL, big);
+            }
+            break;
+
+        case PCM_S32:
+            for (; count > 0; count--, p += step, in += in_step) {
+                pcm_put32(p, (unsigned long)*in & 0xFFFFFFFFUL, big);
+            }
+            break;
+
+        case PCM_F32:
+            for (; count > 0; count--, p += step, in += in_step) {
+                f = (float)((double)*in / PCM_FULL_SCALE);
+                memcpy(&w, &f, sizeof(w));
+                pcm_put32(p, (unsigned long)w, big);
+            }
+            break;
+    }
+}
+
+/* Map frames of src_ch channels to dst_ch channels */
+static void pcm_mix(const long* in, DWORD src_ch, long* out, DWORD dst_ch, DWORD frames) {
+    DWORD f, c;
+    long acc;
+
+    for (f = 0; f < frames; f++, in += src_ch, out += dst_ch) {
+        if (dst_ch == 1) {
+            /* Mix down: average, halving first so that sums cannot overflow */
+            if (src_ch == 2) {
+                out[0] = (in[0] >> 1) + (in[1] >> 1) + (in[0] & in[1] & 1L);
+            } else {
+                acc = 0;
+                for (c = 0; c < src_ch; c++) {
+                    acc += in[c] / (long)src_ch;
+                }
+                out[0] = acc;
+            }
+        } else if (src_ch == 1) {
+            for (c = 0; c < dst_ch; c++) {
+                out[c] = in[0];
+            }
+        } else {
+            for (c = 0; c < dst_ch; c++) {
+                out[c] = (c < src_ch) ? in[c] : 0L;
+            }
+        }
+    }
+}
+
+/* Offset and step in bytes of channel c, frame f */
+static void pcm_position(const SMDI_PCMFormat* fmt, DWORD frames, DWORD f, DWORD c,
+                         DWORD* offset, DWORD* step) {
+    DWORD size;
+    DWORD stride;
+
+    size = SMDI_PCMSampleSize(fmt->dwEncoding);
+    if (fmt->bPlanar) {
+        stride = (fmt->dwPlaneStride != 0) ? fmt->dwPlaneStride : frames;
+        *offset = (c * stride + f) * size;
+        *step = size;
+    } else {
+        *offset = (f * fmt->dwChannels + c) * size;
+        *step = size * fmt->dwChannels;
+    }
+}
+
+/* Check a format can be converted */
+static BOOL pcm_valid(const SMDI_PCMFormat* fmt) {
+    return (fmt != NULL && SMDI_PCMSampleSize(fmt->dwEncoding) != 0 &&
+            fmt->dwChannels >= 1 && fmt->dwChannels <= PCM_MAX_CHANNELS &&
+            fmt->dwByteOrder <= PCM_ORDER_LITTLE);
+}
+
+/* Same encoding and channels: copy, swapping words if the byte order differs */
+static BOOL pcm_copy(const SMDI_PCMFormat* src, const BYTE* in,
+                     const SMDI_PCMFormat* dst, BYTE* out, DWORD frames) {
+    DWORD size;
+    DWORD mode;
+    DWORD c;
+    DWORD in_offset, out_offset, step;
+
+    if (src->dwEncoding != dst->dwEncoding || src->dwChannels != dst->dwChannels ||
+        src->bPlanar != dst->bPlanar) {
+        return FALSE;
+    }
+
+    size = SMDI_PCMSampleSize(src->dwEncoding);
+    mode = CM_NORMAL;
+    if (pcm_is_big(src->dwByteOrder) != pcm_is_big(dst->dwByteOrder)) {
+        mode = SMDI_SwapCopyMode(size * 8);
+    }
+
+    if (!src->bPlanar) {
+        SMDI_CopySampleData(out, in, frames * size * src->dwChannels, mode);
+        return TRUE;
+    }
+
+    for (c = 0; c < src->dwChannels; c++) {
+        pcm_position(src, frames, 0, c, &in_offset, &step);
+        pcm_position(dst, frames, 0, c, &out_offset, &step);
+        SMDI_CopySampleData(out + out_offset, in + in_offset, frames * size, mode);
+    }
+    return TRUE;
+}
+
+/* Convert frames from one format to another */
+BOOL SMDI_PCMConvert(const SMDI_PCMFormat* src, const void* in,
+                     const SMDI_PCMFormat* dst, void* out, DWORD frames) {
+    return SMDI_PCMConvertDither(src, in, dst, out, frames, NULL);
+}
+
+/* Start a dither stream */
+void SMDI_PCMInitDither(SMDI_PCMDither* dither, DWORD dwMode) {
+    if (dither == NULL) {
+        return;
+    }
+
+    memset(dither, 0, sizeof(SMDI_PCMDither));
+    dither->dwMode = dwMode;
+    dither->dwSeed = PCM_DITHER_SEED;
+}
+
+/* Dither mode for a name, or -1 if unknown */
+long SMDI_PCMParseDither(const char* name) {
+    long i;
+
+    if (name == NULL) {
+        return -1;
+    }
+    for (i = PCM_DITHER_NONE; i <= PCM_DITHER_SHAPED; i++) {
+        if (strcmp(name, g_dither_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Convert frames, dithering when the destination keeps fewer bits */
+BOOL SMDI_PCMConvertDither(const SMDI_PCMFormat* src, const void* in,
+                           const SMDI_PCMFormat* dst, void* out, DWORD frames,
+                           SMDI_PCMDither* dither) {
+    long decoded[PCM_BLOCK_FRAMES * PCM_MAX_CHANNELS];
+    long mixed[PCM_BLOCK_FRAMES * PCM_MAX_CHANNELS];
+    long* encoded;
+    BOOL src_big, dst_big;
+    DWORD done, count, c;
+    DWORD offset, step;
+    int dst_bits;
+
+    if (!pcm_valid(src) || !pcm_valid(dst) || in == NULL || out == NULL) {
+        return FALSE;
+    }
+
+    if (pcm_copy(src, (const BYTE*)in, dst, (BYTE*)out, frames)) {
+        return TRUE;
+    }
+
+    src_big = pcm_is_big(src->dwByteOrder);
+    dst_big = pcm_is_big(dst->dwByteOrder);
+    encoded = (src->dwChannels == dst->dwChannels) ? decoded : mixed;
+    
+    /* Dither only where bits are dropped */
+    dst_bits = pcm_bits(dst->dwEncoding);
+    if (dither != NULL && (dither->dwMode == PCM_DITHER_NONE ||
+                           dst_bits >= pcm_bits(src->dwEncoding))) {
+        dither = NULL;
+    }
+
+    for (done = 0; done < frames; done += count) {
+        count = frames - done;
+        if (count > PCM_BLOCK_FRAMES) {
+            count = PCM_BLOCK_FRAMES;
+        }
+
+        for (c = 0; c < src->dwChannels; c++) {
+            pcm_position(src, frames, done, c, &offset, &step);
+            pcm_decode(src->dwEncoding, src_big, (const BYTE*)in + offset, step,
+                       decoded + c, src->dwChannels, count);
+        }
+
+        if (encoded == mixed) {
+            pcm_mix(decoded, src->dwChannels, mixed, dst->dwChannels, count);
+        }
+
+        if (dither != NULL) {
+            for (c = 0; c < dst->dwChannels; c++) {
+                pcm_dither(dither, encoded + c, dst->dwChannels, count, dst_bits,
+                           dither->lError[c]);
+            }
+        }
+
+        for (c = 0; c < dst->dwChannels; c++) {
+            pcm_position(dst, frames, done, c, &offset, &step);
+            pcm_encode(dst->dwEncoding, dst_big, encoded + c, dst->dwChannels,
+                       (BYTE*)out + offset, step, count);
+        }
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,196 @@
+/*
+ * SMDI machine-readable operation reports for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ *
+ * Each operation is written as one JSON object per line so that
+ * automation can follow throughput across many runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "smdi.h"
+#include "smdi_report.h"
+
+/* Report output, NULL when disabled */
+static FILE* g_report_file = NULL;
+static BOOL g_report_is_stdout = FALSE;
+
+/* Start writing reports */
+BOOL SMDI_ReportOpen(const char* target) {
+    FILE* fp;
+
+    if (target == NULL) {
+        return FALSE;
+    }
+
+    SMDI_ReportClose();
+
+    if (strcmp(target, "-") == 0 || strcmp(target, "stdout") == 0) {
+        g_report_file = stdout;
+        g_report_is_stdout = TRUE;
+        return TRUE;
+    }
+
+    /* Append so that nightly runs accumulate in one file */
+    fp = fopen(target, "a");
+    if (fp == NULL) {
+        return FALSE;
+    }
+
+    g_report_file = fp;
+    g_report_is_stdout = FALSE;
+    return TRUE;
+}
+
+/* Stop writing reports */
+void SMDI_ReportClose(void) {
+    if (g_report_file != NULL && !g_report_is_stdout) {
+        fclose(g_report_file);
+    }
+    g_report_file = NULL;
+    g_report_is_stdout = FALSE;
+}
+
+/* Check whether reports are being written */
+BOOL SMDI_ReportEnabled(void) {
+    return (g_report_file != NULL);
+}
+
+/* Clear a report record */
+void SMDI_ReportInit(SMDI_Report* report, const char* operation) {
+    if (report == NULL) {
+        return;
+    }
+
+    memset(report, 0, sizeof(SMDI_Report));
+    report->operation = operation;
+    report->sample_number = -1;
+    report->file = NULL;
+}
+
+/* Copy the counters of the last transfer into a report record */
+void SMDI_ReportFromStats(SMDI_Report* report) {
+    SMDI_TransferStats stats;
+
+    if (report == NULL) {
+        return;
+    }
+
+    SMDI_GetTransferStats(&stats);
+    report->bytes = stats.dwBytes;
+    report->packets = stats.dwPackets;
+    report->packet_size = stats.dwPacketSize;
+    report->waits = stats.dwWaits;
+    report->retries = stats.dwRetries;
+}
+
+/* Write a JSON string with the necessary escapes */
+static void report_string(FILE* fp, const char* str) {
+    const unsigned char* p;
+
+    fputc('"', fp);
+    for (p = (const unsigned char*)str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', fp);
+            fputc(*p, fp);
+        } else if (*p < 0x20) {
+            fprintf(fp, "\\u%04x", (unsigned int)*p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* Write one report record */
+void SMDI_ReportWrite(SMDI_Report* report) {
+    FILE* fp;
+    double rate;
+
+    if (report == NULL || g_report_file == NULL) {
+        return;
+    }
+
+    fp = g_report_file;
+
+    rate = 0.0;
+    if (report->seconds > 0.0) {
+        rate = (double)report->bytes / report->seconds;
+    }
+
+    fprintf(fp, "{\"time\":%lu,\"op\":", (unsigned long)time(NULL));
+    report_string(fp, report->operation != NULL ? report->operation : "");
+
+    fprintf(fp, ",\"ha\":%d", (int)report->ha_id);
+    if (report->all_ids) {
+        fprintf(fp, ",\"id\":null");
+    } else {
+        fprintf(fp, ",\"id\":%d", (int)report->scsi_id);
+    }
+
+    if (report->sample_number >= 0) {
+        fprintf(fp, ",\"sample\":%ld", report->sample_number);
+    } else {
+        fprintf(fp, ",\"sample\":null");
+    }
+
+    fprintf(fp, ",\"file\":");
+    if (report->file != NULL) {
+        report_string(fp, report->file);
+    } else {
+        fprintf(fp, "null");
+    }
+
+    fprintf(fp, ",\"bytes\":%lu,\"packets\":%lu,\"packet_length\":%lu",
+            report->bytes, report->packets, report->packet_size);
+    fprintf(fp, ",\"seconds\":%.6f,\"bytes_per_sec\":%.1f", report->seconds, rate);
+    fprintf(fp, ",\"waits\":%lu,\"retries\":%lu,\"count\":%lu",
+            report->waits, report->retries, report->count);
+    fprintf(fp, ",\"result\":\"0x%08lX\",\"message\":", report->result);
+    report_string(fp, SMDI_MessageName(report->result));
+    fprintf(fp, ",\"ok\":%s}\n", report->success ? "true" : "false");
+
+    fflush(fp);
+}
+
+/* Get a symbolic name for an SMDI message or error code */
+const char* SMDI_MessageName(DWORD message) {
+    switch (message) {
+        case SMDIM_ERROR:                return "Error";
+        case SMDIM_MASTERIDENTIFY:       return "MasterIdentify";
+        case SMDIM_SLAVEIDENTIFY:        return "SlaveIdentify";
+        case SMDIM_MESSAGEREJECT:        return "MessageReject";
+        case SMDIM_ACK:                  return "Ack";
+        case SMDIM_NAK:                  return "Nak";
+        case SMDIM_WAIT:                 return "Wait";
+        case SMDIM_SENDNEXTPACKET:       return "SendNextPacket";
+        case SMDIM_ENDOFPROCEDURE:       return "EndOfProcedure";
+        case SMDIM_ABORTPROCEDURE:       return "AbortProcedure";
+        case SMDIM_DATAPACKET:           return "DataPacket";
+        case SMDIM_SAMPLEHEADERREQUEST:  return "SampleHeaderRequest";
+        case SMDIM_SAMPLEHEADER:         return "SampleHeader";
+        case SMDIM_SAMPLENAME:           return "SampleName";
+        case SMDIM_DELETESAMPLE:         return "DeleteSample";
+        case SMDIM_BEGINSAMPLETRANSFER:  return "BeginSampleTransfer";
+        case SMDIM_TRANSFERACKNOWLEDGE:  return "TransferAcknowledge";
+        case SMDIM_TRANSMITMIDIMESSAGE:  return "TransmitMidiMessage";
+        case SMDIE_OUTOFRANGE:           return "OutOfRange";
+        case SMDIE_NOSAMPLE:             return "NoSample";
+        case SMDIE_NOMEMORY:             return "NoMemory";
+        case SMDIE_UNSUPPSAMBITS:        return "UnsupportedSampleBits";
+        /* FE_OPENERROR has the same value as SMDIM_SLAVEIDENTIFY */
+        case FE_UNKNOWNFORMAT:           return "UnknownFileFormat";
+        default:                         return "Unknown";
+    }
+}
+
+/* Get the wall clock time in seconds */
+double SMDI_GetTime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
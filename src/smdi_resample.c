@@ -0,0 +1,296 @@
+/*
+ * SMDI sample rate conversion implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * Polyphase windowed-sinc resampling. The rate ratio is reduced to
+ * up/down; each output sample lies at a fractional input position
+ * whose phase selects one row of a precomputed filter table. Ratios
+ * with more phases than the table holds interpolate between adjacent
+ * rows. Tables are cached per ratio, so a batch of files at the same
+ * rates builds the filter once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "smdi.h"
+#include "smdi_sample.h"
+#include "smdi_pcm.h"
+#include "smdi_resample.h"
+
+/* Filter design */
+#define RESAMPLE_MAX_PHASES      256    /* Rows per table before interpolating */
+#define RESAMPLE_ZERO_CROSSINGS  16     /* Sinc lobes on each side of the centre */
+#define RESAMPLE_ROLLOFF         0.95   /* Passband edge relative to the lower Nyquist */
+#define RESAMPLE_CACHE_SIZE      4      /* Ratios kept */
+#define RESAMPLE_PI              3.14159265358979323846
+
+/* Filter table for one rate ratio */
+typedef struct {
+    DWORD up;           /* Output rate / gcd, 0 for an empty slot */
+    DWORD down;         /* Input rate / gcd */
+    DWORD phases;       /* Table rows less one; equals up when exact */
+    DWORD taps;         /* Coefficients per row */
+    float* coeffs;      /* (phases + 1) rows of taps */
+} resample_table_t;
+
+static resample_table_t g_tables[RESAMPLE_CACHE_SIZE];
+static int g_next_table = 0;
+
+/* Greatest common divisor */
+static DWORD resample_gcd(DWORD a, DWORD b) {
+    DWORD t;
+
+    while (b != 0) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Blackman window over -1..1 */
+static double resample_window(double x) {
+    return 0.42 + 0.5 * cos(RESAMPLE_PI * x) + 0.08 * cos(2.0 * RESAMPLE_PI * x);
+}
+
+/* Get the filter table for a ratio, building it on first use */
+static resample_table_t* resample_table(DWORD in_rate, DWORD out_rate) {
+    resample_table_t* table;
+    DWORD g, up, down, half, p, k;
+    double cutoff, offset, d, x, v, sum;
+    float* row;
+    int i;
+
+    g = resample_gcd(in_rate, out_rate);
+    up = out_rate / g;
+    down = in_rate / g;
+
+    for (i = 0; i < RESAMPLE_CACHE_SIZE; i++) {
+        if (g_tables[i].up == up && g_tables[i].down == down) {
+            return &g_tables[i];
+        }
+    }
+
+    /* Replace the oldest slot */
+    table = &g_tables[g_next_table];
+    g_next_table = (g_next_table + 1) % RESAMPLE_CACHE_SIZE;
+    free(table->coeffs);
+    memset(table, 0, sizeof(resample_table_t));
+
+    /* Band-limit to the lower of the two Nyquist rates; the filter widens
+       as the cutoff drops so the transition band stays as sharp */
+    cutoff = RESAMPLE_ROLLOFF;
+    if (out_rate < in_rate) {
+        cutoff *= (double)out_rate / (double)in_rate;
+    }
+    half = (DWORD)ceil(RESAMPLE_ZERO_CROSSINGS / cutoff);
+
+    table->taps = half * 2;
+    table->phases = (up <= RESAMPLE_MAX_PHASES) ? up : RESAMPLE_MAX_PHASES;
+    table->coeffs = (float*)malloc((table->phases + 1) * table->taps * sizeof(float));
+    if (table->coeffs == NULL) {
+        return NULL;
+    }
+
+    /* Row p filters for an output at base + p / phases; tap k reads input
+       base - half + 1 + k. Rows are normalized to unity gain at DC. */
+    for (p = 0; p <= table->phases; p++) {
+        row = table->coeffs + p * table->taps;
+        offset = (double)p / (double)table->phases;
+        sum = 0.0;
+        for (k = 0; k < table->taps; k++) {
+            d = (double)k - (double)half + 1.0 - offset;
+            x = cutoff * d;
+            v = (x == 0.0) ? 1.0 : sin(RESAMPLE_PI * x) / (RESAMPLE_PI * x);
+            v *= cutoff * resample_window(d / (double)half);
+            row[k] = (float)v;
+            sum += v;
+        }
+        for (k = 0; k < table->taps; k++) {
+            row[k] = (float)(row[k] / sum);
+        }
+    }
+
+    table->up = up;
+    table->down = down;
+    return table;
+}
+
+/* Apply one filter row at input position first (may run off either end) */
+static float resample_dot(const float* row, DWORD taps, const float* in, DWORD in_frames,
+                          long first) {
+    float acc;
+    DWORD k;
+    long i;
+
+    acc = 0.0f;
+    if (first >= 0 && (DWORD)first + taps <= in_frames) {
+        in += first;
+        for (k = 0; k < taps; k++) {
+            acc += row[k] * in[k];
+        }
+        return acc;
+    }
+
+    /* Silence beyond the ends of the sample */
+    for (k = 0; k < taps; k++) {
+        i = first + (long)k;
+        if (i >= 0 && (DWORD)i < in_frames) {
+            acc += row[k] * in[i];
+        }
+    }
+    return acc;
+}
+
+/* Frames produced when converting in_frames from in_rate to out_rate */
+DWORD SMDI_ResampleLength(DWORD in_frames, DWORD in_rate, DWORD out_rate) {
+    DWORD g;
+
+    if (in_rate == 0 || out_rate == 0) {
+        return 0;
+    }
+
+    /* Outputs n with n * down < in_frames * up */
+    g = resample_gcd(in_rate, out_rate);
+    return (DWORD)ceil((double)in_frames * (double)(out_rate / g) /
+                       (double)(in_rate / g) - 1e-9);
+}
+
+/* Resample one channel of float data */
+BOOL SMDI_ResampleFloat(const float* in, DWORD in_frames, DWORD in_rate,
+                        float* out, DWORD out_rate) {
+    resample_table_t* table;
+    DWORD out_frames, n, phase, row;
+    DWORD base, half;
+    double position, t;
+    float a0, a1;
+
+    if (in == NULL || out == NULL || in_rate == 0 || out_rate == 0) {
+        return FALSE;
+    }
+
+    table = resample_table(in_rate, out_rate);
+    if (table == NULL) {
+        return FALSE;
+    }
+
+    out_frames = SMDI_ResampleLength(in_frames, in_rate, out_rate);
+    half = table->taps / 2;
+
+    /* The output position is base + phase / up input samples */
+    base = 0;
+    phase = 0;
+    for (n = 0; n < out_frames; n++) {
+        if (table->phases == table->up) {
+            out[n] = resample_dot(table->coeffs + phase * table->taps, table->taps,
+                                  in, in_frames, (long)base - (long)half + 1L);
+        } else {
+            position = (double)phase * (double)table->phases / (double)table->up;
+            row = (DWORD)position;
+            t = position - (double)row;
+            a0 = resample_dot(table->coeffs + row * table->taps, table->taps,
+                              in, in_frames, (long)base - (long)half + 1L);
+            a1 = resample_dot(table->coeffs + (row + 1) * table->taps, table->taps,
+                              in, in_frames, (long)base - (long)half + 1L);
+            out[n] = (float)(a0 + t * (a1 - a0));
+        }
+
+        phase += table->down;
+        base += phase / table->up;
+        phase %= table->up;
+    }
+
+    return TRUE;
+}
+
+/* Scale a sample point to the new rate */
+static DWORD resample_point(DWORD point, DWORD in_rate, DWORD out_rate, DWORD out_count) {
+    DWORD scaled;
+
+    scaled = (DWORD)floor((double)point * (double)out_rate / (double)in_rate + 0.5);
+    if (out_count > 0 && scaled >= out_count) {
+        scaled = out_count - 1;
+    }
+    return scaled;
+}
+
+/* Resample a sample to a new rate */
+SMDI_Sample* SMDI_ResampleSample(SMDI_Sample* sample, DWORD out_rate, DWORD dither_mode) {
+    SMDI_Sample* result;
+    SMDI_PCMFormat sample_fmt, float_fmt;
+    SMDI_PCMDither dither;
+    float* in;
+    float* out;
+    DWORD in_count, out_count, c;
+
+    if (sample == NULL || out_rate == 0 || sample->sample_rate == 0 ||
+        sample->channels == 0 || sample->channels > PCM_MAX_CHANNELS) {
+        return NULL;
+    }
+
+    in_count = sample->sample_count;
+    out_count = SMDI_ResampleLength(in_count, sample->sample_rate, out_rate);
+
+    /* Every output frame is written by the conversion below */
+    result = SMDI_AllocSample(out_rate, sample->bits_per_sample, sample->channels, out_count);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    /* Copy the sample properties, moving the loop to the new rate */
+    result->loop_type = sample->loop_type;
+    result->loop_start = resample_point(sample->loop_start, sample->sample_rate,
+                                        out_rate, out_count);
+    result->loop_end = resample_point(sample->loop_end, sample->sample_rate,
+                                      out_rate, out_count);
+    result->root_note = sample->root_note;
+    result->fine_tune = sample->fine_tune;
+    strcpy(result->name, sample->name);
+
+    /* Work on one float plane per channel */
+    in = (float*)malloc(in_count * sample->channels * sizeof(float));
+    out = (float*)malloc(out_count * sample->channels * sizeof(float));
+    if (in == NULL || out == NULL) {
+        free(in);
+        free(out);
+        SMDI_FreeSample(result);
+        return NULL;
+    }
+
+    SMDI_PCMSetFormat(&sample_fmt, (sample->bits_per_sample == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_HOST, sample->channels, FALSE);
+    SMDI_PCMSetFormat(&float_fmt, PCM_F32, PCM_ORDER_HOST, sample->channels, TRUE);
+    SMDI_PCMConvert(&sample_fmt, sample->sample_data, &float_fmt, in, in_count);
+
+    for (c = 0; c < sample->channels; c++) {
+        if (!SMDI_ResampleFloat(in + c * in_count, in_count, sample->sample_rate,
+                                out + c * out_count, out_rate)) {
+            free(in);
+            free(out);
+            SMDI_FreeSample(result);
+            return NULL;
+        }
+    }
+
+    /* Requantize back to the sample's word size */
+    SMDI_PCMInitDither(&dither, dither_mode);
+    SMDI_PCMConvertDither(&float_fmt, out, &sample_fmt, result->sample_data, out_count,
+                          &dither);
+
+    free(in);
+    free(out);
+    return result;
+}
+
+/* Release the cached filter tables */
+void SMDI_FreeResampleTables(void) {
+    int i;
+
+    for (i = 0; i < RESAMPLE_CACHE_SIZE; i++) {
+        free(g_tables[i].coeffs);
+        memset(&g_tables[i], 0, sizeof(resample_table_t));
+    }
+    g_next_table = 0;
+}
@@ -8,29 +8,15 @@
 #include <string.h>
 #include "smdi.h"
 #include "smdi_sample.h"
+#include "smdi_sdmp.h"
+#include "smdi_endian.h"
 
-/* Structure for native sample format header */
-typedef struct {
-    BYTE  signature[4];       /* 'SDMP' */
-    DWORD version;            /* Version number (1) */
-    BYTE  bitsPerSample;      /* Typically 16 */
-    BYTE  channels;           /* 1=mono, 2=stereo */
-    BYTE  loopType;           /* 0=none, 1=forward, 2=bidirectional */
-    BYTE  reserved;
-    DWORD sampleRate;         /* In Hz */
-    DWORD sampleCount;        /* Per channel */
-    DWORD loopStart;          /* Sample point */
-    DWORD loopEnd;            /* Sample point */
-    WORD  pitch;              /* MIDI note */
-    WORD  pitchFraction;      /* Cents, -50 to +50 */
-    DWORD nameLength;         /* Length of name string */
-    /* Name string follows... */
-    /* Then sample data... */
-} NativeSampleHeader;
+/* Bounce buffer size for writing host order data in SMDI order */
+#define SAMPLE_SWAP_CHUNK 49152    /* A multiple of 2, 3 and 4 byte words */
 
-/* Create a new sample */
-SMDI_Sample* SMDI_CreateSample(DWORD sample_rate, BYTE bits_per_sample, 
-                             BYTE channels, DWORD sample_count) {
+/* Create a new sample, leaving the data uninitialised */
+SMDI_Sample* SMDI_AllocSample(DWORD sample_rate, BYTE bits_per_sample, 
+                            BYTE channels, DWORD sample_count) {
     SMDI_Sample* sample;
     DWORD data_size;
     
@@ -58,6 +44,8 @@ SMDI_Sample* SMDI_CreateSample(DWORD sample_rate, BYTE bits_per_sample,
     sample->root_note = 60;  /* Middle C */
     sample->fine_tune = 0;
     sample->name[0] = '\0';  /* Empty name */
+    sample->map_base = NULL;
+    sample->map_size = 0;
     
     /* Calculate data size in bytes */
     if (bits_per_sample == 16) {
@@ -73,23 +61,36 @@ SMDI_Sample* SMDI_CreateSample(DWORD sample_rate, BYTE bits_per_sample,
         return NULL;
     }
     
-    /* Clear the sample data */
-    memset(sample->sample_data, 0, data_size);
-    
     /* Store the data size */
     sample->data_size = data_size;
     
     return sample;
 }
 
+/* Create a new sample */
+SMDI_Sample* SMDI_CreateSample(DWORD sample_rate, BYTE bits_per_sample, 
+                             BYTE channels, DWORD sample_count) {
+    SMDI_Sample* sample;
+    
+    sample = SMDI_AllocSample(sample_rate, bits_per_sample, channels, sample_count);
+    if (sample != NULL) {
+        /* Clear the sample data */
+        memset(sample->sample_data, 0, sample->data_size);
+    }
+    
+    return sample;
+}
+
 /* Free a sample */
 void SMDI_FreeSample(SMDI_Sample* sample) {
     if (sample == NULL) {
         return;
     }
     
-    /* Free the sample data */
-    if (sample->sample_data != NULL) {
+    /* Free the sample data, or drop the file mapping holding it */
+    if (sample->map_base != NULL) {
+        SMDI_UnmapNativeFile(sample->map_base, sample->map_size);
+    } else if (sample->sample_data != NULL) {
         free(sample->sample_data);
     }
     
@@ -112,8 +113,8 @@ SMDI_Sample* SMDI_HeaderToSample(SMDI_SampleHeader* header, void* data) {
         return NULL;
     }
     
-    /* Create a new sample */
-    sample = SMDI_CreateSample(
+    /* Create a new sample; the data is copied over it */
+    sample = SMDI_AllocSample(
         1000000000 / header->dwPeriod,    /* Convert period to rate */
         header->BitsPerWord,
         header->NumberOfChannels,
@@ -176,11 +177,58 @@ void SMDI_SampleToHeader(SMDI_Sample* sample, SMDI_SampleHeader* header) {
     header->cName[header->NameLength] = '\0';
 }
 
+/* Set up an upload source sending a sample straight from memory */
+void SMDI_SampleSourceFromSample(SMDI_SampleSource* source, SMDI_Sample* sample) {
+    if (source == NULL || sample == NULL) {
+        return;
+    }
+    
+    memset(source, 0, sizeof(SMDI_SampleSource));
+    source->dwStructSize = sizeof(SMDI_SampleSource);
+    SMDI_SampleToHeader(sample, &source->header);
+    source->dwSampleRate = sample->sample_rate;
+    
+    /* The data is in host order; packets are swapped as they are copied */
+    source->dwCopyMode = SMDI_HostCopyMode(sample->bits_per_sample);
+    source->lpData = sample->sample_data;
+}
+
+/* Write sample data in SMDI (big-endian) order without touching the sample */
+static BOOL write_sample_data(FILE* file, SMDI_Sample* sample) {
+    BYTE* chunk;
+    DWORD mode;
+    DWORD offset;
+    DWORD length;
+    BOOL ok;
+    
+    mode = SMDI_HostCopyMode(sample->bits_per_sample);
+    if (mode == CM_NORMAL) {
+        return (fwrite(sample->sample_data, 1, sample->data_size, file) == sample->data_size);
+    }
+    
+    chunk = (BYTE*)malloc(SAMPLE_SWAP_CHUNK);
+    if (chunk == NULL) {
+        return FALSE;
+    }
+    
+    ok = TRUE;
+    for (offset = 0; ok && offset < sample->data_size; offset += length) {
+        length = sample->data_size - offset;
+        if (length > SAMPLE_SWAP_CHUNK) {
+            length = SAMPLE_SWAP_CHUNK;
+        }
+        SMDI_CopySampleData(chunk, (BYTE*)sample->sample_data + offset, length, mode);
+        ok = (fwrite(chunk, 1, length, file) == length);
+    }
+    
+    free(chunk);
+    return ok;
+}
+
 /* Save a sample to a file */
 BOOL SMDI_SaveSample(SMDI_Sample* sample, const char* filename) {
     FILE* file;
-    NativeSampleHeader header;
-    size_t name_len;
+    SMDI_NativeHeader header;
     
     /* Verify parameters */
     if (sample == NULL || filename == NULL) {
@@ -194,48 +242,131 @@ BOOL SMDI_SaveSample(SMDI_Sample* sample, const char* filename) {
     }
     
     /* Create the file header */
-    memcpy(header.signature, "SDMP", 4);
-    header.version = 1;
+    SMDI_InitNativeHeader(&header);
     header.bitsPerSample = sample->bits_per_sample;
     header.channels = sample->channels;
     header.loopType = sample->loop_type;
-    header.reserved = 0;
     header.sampleRate = sample->sample_rate;
     header.sampleCount = sample->sample_count;
     header.loopStart = sample->loop_start;
     header.loopEnd = sample->loop_end;
     header.pitch = sample->root_note;
     header.pitchFraction = sample->fine_tune;
+    strncpy(header.name, sample->name, 255);
+    header.name[255] = '\0';
     
-    /* Get the name length */
-    name_len = strlen(sample->name);
-    if (name_len > 255) {
-        name_len = 255;
+    /* Write the header, padded to the aligned data offset */
+    if (!SMDI_WriteNativeHeader(file, &header)) {
+        fclose(file);
+        return FALSE;
     }
-    header.nameLength = name_len;
     
-    /* Write the header */
-    if (fwrite(&header, sizeof(NativeSampleHeader), 1, file) != 1) {
+    /* Write the sample data */
+    if (!write_sample_data(file, sample)) {
         fclose(file);
         return FALSE;
     }
     
-    /* Write the name */
-    if (name_len > 0) {
-        if (fwrite(sample->name, 1, name_len, file) != name_len) {
-            fclose(file);
-            return FALSE;
+    /* Close the file */
+    if (fclose(file) != 0) {
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/* State of a native file download sink */
+typedef struct {
+    FILE* file;
+    char filename[MAX_PATH];
+    BOOL ok;
+} native_sink_t;
+
+/* Create the native file and write its header once the header is known */
+static BOOL native_sink_begin(SMDI_SampleSink* sink) {
+    native_sink_t* state;
+    SMDI_SampleHeader* sh;
+    SMDI_NativeHeader header;
+    
+    state = (native_sink_t*)sink->lpUserData;
+    sh = &sink->header;
+    if (sh->dwPeriod == 0) {
+        return FALSE;
+    }
+    
+    state->file = fopen(state->filename, "wb");
+    if (state->file == NULL) {
+        return FALSE;
+    }
+    
+    SMDI_InitNativeHeader(&header);
+    header.bitsPerSample = sh->BitsPerWord;
+    header.channels = sh->NumberOfChannels;
+    header.loopType = sh->LoopControl;
+    header.sampleRate = 1000000000 / sh->dwPeriod;
+    header.sampleCount = sh->dwLength;
+    header.loopStart = sh->dwLoopStart;
+    header.loopEnd = sh->dwLoopEnd;
+    header.pitch = sh->wPitch;
+    header.pitchFraction = sh->wPitchFraction;
+    strncpy(header.name, sh->cName, 255);
+    header.name[255] = '\0';
+    
+    /* Native files hold SMDI order, so packets are written as they come */
+    sink->dwCopyMode = CM_NORMAL;
+    state->ok = SMDI_WriteNativeHeader(state->file, &header);
+    return state->ok;
+}
+
+static BOOL native_sink_write(SMDI_SampleSink* sink, void* data, DWORD bytes) {
+    native_sink_t* state;
+    
+    state = (native_sink_t*)sink->lpUserData;
+    state->ok = state->ok && (fwrite(data, 1, bytes, state->file) == bytes);
+    return state->ok;
+}
+
+/* Finish the native file, or remove it if the download failed */
+static BOOL native_sink_end(SMDI_SampleSink* sink, BOOL complete) {
+    native_sink_t* state;
+    BOOL ok;
+    
+    state = (native_sink_t*)sink->lpUserData;
+    ok = FALSE;
+    if (state->file != NULL) {
+        ok = (fclose(state->file) == 0) && state->ok && complete;
+        if (!ok) {
+            remove(state->filename);
         }
     }
     
-    /* Write the sample data */
-    if (fwrite(sample->sample_data, 1, sample->data_size, file) != sample->data_size) {
-        fclose(file);
+    free(state);
+    sink->lpUserData = NULL;
+    return ok;
+}
+
+/* Set up a download sink writing a native file */
+BOOL SMDI_OpenNativeSink(SMDI_SampleSink* sink, const char* filename) {
+    native_sink_t* state;
+    
+    if (sink == NULL || filename == NULL || strlen(filename) >= MAX_PATH) {
         return FALSE;
     }
     
-    /* Close the file */
-    fclose(file);
+    state = (native_sink_t*)malloc(sizeof(native_sink_t));
+    if (state == NULL) {
+        return FALSE;
+    }
+    memset(state, 0, sizeof(native_sink_t));
+    strcpy(state->filename, filename);
+    
+    memset(sink, 0, sizeof(SMDI_SampleSink));
+    sink->dwStructSize = sizeof(SMDI_SampleSink);
+    sink->dwCopyMode = CM_NORMAL;
+    sink->lpBegin = native_sink_begin;
+    sink->lpWrite = native_sink_write;
+    sink->lpEnd = native_sink_end;
+    sink->lpUserData = state;
     
     return TRUE;
 }
@@ -243,10 +374,8 @@ BOOL SMDI_SaveSample(SMDI_Sample* sample, const char* filename) {
 /* Load a sample from a file */
 SMDI_Sample* SMDI_LoadSample(const char* filename) {
     FILE* file;
-    NativeSampleHeader header;
+    SMDI_NativeHeader header;
     SMDI_Sample* sample;
-    char* name_buffer;
-    DWORD data_size;
     
     /* Verify parameters */
     if (filename == NULL) {
@@ -259,20 +388,14 @@ SMDI_Sample* SMDI_LoadSample(const char* filename) {
         return NULL;
     }
     
-    /* Read the header */
-    if (fread(&header, sizeof(NativeSampleHeader), 1, file) != 1) {
+    /* Read the header (version 1 or 2); leaves the file at the data */
+    if (!SMDI_ReadNativeHeader(file, &header)) {
         fclose(file);
         return NULL;
     }
     
-    /* Verify the signature */
-    if (memcmp(header.signature, "SDMP", 4) != 0) {
-        fclose(file);
-        return NULL;
-    }
-    
-    /* Create a new sample */
-    sample = SMDI_CreateSample(
+    /* Create a new sample; the file data is read over it */
+    sample = SMDI_AllocSample(
         header.sampleRate,
         header.bitsPerSample,
         header.channels,
@@ -289,35 +412,8 @@ SMDI_Sample* SMDI_LoadSample(const char* filename) {
     sample->loop_end = header.loopEnd;
     sample->root_note = header.pitch;
     sample->fine_tune = header.pitchFraction;
-    
-    /* Read the name */
-    if (header.nameLength > 0) {
-        /* Allocate a buffer for the name */
-        name_buffer = (char*)malloc(header.nameLength + 1);
-        if (name_buffer == NULL) {
-            SMDI_FreeSample(sample);
-            fclose(file);
-            return NULL;
-        }
-        
-        /* Read the name */
-        if (fread(name_buffer, 1, header.nameLength, file) != header.nameLength) {
-            free(name_buffer);
-            SMDI_FreeSample(sample);
-            fclose(file);
-            return NULL;
-        }
-        
-        /* Null-terminate the name */
-        name_buffer[header.nameLength] = '\0';
-        
-        /* Copy the name to the sample */
-        strncpy(sample->name, name_buffer, 255);
-        sample->name[255] = '\0';
-        
-        /* Free the name buffer */
-        free(name_buffer);
-    }
+    strncpy(sample->name, header.name, 255);
+    sample->name[255] = '\0';
     
     /* Read the sample data */
     if (fread(sample->sample_data, 1, sample->data_size, file) != sample->data_size) {
@@ -326,8 +422,85 @@ SMDI_Sample* SMDI_LoadSample(const char* filename) {
         return NULL;
     }
     
+    /* Files hold SMDI (big-endian) order; samples are kept in host order */
+    SMDI_CopySampleData(sample->sample_data, sample->sample_data, sample->data_size,
+                        SMDI_HostCopyMode(sample->bits_per_sample));
+    
     /* Close the file */
     fclose(file);
     
     return sample;
 }
+
+/* Load a sample with sample_data pointing into a private mapping of the file */
+SMDI_Sample* SMDI_MapSample(const char* filename) {
+    FILE* file;
+    SMDI_NativeHeader header;
+    SMDI_Sample* sample;
+    void* base;
+    DWORD map_size;
+    
+    /* Verify parameters */
+    if (filename == NULL) {
+        return NULL;
+    }
+    
+    /* Open the file */
+    file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    
+    /* Read the header (version 1 or 2) */
+    if (!SMDI_ReadNativeHeader(file, &header) || header.sampleRate == 0 ||
+        header.channels == 0 ||
+        (header.bitsPerSample != 8 && header.bitsPerSample != 16)) {
+        fclose(file);
+        return NULL;
+    }
+    
+    /* Version 1 data can start at an odd offset; read those into memory */
+    if ((header.dataOffset % sizeof(short)) != 0) {
+        fclose(file);
+        return SMDI_LoadSample(filename);
+    }
+    
+    base = SMDI_MapNativeFile(file, &header, &map_size);
+    fclose(file);
+    
+    if (base == NULL) {
+        return SMDI_LoadSample(filename);
+    }
+    
+    sample = (SMDI_Sample*)malloc(sizeof(SMDI_Sample));
+    if (sample == NULL) {
+        SMDI_UnmapNativeFile(base, map_size);
+        return NULL;
+    }
+    
+    /* Copy the sample properties */
+    sample->sample_rate = header.sampleRate;
+    sample->bits_per_sample = header.bitsPerSample;
+    sample->channels = header.channels;
+    sample->loop_type = header.loopType;
+    sample->reserved = 0;
+    sample->sample_count = header.sampleCount;
+    sample->loop_start = header.loopStart;
+    sample->loop_end = header.loopEnd;
+    sample->root_note = header.pitch;
+    sample->fine_tune = header.pitchFraction;
+    strncpy(sample->name, header.name, 255);
+    sample->name[255] = '\0';
+    
+    /* The data stays in the file pages; writes only touch a private copy */
+    sample->sample_data = (short*)((char*)base + header.dataOffset);
+    sample->data_size = header.dataSize;
+    sample->map_base = base;
+    sample->map_size = map_size;
+    
+    /* Convert to host order in the private pages; a no-op on big-endian hosts */
+    SMDI_CopySampleData(sample->sample_data, sample->sample_data, sample->data_size,
+                        SMDI_HostCopyMode(sample->bits_per_sample));
+    
+    return sample;
+}
@@ -0,0 +1,260 @@
+/*
+ * SMDI native sample file (SDMP) header implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * Headers are serialized byte by byte so that files are identical
+ * whatever the compiler padding and host byte order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "smdi.h"
+#include "smdi_sdmp.h"
+
+/* Store big-endian values */
+static void put16(BYTE* p, WORD v) {
+    p[0] = (BYTE)((v >> 8) & 0xFF);
+    p[1] = (BYTE)(v & 0xFF);
+}
+
+static void put32(BYTE* p, DWORD v) {
+    p[0] = (BYTE)((v >> 24) & 0xFF);
+    p[1] = (BYTE)((v >> 16) & 0xFF);
+    p[2] = (BYTE)((v >> 8) & 0xFF);
+    p[3] = (BYTE)(v & 0xFF);
+}
+
+/* Fetch values in either byte order */
+static WORD get16(const BYTE* p, BOOL little) {
+    if (little) {
+        return (WORD)(p[0] | (p[1] << 8));
+    }
+    return (WORD)((p[0] << 8) | p[1]);
+}
+
+static DWORD get32(const BYTE* p, BOOL little) {
+    if (little) {
+        return (DWORD)p[0] | ((DWORD)p[1] << 8) |
+               ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+    }
+    return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) |
+           ((DWORD)p[2] << 8) | (DWORD)p[3];
+}
+
+/* Clear a header and set the current version */
+void SMDI_InitNativeHeader(SMDI_NativeHeader* hdr) {
+    if (hdr == NULL) {
+        return;
+    }
+    
+    memset(hdr, 0, sizeof(SMDI_NativeHeader));
+    hdr->version = SDMP_VERSION_2;
+    hdr->dataOffset = SDMP_DATA_ALIGN;
+}
+
+/* Read a version 1 header (the raw IRIX struct) */
+static BOOL read_v1_header(FILE* fp, const BYTE* start, SMDI_NativeHeader* hdr) {
+    BYTE raw[SDMP_V1_HEADER_SIZE];
+    BOOL little;
+    
+    memcpy(raw, start, 8);
+    if (fread(raw + 8, 1, SDMP_V1_HEADER_SIZE - 8, fp) != SDMP_V1_HEADER_SIZE - 8) {
+        return FALSE;
+    }
+    
+    /* IRIX wrote big-endian; accept files written on little-endian hosts too */
+    little = (get32(&raw[4], FALSE) != SDMP_VERSION_1);
+    
+    hdr->version = SDMP_VERSION_1;
+    hdr->bitsPerSample = raw[8];
+    hdr->channels = raw[9];
+    hdr->loopType = raw[10];
+    hdr->reserved = raw[11];
+    hdr->sampleRate = get32(&raw[12], little);
+    hdr->sampleCount = get32(&raw[16], little);
+    hdr->loopStart = get32(&raw[20], little);
+    hdr->loopEnd = get32(&raw[24], little);
+    hdr->pitch = get16(&raw[28], little);
+    hdr->pitchFraction = get16(&raw[30], little);
+    hdr->nameLength = get32(&raw[32], little);
+    
+    if (hdr->nameLength > 255) {
+        return FALSE;
+    }
+    
+    if (hdr->nameLength > 0 &&
+        fread(hdr->name, 1, hdr->nameLength, fp) != hdr->nameLength) {
+        return FALSE;
+    }
+    hdr->name[hdr->nameLength] = '\0';
+    
+    hdr->dataOffset = SDMP_V1_HEADER_SIZE + hdr->nameLength;
+    hdr->dataSize = hdr->sampleCount * hdr->channels * hdr->bitsPerSample / 8;
+    
+    return TRUE;
+}
+
+/* Read a version 1 or 2 header; the file is left at the sample data */
+BOOL SMDI_ReadNativeHeader(FILE* fp, SMDI_NativeHeader* hdr) {
+    BYTE raw[SDMP_V2_FIXED_SIZE];
+    DWORD version;
+    
+    if (fp == NULL || hdr == NULL) {
+        return FALSE;
+    }
+    
+    memset(hdr, 0, sizeof(SMDI_NativeHeader));
+    
+    if (fread(raw, 1, 8, fp) != 8 || memcmp(raw, SDMP_SIGNATURE, 4) != 0) {
+        return FALSE;
+    }
+    
+    version = get32(&raw[4], FALSE);
+    if (version == SDMP_VERSION_1 || get32(&raw[4], TRUE) == SDMP_VERSION_1) {
+        return read_v1_header(fp, raw, hdr);
+    }
+    
+    if (version != SDMP_VERSION_2) {
+        return FALSE;
+    }
+    
+    if (fread(raw + 8, 1, SDMP_V2_FIXED_SIZE - 8, fp) != SDMP_V2_FIXED_SIZE - 8) {
+        return FALSE;
+    }
+    
+    hdr->version = version;
+    hdr->dataOffset = get32(&raw[8], FALSE);
+    hdr->dataSize = get32(&raw[12], FALSE);
+    hdr->bitsPerSample = raw[16];
+    hdr->channels = raw[17];
+    hdr->loopType = raw[18];
+    hdr->reserved = raw[19];
+    hdr->sampleRate = get32(&raw[20], FALSE);
+    hdr->sampleCount = get32(&raw[24], FALSE);
+    hdr->loopStart = get32(&raw[28], FALSE);
+    hdr->loopEnd = get32(&raw[32], FALSE);
+    hdr->pitch = get16(&raw[36], FALSE);
+    hdr->pitchFraction = get16(&raw[38], FALSE);
+    hdr->nameLength = get32(&raw[40], FALSE);
+    
+    if (hdr->nameLength > 255 || hdr->dataOffset < SDMP_V2_FIXED_SIZE) {
+        return FALSE;
+    }
+    
+    memcpy(hdr->name, &raw[SDMP_V2_NAME_OFFSET], hdr->nameLength);
+    hdr->name[hdr->nameLength] = '\0';
+    
+    /* Skip the reserved metadata area */
+    if (fseek(fp, (long)hdr->dataOffset, SEEK_SET) != 0) {
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/* Write a version 2 header padded up to the data offset */
+BOOL SMDI_WriteNativeHeader(FILE* fp, SMDI_NativeHeader* hdr) {
+    BYTE raw[SDMP_V2_FIXED_SIZE];
+    BYTE zeros[256];
+    DWORD name_len;
+    DWORD remaining;
+    DWORD chunk;
+    
+    if (fp == NULL || hdr == NULL) {
+        return FALSE;
+    }
+    
+    name_len = strlen(hdr->name);
+    if (name_len > 255) {
+        name_len = 255;
+    }
+    
+    /* Data starts on the first aligned boundary after the fixed part */
+    if (hdr->dataOffset < SDMP_V2_FIXED_SIZE || (hdr->dataOffset % SDMP_DATA_ALIGN) != 0) {
+        hdr->dataOffset = SDMP_DATA_ALIGN;
+    }
+    hdr->version = SDMP_VERSION_2;
+    hdr->nameLength = name_len;
+    hdr->dataSize = hdr->sampleCount * hdr->channels * hdr->bitsPerSample / 8;
+    
+    memset(raw, 0, sizeof(raw));
+    memcpy(raw, SDMP_SIGNATURE, 4);
+    put32(&raw[4], hdr->version);
+    put32(&raw[8], hdr->dataOffset);
+    put32(&raw[12], hdr->dataSize);
+    raw[16] = hdr->bitsPerSample;
+    raw[17] = hdr->channels;
+    raw[18] = hdr->loopType;
+    raw[19] = 0;
+    put32(&raw[20], hdr->sampleRate);
+    put32(&raw[24], hdr->sampleCount);
+    put32(&raw[28], hdr->loopStart);
+    put32(&raw[32], hdr->loopEnd);
+    put16(&raw[36], hdr->pitch);
+    put16(&raw[38], hdr->pitchFraction);
+    put32(&raw[40], name_len);
+    memcpy(&raw[SDMP_V2_NAME_OFFSET], hdr->name, name_len);
+    
+    if (fwrite(raw, 1, SDMP_V2_FIXED_SIZE, fp) != SDMP_V2_FIXED_SIZE) {
+        return FALSE;
+    }
+    
+    /* Zero the reserved metadata area */
+    memset(zeros, 0, sizeof(zeros));
+    remaining = hdr->dataOffset - SDMP_V2_FIXED_SIZE;
+    while (remaining > 0) {
+        chunk = remaining > sizeof(zeros) ? sizeof(zeros) : remaining;
+        if (fwrite(zeros, 1, chunk, fp) != chunk) {
+            return FALSE;
+        }
+        remaining -= chunk;
+    }
+    
+    return TRUE;
+}
+
+/* Map a whole native file privately (copy on write) for sequential reading */
+void* SMDI_MapNativeFile(FILE* fp, SMDI_NativeHeader* hdr, DWORD* lpMapSize) {
+    long file_size;
+    long here;
+    void* base;
+    
+    if (fp == NULL || hdr == NULL || lpMapSize == NULL) {
+        return NULL;
+    }
+    
+    /* The file must hold all of the data the header promises */
+    here = ftell(fp);
+    if (fseek(fp, 0, SEEK_END) != 0) {
+        return NULL;
+    }
+    file_size = ftell(fp);
+    fseek(fp, here, SEEK_SET);
+    
+    if (file_size <= 0 || (DWORD)file_size < hdr->dataOffset + hdr->dataSize) {
+        return NULL;
+    }
+    
+    base = mmap(NULL, (size_t)file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+    if (base == (void*)MAP_FAILED) {
+        return NULL;
+    }
+    
+#ifdef MADV_SEQUENTIAL
+    /* Transfers walk the data once from start to end */
+    madvise((char*)base, (size_t)file_size, MADV_SEQUENTIAL);
+#endif
+    
+    *lpMapSize = (DWORD)file_size;
+    return base;
+}
+
+/* Release a mapping from SMDI_MapNativeFile */
+void SMDI_UnmapNativeFile(void* lpMapBase, DWORD dwMapSize) {
+    if (lpMapBase != NULL) {
+        munmap((char*)lpMapBase, (size_t)dwMapSize);
+    }
+}
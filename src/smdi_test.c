@@ -8,20 +8,100 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "smdi.h"
 #include "smdi_sample.h"
+#include "smdi_endian.h"
 #include "scsi_debug.h"
-#include <dmedia/audioutil.h>
-#include <dmedia/audiofile.h>
 #include "smdi_aif.h"
+#include "smdi_report.h"
+#include "smdi_pcm.h"
+#include "smdi_resample.h"
+#include "smdi_backup.h"
+#include "smdi_copy.h"
+#include "smdi_fanout.h"
+#include "smdi_jobs.h"
 
-#define CMDLINE_SIZE 256
+#define CMDLINE_SIZE 1024
 #define MAX_SAMPLES  128
+#define MAX_WORDS    16
+#define MAX_DEVICES  128
+#define MAX_QUEUED   256
+
+/* Benchmark limits */
+#define BENCH_MAX_VALUES  8
+#define BENCH_MAX_ROUNDS  1000
+#define BENCH_PCM_CHUNK   4096      /* Frames per conversion call */
+
+/* PCM conversion kernel measured by "bench pcm" */
+typedef struct {
+    const char* name;
+    DWORD src_encoding;
+    DWORD src_order;
+    DWORD src_channels;
+    BOOL src_planar;
+    DWORD dst_encoding;
+    DWORD dst_order;
+    DWORD dst_channels;
+    BOOL dst_planar;
+    DWORD dither;
+} pcm_bench_kernel_t;
+
+static const pcm_bench_kernel_t g_pcm_kernels[] = {
+    { "s16be -> s16",         PCM_S16, PCM_ORDER_BIG,    2, FALSE, PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_NONE },
+    { "s16le -> s16be",       PCM_S16, PCM_ORDER_LITTLE, 2, FALSE, PCM_S16, PCM_ORDER_BIG,    2, FALSE, PCM_DITHER_NONE },
+    { "u8 -> s16",            PCM_U8,  PCM_ORDER_HOST,   2, FALSE, PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_NONE },
+    { "s24be -> s16",         PCM_S24, PCM_ORDER_BIG,    2, FALSE, PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_NONE },
+    { "s24le -> s16be",       PCM_S24, PCM_ORDER_LITTLE, 2, FALSE, PCM_S16, PCM_ORDER_BIG,    2, FALSE, PCM_DITHER_NONE },
+    { "s32 -> s16",           PCM_S32, PCM_ORDER_HOST,   2, FALSE, PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_NONE },
+    { "f32 -> s16",           PCM_F32, PCM_ORDER_HOST,   2, FALSE, PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_NONE },
+    { "s16 -> f32",           PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_F32, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_NONE },
+    { "s16 stereo -> mono",   PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_S16, PCM_ORDER_HOST,   1, FALSE, PCM_DITHER_NONE },
+    { "s16 mono -> stereo",   PCM_S16, PCM_ORDER_HOST,   1, FALSE, PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_NONE },
+    { "s16 -> planar",        PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_S16, PCM_ORDER_HOST,   2, TRUE,  PCM_DITHER_NONE },
+    { "f32 planar -> s16be",  PCM_F32, PCM_ORDER_HOST,   2, TRUE,  PCM_S16, PCM_ORDER_BIG,    2, FALSE, PCM_DITHER_NONE },
+    { "s24be -> s16 tpdf",    PCM_S24, PCM_ORDER_BIG,    2, FALSE, PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_TPDF },
+    { "f32 -> s16 shaped",    PCM_F32, PCM_ORDER_HOST,   2, FALSE, PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_SHAPED },
+    { "s16 -> s8 tpdf",       PCM_S16, PCM_ORDER_HOST,   2, FALSE, PCM_S8,  PCM_ORDER_HOST,   2, FALSE, PCM_DITHER_TPDF }
+};
+
+/* Command results */
+#define CMD_OK       0
+#define CMD_ERROR    1
+#define CMD_QUIT     2
+
+/* Batch script - command lines in order */
+typedef struct {
+    char** lines;
+    int count;
+    int size;
+} batch_script_t;
+
+/* Batch worker process running the commands of one device */
+typedef struct {
+    BYTE ha_id;
+    BYTE id;
+    pid_t pid;
+    FILE* output;      /* Captured output, printed when the worker finishes */
+} batch_worker_t;
 
 /* External reference to global debug flag */
 /* extern int g_debug_enabled; */
 static int g_debug_enabled = 0;
 
+/* Number of failed operations, used as the batch exit status */
+static int g_failed_operations = 0;
+
+/* Jobs waiting for "queue run", with the strings they point to */
+static SMDI_Job g_queue[MAX_QUEUED];
+static char g_queue_files[MAX_QUEUED][MAX_PATH];
+static char g_queue_names[MAX_QUEUED][256];
+static int g_queue_count = 0;
+
+/* Where the last upload got to, so a repeated send picks up from there */
+static SMDI_Checkpoint g_checkpoint;
+
 
 /* Progress callback function */
 void progress_callback(SMDI_FileTransmissionInfo* fti, DWORD userData) {
@@ -67,6 +147,23 @@ void progress_callback(SMDI_FileTransmissionInfo* fti, DWORD userData) {
     fflush(stdout);
 }
 
+/* Finish a report record for an operation started at start_time and write it */
+static void report_operation(SMDI_Report* report, double start_time, 
+                             DWORD result, BOOL success) {
+    if (!success) {
+        g_failed_operations++;
+    }
+    
+    if (!SMDI_ReportEnabled()) {
+        return;
+    }
+    
+    report->seconds = SMDI_GetTime() - start_time;
+    report->result = result;
+    report->success = success;
+    SMDI_ReportWrite(report);
+}
+
 /* Print usage information */
 void print_usage(void) {
     printf("\n");
@@ -77,11 +174,42 @@ void print_usage(void) {
     printf("list <ha_id> <id>             - List samples on device\n");
     printf("info <ha_id> <id> <sample_id> - Get sample info\n");
     printf("receive <ha_id> <id> <sample_id> <file> - Download sample to file\n");
-    printf("send <ha_id> <id> <file> <sample_id>    - Upload file to device\n");
+    printf("                              (.wav and .aif files are written as WAV/AIFF)\n");
+    printf("send <ha_id> <id> <file> <sample_id> [verify] [retry <count>]\n");
+    printf("                              - Upload file to device (native, WAV/RF64 or\n");
+    printf("                              AIFF; decoded as it is sent; verify reads it\n");
+    printf("                              back and compares; a failed upload resumes\n");
+    printf("                              from the last acknowledged packet, when sent\n");
+    printf("                              again or on each retry)\n");
     printf("delete <ha_id> <id> <sample_id>         - Delete sample from device\n");
+    printf("backup <ha_id> <id> <dest> [resume] [slots <first> <count>]\n");
+    printf("                              - Save the samples of slots 0-127, or of the\n");
+    printf("                              range given, to an archive (or one file per\n");
+    printf("                              slot if dest is a directory)\n");
+    printf("restore <src> <ha_id> <id> [pack] [verify] - Upload every sample of an archive\n");
+    printf("                              or directory, to its own slot or packed into\n");
+    printf("                              the free slots\n");
+    printf("sync <src> <ha_id> <id> [verify] [manifest] - Send only the samples changed\n");
+    printf("                              since the last sync, delete the removed ones\n");
+    printf("copy <ha1> <id1> <n1> <ha2> <id2> <n2> - Copy a sample between devices\n");
+    printf("                              (no intermediate file)\n");
+    printf("fanout <file> <sample_id> <ha_id> <id> [<ha_id> <id> ...]\n");
+    printf("                              - Upload a file to several devices at once\n");
+    printf("queue send|receive|delete|copy <args> [priority] - Queue a transfer job\n");
+    printf("                              (arguments as for the command itself)\n");
+    printf("queue [list|clear]            - Show or drop the queued jobs\n");
+    printf("queue run [per_adapter] [max] - Run the queued jobs, in parallel across\n");
+    printf("                              devices, highest priority first\n");
     printf("debug [on|off]                - Enable/disable debug output\n");
+    printf("report <file|stdout|off>      - Write a JSON line per operation\n");
+    printf("bench <ha_id> <id> <sample_id> [kb,...] [packet,...] [rounds]\n");
+    printf("                              - Upload/download round trip benchmark\n");
+    printf("bench pcm [mb] [rounds]       - PCM format conversion kernels in GB/s\n");
+    printf("wait                          - Wait for running device commands (batch)\n");
     /* AIF support additions */
-    printf("loadaif <file.aif> <sample_id> <ha_id> <id> - Load AIF and send to device\n");
+    printf("loadaif <file.aif> <sample_id> <ha_id> <id> [8|16] [none|tpdf|shaped] [rate]\n");
+    printf("                              - Load AIF (reduced to 8/16 bit, resampled to\n");
+    printf("                                rate if given) and send to device\n");
     printf("saveaif <ha_id> <id> <sample_id> <file.aif> - Receive sample and save as AIF\n");
     printf("quit                          - Exit the program\n");
     printf("\n");
@@ -105,16 +233,25 @@ void cmd_scan(unsigned char ha_id) {
     int i;
     SCSI_DevInfo dev_info;
     int found;
+    int smdi_found;
     int old_debug = g_debug_enabled;
+    SMDI_Report report;
+    double start_time;
     
     /* This is a debugging function - temporarily enable debugging */
     g_debug_enabled = 1;
     
+    SMDI_ReportInit(&report, "scan");
+    report.ha_id = ha_id;
+    report.all_ids = TRUE;
+    start_time = SMDI_GetTime();
+    
     printf("Scanning host adapter %d for SMDI devices...\n", ha_id);
     printf("ID | Type       | Vendor   | Product        | SMDI\n");
     printf("---|------------|----------|----------------|------\n");
     
     found = 0;
+    smdi_found = 0;
     
     for (i = 0; i < 16; i++) {
         /* Skip LUN 0 of target 7 (typically host adapter) */
@@ -154,6 +291,7 @@ void cmd_scan(unsigned char ha_id) {
             /* Print SMDI status */
             if (dev_info.bSMDI) {
                 printf("Yes\n");
+                smdi_found++;
             } else {
                 printf("No\n");
             }
@@ -168,6 +306,10 @@ void cmd_scan(unsigned char ha_id) {
         printf("%d device(s) found on host adapter %d\n", found, ha_id);
     }
     
+    report.count = found;
+    report_operation(&report, start_time, 
+                     smdi_found > 0 ? SMDIM_SLAVEIDENTIFY : SMDIM_ERROR, smdi_found > 0);
+    
     /* Restore debug state */
     g_debug_enabled = old_debug;
 }
@@ -177,6 +319,16 @@ void cmd_list(unsigned char ha_id, unsigned char id) {
     SMDI_SampleHeader sh;
     int i;
     int found;
+    DWORD result;
+    DWORD messRet;
+    SMDI_Report report;
+    double start_time;
+    
+    SMDI_ReportInit(&report, "list");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    start_time = SMDI_GetTime();
+    result = SMDIM_SAMPLEHEADER;
     
     printf("Listing samples on device %d:%d...\n", ha_id, id);
     printf("ID  | Name                           | Rate     | Length   | Bits | Ch\n");
@@ -190,7 +342,13 @@ void cmd_list(unsigned char ha_id, unsigned char id) {
         sh.dwStructSize = sizeof(SMDI_SampleHeader);
         
         /* Request sample header */
-        if (SMDI_SampleHeaderRequest(ha_id, id, i, &sh) == SMDIM_SAMPLEHEADER && sh.bDoesExist) {
+        messRet = SMDI_SampleHeaderRequest(ha_id, id, i, &sh);
+        if (messRet == SMDIM_ERROR && result != SMDIM_ERROR) {
+            /* Report the first slot that could not be read */
+            result = messRet;
+            report.sample_number = i;
+        }
+        if (messRet == SMDIM_SAMPLEHEADER && sh.bDoesExist) {
             /* Format sample properties */
             printf("%3d | %-30s | %8d | %8d | %4d | %2d\n",
                    i,
@@ -209,6 +367,9 @@ void cmd_list(unsigned char ha_id, unsigned char id) {
     } else {
         printf("%d sample(s) found on device %d:%d\n", found, ha_id, id);
     }
+    
+    report.count = found;
+    report_operation(&report, start_time, result, result != SMDIM_ERROR);
 }
 
 /* Command: Get sample info */
@@ -254,15 +415,42 @@ void cmd_info(unsigned char ha_id, unsigned char id, unsigned long sample_id) {
            (sh.dwLength * sh.NumberOfChannels * sh.BitsPerWord) / 8);
 }
 
+/* File type a download is written as, from the file name's extension */
+static DWORD receive_file_type(const char* filename) {
+    const char* ext;
+    
+    ext = strrchr(filename, '.');
+    if (ext == NULL || strchr(ext, '/') != NULL) {
+        return SF_NATIVE;
+    }
+    
+    if (strcmp(ext, ".wav") == 0 || strcmp(ext, ".WAV") == 0) {
+        return SF_WAV;
+    }
+    if (strcmp(ext, ".aif") == 0 || strcmp(ext, ".AIF") == 0 ||
+        strcmp(ext, ".aiff") == 0 || strcmp(ext, ".AIFF") == 0) {
+        return SF_AIFF;
+    }
+    return SF_NATIVE;
+}
+
 /* Command: Download sample to file */
 void cmd_receive(unsigned char ha_id, unsigned char id, 
                 unsigned long sample_id, const char* filename) {
     SMDI_FileTransfer ft;
     DWORD result;
+    SMDI_Report report;
+    double start_time;
     
     printf("Downloading sample %lu from device %d:%d to file '%s'...\n", 
            sample_id, ha_id, id, filename);
     
+    SMDI_ReportInit(&report, "receive");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    report.sample_number = (long)sample_id;
+    report.file = filename;
+    
     /* Initialize file transfer structure */
     memset(&ft, 0, sizeof(SMDI_FileTransfer));
     ft.dwStructSize = sizeof(SMDI_FileTransfer);
@@ -270,14 +458,17 @@ void cmd_receive(unsigned char ha_id, unsigned char id,
     ft.SCSI_ID = id;
     ft.dwSampleNumber = sample_id;
     ft.lpFileName = (char*)filename;
-    ft.dwFileType = SF_NATIVE;  /* Use our native format */
+    ft.dwFileType = receive_file_type(filename);  /* WAV, AIFF or our native format */
     ft.lpCallback = (void*)progress_callback;
     ft.dwUserData = 0;
     ft.bAsync = FALSE;
     ft.lpReturnValue = &result;
     
     /* Perform the download */
+    SMDI_ResetTransferStats();
+    start_time = SMDI_GetTime();
     result = SMDI_ReceiveFile(&ft);
+    SMDI_ReportFromStats(&report);
     
     printf("\n");
     
@@ -286,21 +477,15 @@ void cmd_receive(unsigned char ha_id, unsigned char id,
     } else {
         printf("Failed to download sample. Error code: 0x%08lX\n", result);
     }
+    
+    report_operation(&report, start_time, result, result == SMDIM_ENDOFPROCEDURE);
 }
 
-/* Command: Upload file to device */
-void cmd_send(unsigned char ha_id, unsigned char id, 
-             const char* filename, unsigned long sample_id) {
-    SMDI_FileTransfer ft;
-    DWORD result;
-    char sample_name[256];
+/* Sample name for a file: its basename without the extension */
+static void sample_name_from_file(char* sample_name, const char* filename) {
     const char* basename;
     char* dot;
     
-    printf("Uploading file '%s' to device %d:%d as sample %lu...\n", 
-           filename, ha_id, id, sample_id);
-    
-    /* Extract basename from filename for sample name */
     basename = strrchr(filename, '/');
     if (basename) {
         basename++; /* Skip the slash */
@@ -308,13 +493,36 @@ void cmd_send(unsigned char ha_id, unsigned char id,
         basename = filename;
     }
     
-    /* Copy basename and remove extension */
     strncpy(sample_name, basename, 255);
     sample_name[255] = '\0';
     dot = strrchr(sample_name, '.');
     if (dot) {
         *dot = '\0';
     }
+}
+
+/* Command: Upload file to device */
+void cmd_send(unsigned char ha_id, unsigned char id, 
+             const char* filename, unsigned long sample_id, BOOL verify,
+             unsigned long retries) {
+    SMDI_FileTransfer ft;
+    DWORD result;
+    DWORD resumed;
+    char sample_name[256];
+    SMDI_Report report;
+    double start_time;
+    
+    printf("Uploading file '%s' to device %d:%d as sample %lu%s...\n", 
+           filename, ha_id, id, sample_id, verify ? " (verified)" : "");
+    
+    SMDI_ReportInit(&report, "send");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    report.sample_number = (long)sample_id;
+    report.file = filename;
+    
+    /* The sample is named after the file */
+    sample_name_from_file(sample_name, filename);
     
     /* Initialize file transfer structure */
     memset(&ft, 0, sizeof(SMDI_FileTransfer));
@@ -328,17 +536,51 @@ void cmd_send(unsigned char ha_id, unsigned char id,
     ft.dwUserData = 0;
     ft.bAsync = FALSE;
     ft.lpReturnValue = &result;
+    ft.bVerify = verify;
+    ft.lpCheckpoint = &g_checkpoint;
     
-    /* Perform the upload */
-    result = SMDI_SendFile(&ft);
+    /* Perform the upload; a failure on the way is retried from the last
+       packet the sampler acknowledged */
+    SMDI_ResetTransferStats();
+    start_time = SMDI_GetTime();
+    resumed = 0;
+    for (;;) {
+        result = SMDI_SendFile(&ft);
+        if (g_checkpoint.dwResumed > resumed) {
+            resumed = g_checkpoint.dwResumed;
+        }
+        if (result == SMDIM_ENDOFPROCEDURE || result == SMDIM_ACK ||
+            result == FE_OPENERROR || result == FE_UNKNOWNFORMAT ||
+            result == FE_VERIFYERROR || retries == 0) {
+            break;
+        }
+        retries--;
+        printf("\nUpload failed (0x%08lX), resuming at packet %lu...\n",
+               result, g_checkpoint.dwPackets);
+    }
+    SMDI_ReportFromStats(&report);
     
     printf("\n");
     
     if (result == SMDIM_ENDOFPROCEDURE || result == SMDIM_ACK) {
-        printf("Sample uploaded successfully.\n");
+        printf(verify ? "Sample uploaded and verified successfully.\n" :
+                        "Sample uploaded successfully.\n");
+        if (resumed > 0) {
+            printf("Resumed after packet %lu.\n", resumed);
+        }
+    } else if (result == FE_VERIFYERROR) {
+        printf("Verify failed: the sampler's copy differs from byte %lu.\n",
+               ft.dwVerifyOffset);
     } else {
         printf("Failed to upload sample. Error code: 0x%08lX\n", result);
+        if (g_checkpoint.dwPackets > 0) {
+            printf("%lu packets were acknowledged; send again to resume.\n",
+                   g_checkpoint.dwPackets);
+        }
     }
+    
+    report_operation(&report, start_time, result, 
+                     result == SMDIM_ENDOFPROCEDURE || result == SMDIM_ACK);
 }
 
 /* Command: Delete sample from device */
@@ -346,20 +588,31 @@ void cmd_delete(unsigned char ha_id, unsigned char id, unsigned long sample_id)
     DWORD result;
     DWORD error_code;
     SMDI_SampleHeader sh;
+    SMDI_Report report;
+    double start_time;
     
     printf("Deleting sample %lu from device %d:%d...\n", sample_id, ha_id, id);
     
+    SMDI_ReportInit(&report, "delete");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    report.sample_number = (long)sample_id;
+    start_time = SMDI_GetTime();
+    
     /* First verify the sample exists */
     memset(&sh, 0, sizeof(SMDI_SampleHeader));
     sh.dwStructSize = sizeof(SMDI_SampleHeader);
     
     if (SMDI_SampleHeaderRequest(ha_id, id, sample_id, &sh) != SMDIM_SAMPLEHEADER || !sh.bDoesExist) {
         printf("Sample %lu not found on device %d:%d\n", sample_id, ha_id, id);
+        report_operation(&report, start_time, SMDIE_NOSAMPLE, FALSE);
         return;
     }
     
     /* Perform the deletion */
     result = SMDI_DeleteSample(ha_id, id, sample_id);
+    report_operation(&report, start_time, result, 
+                     result == SMDIM_ACK || result == SMDIM_ENDOFPROCEDURE);
     
     /* Handle the result */
     if (result == SMDIM_ACK || result == SMDIM_ENDOFPROCEDURE) {
@@ -415,51 +668,80 @@ void cmd_delete(unsigned char ha_id, unsigned char id, unsigned long sample_id)
 
 /* Command: Load AIF file and send to device */
 void cmd_loadaif(const char* aif_filename, unsigned long sample_id, 
-               unsigned char ha_id, unsigned char id) {
-    SMDI_Sample* sample;
+               unsigned char ha_id, unsigned char id, BYTE bits, DWORD dither,
+               DWORD rate) {
+    SMDI_Sample* sample = NULL;
+    SMDI_Sample* resampled;
+    SMDI_SampleSource source;
     SMDI_FileTransfer ft;
     DWORD result;
-    char temp_filename[MAX_PATH];
+    SMDI_Report report;
+    double start_time;
     
     printf("Loading AIF file '%s' and sending to device %d:%d as sample %lu...\n", 
            aif_filename, ha_id, id, sample_id);
     
-    /* Load AIF file */
-    sample = SMDI_LoadAIFSample(aif_filename);
-    if (sample == NULL) {
-        printf("Failed to load AIF file '%s'.\n", aif_filename);
-        return;
+    SMDI_ReportInit(&report, "loadaif");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    report.sample_number = (long)sample_id;
+    report.file = aif_filename;
+    SMDI_ResetTransferStats();
+    start_time = SMDI_GetTime();
+    
+    if (rate == 0) {
+        /* Frames are decoded and requantized as each packet goes out */
+        if (!SMDI_OpenAIFSource(&source, aif_filename, bits, dither)) {
+            printf("Failed to load AIF file '%s'.\n", aif_filename);
+            report_operation(&report, start_time, FE_UNKNOWNFORMAT, FALSE);
+            return;
+        }
+    } else {
+        /* Resampling needs the whole sample, which is then sent from memory */
+        sample = SMDI_LoadAIFSampleAs(aif_filename, bits, dither);
+        if (sample == NULL) {
+            printf("Failed to load AIF file '%s'.\n", aif_filename);
+            report_operation(&report, start_time, FE_UNKNOWNFORMAT, FALSE);
+            return;
+        }
+        
+        /* Convert to the sampler's rate before anything goes over the bus */
+        if (rate != sample->sample_rate) {
+            printf("Resampling from %lu Hz to %lu Hz...\n", sample->sample_rate, rate);
+            resampled = SMDI_ResampleSample(sample, rate, dither);
+            SMDI_FreeSample(sample);
+            sample = resampled;
+            if (sample == NULL) {
+                printf("Failed to resample '%s'.\n", aif_filename);
+                report_operation(&report, start_time, SMDIE_NOMEMORY, FALSE);
+                return;
+            }
+        }
+        SMDI_SampleSourceFromSample(&source, sample);
     }
     
     printf("AIF file loaded successfully:\n");
-    printf("  Name: %s\n", sample->name);
+    printf("  Name: %s\n", source.header.cName);
     printf("  Rate: %lu Hz, Bits: %d, Channels: %d\n", 
-           sample->sample_rate, sample->bits_per_sample, sample->channels);
-    printf("  Samples: %lu\n", sample->sample_count);
-    
-    /* Create temporary file in native format */
-    sprintf(temp_filename, "/tmp/smdi_temp_%lu.sdmp", sample_id);
-    if (!SMDI_SaveSample(sample, temp_filename)) {
-        printf("Failed to create temporary file.\n");
-        SMDI_FreeSample(sample);
-        return;
-    }
+           source.dwSampleRate, source.header.BitsPerWord, source.header.NumberOfChannels);
+    printf("  Samples: %lu\n", source.header.dwLength);
     
-    /* Set up file transfer */
+    /* Set up the transfer; packets are filled straight from the source */
     memset(&ft, 0, sizeof(SMDI_FileTransfer));
     ft.dwStructSize = sizeof(SMDI_FileTransfer);
     ft.HA_ID = ha_id;
     ft.SCSI_ID = id;
     ft.dwSampleNumber = sample_id;
-    ft.lpFileName = temp_filename;
-    ft.lpSampleName = sample->name;
+    ft.lpFileName = NULL;
+    ft.lpSampleName = NULL;
     ft.lpCallback = (void*)progress_callback;
     ft.dwUserData = 0;
     ft.bAsync = FALSE;
     ft.lpReturnValue = &result;
     
-    /* Send the file */
-    result = SMDI_SendFile(&ft);
+    /* Send the sample */
+    result = SMDI_SendSampleSource(&ft, &source);
+    SMDI_ReportFromStats(&report);
     
     printf("\n");
     
@@ -469,20 +751,30 @@ void cmd_loadaif(const char* aif_filename, unsigned long sample_id,
         printf("Failed to upload sample. Error code: 0x%08lX\n", result);
     }
     
+    report_operation(&report, start_time, result, 
+                     result == SMDIM_ENDOFPROCEDURE || result == SMDIM_ACK);
+    
     /* Clean up */
+    SMDI_CloseSampleSource(&source);
     SMDI_FreeSample(sample);
-    unlink(temp_filename);  /* Remove temporary file */
 }
 
 /* Command: Receive sample from device and save as AIF */
 void cmd_saveaif(unsigned char ha_id, unsigned char id, 
                 unsigned long sample_id, const char* aif_filename) {
-    SMDI_Sample* sample;
+    SMDI_SampleSink sink;
     SMDI_FileTransfer ft;
     DWORD result;
-    char temp_filename[MAX_PATH];
     int is_aifc = 0;
     const char* ext_ptr;
+    SMDI_Report report;
+    double start_time;
+    
+    SMDI_ReportInit(&report, "saveaif");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    report.sample_number = (long)sample_id;
+    report.file = aif_filename;
     
     /* Determine if we should use AIFF-C format based on file extension */
     ext_ptr = strstr(aif_filename, ".aifc");
@@ -497,187 +789,1592 @@ void cmd_saveaif(unsigned char ha_id, unsigned char id,
     printf("Downloading sample %lu from device %d:%d and saving as %s...\n", 
            sample_id, ha_id, id, aif_filename);
     
-    /* Create a temporary file to receive sample */
-    sprintf(temp_filename, "/tmp/smdi_temp_%lu.sdmp", sample_id);
+    /* Packets are written straight to the AIF file as they arrive */
+    if (!SMDI_OpenAIFSink(&sink, aif_filename, is_aifc)) {
+        printf("Failed to save as AIF file.\n");
+        report_operation(&report, SMDI_GetTime(), FE_OPENERROR, FALSE);
+        return;
+    }
     
-    /* Set up file transfer */
+    /* Set up the transfer */
     memset(&ft, 0, sizeof(SMDI_FileTransfer));
     ft.dwStructSize = sizeof(SMDI_FileTransfer);
     ft.HA_ID = ha_id;
     ft.SCSI_ID = id;
     ft.dwSampleNumber = sample_id;
-    ft.lpFileName = temp_filename;
-    ft.dwFileType = SF_NATIVE;
+    ft.lpFileName = NULL;
     ft.lpCallback = (void*)progress_callback;
     ft.dwUserData = 0;
     ft.bAsync = FALSE;
     ft.lpReturnValue = &result;
     
     /* Perform the download */
-    result = SMDI_ReceiveFile(&ft);
+    SMDI_ResetTransferStats();
+    start_time = SMDI_GetTime();
+    result = SMDI_ReceiveSampleSink(&ft, &sink);
+    SMDI_ReportFromStats(&report);
     
     printf("\n");
     
     if (result != SMDIM_ENDOFPROCEDURE) {
-        printf("Failed to download sample. Error code: 0x%08lX\n", result);
+        if (result == FE_OPENERROR || result == FE_WRITEERROR) {
+            printf("Failed to save as AIF file.\n");
+        } else {
+            printf("Failed to download sample. Error code: 0x%08lX\n", result);
+        }
+        report_operation(&report, start_time, result, FALSE);
         return;
     }
     
-    /* Load the temporary sample file */
-    sample = SMDI_LoadSample(temp_filename);
-    if (sample == NULL) {
-        printf("Failed to load downloaded sample.\n");
-        unlink(temp_filename);
-        return;
+    report_operation(&report, start_time, result, TRUE);
+    
+    printf("Sample saved as %s successfully.\n", aif_filename);
+    printf("  Name: %s\n", sink.header.cName);
+    printf("  Rate: %lu Hz, Bits: %d, Channels: %d\n", 
+           1000000000 / sink.header.dwPeriod, sink.header.BitsPerWord,
+           sink.header.NumberOfChannels);
+    printf("  Samples: %lu\n", sink.header.dwLength);
+}
+
+/* Print each sample as a backup finishes it */
+static void backup_callback(SMDI_Backup* backup, DWORD sample_number, DWORD result) {
+    (void)backup;
+    if (result == SMDIM_ENDOFPROCEDURE) {
+        printf("Sample %3lu: saved\n", sample_number);
+    } else if (result == FE_OPENERROR) {
+        /* Same value as SlaveIdentify, so name it here */
+        printf("Sample %3lu: failed: cannot be written to the backup\n", sample_number);
+    } else {
+        printf("Sample %3lu: failed: 0x%08lX (%s)\n", sample_number,
+               result, SMDI_MessageName(result));
     }
+    fflush(stdout);
+}
+
+/* Command: Save every sample on a device to an archive or directory */
+void cmd_backup(unsigned char ha_id, unsigned char id, const char* destination,
+                BOOL resume, unsigned long first, unsigned long slots) {
+    SMDI_Backup backup;
+    SMDI_SampleHeader sh;
+    DWORD result;
+    SMDI_Report report;
+    double start_time;
+    double seconds;
     
-    /* Save as AIF file */
-    if (!SMDI_SaveAIFSample(sample, aif_filename, is_aifc)) {
-        printf("Failed to save as AIF file.\n");
-        SMDI_FreeSample(sample);
-        unlink(temp_filename);
-        return;
+    printf("Backing up slots %lu-%lu of device %d:%d to '%s'%s...\n", first,
+           first + slots - 1, ha_id, id, destination, resume ? " (resuming)" : "");
+    
+    SMDI_ReportInit(&report, "backup");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    report.file = destination;
+    
+    memset(&backup, 0, sizeof(SMDI_Backup));
+    backup.dwStructSize = sizeof(SMDI_Backup);
+    backup.HA_ID = ha_id;
+    backup.SCSI_ID = id;
+    backup.dwFirstSample = first;
+    backup.dwSlots = slots;
+    backup.lpDestination = (char*)destination;
+    backup.bResume = resume;
+    backup.lpCallback = backup_callback;
+    
+    SMDI_ResetTransferStats();
+    start_time = SMDI_GetTime();
+    result = SMDI_BackupDevice(&backup);
+    seconds = SMDI_GetTime() - start_time;
+    SMDI_ReportFromStats(&report);
+    report.bytes = backup.dwBytes;
+    report.count = backup.dwSaved;
+    
+    if (result == FE_OPENERROR && backup.dwSaved == 0 && backup.dwFailed == 0) {
+        printf("Cannot write backup to '%s'.\n", destination);
     }
+    printf("%lu sample(s) found, %lu saved, %lu already backed up, %lu failed\n",
+           backup.dwFound, backup.dwSaved, backup.dwSkipped, backup.dwFailed);
+    printf("%lu bytes in %.2f s (%.1f KB/s)\n", backup.dwBytes, seconds,
+           seconds > 0.0 ? (double)backup.dwBytes / seconds / 1024.0 : 0.0);
     
-    printf("Sample saved as %s successfully.\n", aif_filename);
-    printf("  Name: %s\n", sample->name);
-    printf("  Rate: %lu Hz, Bits: %d, Channels: %d\n", 
-           sample->sample_rate, sample->bits_per_sample, sample->channels);
-    printf("  Samples: %lu\n", sample->sample_count);
+    /* Samples past the range are not saved; say so if there are any */
+    memset(&sh, 0, sizeof(SMDI_SampleHeader));
+    sh.dwStructSize = sizeof(SMDI_SampleHeader);
+    if (SMDI_SampleHeaderRequest(ha_id, id, first + slots, &sh) == SMDIM_SAMPLEHEADER &&
+        sh.bDoesExist) {
+        printf("Warning: slot %lu holds a sample but was not backed up; "
+               "give a larger slot range.\n", first + slots);
+    }
     
-    /* Clean up */
-    SMDI_FreeSample(sample);
-    unlink(temp_filename);
+    report_operation(&report, start_time, result, result == SMDIM_ENDOFPROCEDURE);
 }
 
-/* Main function */
-int main(int argc, char *argv[]) {
-    char cmdline[CMDLINE_SIZE];
-    char cmd[CMDLINE_SIZE];
-    char arg1[CMDLINE_SIZE];
-    char arg2[CMDLINE_SIZE];
-    char arg3[CMDLINE_SIZE];
-    char arg4[CMDLINE_SIZE];
-    int args;
-    int debug_enabled = 0;
-    
-    printf("IRIX SMDI Test Shell\n");
-    printf("===================\n");
-    printf("Type 'help' for a list of commands\n");
+/* Print each sample as a restore finishes it */
+static void restore_callback(SMDI_Restore* restore, SMDI_RestoreSample* sample) {
+    const char* name;
     
-    /* Initialize SMDI */
-    cmd_init();
+    (void)restore;
+    name = strrchr(sample->lpName, '/');
+    name = (name != NULL) ? name + 1 : sample->lpName;
     
-    while (1) {
-        /* Display prompt and get command */
-        printf("\nsmdi> ");
-        fflush(stdout);
-        
-        if (fgets(cmdline, CMDLINE_SIZE, stdin) == NULL) {
-            break;
+    if (sample->dwTarget == SMDI_NOSLOT) {
+        printf("'%s': failed: no free slot\n", name);
+    } else if (sample->dwAction == SMDI_RESTORE_UNCHANGED) {
+        printf("Sample %3lu: '%s' unchanged\n", sample->dwTarget, name);
+    } else if (sample->dwAction == SMDI_RESTORE_DELETED &&
+               sample->dwResult == SMDIM_ENDOFPROCEDURE) {
+        printf("Sample %3lu: '%s' deleted, no longer in the source\n", sample->dwTarget, name);
+    } else if (sample->dwResult == SMDIM_ENDOFPROCEDURE) {
+        printf("Sample %3lu: '%s' %lu bytes in %.2f s (%.1f KB/s)", sample->dwTarget,
+               name, sample->dwBytes, sample->dSeconds,
+               sample->dSeconds > 0.0 ? (double)sample->dwBytes / sample->dSeconds / 1024.0 : 0.0);
+        if (sample->dWaitSeconds >= 0.01) {
+            printf(", waited %.2f s to decode", sample->dWaitSeconds);
         }
-        
-        /* Parse command line */
-        cmd[0] = '\0';
-        arg1[0] = '\0';
-        arg2[0] = '\0';
-        arg3[0] = '\0';
-        arg4[0] = '\0';
-        
-        args = sscanf(cmdline, "%s %s %s %s %s", cmd, arg1, arg2, arg3, arg4);
-        
-        if (args <= 0 || cmd[0] == '\0') {
-            continue;  /* Empty command line */
+        printf("\n");
+    } else if (sample->dwResult == FE_OPENERROR) {
+        /* Same value as SlaveIdentify, so name it here */
+        printf("Sample %3lu: '%s' failed: cannot be opened\n", sample->dwTarget, name);
+    } else if (sample->dwResult == FE_VERIFYERROR) {
+        printf("Sample %3lu: '%s' failed: verify differs from byte %lu\n", sample->dwTarget,
+               name, sample->dwVerifyOffset);
+    } else if (sample->dwResult == FE_READERROR) {
+        printf("Sample %3lu: '%s' failed: data is damaged or short\n", sample->dwTarget, name);
+    } else {
+        printf("Sample %3lu: '%s' failed: 0x%08lX (%s)\n", sample->dwTarget, name,
+               sample->dwResult, SMDI_MessageName(sample->dwResult));
+    }
+    fflush(stdout);
+}
+
+/* Command: Upload every sample of an archive or directory to a device */
+void cmd_restore(const char* source, unsigned char ha_id, unsigned char id, BOOL pack,
+                 BOOL verify) {
+    SMDI_Restore restore;
+    DWORD result;
+    SMDI_Report report;
+    double start_time;
+    double seconds;
+    
+    printf("Restoring '%s' to device %d:%d%s%s...\n", source, ha_id, id,
+           pack ? " (packed into free slots)" : "", verify ? " (verified)" : "");
+    
+    SMDI_ReportInit(&report, "restore");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    report.file = source;
+    
+    memset(&restore, 0, sizeof(SMDI_Restore));
+    restore.dwStructSize = sizeof(SMDI_Restore);
+    restore.lpSource = (char*)source;
+    restore.HA_ID = ha_id;
+    restore.SCSI_ID = id;
+    restore.dwPlacement = pack ? SMDI_RESTORE_PACK : SMDI_RESTORE_SAME;
+    restore.dwFirstSample = 0;
+    restore.dwSlots = MAX_SAMPLES;
+    restore.bVerify = verify;
+    restore.lpCallback = restore_callback;
+    
+    SMDI_ResetTransferStats();
+    start_time = SMDI_GetTime();
+    result = SMDI_RestoreDevice(&restore);
+    seconds = SMDI_GetTime() - start_time;
+    SMDI_ReportFromStats(&report);
+    report.bytes = restore.dwBytes;
+    report.count = restore.dwRestored;
+    
+    if (result == FE_OPENERROR && restore.dwFound == 0) {
+        printf("Cannot read a backup from '%s'.\n", source);
+    }
+    printf("%lu sample(s) found, %lu restored, %lu failed\n",
+           restore.dwFound, restore.dwRestored, restore.dwFailed);
+    printf("%lu bytes in %.2f s (%.1f KB/s)\n", restore.dwBytes, seconds,
+           seconds > 0.0 ? (double)restore.dwBytes / seconds / 1024.0 : 0.0);
+    
+    report_operation(&report, start_time, result, result == SMDIM_ENDOFPROCEDURE);
+}
+
+/* Command: Send only the samples that changed since the last sync */
+void cmd_sync(const char* source, unsigned char ha_id, unsigned char id,
+              const char* manifest, BOOL verify) {
+    SMDI_Restore restore;
+    DWORD result;
+    SMDI_Report report;
+    char default_manifest[MAX_PATH];
+    size_t len;
+    double start_time;
+    double seconds;
+    
+    /* By default the manifest sits next to the source, one per device */
+    if (manifest == NULL) {
+        len = strlen(source);
+        while (len > 1 && source[len - 1] == '/') {
+            len--;
         }
-        
-        /* Process command */
-        if (strcmp(cmd, "help") == 0 || strcmp(cmd, "?") == 0) {
-            print_usage();
+        if (len + 24 > MAX_PATH) {
+            printf("Source path too long.\n");
+            return;
         }
-        else if (strcmp(cmd, "scan") == 0) {
-            if (args < 2) {
-                printf("Usage: scan <ha_id>\n");
-            } else {
-                cmd_scan((unsigned char)atoi(arg1));
-            }
+        sprintf(default_manifest, "%.*s.sync-%d-%d", (int)len, source, ha_id, id);
+        manifest = default_manifest;
+    }
+    
+    printf("Syncing '%s' to device %d:%d (manifest '%s')...\n", source, ha_id, id,
+           manifest);
+    
+    SMDI_ReportInit(&report, "sync");
+    report.ha_id = ha_id;
+    report.scsi_id = id;
+    report.file = source;
+    
+    memset(&restore, 0, sizeof(SMDI_Restore));
+    restore.dwStructSize = sizeof(SMDI_Restore);
+    restore.lpSource = (char*)source;
+    restore.HA_ID = ha_id;
+    restore.SCSI_ID = id;
+    restore.lpManifest = (char*)manifest;
+    restore.bVerify = verify;
+    restore.lpCallback = restore_callback;
+    
+    SMDI_ResetTransferStats();
+    start_time = SMDI_GetTime();
+    result = SMDI_SyncDevice(&restore);
+    seconds = SMDI_GetTime() - start_time;
+    SMDI_ReportFromStats(&report);
+    report.bytes = restore.dwBytes;
+    report.count = restore.dwRestored;
+    
+    if (result == FE_OPENERROR && restore.dwFound == 0) {
+        printf("Cannot read a backup from '%s'.\n", source);
+    } else if (result == FE_WRITEERROR) {
+        printf("Cannot write the manifest '%s'.\n", manifest);
+    }
+    printf("%lu sample(s) found, %lu sent, %lu unchanged, %lu deleted, %lu failed\n",
+           restore.dwFound, restore.dwRestored, restore.dwUnchanged, restore.dwDeleted,
+           restore.dwFailed);
+    printf("%lu bytes in %.2f s (%.1f KB/s)\n", restore.dwBytes, seconds,
+           seconds > 0.0 ? (double)restore.dwBytes / seconds / 1024.0 : 0.0);
+    
+    report_operation(&report, start_time, result, result == SMDIM_ENDOFPROCEDURE);
+}
+
+/* Command: Copy a sample from one device to another */
+void cmd_copy(unsigned char src_ha, unsigned char src_id, unsigned long src_sample,
+              unsigned char dst_ha, unsigned char dst_id, unsigned long dst_sample) {
+    SMDI_Copy copy;
+    DWORD result;
+    SMDI_Report report;
+    double start_time;
+    double seconds;
+    
+    printf("Copying sample %lu from device %d:%d to sample %lu on device %d:%d...\n",
+           src_sample, src_ha, src_id, dst_sample, dst_ha, dst_id);
+    
+    SMDI_ReportInit(&report, "copy");
+    report.ha_id = dst_ha;
+    report.scsi_id = dst_id;
+    report.sample_number = (long)dst_sample;
+    
+    memset(&copy, 0, sizeof(SMDI_Copy));
+    copy.dwStructSize = sizeof(SMDI_Copy);
+    copy.SourceHA_ID = src_ha;
+    copy.SourceSCSI_ID = src_id;
+    copy.dwSourceSample = src_sample;
+    copy.DestHA_ID = dst_ha;
+    copy.DestSCSI_ID = dst_id;
+    copy.dwDestSample = dst_sample;
+    copy.lpCallback = (void*)progress_callback;
+    
+    SMDI_ResetTransferStats();
+    start_time = SMDI_GetTime();
+    result = SMDI_CopySample(&copy);
+    seconds = SMDI_GetTime() - start_time;
+    SMDI_ReportFromStats(&report);
+    
+    printf("\n");
+    
+    if (result == SMDIM_ENDOFPROCEDURE) {
+        printf("Sample '%s' copied: %lu bytes in %.2f s (%.1f KB/s)\n", copy.header.cName,
+               copy.dwBytes, seconds,
+               seconds > 0.0 ? (double)copy.dwBytes / seconds / 1024.0 : 0.0);
+    } else if (result == SMDIE_NOSAMPLE) {
+        printf("Sample %lu not found on device %d:%d\n", src_sample, src_ha, src_id);
+    } else if (result == FE_READERROR) {
+        printf("Failed to download the sample from device %d:%d.\n", src_ha, src_id);
+    } else {
+        printf("Failed to copy sample. Error code: 0x%08lX\n", result);
+    }
+    
+    report_operation(&report, start_time, result, result == SMDIM_ENDOFPROCEDURE);
+}
+
+/* Print each device of a fan-out as its upload finishes */
+static void fanout_callback(SMDI_FanOut* fanout, SMDI_FanOutTarget* target) {
+    printf("Device %d:%d sample %lu: ", target->HA_ID, target->SCSI_ID, target->dwSampleNumber);
+    if (target->dwResult == SMDIM_ENDOFPROCEDURE) {
+        printf("%lu bytes in %.2f s (%.1f KB/s, %lu byte packets)\n", fanout->dwBytes,
+               target->dSeconds,
+               target->dSeconds > 0.0 ? (double)fanout->dwBytes / target->dSeconds / 1024.0 : 0.0,
+               target->dwPacketSize);
+    } else if (target->dwResult == FE_OPENERROR) {
+        /* Same value as SlaveIdentify, so name it here */
+        printf("failed: the file cannot be opened\n");
+    } else if (target->dwResult == FE_READERROR) {
+        printf("failed: the file data is damaged or short\n");
+    } else {
+        printf("failed: 0x%08lX (%s)\n", target->dwResult, SMDI_MessageName(target->dwResult));
+    }
+    fflush(stdout);
+}
+
+/* Command: Upload one file to several devices at once */
+void cmd_fanout(const char* filename, unsigned long sample_id, SMDI_FanOutTarget* targets,
+                unsigned long count) {
+    SMDI_FanOut fanout;
+    DWORD result;
+    SMDI_Report report;
+    double start_time;
+    
+    printf("Uploading '%s' to sample %lu on %lu devices...\n", filename, sample_id, count);
+    
+    SMDI_ReportInit(&report, "fanout");
+    report.sample_number = (long)sample_id;
+    
+    memset(&fanout, 0, sizeof(SMDI_FanOut));
+    fanout.dwStructSize = sizeof(SMDI_FanOut);
+    fanout.lpFileName = (char*)filename;
+    fanout.lpTargets = targets;
+    fanout.dwTargets = count;
+    fanout.lpCallback = fanout_callback;
+    
+    start_time = SMDI_GetTime();
+    result = SMDI_FanOutFile(&fanout);
+    report.bytes = fanout.dwBytes * (count - fanout.dwFailed);
+    report.count = count - fanout.dwFailed;
+    
+    if (result == FE_OPENERROR && fanout.dwBytes == 0) {
+        printf("Cannot open '%s'.\n", filename);
+    } else if (result == FE_UNKNOWNFORMAT) {
+        printf("'%s' is not a native, WAV or AIFF sample.\n", filename);
+    } else {
+        printf("%lu of %lu devices loaded in %.2f s\n", count - fanout.dwFailed, count,
+               fanout.dSeconds);
+    }
+    
+    report_operation(&report, start_time, result, result == SMDIM_ENDOFPROCEDURE);
+}
+
+/* Name of a kind of job */
+static const char* job_type_name(DWORD type) {
+    switch (type) {
+        case SMDI_JOB_SEND:    return "send";
+        case SMDI_JOB_RECEIVE: return "receive";
+        case SMDI_JOB_DELETE:  return "delete";
+        case SMDI_JOB_COPY:    return "copy";
+    }
+    return "?";
+}
+
+/* Print a queued job on one line */
+static void print_job(int n, const SMDI_Job* job) {
+    printf("[%d] %-7s %d:%d sample %lu", n, job_type_name(job->dwType),
+           job->HA_ID, job->SCSI_ID, job->dwSampleNumber);
+    if (job->dwType == SMDI_JOB_SEND) {
+        printf(" from '%s'", job->lpFileName);
+    } else if (job->dwType == SMDI_JOB_RECEIVE) {
+        printf(" to '%s'", job->lpFileName);
+    } else if (job->dwType == SMDI_JOB_COPY) {
+        printf(" to %d:%d sample %lu", job->DestHA_ID, job->DestSCSI_ID, job->dwDestSample);
+    }
+    if (job->dwPriority > 0) {
+        printf(", priority %lu", job->dwPriority);
+    }
+}
+
+/* Print each job as it starts and finishes */
+static void job_callback(SMDI_Scheduler* scheduler, SMDI_Job* job) {
+    SMDI_Report report;
+    int n;
+    
+    n = (int)(job - scheduler->lpJobs) + 1;
+    if (job->dwState == SMDI_JOB_RUNNING) {
+        print_job(n, job);
+        printf(": started after %.2f s\n", job->dWaitSeconds);
+        fflush(stdout);
+        return;
+    }
+    
+    printf("[%d] %-7s ", n, job_type_name(job->dwType));
+    if (job->dwResult == SMDIM_ENDOFPROCEDURE) {
+        printf("done in %.2f s\n", job->dSeconds);
+    } else if (job->dwResult == FE_OPENERROR) {
+        /* Same value as SlaveIdentify, so name it here */
+        printf("failed: the file cannot be opened\n");
+    } else if (job->dwResult == SMDIE_NOSAMPLE) {
+        printf("failed: no such sample\n");
+    } else {
+        printf("failed: 0x%08lX (%s)\n", job->dwResult, SMDI_MessageName(job->dwResult));
+    }
+    fflush(stdout);
+    
+    SMDI_ReportInit(&report, job_type_name(job->dwType));
+    report.ha_id = job->HA_ID;
+    report.scsi_id = job->SCSI_ID;
+    report.sample_number = (long)job->dwSampleNumber;
+    report.file = job->lpFileName;
+    report_operation(&report, SMDI_GetTime() - job->dSeconds, job->dwResult,
+                     job->dwResult == SMDIM_ENDOFPROCEDURE);
+}
+
+/* Command: Add a job to the queue */
+static int cmd_queue_add(int args, char* argv[]) {
+    SMDI_Job* job;
+    const char* type;
+    int needed;
+    
+    type = argv[1];
+    if (strcmp(type, "send") == 0 || strcmp(type, "receive") == 0) {
+        needed = 6;
+    } else if (strcmp(type, "delete") == 0) {
+        needed = 5;
+    } else if (strcmp(type, "copy") == 0) {
+        needed = 8;
+    } else {
+        printf("Unknown job '%s' (send, receive, delete or copy)\n", type);
+        return CMD_ERROR;
+    }
+    if (args < needed || args > needed + 1) {
+        printf("Usage: queue send <ha_id> <id> <file> <sample_id> [priority]\n");
+        printf("       queue receive <ha_id> <id> <sample_id> <file> [priority]\n");
+        printf("       queue delete <ha_id> <id> <sample_id> [priority]\n");
+        printf("       queue copy <ha1> <id1> <n1> <ha2> <id2> <n2> [priority]\n");
+        return CMD_ERROR;
+    }
+    if (g_queue_count >= MAX_QUEUED) {
+        printf("The queue is full (%d jobs)\n", MAX_QUEUED);
+        return CMD_ERROR;
+    }
+    
+    job = &g_queue[g_queue_count];
+    memset(job, 0, sizeof(SMDI_Job));
+    job->dwStructSize = sizeof(SMDI_Job);
+    job->HA_ID = (BYTE)atoi(argv[2]);
+    job->SCSI_ID = (BYTE)atoi(argv[3]);
+    job->dwPriority = (args > needed) ? (DWORD)atol(argv[needed]) : 0;
+    
+    if (strcmp(type, "send") == 0) {
+        job->dwType = SMDI_JOB_SEND;
+        strncpy(g_queue_files[g_queue_count], argv[4], MAX_PATH - 1);
+        g_queue_files[g_queue_count][MAX_PATH - 1] = '\0';
+        sample_name_from_file(g_queue_names[g_queue_count], argv[4]);
+        job->lpFileName = g_queue_files[g_queue_count];
+        job->lpSampleName = g_queue_names[g_queue_count];
+        job->dwSampleNumber = (DWORD)atol(argv[5]);
+    } else if (strcmp(type, "receive") == 0) {
+        job->dwType = SMDI_JOB_RECEIVE;
+        job->dwSampleNumber = (DWORD)atol(argv[4]);
+        strncpy(g_queue_files[g_queue_count], argv[5], MAX_PATH - 1);
+        g_queue_files[g_queue_count][MAX_PATH - 1] = '\0';
+        job->lpFileName = g_queue_files[g_queue_count];
+        job->dwFileType = receive_file_type(argv[5]);
+    } else if (strcmp(type, "delete") == 0) {
+        job->dwType = SMDI_JOB_DELETE;
+        job->dwSampleNumber = (DWORD)atol(argv[4]);
+    } else {
+        job->dwType = SMDI_JOB_COPY;
+        job->dwSampleNumber = (DWORD)atol(argv[4]);
+        job->DestHA_ID = (BYTE)atoi(argv[5]);
+        job->DestSCSI_ID = (BYTE)atoi(argv[6]);
+        job->dwDestSample = (DWORD)atol(argv[7]);
+    }
+    
+    g_queue_count++;
+    print_job(g_queue_count, job);
+    printf(" queued\n");
+    return CMD_OK;
+}
+
+/* Command: Run the queued jobs, then empty the queue */
+static void cmd_queue_run(unsigned long per_adapter, unsigned long max_jobs) {
+    SMDI_Scheduler scheduler;
+    DWORD result;
+    
+    if (g_queue_count == 0) {
+        printf("No jobs queued.\n");
+        return;
+    }
+    
+    printf("Running %d job(s)", g_queue_count);
+    if (per_adapter > 0) {
+        printf(", at most %lu per host adapter", per_adapter);
+    }
+    if (max_jobs > 0) {
+        printf(", %lu at once", max_jobs);
+    }
+    printf("...\n");
+    
+    memset(&scheduler, 0, sizeof(SMDI_Scheduler));
+    scheduler.dwStructSize = sizeof(SMDI_Scheduler);
+    scheduler.lpJobs = g_queue;
+    scheduler.dwJobs = (DWORD)g_queue_count;
+    scheduler.dwMaxPerAdapter = per_adapter;
+    scheduler.dwMaxJobs = max_jobs;
+    scheduler.lpCallback = job_callback;
+    
+    result = SMDI_RunJobs(&scheduler);
+    if (result == SMDIE_NOMEMORY && scheduler.dwDone + scheduler.dwFailed == 0) {
+        printf("Cannot start the jobs: out of memory.\n");
+        g_failed_operations++;
+    }
+    printf("%lu job(s) done, %lu failed in %.2f s\n", scheduler.dwDone,
+           scheduler.dwFailed, scheduler.dSeconds);
+    
+    g_queue_count = 0;
+}
+
+/* Command: Queue, list and run transfer jobs */
+static int cmd_queue(int args, char* argv[]) {
+    int i;
+    
+    if (args < 2 || strcmp(argv[1], "list") == 0) {
+        if (g_queue_count == 0) {
+            printf("No jobs queued.\n");
         }
-        else if (strcmp(cmd, "list") == 0) {
-            if (args < 3) {
-                printf("Usage: list <ha_id> <id>\n");
-            } else {
-                cmd_list((unsigned char)atoi(arg1), (unsigned char)atoi(arg2));
-            }
+        for (i = 0; i < g_queue_count; i++) {
+            print_job(i + 1, &g_queue[i]);
+            printf("\n");
         }
-        else if (strcmp(cmd, "info") == 0) {
-            if (args < 4) {
-                printf("Usage: info <ha_id> <id> <sample_id>\n");
-            } else {
-                cmd_info((unsigned char)atoi(arg1), (unsigned char)atoi(arg2), (unsigned long)atol(arg3));
-            }
+        return CMD_OK;
+    }
+    if (strcmp(argv[1], "clear") == 0) {
+        printf("%d job(s) removed.\n", g_queue_count);
+        g_queue_count = 0;
+        return CMD_OK;
+    }
+    if (strcmp(argv[1], "run") == 0) {
+        cmd_queue_run(args > 2 ? (unsigned long)atol(argv[2]) : 0,
+                      args > 3 ? (unsigned long)atol(argv[3]) : 0);
+        return CMD_OK;
+    }
+    return cmd_queue_add(args, argv);
+}
+
+/* Compare two doubles for qsort */
+static int compare_double(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    
+    if (da < db) {
+        return -1;
+    }
+    return (da > db) ? 1 : 0;
+}
+
+/* Parse a comma separated list of numbers; returns the number of values */
+static int parse_number_list(const char* text, DWORD values[], int max_values) {
+    char copy[CMDLINE_SIZE];
+    char* token;
+    int count = 0;
+    
+    strncpy(copy, text, CMDLINE_SIZE - 1);
+    copy[CMDLINE_SIZE - 1] = '\0';
+    
+    for (token = strtok(copy, ","); token != NULL && count < max_values;
+         token = strtok(NULL, ",")) {
+        values[count++] = (DWORD)atol(token);
+    }
+    
+    return count;
+}
+
+/* Print one benchmark result line: latency in ms and throughput */
+static void bench_print(const char* op, DWORD size, DWORD packet_size,
+                        double times[], int count) {
+    double total = 0.0;
+    int i, p99;
+    
+    if (count == 0) {
+        printf("%8lu %8lu  %-8s  failed\n", size, packet_size, op);
+        return;
+    }
+    
+    qsort(times, count, sizeof(double), compare_double);
+    for (i = 0; i < count; i++) {
+        total += times[i];
+    }
+    
+    /* Nearest rank percentile */
+    p99 = (count * 99 + 99) / 100 - 1;
+    
+    printf("%8lu %8lu  %-8s %9.2f %9.2f %9.2f %9.3f\n",
+           size, packet_size, op,
+           times[0] * 1000.0, total * 1000.0 / count, times[p99] * 1000.0,
+           total > 0.0 ? ((double)size * count / total) / 1048576.0 : 0.0);
+}
+
+/* Move one sample to (upload) or from (download) the device in memory */
+static DWORD bench_transfer(SMDI_TransmissionInfo* ti, BOOL upload) {
+    DWORD result;
+    
+    if (upload) {
+        result = SMDI_InitSampleTransmission(ti);
+        while (result == SMDIM_SENDNEXTPACKET) {
+            result = SMDI_SampleTransmission(ti);
         }
-        else if (strcmp(cmd, "receive") == 0) {
-            if (args < 5) {
-                printf("Usage: receive <ha_id> <id> <sample_id> <file>\n");
-            } else {
-                cmd_receive((unsigned char)atoi(arg1), (unsigned char)atoi(arg2), 
-                           (unsigned long)atol(arg3), arg4);
+    } else {
+        result = SMDI_InitSampleReception(ti);
+        if (result == SMDIM_TRANSFERACKNOWLEDGE) {
+            result = SMDIM_DATAPACKET;
+            while (result == SMDIM_DATAPACKET) {
+                result = SMDI_SampleReception(ti);
             }
         }
-        else if (strcmp(cmd, "send") == 0) {
-            if (args < 5) {
-                printf("Usage: send <ha_id> <id> <file> <sample_id>\n");
+    }
+    
+    return result;
+}
+
+/* Command: Upload/download round trips of synthetic samples */
+void cmd_bench(unsigned char ha_id, unsigned char id, unsigned long sample_id,
+               const char* size_list, const char* packet_list, int rounds) {
+    DWORD sizes[BENCH_MAX_VALUES];
+    DWORD packets[BENCH_MAX_VALUES];
+    double* up_times;
+    double* down_times;
+    int size_count, packet_count;
+    int up_count, down_count;
+    int s, p, r;
+    DWORD i, size, saved_packet_size, negotiated;
+    BYTE* tx_data;
+    BYTE* rx_data;
+    SMDI_SampleHeader tx_header;
+    SMDI_SampleHeader rx_header;
+    SMDI_TransmissionInfo ti;
+    SMDI_TransferStats stats;
+    SMDI_Report report;
+    DWORD result;
+    double start_time;
+    
+    size_count = parse_number_list(size_list, sizes, BENCH_MAX_VALUES);
+    packet_count = parse_number_list(packet_list, packets, BENCH_MAX_VALUES);
+    if (rounds < 1) {
+        rounds = 1;
+    }
+    if (rounds > BENCH_MAX_ROUNDS) {
+        rounds = BENCH_MAX_ROUNDS;
+    }
+    
+    up_times = (double*)malloc(rounds * sizeof(double));
+    down_times = (double*)malloc(rounds * sizeof(double));
+    if (up_times == NULL || down_times == NULL) {
+        printf("Out of memory\n");
+        free(up_times);
+        free(down_times);
+        return;
+    }
+    
+    printf("Benchmark on device %d:%d, sample %lu, %d round(s)\n",
+           ha_id, id, sample_id, rounds);
+    printf("   Bytes   Packet  Op           Min ms    Avg ms    P99 ms      MB/s\n");
+    
+    saved_packet_size = SMDI_GetPacketSize();
+    
+    for (s = 0; s < size_count; s++) {
+        /* 16-bit mono sample of the requested size in KB */
+        size = sizes[s] * 1024;
+        if (size < 2) {
+            continue;
+        }
+        
+        tx_data = (BYTE*)malloc(size);
+        rx_data = (BYTE*)malloc(size);
+        if (tx_data == NULL || rx_data == NULL) {
+            printf("Out of memory for %lu byte sample\n", size);
+            free(tx_data);
+            free(rx_data);
+            continue;
+        }
+        
+        /* Ramp pattern so that misplaced packets show up when verifying */
+        for (i = 0; i < size; i++) {
+            tx_data[i] = (BYTE)((i * 7 + (i >> 8)) & 0xFF);
+        }
+        
+        memset(&tx_header, 0, sizeof(tx_header));
+        tx_header.dwStructSize = sizeof(SMDI_SampleHeader);
+        tx_header.BitsPerWord = 16;
+        tx_header.NumberOfChannels = 1;
+        tx_header.dwPeriod = 1000000000 / 44100;
+        tx_header.dwLength = size / 2;
+        tx_header.wPitch = 60;
+        strcpy(tx_header.cName, "SMDI Bench");
+        tx_header.NameLength = (BYTE)strlen(tx_header.cName);
+        
+        for (p = 0; p < packet_count; p++) {
+            SMDI_SetPacketSize(packets[p]);
+            up_count = 0;
+            down_count = 0;
+            negotiated = packets[p];
+            
+            for (r = 0; r < rounds; r++) {
+                /* Upload */
+                memset(&ti, 0, sizeof(ti));
+                ti.dwStructSize = sizeof(SMDI_TransmissionInfo);
+                ti.lpSampleHeader = &tx_header;
+                ti.dwSampleNumber = sample_id;
+                /* Host order words, swapped on the packet path where needed */
+                ti.dwCopyMode = SMDI_HostCopyMode(tx_header.BitsPerWord);
+                ti.lpSampleData = tx_data;
+                ti.HA_ID = ha_id;
+                ti.SCSI_ID = id;
+                
+                SMDI_ReportInit(&report, "bench_send");
+                report.ha_id = ha_id;
+                report.scsi_id = id;
+                report.sample_number = (long)sample_id;
+                
+                SMDI_ResetTransferStats();
+                start_time = SMDI_GetTime();
+                result = bench_transfer(&ti, TRUE);
+                up_times[up_count] = SMDI_GetTime() - start_time;
+                SMDI_ReportFromStats(&report);
+                report_operation(&report, start_time, result, result == SMDIM_ENDOFPROCEDURE);
+                
+                if (result != SMDIM_ENDOFPROCEDURE) {
+                    printf("Upload failed: 0x%08lX (%s)\n", result, SMDI_MessageName(result));
+                    break;
+                }
+                up_count++;
+                
+                /* Download into a cleared buffer */
+                memset(rx_data, 0, size);
+                memset(&rx_header, 0, sizeof(rx_header));
+                rx_header.dwStructSize = sizeof(SMDI_SampleHeader);
+                ti.lpSampleHeader = &rx_header;
+                ti.lpSampleData = rx_data;
+                
+                SMDI_ReportInit(&report, "bench_receive");
+                report.ha_id = ha_id;
+                report.scsi_id = id;
+                report.sample_number = (long)sample_id;
+                
+                SMDI_ResetTransferStats();
+                start_time = SMDI_GetTime();
+                if (SMDI_SampleHeaderRequest(ha_id, id, sample_id, &rx_header) == SMDIM_SAMPLEHEADER &&
+                    rx_header.dwLength * rx_header.NumberOfChannels * rx_header.BitsPerWord / 8 != size) {
+                    result = SMDIM_ERROR;
+                } else {
+                    result = bench_transfer(&ti, FALSE);
+                }
+                down_times[down_count] = SMDI_GetTime() - start_time;
+                SMDI_GetTransferStats(&stats);
+                negotiated = stats.dwPacketSize;
+                SMDI_ReportFromStats(&report);
+                
+                if (result == SMDIM_ENDOFPROCEDURE && memcmp(tx_data, rx_data, size) != 0) {
+                    printf("Verify failed: downloaded data differs\n");
+                    result = SMDIM_ERROR;
+                }
+                report_operation(&report, start_time, result, result == SMDIM_ENDOFPROCEDURE);
+                
+                if (result != SMDIM_ENDOFPROCEDURE) {
+                    printf("Download failed: 0x%08lX (%s)\n", result, SMDI_MessageName(result));
+                    break;
+                }
+                down_count++;
+            }
+            
+            bench_print("upload", size, negotiated, up_times, up_count);
+            bench_print("download", size, negotiated, down_times, down_count);
+        }
+        
+        free(tx_data);
+        free(rx_data);
+    }
+    
+    /* Leave the device and the settings as they were */
+    SMDI_SetPacketSize(saved_packet_size);
+    SMDI_DeleteSample(ha_id, id, sample_id);
+    
+    free(up_times);
+    free(down_times);
+}
+
+/* Convert frames in chunks the way the transfer pipeline does */
+static void bench_pcm_convert(SMDI_PCMFormat* src, BYTE* in, SMDI_PCMFormat* dst, BYTE* out,
+                              DWORD frames, DWORD dither_mode) {
+    SMDI_PCMDither dither;
+    DWORD done, count;
+    DWORD src_step, dst_step;
+    
+    SMDI_PCMInitDither(&dither, dither_mode);
+    
+    /* Chunks of planar data step through each plane */
+    src->dwPlaneStride = frames;
+    dst->dwPlaneStride = frames;
+    src_step = src->bPlanar ? SMDI_PCMSampleSize(src->dwEncoding) : SMDI_PCMFrameSize(src);
+    dst_step = dst->bPlanar ? SMDI_PCMSampleSize(dst->dwEncoding) : SMDI_PCMFrameSize(dst);
+    
+    for (done = 0; done < frames; done += count) {
+        count = frames - done;
+        if (count > BENCH_PCM_CHUNK) {
+            count = BENCH_PCM_CHUNK;
+        }
+        SMDI_PCMConvertDither(src, in + done * src_step, dst, out + done * dst_step, count,
+                              &dither);
+    }
+}
+
+/* Command: Measure the PCM conversion kernels in memory */
+void cmd_bench_pcm(int size_mb, int rounds) {
+    const pcm_bench_kernel_t* kernel;
+    SMDI_PCMFormat noise_fmt, src_fmt, dst_fmt;
+    double* times;
+    double start, total;
+    BYTE* noise;
+    BYTE* in;
+    BYTE* out;
+    DWORD frames, i, in_bytes;
+    int k, r;
+    
+    if (size_mb < 1) {
+        size_mb = 1;
+    }
+    if (rounds < 1) {
+        rounds = 1;
+    }
+    if (rounds > BENCH_MAX_ROUNDS) {
+        rounds = BENCH_MAX_ROUNDS;
+    }
+    
+    times = (double*)malloc(rounds * sizeof(double));
+    if (times == NULL) {
+        printf("Out of memory\n");
+        return;
+    }
+    
+    printf("PCM conversion benchmark, %d MB of input per kernel, %d round(s)\n", size_mb, rounds);
+    printf("Kernel                  Min ms    Avg ms      GB/s\n");
+    
+    for (k = 0; k < (int)(sizeof(g_pcm_kernels) / sizeof(g_pcm_kernels[0])); k++) {
+        kernel = &g_pcm_kernels[k];
+        SMDI_PCMSetFormat(&src_fmt, kernel->src_encoding, kernel->src_order,
+                          kernel->src_channels, kernel->src_planar);
+        SMDI_PCMSetFormat(&dst_fmt, kernel->dst_encoding, kernel->dst_order,
+                          kernel->dst_channels, kernel->dst_planar);
+        SMDI_PCMSetFormat(&noise_fmt, PCM_S16, PCM_ORDER_HOST, kernel->src_channels, FALSE);
+        
+        frames = (DWORD)size_mb * 1048576UL / SMDI_PCMFrameSize(&src_fmt);
+        in_bytes = frames * SMDI_PCMFrameSize(&src_fmt);
+        noise = (BYTE*)malloc(frames * SMDI_PCMFrameSize(&noise_fmt));
+        in = (BYTE*)malloc(in_bytes);
+        out = (BYTE*)malloc(frames * SMDI_PCMFrameSize(&dst_fmt));
+        if (noise == NULL || in == NULL || out == NULL) {
+            printf("%-20s  out of memory\n", kernel->name);
+            free(noise);
+            free(in);
+            free(out);
+            continue;
+        }
+        
+        /* Source data: 16-bit noise converted to the source format */
+        for (i = 0; i < frames * kernel->src_channels; i++) {
+            ((short*)noise)[i] = (short)((i * 2654435761UL) >> 16);
+        }
+        src_fmt.dwPlaneStride = frames;
+        SMDI_PCMConvert(&noise_fmt, noise, &src_fmt, in, frames);
+        free(noise);
+        
+        total = 0.0;
+        for (r = 0; r < rounds; r++) {
+            start = SMDI_GetTime();
+            bench_pcm_convert(&src_fmt, in, &dst_fmt, out, frames, kernel->dither);
+            times[r] = SMDI_GetTime() - start;
+            total += times[r];
+        }
+        
+        qsort(times, rounds, sizeof(double), compare_double);
+        printf("%-20s %9.2f %9.2f %9.3f\n", kernel->name,
+               times[0] * 1000.0, total * 1000.0 / rounds,
+               total > 0.0 ? ((double)in_bytes * rounds / total) / 1e9 : 0.0);
+        
+        free(in);
+        free(out);
+    }
+    
+    free(times);
+}
+
+/* Split a command line into words in place; double quotes group words */
+static int split_command(char* line, char* words[], int max_words) {
+    int count = 0;
+    char* p = line;
+    
+    while (*p != '\0' && count < max_words) {
+        while (*p != '\0' && isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            break;  /* End of line or comment */
+        }
+        
+        if (*p == '"') {
+            p++;
+            words[count++] = p;
+            while (*p != '\0' && *p != '"') {
+                p++;
+            }
+        } else {
+            words[count++] = p;
+            while (*p != '\0' && !isspace((unsigned char)*p)) {
+                p++;
+            }
+        }
+        
+        if (*p != '\0') {
+            *p++ = '\0';
+        }
+    }
+    
+    return count;
+}
+
+/* Execute one command; returns CMD_OK, CMD_ERROR or CMD_QUIT */
+static int execute_command(int args, char* argv[]) {
+    const char* cmd = argv[0];
+    long dither;
+    const char* manifest;
+    BOOL is_sync;
+    BOOL pack;
+    BOOL verify;
+    SMDI_FanOutTarget targets[SMDI_FANOUT_TARGETS];
+    unsigned long count;
+    unsigned long retries;
+    unsigned long first;
+    BOOL resume;
+    int i;
+    
+    if (strcmp(cmd, "help") == 0 || strcmp(cmd, "?") == 0) {
+        print_usage();
+    }
+    else if (strcmp(cmd, "scan") == 0) {
+        if (args < 2) {
+            printf("Usage: scan <ha_id>\n");
+            return CMD_ERROR;
+        }
+        cmd_scan((unsigned char)atoi(argv[1]));
+    }
+    else if (strcmp(cmd, "list") == 0) {
+        if (args < 3) {
+            printf("Usage: list <ha_id> <id>\n");
+            return CMD_ERROR;
+        }
+        cmd_list((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]));
+    }
+    else if (strcmp(cmd, "info") == 0) {
+        if (args < 4) {
+            printf("Usage: info <ha_id> <id> <sample_id>\n");
+            return CMD_ERROR;
+        }
+        cmd_info((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]), (unsigned long)atol(argv[3]));
+    }
+    else if (strcmp(cmd, "receive") == 0) {
+        if (args < 5) {
+            printf("Usage: receive <ha_id> <id> <sample_id> <file>\n");
+            return CMD_ERROR;
+        }
+        cmd_receive((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]), 
+                   (unsigned long)atol(argv[3]), argv[4]);
+    }
+    else if (strcmp(cmd, "send") == 0) {
+        verify = FALSE;
+        retries = 0;
+        for (i = 5; i < args; i++) {
+            if (strcmp(argv[i], "verify") == 0) {
+                verify = TRUE;
+            } else if (strcmp(argv[i], "retry") == 0 && i + 1 < args) {
+                retries = (unsigned long)atol(argv[++i]);
             } else {
-                cmd_send((unsigned char)atoi(arg1), (unsigned char)atoi(arg2), 
-                        arg3, (unsigned long)atol(arg4));
+                break;
             }
         }
-        else if (strcmp(cmd, "delete") == 0) {
-            if (args < 4) {
-                printf("Usage: delete <ha_id> <id> <sample_id>\n");
+        if (args < 5 || i < args) {
+            printf("Usage: send <ha_id> <id> <file> <sample_id> [verify] [retry <count>]\n");
+            return CMD_ERROR;
+        }
+        cmd_send((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]), 
+                argv[3], (unsigned long)atol(argv[4]), verify, retries);
+    }
+    else if (strcmp(cmd, "delete") == 0) {
+        if (args < 4) {
+            printf("Usage: delete <ha_id> <id> <sample_id>\n");
+            return CMD_ERROR;
+        }
+        cmd_delete((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]), 
+                  (unsigned long)atol(argv[3]));
+    }
+    else if (strcmp(cmd, "backup") == 0) {
+        resume = FALSE;
+        first = 0;
+        count = MAX_SAMPLES;
+        for (i = 4; i < args; i++) {
+            if (strcmp(argv[i], "resume") == 0) {
+                resume = TRUE;
+            } else if (strcmp(argv[i], "slots") == 0 && i + 2 < args && atol(argv[i + 2]) > 0) {
+                first = (unsigned long)atol(argv[i + 1]);
+                count = (unsigned long)atol(argv[i + 2]);
+                i += 2;
             } else {
-                cmd_delete((unsigned char)atoi(arg1), (unsigned char)atoi(arg2), 
-                          (unsigned long)atol(arg3));
+                break;
             }
         }
-        else if (strcmp(cmd, "debug") == 0) {
-            if (args < 2 || strcmp(arg1, "on") == 0) {
-                g_debug_enabled = 1;
-                SMDI_SetDebugMode(1);  /* Set SMDI debug mode */
-                printf("Debug output enabled\n");
+        if (args < 4 || i < args) {
+            printf("Usage: backup <ha_id> <id> <dest> [resume] [slots <first> <count>]\n");
+            return CMD_ERROR;
+        }
+        cmd_backup((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]),
+                   argv[3], resume, first, count);
+    }
+    else if (strcmp(cmd, "restore") == 0 || strcmp(cmd, "sync") == 0) {
+        /* Options after the device: pack and verify, or a sync manifest */
+        is_sync = (strcmp(cmd, "sync") == 0);
+        pack = FALSE;
+        verify = FALSE;
+        manifest = NULL;
+        for (i = 4; i < args; i++) {
+            if (strcmp(argv[i], "verify") == 0) {
+                verify = TRUE;
+            } else if (strcmp(argv[i], "pack") == 0 && !is_sync) {
+                pack = TRUE;
+            } else if (manifest == NULL && is_sync) {
+                manifest = argv[i];
+            } else {
+                break;
             }
-            else if (strcmp(arg1, "off") == 0) {
-                g_debug_enabled = 0;
-                SMDI_SetDebugMode(0);  /* Clear SMDI debug mode */
-                printf("Debug output disabled\n");
+        }
+        if (args < 4 || i < args) {
+            printf(!is_sync ? "Usage: restore <src> <ha_id> <id> [pack] [verify]\n" :
+                              "Usage: sync <src> <ha_id> <id> [verify] [manifest]\n");
+            return CMD_ERROR;
+        }
+        if (!is_sync) {
+            cmd_restore(argv[1], (unsigned char)atoi(argv[2]), (unsigned char)atoi(argv[3]),
+                        pack, verify);
+        } else {
+            cmd_sync(argv[1], (unsigned char)atoi(argv[2]), (unsigned char)atoi(argv[3]),
+                     manifest, verify);
+        }
+    }
+    else if (strcmp(cmd, "copy") == 0) {
+        if (args < 7) {
+            printf("Usage: copy <ha1> <id1> <n1> <ha2> <id2> <n2>\n");
+            return CMD_ERROR;
+        }
+        cmd_copy((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]),
+                 (unsigned long)atol(argv[3]), (unsigned char)atoi(argv[4]),
+                 (unsigned char)atoi(argv[5]), (unsigned long)atol(argv[6]));
+    }
+    else if (strcmp(cmd, "fanout") == 0) {
+        if (args < 5 || (args - 3) % 2 != 0 || (args - 3) / 2 > SMDI_FANOUT_TARGETS) {
+            printf("Usage: fanout <file> <sample_id> <ha_id> <id> [<ha_id> <id> ...]\n");
+            printf("       (up to %d devices)\n", SMDI_FANOUT_TARGETS);
+            return CMD_ERROR;
+        }
+        memset(targets, 0, sizeof(targets));
+        count = (unsigned long)(args - 3) / 2;
+        for (i = 0; i < (int)count; i++) {
+            targets[i].dwStructSize = sizeof(SMDI_FanOutTarget);
+            targets[i].HA_ID = (BYTE)atoi(argv[3 + 2 * i]);
+            targets[i].SCSI_ID = (BYTE)atoi(argv[4 + 2 * i]);
+            targets[i].dwSampleNumber = (DWORD)atol(argv[2]);
+        }
+        cmd_fanout(argv[1], (unsigned long)atol(argv[2]), targets, count);
+    }
+    else if (strcmp(cmd, "queue") == 0) {
+        return cmd_queue(args, argv);
+    }
+    else if (strcmp(cmd, "debug") == 0) {
+        if (args < 2 || strcmp(argv[1], "on") == 0) {
+            g_debug_enabled = 1;
+            SMDI_SetDebugMode(1);  /* Set SMDI debug mode */
+            printf("Debug output enabled\n");
+        }
+        else if (strcmp(argv[1], "off") == 0) {
+            g_debug_enabled = 0;
+            SMDI_SetDebugMode(0);  /* Clear SMDI debug mode */
+            printf("Debug output disabled\n");
+        }
+        else {
+            printf("Usage: debug [on|off]\n");
+            return CMD_ERROR;
+        }
+    }
+    else if (strcmp(cmd, "report") == 0) {
+        if (args < 2) {
+            printf("Usage: report <file|stdout|off>\n");
+            return CMD_ERROR;
+        }
+        else if (strcmp(argv[1], "off") == 0) {
+            SMDI_ReportClose();
+            printf("Reports disabled\n");
+        }
+        else if (SMDI_ReportOpen(argv[1])) {
+            printf("Writing reports to '%s'\n", argv[1]);
+        }
+        else {
+            printf("Failed to open report file '%s'\n", argv[1]);
+            return CMD_ERROR;
+        }
+    }
+    else if (strcmp(cmd, "loadaif") == 0) {
+        if (args < 5) {
+            printf("Usage: loadaif <file.aif> <sample_id> <ha_id> <id> [8|16] [none|tpdf|shaped] [rate]\n");
+            return CMD_ERROR;
+        }
+        dither = (args > 6) ? SMDI_PCMParseDither(argv[6]) : PCM_DITHER_TPDF;
+        if (dither < 0 || (args > 5 && atoi(argv[5]) != 8 && atoi(argv[5]) != 16)) {
+            printf("Usage: loadaif <file.aif> <sample_id> <ha_id> <id> [8|16] [none|tpdf|shaped] [rate]\n");
+            return CMD_ERROR;
+        }
+        cmd_loadaif(argv[1], (unsigned long)atol(argv[2]), 
+                  (unsigned char)atoi(argv[3]), (unsigned char)atoi(argv[4]),
+                  (BYTE)(args > 5 ? atoi(argv[5]) : 0), (DWORD)dither,
+                  (DWORD)(args > 7 ? atol(argv[7]) : 0));
+    }
+    else if (strcmp(cmd, "saveaif") == 0) {
+        if (args < 5) {
+            printf("Usage: saveaif <ha_id> <id> <sample_id> <file.aif>\n");
+            return CMD_ERROR;
+        }
+        cmd_saveaif((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]),
+                   (unsigned long)atol(argv[3]), argv[4]);
+    }
+    else if (strcmp(cmd, "bench") == 0 && args > 1 && strcmp(argv[1], "pcm") == 0) {
+        cmd_bench_pcm(args > 2 ? atoi(argv[2]) : 64,
+                      args > 3 ? atoi(argv[3]) : 5);
+    }
+    else if (strcmp(cmd, "bench") == 0) {
+        if (args < 4) {
+            printf("Usage: bench <ha_id> <id> <sample_id> [kb,...] [packet,...] [rounds]\n");
+            return CMD_ERROR;
+        }
+        cmd_bench((unsigned char)atoi(argv[1]), (unsigned char)atoi(argv[2]),
+                  (unsigned long)atol(argv[3]),
+                  args > 4 ? argv[4] : "64,1024",
+                  args > 5 ? argv[5] : "4096,16384",
+                  args > 6 ? atoi(argv[6]) : 5);
+    }
+    else if (strcmp(cmd, "wait") == 0) {
+        /* Batch barrier - nothing to do once reached */
+    }
+    else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) {
+        return CMD_QUIT;
+    }
+    else {
+        printf("Unknown command: %s\nType 'help' for a list of commands\n", cmd);
+        return CMD_ERROR;
+    }
+    
+    return CMD_OK;
+}
+
+/* Run one command line; returns TRUE when the shell should exit */
+static BOOL run_command_line(const char* cmdline, BOOL echo) {
+    char line[CMDLINE_SIZE];
+    char* words[MAX_WORDS];
+    int count;
+    int result;
+    
+    strncpy(line, cmdline, CMDLINE_SIZE - 1);
+    line[CMDLINE_SIZE - 1] = '\0';
+    
+    count = split_command(line, words, MAX_WORDS);
+    if (count == 0) {
+        return FALSE;  /* Empty command line */
+    }
+    
+    if (echo) {
+        printf("smdi> %s\n", cmdline);
+    }
+    
+    result = execute_command(count, words);
+    if (result == CMD_ERROR) {
+        g_failed_operations++;
+    }
+    
+    return (result == CMD_QUIT) ? TRUE : FALSE;
+}
+
+/* Find the device a command line works on; FALSE if it is not a device command */
+static BOOL command_device(const char* cmdline, BYTE* ha_id, BYTE* id) {
+    char line[CMDLINE_SIZE];
+    char* words[MAX_WORDS];
+    int count;
+    
+    strncpy(line, cmdline, CMDLINE_SIZE - 1);
+    line[CMDLINE_SIZE - 1] = '\0';
+    
+    count = split_command(line, words, MAX_WORDS);
+    if (count == 0) {
+        return FALSE;
+    }
+    
+    if ((strcmp(words[0], "list") == 0 && count >= 3) ||
+        (strcmp(words[0], "info") == 0 && count >= 4) ||
+        (strcmp(words[0], "delete") == 0 && count >= 4) ||
+        (strcmp(words[0], "backup") == 0 && count >= 4) ||
+        (strcmp(words[0], "bench") == 0 && count >= 4 && strcmp(words[1], "pcm") != 0) ||
+        (strcmp(words[0], "receive") == 0 && count >= 5) ||
+        (strcmp(words[0], "send") == 0 && count >= 5) ||
+        (strcmp(words[0], "saveaif") == 0 && count >= 5)) {
+        *ha_id = (BYTE)atoi(words[1]);
+        *id = (BYTE)atoi(words[2]);
+        return TRUE;
+    }
+    
+    if ((strcmp(words[0], "restore") == 0 || strcmp(words[0], "sync") == 0) && count >= 4) {
+        *ha_id = (BYTE)atoi(words[2]);
+        *id = (BYTE)atoi(words[3]);
+        return TRUE;
+    }
+    
+    if (strcmp(words[0], "loadaif") == 0 && count >= 5) {
+        *ha_id = (BYTE)atoi(words[3]);
+        *id = (BYTE)atoi(words[4]);
+        return TRUE;
+    }
+    
+    return FALSE;
+}
+
+/* Add a command line to a batch script */
+static BOOL batch_add(batch_script_t* script, const char* cmdline) {
+    char** lines;
+    char* copy;
+    size_t len;
+    
+    if (script->count == script->size) {
+        lines = (char**)realloc(script->lines, (script->size + 32) * sizeof(char*));
+        if (lines == NULL) {
+            return FALSE;
+        }
+        script->lines = lines;
+        script->size += 32;
+    }
+    
+    /* Strip the line ending */
+    len = strlen(cmdline);
+    while (len > 0 && (cmdline[len - 1] == '\n' || cmdline[len - 1] == '\r')) {
+        len--;
+    }
+    
+    copy = (char*)malloc(len + 1);
+    if (copy == NULL) {
+        return FALSE;
+    }
+    memcpy(copy, cmdline, len);
+    copy[len] = '\0';
+    
+    script->lines[script->count++] = copy;
+    return TRUE;
+}
+
+/* Read a script file ("-" for standard input) into a batch script */
+static BOOL batch_load(batch_script_t* script, const char* filename) {
+    char cmdline[CMDLINE_SIZE];
+    FILE* fp;
+    BOOL ok = TRUE;
+    
+    if (strcmp(filename, "-") == 0) {
+        fp = stdin;
+    } else {
+        fp = fopen(filename, "r");
+        if (fp == NULL) {
+            printf("Failed to open script '%s'\n", filename);
+            return FALSE;
+        }
+    }
+    
+    while (ok && fgets(cmdline, CMDLINE_SIZE, fp) != NULL) {
+        ok = batch_add(script, cmdline);
+    }
+    
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    
+    return ok;
+}
+
+/* Free a batch script */
+static void batch_free(batch_script_t* script) {
+    int i;
+    
+    for (i = 0; i < script->count; i++) {
+        free(script->lines[i]);
+    }
+    free(script->lines);
+    script->lines = NULL;
+    script->count = 0;
+    script->size = 0;
+}
+
+/* Worker process body: run the commands of one device, then exit */
+static void batch_worker_run(batch_script_t* script, int start, int end,
+                             batch_worker_t* worker) {
+    BYTE ha_id, id;
+    int i;
+    
+    /* Handles inherited from the parent belong to the parent */
+    SMDI_CloseDevices();
+    
+    if (worker->output != NULL) {
+        dup2(fileno(worker->output), 1);
+    }
+    
+    g_failed_operations = 0;
+    
+    for (i = start; i < end; i++) {
+        if (command_device(script->lines[i], &ha_id, &id) &&
+            ha_id == worker->ha_id && id == worker->id) {
+            if (run_command_line(script->lines[i], TRUE)) {
+                break;
             }
-            else {
-                printf("Usage: debug [on|off]\n");
+        }
+    }
+    
+    SMDI_CloseDevices();
+    fflush(NULL);
+    _exit(g_failed_operations > 255 ? 255 : g_failed_operations);
+}
+
+/* Print the captured output of a finished worker */
+static void batch_worker_output(batch_worker_t* worker) {
+    char buffer[CMDLINE_SIZE];
+    size_t n;
+    
+    if (worker->output == NULL) {
+        return;
+    }
+    
+    printf("--- device %d:%d ---\n", worker->ha_id, worker->id);
+    rewind(worker->output);
+    while ((n = fread(buffer, 1, sizeof(buffer), worker->output)) > 0) {
+        fwrite(buffer, 1, n, stdout);
+    }
+    fflush(stdout);
+    
+    fclose(worker->output);
+    worker->output = NULL;
+}
+
+/* Run consecutive device commands, one worker process per device */
+static void batch_run_devices(batch_script_t* script, int start, int end, int max_jobs) {
+    batch_worker_t workers[MAX_DEVICES];
+    int worker_count = 0;
+    int next = 0;
+    int running = 0;
+    int status;
+    pid_t pid;
+    BYTE ha_id, id;
+    int i, w;
+    
+    /* One worker per device, in order of first use */
+    for (i = start; i < end; i++) {
+        command_device(script->lines[i], &ha_id, &id);
+        for (w = 0; w < worker_count; w++) {
+            if (workers[w].ha_id == ha_id && workers[w].id == id) {
+                break;
             }
         }
-        else if (strcmp(cmd, "loadaif") == 0) {
-            if (args < 5) {
-                printf("Usage: loadaif <file.aif> <sample_id> <ha_id> <id>\n");
+        if (w == worker_count && worker_count < MAX_DEVICES) {
+            workers[w].ha_id = ha_id;
+            workers[w].id = id;
+            workers[w].pid = 0;
+            workers[w].output = NULL;
+            worker_count++;
+        }
+    }
+    
+    while (next < worker_count || running > 0) {
+        /* Start workers up to the job limit */
+        while (next < worker_count && running < max_jobs) {
+            fflush(NULL);
+            workers[next].output = tmpfile();
+            
+            pid = fork();
+            if (pid == 0) {
+                batch_worker_run(script, start, end, &workers[next]);
+            }
+            
+            if (pid < 0) {
+                printf("Failed to start worker for device %d:%d\n",
+                       workers[next].ha_id, workers[next].id);
+                if (workers[next].output != NULL) {
+                    fclose(workers[next].output);
+                    workers[next].output = NULL;
+                }
+                g_failed_operations++;
             } else {
-                cmd_loadaif(arg1, (unsigned long)atol(arg2), 
-                          (unsigned char)atoi(arg3), (unsigned char)atoi(arg4));
+                workers[next].pid = pid;
+                running++;
             }
+            next++;
         }
-        else if (strcmp(cmd, "saveaif") == 0) {
-            if (args < 5) {
-                printf("Usage: saveaif <ha_id> <id> <sample_id> <file.aif>\n");
-            } else {
-                cmd_saveaif((unsigned char)atoi(arg1), (unsigned char)atoi(arg2),
-                           (unsigned long)atol(arg3), arg4);
+        
+        if (running == 0) {
+            break;
+        }
+        
+        /* Collect a finished worker */
+        pid = wait(&status);
+        if (pid < 0) {
+            break;
+        }
+        
+        for (w = 0; w < worker_count; w++) {
+            if (workers[w].pid == pid) {
+                batch_worker_output(&workers[w]);
+                workers[w].pid = 0;
+                running--;
+                
+                if (!WIFEXITED(status)) {
+                    g_failed_operations++;
+                } else {
+                    g_failed_operations += WEXITSTATUS(status);
+                }
+                break;
+            }
+        }
+    }
+}
+
+/* Run a batch script; device commands run concurrently when max_jobs > 1 */
+static void batch_run(batch_script_t* script, int max_jobs) {
+    BYTE ha_id, id;
+    int i, end;
+    
+    i = 0;
+    while (i < script->count) {
+        if (max_jobs > 1 && command_device(script->lines[i], &ha_id, &id)) {
+            /* Everything up to the next other command may overlap */
+            end = i + 1;
+            while (end < script->count && command_device(script->lines[end], &ha_id, &id)) {
+                end++;
             }
+            batch_run_devices(script, i, end, max_jobs);
+            i = end;
+            continue;
         }
-        else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) {
+        
+        if (run_command_line(script->lines[i], TRUE)) {
             break;
         }
+        i++;
+    }
+}
+
+/* Print command line usage */
+static void print_program_usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  -f <file>     Run commands from a script file ('-' for stdin)\n");
+    printf("  -c <command>  Run a command (may be repeated)\n");
+    printf("  -j <jobs>     Run commands for different devices concurrently\n");
+    printf("  -r <file>     Write a JSON line report per operation\n");
+    printf("  -d            Enable debug output\n");
+    printf("Without -f or -c the interactive shell is started.\n");
+}
+
+/* Main function */
+int main(int argc, char *argv[]) {
+    char cmdline[CMDLINE_SIZE];
+    batch_script_t script;
+    BOOL batch_mode = FALSE;
+    int max_jobs = 1;
+    int i;
+    
+    script.lines = NULL;
+    script.count = 0;
+    script.size = 0;
+    
+    /* Parse command line options */
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            if (!batch_load(&script, argv[++i])) {
+                batch_free(&script);
+                return 2;
+            }
+            batch_mode = TRUE;
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            if (!batch_add(&script, argv[++i])) {
+                batch_free(&script);
+                return 2;
+            }
+            batch_mode = TRUE;
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            max_jobs = atoi(argv[++i]);
+            if (max_jobs < 1) {
+                max_jobs = 1;
+            }
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            if (!SMDI_ReportOpen(argv[++i])) {
+                printf("Failed to open report file '%s'\n", argv[i]);
+                batch_free(&script);
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-d") == 0) {
+            g_debug_enabled = 1;
+            SMDI_SetDebugMode(1);
+        }
         else {
-            printf("Unknown command: %s\nType 'help' for a list of commands\n", cmd);
+            print_program_usage(argv[0]);
+            batch_free(&script);
+            return 2;
         }
     }
     
+    if (batch_mode) {
+        /* Keep device sessions open for the whole script */
+        SMDI_SetKeepDevicesOpen(TRUE);
+        
+        if (SMDI_Init()) {
+            batch_run(&script, max_jobs);
+        } else {
+            printf("SMDI is not available\n");
+            g_failed_operations++;
+        }
+        
+        SMDI_CloseDevices();
+        SMDI_ReportClose();
+        batch_free(&script);
+        return (g_failed_operations > 0) ? 1 : 0;
+    }
+    
+    printf("IRIX SMDI Test Shell\n");
+    printf("===================\n");
+    printf("Type 'help' for a list of commands\n");
+    
+    /* Initialize SMDI */
+    cmd_init();
+    
+    while (1) {
+        /* Display prompt and get command */
+        printf("\nsmdi> ");
+        fflush(stdout);
+        
+        if (fgets(cmdline, CMDLINE_SIZE, stdin) == NULL) {
+            break;
+        }
+        
+        if (run_command_line(cmdline, FALSE)) {
+            break;
+        }
+    }
+    
+    SMDI_ReportClose();
+    
     printf("\nExiting SMDI Test Shell\n");
     return 0;
 }
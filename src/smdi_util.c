@@ -8,8 +8,13 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/mman.h>
 #include <stdarg.h>
 #include "smdi.h"
+#include "smdi_endian.h"
 #include "aspi_irix.h"
 #include "scsi_debug.h"
 
@@ -22,10 +27,26 @@ static unsigned char smdicmd[256];
 /* Global debug flag - changed to non-static so it can be accessed from other files */
 int g_smdi_debug_enabled = 0;
 
-/* Sleep function for IRIX */
+/* CRC-32 (IEEE 802.3, reflected) a nibble at a time */
+static const DWORD crc_nibble[16] = {
+    0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL,
+    0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+    0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL,
+    0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL
+};
+
+/* Sleep function for IRIX; elsewhere (emulator builds) select() waits */
 static void sleep_ms(int ms) {
+#ifdef __sgi
     /* Convert ms to clock ticks (10ms each), rounding up */
     sginap((ms + 9) / 10);
+#else
+    struct timeval tv;
+    
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (long)(ms % 1000) * 1000L;
+    select(0, NULL, NULL, NULL, &tv);
+#endif
 }
 
 /* Debug print function */
@@ -57,6 +78,76 @@ DWORD SMDI_GetLastError(void) {
     return error_code;
 }
 
+/* Get the packet number the device asked for in its last Send Next Packet */
+DWORD SMDI_GetRequestedPacket(void) {
+    /* The 24-bit packet number is in bytes 11-13 */
+    return ((DWORD)smdicmd[11] << 16) |
+           ((DWORD)smdicmd[12] << 8) |
+           (DWORD)smdicmd[13];
+}
+
+/* Continue a CRC-32 (start from 0) over the next bytes */
+DWORD SMDI_CRC32(DWORD dwCrc, const void* data, DWORD dwBytes) {
+    const BYTE* p;
+    DWORD crc;
+
+    p = (const BYTE*)data;
+    crc = ~dwCrc & 0xFFFFFFFFUL;
+    while (dwBytes-- > 0) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ crc_nibble[crc & 0x0F];
+        crc = (crc >> 4) ^ crc_nibble[crc & 0x0F];
+    }
+    return ~crc & 0xFFFFFFFFUL;
+}
+
+/* Hash of the header fields a sample keeps on the sampler and its name */
+DWORD SMDI_HeaderHash(const SMDI_SampleHeader* sh) {
+    BYTE fields[24];
+    DWORD values[4];
+    DWORD crc;
+    int i;
+
+    fields[0] = sh->BitsPerWord;
+    fields[1] = sh->NumberOfChannels;
+    fields[2] = sh->LoopControl;
+    fields[3] = 0;
+    values[0] = sh->dwPeriod;
+    values[1] = sh->dwLength;
+    values[2] = sh->dwLoopStart;
+    values[3] = sh->dwLoopEnd;
+    for (i = 0; i < 4; i++) {
+        fields[4 + i * 4] = (BYTE)(values[i] >> 24);
+        fields[5 + i * 4] = (BYTE)(values[i] >> 16);
+        fields[6 + i * 4] = (BYTE)(values[i] >> 8);
+        fields[7 + i * 4] = (BYTE)values[i];
+    }
+    fields[20] = (BYTE)(sh->wPitch >> 8);
+    fields[21] = (BYTE)sh->wPitch;
+    fields[22] = (BYTE)(sh->wPitchFraction >> 8);
+    fields[23] = (BYTE)sh->wPitchFraction;
+
+    crc = SMDI_CRC32(0, fields, sizeof(fields));
+    for (i = 0; i < 256 && sh->cName[i] != '\0'; i++) {
+    }
+    return SMDI_CRC32(crc, sh->cName, (DWORD)i);
+}
+
+/* Memory shared with child processes; /dev/zero gives it on systems
+   without anonymous mappings */
+void* SMDI_SharedAlloc(size_t size) {
+    void* base;
+    int fd;
+
+    fd = open("/dev/zero", O_RDWR);
+    if (fd < 0) {
+        return NULL;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (base == (void*)MAP_FAILED) ? NULL : base;
+}
+
 /* Public function to get/set debug mode */
 void SMDI_SetDebugMode(int enable) {
     g_smdi_debug_enabled = enable ? 1 : 0;
@@ -141,19 +232,44 @@ DWORD SMDI_GetMessage(BYTE ha_id, BYTE id) {
     return SMDI_GetWholeMessageID(smdicmd);
 }
 
+/* Send a complete data packet message and get the device's answer */
+static DWORD SMDI_SendDataMessage(BYTE ha_id, BYTE id, void* message, DWORD length) {
+    DWORD result;
+    scsi_debug_t debug;
+    int send_success;
+    
+    scsi_debug_init(&debug);
+    debug.enabled = g_smdi_debug_enabled;
+    
+    send_success = ASPI_Send(&debug, ha_id, id, message, length);
+    
+    if (!send_success) {
+        debug_print("ERROR: ASPI_Send failed");
+        return SMDIM_ERROR;
+    }
+    
+    /* Wait a short time for the device to process */
+    sleep_ms(50);
+    
+    /* Receive the response */
+    ASPI_Receive(&debug, ha_id, id, smdicmd, 256);
+    
+    /* Get the message ID from the response */
+    result = SMDI_GetWholeMessageID(smdicmd);
+    debug_print("Response message ID: 0x%08lX", result);
+    
+    return result;
+}
+
 /* Send an SMDI data packet to the device */
 DWORD SMDI_SendDataPacket(BYTE ha_id,
                         BYTE id, 
                         DWORD pn, 
                         void* data, 
-                        DWORD length) {
+                        DWORD length,
+                        DWORD dwCopyMode) {
     void* datamessage;
     DWORD result;
-    scsi_debug_t debug;
-    int send_success;
-    
-    scsi_debug_init(&debug);
-    debug.enabled = g_smdi_debug_enabled;
 
     debug_print("SendDataPacket to %d:%d, packet %lu, length %lu", 
                 ha_id, id, pn, length);
@@ -175,30 +291,43 @@ DWORD SMDI_SendDataPacket(BYTE ha_id,
     /* Copy the header to the message buffer */
     memcpy(datamessage, smdicmd, 14);
 
-    /* Copy the data directly (no byte swapping needed on big-endian system) */
-    memcpy((void*)(((unsigned long)datamessage) + 14), data, length);
+    /* Copy the data, swapping words into SMDI order on the way if asked */
+    SMDI_CopySampleData((void*)(((unsigned long)datamessage) + 14), data, length, dwCopyMode);
     
     /* Send the data packet */
-    send_success = ASPI_Send(&debug, ha_id, id, datamessage, 14 + length);
+    result = SMDI_SendDataMessage(ha_id, id, datamessage, 14 + length);
     
-    if (!send_success) {
-        debug_print("ERROR: ASPI_Send failed");
-        free(datamessage);
-        return SMDIM_ERROR;
-    }
+    /* Free the message buffer */
+    free(datamessage);
     
-    /* Wait a short time for the device to process */
-    sleep_ms(50);
+    return result;
+}
+
+/* Send a data packet straight from its buffer, which must have 14 writable
+   bytes in front of it for the message header (e.g. a private file mapping) */
+DWORD SMDI_SendDataPacketInPlace(BYTE ha_id, BYTE id, DWORD pn, void* data, DWORD length) {
+    BYTE* message;
+    BYTE saved[14];
+    DWORD result;
     
-    /* Receive the response */
-    ASPI_Receive(&debug, ha_id, id, smdicmd, 256);
+    debug_print("SendDataPacketInPlace to %d:%d, packet %lu, length %lu", 
+                ha_id, id, pn, length);
     
-    /* Get the message ID from the response */
-    result = SMDI_GetWholeMessageID(smdicmd);
-    debug_print("Response message ID: 0x%08lX", result);
+    message = (BYTE*)data - 14;
+    memcpy(saved, message, 14);
     
-    /* Free the message buffer */
-    free(datamessage);
+    /* Prepare the message header */
+    SMDI_MakeMessageHeader(smdicmd, SMDIM_DATAPACKET, 3 + length);
+    
+    /* Set packet number (24-bit value) */
+    smdicmd[11] = (unsigned char)((pn >> 16) & 0xFF);
+    smdicmd[12] = (unsigned char)((pn >> 8) & 0xFF);
+    smdicmd[13] = (unsigned char)(pn & 0xFF);
+    
+    /* Put the header in front of the data, send, then restore the bytes */
+    memcpy(message, smdicmd, 14);
+    result = SMDI_SendDataMessage(ha_id, id, message, 14 + length);
+    memcpy(message, saved, 14);
     
     return result;
 }
@@ -438,7 +567,8 @@ DWORD SMDI_NextDataPacketRequest(BYTE ha_id,
                                BYTE id,
                                DWORD packetNumber,
                                void* buffer,
-                               DWORD maxlen) {
+                               DWORD maxlen,
+                               DWORD dwCopyMode) {
     void* mybuffer;
     DWORD reply;
     scsi_debug_t debug;
@@ -479,8 +609,8 @@ DWORD SMDI_NextDataPacketRequest(BYTE ha_id,
     /* Receive the response */
     ASPI_Receive(&debug, ha_id, id, mybuffer, maxlen + 14);
     
-    /* Copy the data directly (no byte swapping needed on big-endian system) */
-    memcpy(buffer, (void*)(((unsigned long)mybuffer) + 14), maxlen);
+    /* Copy the data out, swapping words into host order on the way if asked */
+    SMDI_CopySampleData(buffer, (void*)(((unsigned long)mybuffer) + 14), maxlen, dwCopyMode);
     
     /* Get the message ID from the response */
     reply = SMDI_GetWholeMessageID(mybuffer);
@@ -860,6 +990,17 @@ BYTE SMDI_Init(void) {
     return (BYTE)result;
 }
 
+/* Keep device sessions open between operations */
+void SMDI_SetKeepDevicesOpen(BOOL enable) {
+    debug_print("SMDI_SetKeepDevicesOpen: %s", enable ? "on" : "off");
+    ASPI_SetKeepOpen(enable ? 1 : 0);
+}
+
+/* Close all device sessions kept open */
+void SMDI_CloseDevices(void) {
+    ASPI_CloseAll();
+}
+
 /* Test if a device is ready */
 BOOL SMDI_TestUnitReady(BYTE ha_id, BYTE id) {
     int result;
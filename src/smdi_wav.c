@@ -0,0 +1,479 @@
+/*
+ * SMDI WAV file format support for IRIX 5.3
+ * ANSI C90 compliant implementation for MIPS big-endian architecture
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smdi.h"
+#include "smdi_sample.h"
+#include "smdi_pcm.h"
+#include "smdi_wave.h"
+#include "smdi_wav.h"
+
+/* Frames read into the sample per call */
+#define WAV_READ_FRAMES 65536
+
+/* Load a WAV file into SMDI sample format */
+SMDI_Sample* SMDI_LoadWAVSample(const char* filename) {
+    return SMDI_LoadWAVSampleAs(filename, 0, PCM_DITHER_TPDF);
+}
+
+/* Open a WAV file and settle the word size it loads as (0 keeps 8 and 16
+   bit files as they are and reduces wider ones to 16 bit) */
+static SMDI_WAVEFile* open_wav(const char* filename, BYTE* bits_per_sample) {
+    SMDI_WAVEFile* file;
+    
+    file = SMDI_WAVEOpen(filename);
+    if (file == NULL) {
+        fprintf(stderr, "SMDI_LoadWAVSample: '%s' is not a readable WAV or RF64 file\n",
+                filename);
+        return NULL;
+    }
+    
+    if ((*bits_per_sample != 0 && *bits_per_sample != 8 && *bits_per_sample != 16) ||
+        file->info.dwFrames == 0) {
+        fprintf(stderr, "SMDI_LoadWAVSample: Unsupported sample format in '%s'\n", filename);
+        SMDI_WAVEClose(file);
+        return NULL;
+    }
+    
+    if (*bits_per_sample == 0) {
+        *bits_per_sample = (file->info.pcmFormat.dwEncoding == PCM_U8) ? 8 : 16;
+    }
+    return file;
+}
+
+/* Take the loop, tuning and name of a sample from the file's chunks */
+static void wav_properties(const SMDI_WAVEInfo* info, const char* filename,
+                           SMDI_Sample* sample) {
+    const SMDI_WAVELoop* loop;
+    int fine_tune;
+    const char* basename;
+    char* dot;
+    
+    if (info->bHasSampler) {
+        /* The first loop is the sustain loop; both count the end point as
+           part of the loop */
+        loop = &info->loops[0];
+        if (info->dwNumLoops > 0 && loop->dwStart <= loop->dwEnd &&
+            loop->dwStart < info->dwFrames) {
+            sample->loop_type = (loop->dwType == WAVE_LOOP_ALTERNATING) ?
+                                SAMPLE_LOOP_BIDIRECTIONAL : SAMPLE_LOOP_FORWARD;
+            sample->loop_start = loop->dwStart;
+            sample->loop_end = (loop->dwEnd < info->dwFrames) ? loop->dwEnd :
+                               info->dwFrames - 1;
+        }
+    
+        /* Unity note and the fraction of a semitone above it, kept to
+           -50 to +50 cents */
+        sample->root_note = (WORD)((info->dwUnityNote < 127) ? info->dwUnityNote : 127);
+        fine_tune = (int)((double)info->dwPitchFraction * 100.0 / 4294967296.0 + 0.5);
+        if (fine_tune > 50 && sample->root_note < 127) {
+            sample->root_note++;
+            fine_tune -= 100;
+        }
+        if (fine_tune > 50) fine_tune = 50;
+        sample->fine_tune = (WORD)fine_tune;
+    }
+    
+    /* Get sample name if available */
+    if (info->szName[0] != '\0') {
+        strncpy(sample->name, info->szName, 255);
+        sample->name[255] = '\0';
+    }
+    
+    /* If no name was found, use filename as fallback */
+    if (sample->name[0] == '\0') {
+        basename = strrchr(filename, '/');
+        if (basename) {
+            basename++; /* Skip the slash */
+        } else {
+            basename = filename;
+        }
+    
+        /* Copy basename and remove extension */
+        strncpy(sample->name, basename, 255);
+        sample->name[255] = '\0';
+        dot = strrchr(sample->name, '.');
+        if (dot) {
+            *dot = '\0';
+        }
+    }
+}
+
+/* Load a WAV file as 8 or 16 bit samples with the given dither */
+SMDI_Sample* SMDI_LoadWAVSampleAs(const char* filename, BYTE bits_per_sample,
+                                  DWORD dither_mode) {
+    SMDI_WAVEFile* file;
+    SMDI_WAVEInfo* info;
+    SMDI_Sample* sample;
+    SMDI_PCMFormat sample_pcm;
+    SMDI_PCMDither dither;
+    DWORD frame_size, done, count;
+    
+    file = open_wav(filename, &bits_per_sample);
+    if (file == NULL) {
+        return NULL;
+    }
+    info = &file->info;
+    
+    /* Every frame is read over the data, so it is not cleared first */
+    sample = SMDI_AllocSample(info->dwRate, bits_per_sample, (BYTE)info->dwChannels,
+                              info->dwFrames);
+    if (sample == NULL) {
+        fprintf(stderr, "SMDI_LoadWAVSample: Failed to create sample\n");
+        SMDI_WAVEClose(file);
+        return NULL;
+    }
+    
+    /* Frames are read straight into the sample in bounded blocks; the
+       dither state runs on across blocks */
+    SMDI_PCMSetFormat(&sample_pcm, (bits_per_sample == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_HOST, info->dwChannels, FALSE);
+    SMDI_PCMInitDither(&dither, dither_mode);
+    frame_size = SMDI_PCMFrameSize(&sample_pcm);
+    for (done = 0; done < info->dwFrames; done += count) {
+        count = info->dwFrames - done;
+        if (count > WAV_READ_FRAMES) {
+            count = WAV_READ_FRAMES;
+        }
+        if (SMDI_WAVEReadFrames(file, &sample_pcm,
+                                (char*)sample->sample_data + done * frame_size,
+                                count, &dither) != count) {
+            fprintf(stderr, "SMDI_LoadWAVSample: Failed to read frames\n");
+            SMDI_FreeSample(sample);
+            SMDI_WAVEClose(file);
+            return NULL;
+        }
+    }
+    
+    wav_properties(info, filename, sample);
+    SMDI_WAVEClose(file);
+    
+    return sample;
+}
+
+/* State of a WAV upload source */
+typedef struct {
+    SMDI_WAVEFile* file;
+    SMDI_PCMFormat format;                  /* 8 or 16 bit in SMDI order */
+    SMDI_PCMDither dither;
+    BYTE carry[PCM_MAX_CHANNELS * 2];       /* Frame split between two packets */
+    DWORD carry_pos;
+    DWORD carry_len;
+} wav_source_t;
+
+/* Decode the next bytes of a WAV source into a packet */
+static DWORD wav_source_read(SMDI_SampleSource* source, void* buffer, DWORD bytes) {
+    wav_source_t* state;
+    BYTE* out;
+    DWORD frame_size, frames, got, done;
+    
+    state = (wav_source_t*)source->lpUserData;
+    out = (BYTE*)buffer;
+    frame_size = SMDI_PCMFrameSize(&state->format);
+    done = 0;
+    
+    /* Finish the frame the last packet split */
+    while (done < bytes && state->carry_pos < state->carry_len) {
+        out[done++] = state->carry[state->carry_pos++];
+    }
+    
+    /* Whole frames are decoded straight into the packet */
+    frames = (bytes - done) / frame_size;
+    if (frames > 0) {
+        got = SMDI_WAVEReadFrames(state->file, &state->format, out + done, frames,
+                                  &state->dither);
+        done += got * frame_size;
+        if (got < frames) {
+            return done;
+        }
+    }
+    
+    /* A frame running on into the next packet goes through the carry */
+    if (done < bytes) {
+        if (SMDI_WAVEReadFrames(state->file, &state->format, state->carry, 1,
+                                &state->dither) != 1) {
+            return done;
+        }
+        state->carry_pos = 0;
+        state->carry_len = frame_size;
+        while (done < bytes) {
+            out[done++] = state->carry[state->carry_pos++];
+        }
+    }
+    
+    return done;
+}
+
+/* Release a WAV source */
+static void wav_source_close(SMDI_SampleSource* source) {
+    wav_source_t* state;
+    
+    state = (wav_source_t*)source->lpUserData;
+    if (state != NULL) {
+        SMDI_WAVEClose(state->file);
+        free(state);
+        source->lpUserData = NULL;
+    }
+}
+
+/* Open a WAV file as an upload source decoding frames as packets go out */
+BOOL SMDI_OpenWAVSource(SMDI_SampleSource* source, const char* filename,
+                        BYTE bits_per_sample, DWORD dither_mode) {
+    SMDI_WAVEFile* file;
+    wav_source_t* state;
+    SMDI_Sample props;
+    
+    if (source == NULL || filename == NULL) {
+        return FALSE;
+    }
+    
+    file = open_wav(filename, &bits_per_sample);
+    if (file == NULL) {
+        return FALSE;
+    }
+    
+    state = (wav_source_t*)malloc(sizeof(wav_source_t));
+    if (state == NULL) {
+        SMDI_WAVEClose(file);
+        return FALSE;
+    }
+    memset(state, 0, sizeof(wav_source_t));
+    state->file = file;
+    
+    /* Frames are produced in SMDI order, so packets go out as they are */
+    SMDI_PCMSetFormat(&state->format, (bits_per_sample == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_BIG, file->info.dwChannels, FALSE);
+    SMDI_PCMInitDither(&state->dither, dither_mode);
+    
+    /* The header is built as for a loaded sample */
+    memset(&props, 0, sizeof(SMDI_Sample));
+    props.sample_rate = file->info.dwRate;
+    props.bits_per_sample = bits_per_sample;
+    props.channels = (BYTE)file->info.dwChannels;
+    props.sample_count = file->info.dwFrames;
+    props.root_note = 60;   /* Middle C */
+    wav_properties(&file->info, filename, &props);
+    
+    memset(source, 0, sizeof(SMDI_SampleSource));
+    source->dwStructSize = sizeof(SMDI_SampleSource);
+    SMDI_SampleToHeader(&props, &source->header);
+    source->dwSampleRate = props.sample_rate;
+    source->dwCopyMode = CM_NORMAL;
+    source->lpRead = wav_source_read;
+    source->lpClose = wav_source_close;
+    source->lpUserData = state;
+    
+    return TRUE;
+}
+
+/* Describe a sample's format, loop, tuning and name for a WAV header */
+static void wav_info(SMDI_WAVEInfo* info, const SMDI_Sample* sample) {
+    int fine_tune;
+    
+    SMDI_WAVEInitInfo(info);
+    info->dwChannels = sample->channels;
+    info->dwBits = sample->bits_per_sample;
+    info->dwRate = sample->sample_rate;
+    
+    /* The smpl chunk tunes up from the unity note, so a flat sample is
+       given as the note below and a fraction above it */
+    info->bHasSampler = TRUE;
+    info->dwUnityNote = sample->root_note;
+    fine_tune = (short)sample->fine_tune;
+    if (fine_tune < 0 && info->dwUnityNote > 0) {
+        info->dwUnityNote--;
+        fine_tune += 100;
+    }
+    if (fine_tune > 0) {
+        info->dwPitchFraction = (DWORD)((double)fine_tune * 4294967296.0 / 100.0);
+    }
+    
+    /* The loop, if any, as the only smpl loop */
+    if (sample->loop_type != SAMPLE_LOOP_NONE &&
+        sample->loop_start < sample->loop_end) {
+        info->dwNumLoops = 1;
+        info->loops[0].dwType = (sample->loop_type == SAMPLE_LOOP_BIDIRECTIONAL) ?
+                                WAVE_LOOP_ALTERNATING : WAVE_LOOP_FORWARD;
+        info->loops[0].dwStart = sample->loop_start;
+        info->loops[0].dwEnd = sample->loop_end;
+    }
+    
+    strncpy(info->szName, sample->name, 255);
+    info->szName[255] = '\0';
+}
+
+/* Save SMDI sample as WAV file */
+BOOL SMDI_SaveWAVSample(SMDI_Sample* sample, const char* filename) {
+    SMDI_WAVEFile* file;
+    SMDI_WAVEInfo info;
+    SMDI_PCMFormat sample_pcm;
+    BOOL ok;
+    
+    if (sample == NULL || filename == NULL) {
+        return FALSE;
+    }
+    
+    wav_info(&info, sample);
+    
+    file = SMDI_WAVECreate(filename, &info);
+    if (file == NULL) {
+        fprintf(stderr, "SMDI_SaveWAVSample: Failed to open file '%s' for writing\n", filename);
+        return FALSE;
+    }
+    
+    SMDI_PCMSetFormat(&sample_pcm, (sample->bits_per_sample == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_HOST, sample->channels, FALSE);
+    ok = SMDI_WAVEWriteFrames(file, &sample_pcm, sample->sample_data, sample->sample_count);
+    if (!ok) {
+        fprintf(stderr, "SMDI_SaveWAVSample: Failed to write frames\n");
+    }
+    
+    /* Clean up, finishing the chunk sizes */
+    if (!SMDI_WAVEClose(file)) {
+        ok = FALSE;
+    }
+    
+    return ok;
+}
+
+/* State of a WAV download sink */
+typedef struct {
+    SMDI_WAVEFile* file;
+    SMDI_PCMFormat format;                  /* Received data, in SMDI order */
+    char filename[MAX_PATH];
+    BYTE carry[PCM_MAX_CHANNELS * 2];       /* Frame split between two packets */
+    DWORD carry_len;
+} wav_sink_t;
+
+/* Create the WAV file once the sample header is known */
+static BOOL wav_sink_begin(SMDI_SampleSink* sink) {
+    wav_sink_t* state;
+    SMDI_SampleHeader* header;
+    SMDI_Sample props;
+    SMDI_WAVEInfo info;
+    
+    state = (wav_sink_t*)sink->lpUserData;
+    header = &sink->header;
+    if ((header->BitsPerWord != 8 && header->BitsPerWord != 16) ||
+        header->NumberOfChannels < 1 || header->NumberOfChannels > PCM_MAX_CHANNELS ||
+        header->dwPeriod == 0) {
+        fprintf(stderr, "SMDI_SaveWAVSample: Unsupported sample format\n");
+        return FALSE;
+    }
+    
+    /* The header describes the file as it would a loaded sample */
+    memset(&props, 0, sizeof(SMDI_Sample));
+    props.sample_rate = 1000000000 / header->dwPeriod;
+    props.bits_per_sample = header->BitsPerWord;
+    props.channels = header->NumberOfChannels;
+    props.loop_type = header->LoopControl;
+    props.sample_count = header->dwLength;
+    props.loop_start = header->dwLoopStart;
+    props.loop_end = header->dwLoopEnd;
+    props.root_note = header->wPitch;
+    props.fine_tune = header->wPitchFraction;
+    memcpy(props.name, header->cName, header->NameLength);
+    props.name[header->NameLength] = '\0';
+    wav_info(&info, &props);
+    
+    state->file = SMDI_WAVECreate(state->filename, &info);
+    if (state->file == NULL) {
+        fprintf(stderr, "SMDI_SaveWAVSample: Failed to open file '%s' for writing\n",
+                state->filename);
+        return FALSE;
+    }
+    
+    /* Packets arrive in SMDI order and are converted as they are written */
+    SMDI_PCMSetFormat(&state->format, (header->BitsPerWord == 8) ? PCM_S8 : PCM_S16,
+                      PCM_ORDER_BIG, header->NumberOfChannels, FALSE);
+    sink->dwCopyMode = CM_NORMAL;
+    return TRUE;
+}
+
+/* Append a packet to the WAV file */
+static BOOL wav_sink_write(SMDI_SampleSink* sink, void* data, DWORD bytes) {
+    wav_sink_t* state;
+    BYTE* in;
+    DWORD frame_size, frames;
+    
+    state = (wav_sink_t*)sink->lpUserData;
+    in = (BYTE*)data;
+    frame_size = SMDI_PCMFrameSize(&state->format);
+    
+    /* Complete the frame the last packet split */
+    while (state->carry_len > 0 && state->carry_len < frame_size && bytes > 0) {
+        state->carry[state->carry_len++] = *in++;
+        bytes--;
+    }
+    if (state->carry_len == frame_size) {
+        if (!SMDI_WAVEWriteFrames(state->file, &state->format, state->carry, 1)) {
+            return FALSE;
+        }
+        state->carry_len = 0;
+    }
+    
+    /* Whole frames are converted into the file */
+    frames = bytes / frame_size;
+    if (frames > 0 && !SMDI_WAVEWriteFrames(state->file, &state->format, in, frames)) {
+        return FALSE;
+    }
+    
+    /* Keep the start of a frame running on into the next packet */
+    in += frames * frame_size;
+    bytes -= frames * frame_size;
+    while (bytes > 0) {
+        state->carry[state->carry_len++] = *in++;
+        bytes--;
+    }
+    
+    return TRUE;
+}
+
+/* Finish the WAV file, or remove it if the download failed */
+static BOOL wav_sink_end(SMDI_SampleSink* sink, BOOL complete) {
+    wav_sink_t* state;
+    BOOL ok;
+    
+    state = (wav_sink_t*)sink->lpUserData;
+    ok = FALSE;
+    if (state->file != NULL) {
+        ok = SMDI_WAVEClose(state->file) && complete;
+        if (!ok) {
+            remove(state->filename);
+        }
+    }
+    
+    free(state);
+    sink->lpUserData = NULL;
+    return ok;
+}
+
+/* Set up a download sink writing a WAV file */
+BOOL SMDI_OpenWAVSink(SMDI_SampleSink* sink, const char* filename) {
+    wav_sink_t* state;
+    
+    if (sink == NULL || filename == NULL || strlen(filename) >= MAX_PATH) {
+        return FALSE;
+    }
+    
+    state = (wav_sink_t*)malloc(sizeof(wav_sink_t));
+    if (state == NULL) {
+        return FALSE;
+    }
+    memset(state, 0, sizeof(wav_sink_t));
+    strcpy(state->filename, filename);
+    
+    memset(sink, 0, sizeof(SMDI_SampleSink));
+    sink->dwStructSize = sizeof(SMDI_SampleSink);
+    sink->dwCopyMode = CM_NORMAL;
+    sink->lpBegin = wav_sink_begin;
+    sink->lpWrite = wav_sink_write;
+    sink->lpEnd = wav_sink_end;
+    sink->lpUserData = state;
+    
+    return TRUE;
+}
@@ -0,0 +1,726 @@
+/*
+ * SMDI WAV/RF64 file reader and writer implementation for IRIX 5.3
+ * ANSI C90 compliant for MIPS big-endian architecture
+ *
+ * Chunks are parsed and written byte by byte, so files are the same on
+ * every host. RF64 (and BW64) files take their sizes from the ds64 chunk;
+ * offsets stay within what fseek reaches, so chunks that follow more than
+ * 2 GB of sound data are not read, but the sound data itself is read
+ * straight through. Written files reserve a JUNK chunk ahead of fmt that
+ * turns into ds64 if the sound data grows past 4 GB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smdi.h"
+#include "smdi_endian.h"
+#include "smdi_pcm.h"
+#include "smdi_wave.h"
+
+/* Frames converted per block */
+#define WAVE_IO_FRAMES      4096
+
+/* Room for every chunk written ahead of the sound data */
+#define WAVE_HEADER_MAX     2048
+
+/* Furthest offset a chunk may start at, kept within a signed long */
+#define WAVE_POS_MAX        0x7FFFFFFFUL
+
+/* Size of a ds64 chunk with no table, and of the JUNK chunk holding its place */
+#define WAVE_DS64_SIZE      28
+
+/* Size field of a chunk whose real size is in ds64 */
+#define WAVE_SIZE_IN_DS64   0xFFFFFFFFUL
+
+/* Store little-endian values */
+static void put16(BYTE* p, WORD v) {
+    p[0] = (BYTE)(v & 0xFF);
+    p[1] = (BYTE)((v >> 8) & 0xFF);
+}
+
+static void put32(BYTE* p, DWORD v) {
+    p[0] = (BYTE)(v & 0xFF);
+    p[1] = (BYTE)((v >> 8) & 0xFF);
+    p[2] = (BYTE)((v >> 16) & 0xFF);
+    p[3] = (BYTE)((v >> 24) & 0xFF);
+}
+
+/* Fetch little-endian values */
+static WORD get16(const BYTE* p) {
+    return (WORD)(p[0] | (p[1] << 8));
+}
+
+static DWORD get32(const BYTE* p) {
+    return (DWORD)p[0] | ((DWORD)p[1] << 8) |
+           ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+/* Add to a 64-bit count held as two 32-bit halves */
+static void add64(DWORD* hi, DWORD* lo, DWORD v) {
+    *lo = (*lo + v) & 0xFFFFFFFFUL;
+    if (*lo < v) {
+        *hi = (*hi + 1) & 0xFFFFFFFFUL;
+    }
+}
+
+/* Byte order a format resolves to on this host */
+static BOOL is_little(DWORD dwByteOrder) {
+    if (dwByteOrder == PCM_ORDER_HOST) {
+        return SMDI_HostIsLittleEndian();
+    }
+    return (dwByteOrder == PCM_ORDER_LITTLE) ? TRUE : FALSE;
+}
+
+/* True if frames in fmt can move to or from the file without conversion;
+   *swap is set when the words need their bytes reversed */
+static BOOL same_layout(const SMDI_WAVEFile* file, const SMDI_PCMFormat* fmt, BOOL* swap) {
+    const SMDI_PCMFormat* ffmt = &file->info.pcmFormat;
+
+    if (fmt->dwEncoding != ffmt->dwEncoding || fmt->dwChannels != ffmt->dwChannels) {
+        return FALSE;
+    }
+    *swap = (is_little(fmt->dwByteOrder) != is_little(ffmt->dwByteOrder)) ? TRUE : FALSE;
+    return TRUE;
+}
+
+/* Layout of the sound data for a format tag and container size */
+static BOOL choose_format(SMDI_WAVEInfo* info, DWORD container_bits) {
+    DWORD encoding;
+
+    if (info->dwChannels < 1 || info->dwChannels > PCM_MAX_CHANNELS) {
+        return FALSE;
+    }
+
+    if (info->wFormatTag == WAVE_FORMAT_IEEE_FLOAT) {
+        if (container_bits != 32) {
+            return FALSE;
+        }
+        encoding = PCM_F32;
+    } else if (info->wFormatTag == WAVE_FORMAT_PCM) {
+        /* 8-bit WAV data is unsigned, wider data signed */
+        switch (container_bits) {
+            case 8:  encoding = PCM_U8;  break;
+            case 16: encoding = PCM_S16; break;
+            case 24: encoding = PCM_S24; break;
+            case 32: encoding = PCM_S32; break;
+            default: return FALSE;
+        }
+    } else {
+        return FALSE;
+    }
+
+    if (info->dwBits == 0 || info->dwBits > container_bits) {
+        info->dwBits = container_bits;
+    }
+    SMDI_PCMSetFormat(&info->pcmFormat, encoding, PCM_ORDER_LITTLE, info->dwChannels, FALSE);
+    return TRUE;
+}
+
+/* Parse the smpl chunk header and its loops */
+static void parse_sampler(SMDI_WAVEInfo* info, const BYTE* p, DWORD size) {
+    DWORD count, i;
+    SMDI_WAVELoop* loop;
+
+    info->bHasSampler = TRUE;
+    info->dwUnityNote = get32(p + 12);
+    info->dwPitchFraction = get32(p + 16);
+
+    count = get32(p + 28);
+    if (count > (size - 36) / 24) {
+        count = (size - 36) / 24;
+    }
+    if (count > WAVE_MAX_LOOPS) {
+        count = WAVE_MAX_LOOPS;
+    }
+
+    p += 36;
+    for (i = 0; i < count; i++, p += 24) {
+        loop = &info->loops[i];
+        loop->dwCuePointId = get32(p);
+        loop->dwType = get32(p + 4);
+        loop->dwStart = get32(p + 8);
+        loop->dwEnd = get32(p + 12);
+        loop->dwFraction = get32(p + 16);
+        loop->dwPlayCount = get32(p + 20);
+    }
+    info->dwNumLoops = count;
+}
+
+/* Find the name in a LIST INFO chunk */
+static void parse_list(SMDI_WAVEInfo* info, const BYTE* p, DWORD size) {
+    DWORD pos, len, n;
+
+    if (size < 4 || memcmp(p, "INFO", 4) != 0) {
+        return;
+    }
+
+    pos = 4;
+    while (pos + 8 <= size) {
+        len = get32(p + pos + 4);
+        pos += 8;
+        if (len > size - pos) {
+            len = size - pos;
+        }
+        if (memcmp(p + pos - 8, "INAM", 4) == 0) {
+            n = (len < sizeof(info->szName)) ? len : sizeof(info->szName) - 1;
+            memcpy(info->szName, p + pos, n);
+            info->szName[n] = '\0';
+            return;
+        }
+        pos += len + (len & 1);
+    }
+}
+
+/* Clear an info block for a new file */
+void SMDI_WAVEInitInfo(SMDI_WAVEInfo* info) {
+    if (info == NULL) {
+        return;
+    }
+    memset(info, 0, sizeof(SMDI_WAVEInfo));
+    info->wFormatTag = WAVE_FORMAT_PCM;
+    info->dwBits = 16;
+    info->dwUnityNote = 60;    /* Middle C */
+}
+
+/* Open a file and parse its chunks */
+SMDI_WAVEFile* SMDI_WAVEOpen(const char* filename) {
+    SMDI_WAVEFile* file;
+    SMDI_WAVEInfo* info;
+    FILE* fp;
+    BYTE head[12];
+    BYTE buf[64];
+    BYTE* chunk;
+    DWORD end, pos, size, n, container_bits, block_align, frame_size;
+    DWORD ds64_lo, ds64_hi;
+    long file_size;
+    double frames;
+    BOOL have_fmt, have_data, have_ds64;
+
+    if (filename == NULL) {
+        return NULL;
+    }
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    /* RIFF or RF64 header */
+    if (fread(head, 1, 12, fp) != 12 || memcmp(head + 8, "WAVE", 4) != 0 ||
+        (memcmp(head, "RIFF", 4) != 0 && memcmp(head, "RF64", 4) != 0 &&
+         memcmp(head, "BW64", 4) != 0)) {
+        fclose(fp);
+        return NULL;
+    }
+
+    file = (SMDI_WAVEFile*)malloc(sizeof(SMDI_WAVEFile));
+    if (file == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    memset(file, 0, sizeof(SMDI_WAVEFile));
+    file->fp = fp;
+    info = &file->info;
+    SMDI_WAVEInitInfo(info);
+    info->bRF64 = (memcmp(head, "RIFF", 4) != 0) ? TRUE : FALSE;
+
+    /* Chunks are walked up to the end of the file as far as fseek reaches;
+       files too large for ftell are walked up to the RIFF size instead */
+    end = WAVE_POS_MAX;
+    file_size = -1L;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        file_size = ftell(fp);
+    }
+    if (file_size >= 0 && (DWORD)file_size < end) {
+        end = (DWORD)file_size;
+    }
+    size = get32(head + 4);
+    if (!info->bRF64 && size >= 4 && size < end - 8) {
+        end = size + 8;
+    }
+
+    container_bits = 0;
+    block_align = 0;
+    ds64_lo = 0;
+    ds64_hi = 0;
+    have_fmt = FALSE;
+    have_data = FALSE;
+    have_ds64 = FALSE;
+    pos = 12;
+    while (pos + 8 <= end) {
+        fseek(fp, (long)pos, SEEK_SET);
+        if (fread(buf, 1, 8, fp) != 8) {
+            break;
+        }
+        size = get32(buf + 4);
+        pos += 8;
+
+        if (memcmp(buf, "data", 4) == 0) {
+            info->dwDataOffset = pos;
+            if (info->bRF64 && have_ds64 && size == WAVE_SIZE_IN_DS64) {
+                info->dwDataSize = ds64_lo;
+                info->dwDataSizeHigh = ds64_hi;
+            } else {
+                info->dwDataSize = size;
+            }
+
+            /* Writers that stream sometimes leave the size unset */
+            if (info->dwDataSizeHigh == 0 && file_size >= 0 &&
+                (info->dwDataSize == 0 || info->dwDataSize > (DWORD)file_size - pos)) {
+                info->dwDataSize = (DWORD)file_size - pos;
+            }
+            have_data = TRUE;
+
+            /* Chunks after sound data beyond fseek's reach are not read */
+            if (info->dwDataSizeHigh != 0 || info->dwDataSize > end - pos) {
+                break;
+            }
+            size = info->dwDataSize;
+        } else if (size > end - pos) {
+            size = end - pos;
+        }
+
+        if (memcmp(buf, "ds64", 4) == 0 && info->bRF64 && size >= WAVE_DS64_SIZE) {
+            if (fread(buf, 1, WAVE_DS64_SIZE, fp) != WAVE_DS64_SIZE) {
+                break;
+            }
+            ds64_lo = get32(buf + 8);
+            ds64_hi = get32(buf + 12);
+            have_ds64 = TRUE;
+        } else if (memcmp(buf, "fmt ", 4) == 0 && size >= 16) {
+            n = (size < 40) ? size : 40;
+            if (fread(buf, 1, n, fp) != n) {
+                break;
+            }
+            info->wFormatTag = get16(buf);
+            info->dwChannels = get16(buf + 2);
+            info->dwRate = get32(buf + 4);
+            block_align = get16(buf + 12);
+            container_bits = get16(buf + 14);
+            info->dwBits = container_bits;
+
+            /* The sub-format GUID starts with the real format tag */
+            if (info->wFormatTag == WAVE_FORMAT_EXTENSIBLE && n >= 40) {
+                info->dwBits = get16(buf + 18);
+                info->wFormatTag = get16(buf + 24);
+            }
+            have_fmt = TRUE;
+        } else if (memcmp(buf, "smpl", 4) == 0 && size >= 36) {
+            chunk = (BYTE*)malloc(size);
+            if (chunk != NULL) {
+                if (fread(chunk, 1, size, fp) == size) {
+                    parse_sampler(info, chunk, size);
+                }
+                free(chunk);
+            }
+        } else if (memcmp(buf, "LIST", 4) == 0 && size >= 4) {
+            chunk = (BYTE*)malloc(size);
+            if (chunk != NULL) {
+                if (fread(chunk, 1, size, fp) == size) {
+                    parse_list(info, chunk, size);
+                }
+                free(chunk);
+            }
+        }
+
+        /* Chunks are padded to an even length */
+        if (size + (size & 1) > end - pos) {
+            break;
+        }
+        pos += size + (size & 1);
+    }
+
+    if (!have_fmt || !have_data || info->dwRate == 0 || !choose_format(info, container_bits)) {
+        fclose(fp);
+        free(file);
+        return NULL;
+    }
+
+    frame_size = SMDI_PCMFrameSize(&info->pcmFormat);
+    if (block_align != 0 && block_align != frame_size) {
+        fclose(fp);
+        free(file);
+        return NULL;
+    }
+
+    /* A frame count must fit the sampler's 32-bit lengths */
+    frames = ((double)info->dwDataSizeHigh * 4294967296.0 + (double)info->dwDataSize) /
+             (double)frame_size;
+    if (frames >= 4294967296.0) {
+        fclose(fp);
+        free(file);
+        return NULL;
+    }
+    info->dwFrames = (DWORD)frames;
+    if (info->dwDataSizeHigh == 0) {
+        info->dwDataSize = info->dwFrames * frame_size;
+    }
+
+    if (fseek(fp, (long)info->dwDataOffset, SEEK_SET) != 0) {
+        fclose(fp);
+        free(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+/* Get the conversion buffer, allocating it on first use */
+static void* io_buffer(SMDI_WAVEFile* file) {
+    if (file->lpBuffer == NULL) {
+        file->lpBuffer = malloc(WAVE_IO_FRAMES * SMDI_PCMFrameSize(&file->info.pcmFormat));
+    }
+    return file->lpBuffer;
+}
+
+/* Read frames converted to an interleaved format */
+DWORD SMDI_WAVEReadFrames(SMDI_WAVEFile* file, const SMDI_PCMFormat* fmt, void* buffer,
+                          DWORD dwFrames, SMDI_PCMDither* dither) {
+    DWORD file_frame, out_frame, done, count, got;
+    BOOL swap;
+    void* raw;
+
+    if (file == NULL || file->bWriting || fmt == NULL || buffer == NULL || fmt->bPlanar) {
+        return 0;
+    }
+
+    if (dwFrames > file->info.dwFrames - file->dwFrame) {
+        dwFrames = file->info.dwFrames - file->dwFrame;
+    }
+    if (dwFrames == 0) {
+        return 0;
+    }
+
+    file_frame = SMDI_PCMFrameSize(&file->info.pcmFormat);
+    out_frame = SMDI_PCMFrameSize(fmt);
+
+    /* Matching data is read in place and at most byte swapped */
+    if (same_layout(file, fmt, &swap)) {
+        got = fread(buffer, file_frame, dwFrames, file->fp);
+        if (swap) {
+            SMDI_CopySampleData(buffer, buffer, got * file_frame,
+                                SMDI_SwapCopyMode(SMDI_PCMSampleSize(fmt->dwEncoding) * 8));
+        }
+        file->dwFrame += got;
+        return got;
+    }
+
+    raw = io_buffer(file);
+    if (raw == NULL) {
+        return 0;
+    }
+
+    for (done = 0; done < dwFrames; done += got) {
+        count = dwFrames - done;
+        if (count > WAVE_IO_FRAMES) {
+            count = WAVE_IO_FRAMES;
+        }
+        got = fread(raw, file_frame, count, file->fp);
+        if (got == 0) {
+            break;
+        }
+        SMDI_PCMConvertDither(&file->info.pcmFormat, raw, fmt,
+                              (char*)buffer + done * out_frame, got, dither);
+        if (got < count) {
+            done += got;
+            break;
+        }
+    }
+
+    file->dwFrame += done;
+    return done;
+}
+
+/* Store the sub-format GUID for a format tag */
+static void put_guid(BYTE* p, WORD tag) {
+    static const BYTE tail[14] = {
+        0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+        0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+    };
+
+    put16(p, tag);
+    memcpy(p + 2, tail, sizeof(tail));
+}
+
+/* Create a file and write its header */
+SMDI_WAVEFile* SMDI_WAVECreate(const char* filename, const SMDI_WAVEInfo* info) {
+    SMDI_WAVEFile* file;
+    BYTE head[WAVE_HEADER_MAX];
+    BYTE* chunk;
+    DWORD pos, size, i, len, frame_size;
+    BOOL extensible;
+
+    if (filename == NULL || info == NULL || info->dwRate == 0 ||
+        info->dwNumLoops > WAVE_MAX_LOOPS) {
+        return NULL;
+    }
+
+    file = (SMDI_WAVEFile*)malloc(sizeof(SMDI_WAVEFile));
+    if (file == NULL) {
+        return NULL;
+    }
+    memset(file, 0, sizeof(SMDI_WAVEFile));
+    memcpy(&file->info, info, sizeof(SMDI_WAVEInfo));
+    file->bWriting = TRUE;
+
+    /* Samples fill whole bytes */
+    file->info.dwBits = (info->dwBits + 7) & ~7UL;
+    if (!choose_format(&file->info, file->info.dwBits)) {
+        free(file);
+        return NULL;
+    }
+    frame_size = SMDI_PCMFrameSize(&file->info.pcmFormat);
+
+    /* RIFF header; the size is patched on close */
+    memcpy(head, "RIFF", 4);
+    put32(head + 4, 0);
+    memcpy(head + 8, "WAVE", 4);
+    pos = 12;
+
+    /* Placeholder for ds64 */
+    memcpy(head + pos, "JUNK", 4);
+    put32(head + pos + 4, WAVE_DS64_SIZE);
+    memset(head + pos + 8, 0, WAVE_DS64_SIZE);
+    file->dwSizesPos = pos;
+    pos += 8 + WAVE_DS64_SIZE;
+
+    /* fmt, extensible where the plain form is ambiguous */
+    extensible = (file->info.dwChannels > 2 ||
+                  (file->info.wFormatTag == WAVE_FORMAT_PCM && file->info.dwBits > 16)) ?
+                 TRUE : FALSE;
+    chunk = head + pos;
+    memcpy(chunk, "fmt ", 4);
+    put16(chunk + 8, extensible ? (WORD)WAVE_FORMAT_EXTENSIBLE : file->info.wFormatTag);
+    put16(chunk + 10, (WORD)file->info.dwChannels);
+    put32(chunk + 12, file->info.dwRate);
+    put32(chunk + 16, file->info.dwRate * frame_size);
+    put16(chunk + 20, (WORD)frame_size);
+    put16(chunk + 22, (WORD)file->info.dwBits);
+    if (extensible) {
+        size = 40;
+        put16(chunk + 24, 22);
+        put16(chunk + 26, (WORD)file->info.dwBits);
+        put32(chunk + 28, 0);   /* No speaker positions */
+        put_guid(chunk + 32, file->info.wFormatTag);
+    } else if (file->info.wFormatTag != WAVE_FORMAT_PCM) {
+        size = 18;
+        put16(chunk + 24, 0);
+    } else {
+        size = 16;
+    }
+    put32(chunk + 4, size);
+    pos += 8 + size;
+
+    /* fact, required for anything but PCM; the count is patched on close */
+    if (file->info.wFormatTag != WAVE_FORMAT_PCM) {
+        memcpy(head + pos, "fact", 4);
+        put32(head + pos + 4, 4);
+        put32(head + pos + 8, 0);
+        file->dwFactPos = pos + 8;
+        pos += 12;
+    }
+
+    /* smpl */
+    if (file->info.bHasSampler) {
+        chunk = head + pos;
+        size = 36 + 24 * file->info.dwNumLoops;
+        memcpy(chunk, "smpl", 4);
+        put32(chunk + 4, size);
+        put32(chunk + 8, 0);    /* Manufacturer */
+        put32(chunk + 12, 0);   /* Product */
+        put32(chunk + 16, 1000000000UL / file->info.dwRate);
+        put32(chunk + 20, file->info.dwUnityNote);
+        put32(chunk + 24, file->info.dwPitchFraction);
+        put32(chunk + 28, 0);   /* SMPTE format */
+        put32(chunk + 32, 0);   /* SMPTE offset */
+        put32(chunk + 36, file->info.dwNumLoops);
+        put32(chunk + 40, 0);   /* Sampler data */
+        for (i = 0; i < file->info.dwNumLoops; i++) {
+            put32(chunk + 44 + i * 24, file->info.loops[i].dwCuePointId);
+            put32(chunk + 48 + i * 24, file->info.loops[i].dwType);
+            put32(chunk + 52 + i * 24, file->info.loops[i].dwStart);
+            put32(chunk + 56 + i * 24, file->info.loops[i].dwEnd);
+            put32(chunk + 60 + i * 24, file->info.loops[i].dwFraction);
+            put32(chunk + 64 + i * 24, file->info.loops[i].dwPlayCount);
+        }
+        pos += 8 + size;
+    }
+
+    /* LIST INFO with the name, stored with its terminator */
+    len = strlen(file->info.szName);
+    if (len > 0) {
+        chunk = head + pos;
+        size = len + 1;
+        memcpy(chunk, "LIST", 4);
+        put32(chunk + 4, 12 + size + (size & 1));
+        memcpy(chunk + 8, "INFO", 4);
+        memcpy(chunk + 12, "INAM", 4);
+        put32(chunk + 16, size);
+        memcpy(chunk + 20, file->info.szName, size);
+        if (size & 1) {
+            chunk[20 + size] = 0;
+        }
+        pos += 20 + size + (size & 1);
+    }
+
+    /* data; the size is patched on close */
+    memcpy(head + pos, "data", 4);
+    put32(head + pos + 4, 0);
+    file->dwDataSizePos = pos + 4;
+    pos += 8;
+
+    file->info.dwDataOffset = pos;
+    file->info.dwDataSize = 0;
+    file->info.dwDataSizeHigh = 0;
+    file->info.bRF64 = FALSE;
+
+    file->fp = fopen(filename, "wb");
+    if (file->fp == NULL) {
+        free(file);
+        return NULL;
+    }
+    if (fwrite(head, 1, pos, file->fp) != pos) {
+        fclose(file->fp);
+        free(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+/* Count frames written into the 64-bit data size */
+static void count_frames(SMDI_WAVEFile* file, DWORD frames) {
+    DWORD frame_size, count;
+
+    frame_size = SMDI_PCMFrameSize(&file->info.pcmFormat);
+    file->dwFrame += frames;
+    while (frames > 0) {
+        count = (frames > WAVE_IO_FRAMES) ? WAVE_IO_FRAMES : frames;
+        add64(&file->dwBytesHigh, &file->dwBytes, count * frame_size);
+        frames -= count;
+    }
+}
+
+/* Append frames, converting to the file's layout */
+BOOL SMDI_WAVEWriteFrames(SMDI_WAVEFile* file, const SMDI_PCMFormat* fmt, const void* buffer,
+                          DWORD dwFrames) {
+    DWORD file_frame, in_frame, done, count;
+    BOOL swap;
+    void* raw;
+
+    if (file == NULL || !file->bWriting || fmt == NULL || buffer == NULL || fmt->bPlanar) {
+        return FALSE;
+    }
+
+    file_frame = SMDI_PCMFrameSize(&file->info.pcmFormat);
+    in_frame = SMDI_PCMFrameSize(fmt);
+
+    /* Matching data goes straight to the file */
+    if (same_layout(file, fmt, &swap) && !swap) {
+        if (fwrite(buffer, file_frame, dwFrames, file->fp) != dwFrames) {
+            file->bError = TRUE;
+            return FALSE;
+        }
+        count_frames(file, dwFrames);
+        return TRUE;
+    }
+
+    raw = io_buffer(file);
+    if (raw == NULL) {
+        file->bError = TRUE;
+        return FALSE;
+    }
+
+    for (done = 0; done < dwFrames; done += count) {
+        count = dwFrames - done;
+        if (count > WAVE_IO_FRAMES) {
+            count = WAVE_IO_FRAMES;
+        }
+        SMDI_PCMConvert(fmt, (const char*)buffer + done * in_frame,
+                        &file->info.pcmFormat, raw, count);
+        if (fwrite(raw, file_frame, count, file->fp) != count) {
+            file->bError = TRUE;
+            count_frames(file, done);
+            return FALSE;
+        }
+    }
+
+    count_frames(file, dwFrames);
+    return TRUE;
+}
+
+/* Overwrite bytes at a file offset */
+static BOOL patch(FILE* fp, DWORD pos, const BYTE* raw, DWORD size) {
+    if (fseek(fp, (long)pos, SEEK_SET) != 0) {
+        return FALSE;
+    }
+    return (fwrite(raw, 1, size, fp) == size) ? TRUE : FALSE;
+}
+
+/* Patch a little-endian size at a file offset */
+static BOOL patch32(FILE* fp, DWORD pos, DWORD value) {
+    BYTE raw[4];
+
+    put32(raw, value);
+    return patch(fp, pos, raw, 4);
+}
+
+/* Close a file, finishing the sizes of a written one */
+BOOL SMDI_WAVEClose(SMDI_WAVEFile* file) {
+    BYTE ds64[8 + WAVE_DS64_SIZE];
+    DWORD riff_lo, riff_hi;
+    BOOL ok;
+
+    if (file == NULL) {
+        return FALSE;
+    }
+
+    ok = TRUE;
+    if (file->bWriting) {
+        ok = !file->bError;
+
+        /* Odd sound data takes a pad byte */
+        if ((file->dwBytes & 1) != 0 && putc(0, file->fp) == EOF) {
+            ok = FALSE;
+        }
+        riff_lo = file->info.dwDataOffset - 8 + (file->dwBytes & 1);
+        riff_hi = file->dwBytesHigh;
+        add64(&riff_hi, &riff_lo, file->dwBytes);
+
+        if (riff_hi == 0) {
+            if (!patch32(file->fp, 4, riff_lo) ||
+                !patch32(file->fp, file->dwDataSizePos, file->dwBytes)) {
+                ok = FALSE;
+            }
+        } else {
+            /* Past 4 GB the sizes move to ds64 in place of the JUNK chunk */
+            memcpy(ds64, "ds64", 4);
+            put32(ds64 + 4, WAVE_DS64_SIZE);
+            put32(ds64 + 8, riff_lo);
+            put32(ds64 + 12, riff_hi);
+            put32(ds64 + 16, file->dwBytes);
+            put32(ds64 + 20, file->dwBytesHigh);
+            put32(ds64 + 24, file->dwFrame);
+            put32(ds64 + 28, 0);
+            put32(ds64 + 32, 0);    /* No table */
+            if (!patch(file->fp, 0, (const BYTE*)"RF64", 4) ||
+                !patch32(file->fp, 4, WAVE_SIZE_IN_DS64) ||
+                !patch(file->fp, file->dwSizesPos, ds64, sizeof(ds64)) ||
+                !patch32(file->fp, file->dwDataSizePos, WAVE_SIZE_IN_DS64)) {
+                ok = FALSE;
+            }
+        }
+
+        if (file->dwFactPos != 0 && !patch32(file->fp, file->dwFactPos, file->dwFrame)) {
+            ok = FALSE;
+        }
+    }
+
+    if (fclose(file->fp) != 0) {
+        ok = FALSE;
+    }
+    free(file->lpBuffer);
+    free(file);
+    return ok;
+}